@@ -0,0 +1,132 @@
+#include "admission.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+WorkQueue::WorkQueue(const Config& config) : config_(config) {
+    config_.max_per_lane = std::max<size_t>(1, config_.max_per_lane);
+    config_.bulk_concurrency = std::max<size_t>(1, config_.bulk_concurrency);
+}
+
+bool WorkQueue::push(Job& job) {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto& lane = lanes_[job.lane];
+        if (lane.size() >= config_.max_per_lane) {
+            stats_.rejected++;
+            return false;
+        }
+        job.enqueued = Clock::now();
+        lane.push_back(std::move(job));
+        stats_.accepted++;
+    }
+    cv_.notify_one();
+    return true;
+}
+
+void WorkQueue::pop(Job& out, bool& shed) {
+    std::unique_lock<std::mutex> lk(mu_);
+    Lane lane = kInteractive;
+    cv_.wait(lk, [&]() {
+        if (!lanes_[kInteractive].empty()) {
+            lane = kInteractive;
+            return true;
+        }
+        if (!lanes_[kBulk].empty() && bulk_running_ < config_.bulk_concurrency) {
+            lane = kBulk;
+            return true;
+        }
+        return false;
+    });
+    out = std::move(lanes_[lane].front());
+    lanes_[lane].pop_front();
+    running_++;
+    if (lane == kBulk) bulk_running_++;
+
+    const auto now = Clock::now();
+    shed = shed_locked(lane, now, now - out.enqueued);
+    if (shed) stats_.shed++;
+}
+
+void WorkQueue::done(Lane lane) {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        running_--;
+        if (lane != kBulk) return;
+        bulk_running_--;
+    }
+    cv_.notify_one();
+}
+
+bool WorkQueue::idle() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return running_ == 0 && lanes_[kInteractive].empty() && lanes_[kBulk].empty();
+}
+
+bool WorkQueue::shed_locked(Lane lane, Clock::time_point now, Clock::duration waited) {
+    Codel& c = codel_[lane];
+    if (now >= c.interval_end) {
+        // Only an interval with pops can show a standing queue: the first interval after
+        // startup, or after an idle spell, has no samples.
+        c.overloaded = c.sampled && c.min_wait > config_.target;
+        c.min_wait = Clock::duration::max();
+        c.sampled = false;
+        c.interval_end = now + config_.interval;
+    }
+    c.min_wait = std::min(c.min_wait, waited);
+    c.sampled = true;
+    if (lanes_[lane].empty()) {
+        // Drained: whatever queue there was is gone.
+        c.min_wait = Clock::duration::zero();
+        c.overloaded = false;
+    }
+    return c.overloaded && waited > config_.target;
+}
+
+WorkQueue::Stats WorkQueue::stats() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return stats_;
+}
+
+ClientRateLimiter::ClientRateLimiter(double rate, double burst)
+    : rate_(rate), burst_(std::max(burst, rate)) {}
+
+bool ClientRateLimiter::take(std::string_view client, double n, uint32_t& retry_after_s) {
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t key = std::hash<std::string_view>{}(client);
+    if (n > burst_) {
+        retry_after_s = 0;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = buckets_.find(key);
+    if (it == buckets_.end()) {
+        if (buckets_.size() >= kMaxClients) drop_idle(now);
+        it = buckets_.emplace(key, Bucket{burst_, now}).first;
+    }
+    Bucket& b = it->second;
+    const double elapsed = std::chrono::duration<double>(now - b.updated).count();
+    b.tokens = std::min(burst_, b.tokens + elapsed * rate_);
+    b.updated = now;
+    if (b.tokens >= n) {
+        b.tokens -= n;
+        return true;
+    }
+    retry_after_s = static_cast<uint32_t>(std::max(1.0, std::ceil((n - b.tokens) / rate_)));
+    return false;
+}
+
+void ClientRateLimiter::drop_idle(std::chrono::steady_clock::time_point now) {
+    for (auto it = buckets_.begin(); it != buckets_.end();) {
+        const double elapsed = std::chrono::duration<double>(now - it->second.updated).count();
+        if (it->second.tokens + elapsed * rate_ >= burst_) {
+            it = buckets_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Every bucket is in use: more clients than we can tell apart, so start over.
+    if (buckets_.size() >= kMaxClients) buckets_.clear();
+}
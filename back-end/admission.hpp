@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Admission control between the accept loop and the request threads.
+//
+// Requests wait in a WorkQueue with two lanes: interactive (static files and cheap API
+// calls) and bulk (/api/generate, /api/history). Request threads always take interactive
+// work first, and at most `bulk_concurrency` of them run bulk work at once, so static
+// assets keep being served however many generates are queued.
+//
+// Each lane is bounded (push() fails when it is full) and shed CoDel-style: the queue
+// tracks the smallest time a request waited during each `interval`. If even that minimum
+// stayed above `target`, there is a standing queue rather than a burst, and for the next
+// interval pop() marks requests that waited longer than `target` as shed: the caller
+// answers them with 503 + Retry-After instead of doing the work. A lane that drains
+// empty has no standing queue, so it is never considered overloaded.
+class WorkQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum Lane { kInteractive = 0, kBulk = 1, kLaneCount = 2 };
+
+    struct Job {
+        int fd = -1;
+        std::string raw;     // request head, up to and including the blank line
+        std::string client;  // peer address
+        Lane lane = kInteractive;
+        Clock::time_point enqueued;
+    };
+
+    struct Config {
+        size_t max_per_lane = 256;
+        size_t bulk_concurrency = 1;
+        std::chrono::milliseconds target{50};
+        std::chrono::milliseconds interval{500};
+    };
+
+    struct Stats {
+        uint64_t accepted = 0;
+        uint64_t rejected = 0;  // lane full
+        uint64_t shed = 0;      // waited too long
+    };
+
+    explicit WorkQueue(const Config& config);
+
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    // Queues `job` (stamping its enqueue time). Returns false, leaving `job` as it was, if
+    // its lane is full.
+    bool push(Job& job);
+
+    // Blocks until a job may run. `shed` is set when it should be answered with 503
+    // instead. Every popped job must be followed by done(job.lane).
+    void pop(Job& out, bool& shed);
+    void done(Lane lane);
+
+    // Nothing queued and nothing between pop() and done().
+    bool idle() const;
+
+    Stats stats() const;
+
+private:
+    struct Codel {
+        Clock::time_point interval_end{};
+        Clock::duration min_wait = Clock::duration::max();  // of this interval's pops
+        bool sampled = false;                               // any pop this interval
+        bool overloaded = false;
+    };
+
+    Config config_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Job> lanes_[kLaneCount];
+    Codel codel_[kLaneCount];
+    size_t bulk_running_ = 0;
+    size_t running_ = 0;  // popped, not yet done(), in either lane
+    Stats stats_;
+
+    bool shed_locked(Lane lane, Clock::time_point now, Clock::duration waited);
+};
+
+// Per-client token buckets for names per second: each client may take `rate` names per
+// second on average, in bursts of up to `burst`. Clients are keyed by a hash of their
+// address; idle (full) buckets are dropped when the table grows past kMaxClients.
+class ClientRateLimiter {
+public:
+    static constexpr size_t kMaxClients = 65536;
+
+    ClientRateLimiter(double rate, double burst);
+
+    // Takes `n` tokens from `client`'s bucket. If there are not enough, takes nothing and
+    // returns false with `retry_after_s` set to when there will be, or to 0 when `n` is
+    // more than a full bucket holds (no wait helps).
+    bool take(std::string_view client, double n, uint32_t& retry_after_s);
+
+    double burst() const { return burst_; }
+
+private:
+    struct Bucket {
+        double tokens = 0;
+        std::chrono::steady_clock::time_point updated;
+    };
+
+    double rate_;
+    double burst_;
+    std::mutex mu_;
+    std::unordered_map<uint64_t, Bucket> buckets_;
+
+    void drop_idle(std::chrono::steady_clock::time_point now);
+};
@@ -0,0 +1,44 @@
+// Replaces the global operator new/delete to count allocations per thread, so
+// `server --alloc-check` can verify that requests are served from their arena. The cost
+// is one thread-local increment per allocation.
+#include <cstdlib>
+#include <new>
+
+#include "request_arena.hpp"
+
+static thread_local uint64_t t_allocations = 0;
+
+uint64_t thread_heap_allocations() {
+    return t_allocations;
+}
+
+void* operator new(std::size_t size) {
+    t_allocations++;
+    if (size == 0) size = 1;
+    while (true) {
+        if (void* p = std::malloc(size)) return p;
+        std::new_handler h = std::get_new_handler();
+        if (!h) throw std::bad_alloc();
+        h();
+    }
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return ::operator new(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
@@ -0,0 +1,203 @@
+#include "async_http.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace {
+
+std::string errno_message(const char* what) {
+    return std::string(what) + ": " + std::strerror(errno);
+}
+
+size_t write_cb(char* ptr, size_t size, size_t nmemb, void* userdata) {
+    static_cast<AsyncHttp::Response*>(userdata)->body.append(ptr, size * nmemb);
+    return size * nmemb;
+}
+
+size_t header_cb(char* buffer, size_t size, size_t nitems, void* userdata) {
+    auto* res = static_cast<AsyncHttp::Response*>(userdata);
+    const std::string_view line(buffer, size * nitems);
+    constexpr std::string_view k = "etag:";
+    if (line.size() >= k.size() && strncasecmp(line.data(), k.data(), k.size()) == 0) {
+        std::string_view v = line.substr(k.size());
+        while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+        while (!v.empty() && (v.back() == '\r' || v.back() == '\n')) v.remove_suffix(1);
+        res->etag.assign(v);
+    }
+    return size * nitems;
+}
+
+}  // namespace
+
+std::string AsyncHttp::create(std::unique_ptr<AsyncHttp>& out) {
+    out.reset();
+    std::unique_ptr<AsyncHttp> h(new AsyncHttp());
+    h->epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (h->epoll_fd_ < 0) return errno_message("epoll_create1");
+    h->timer_fd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (h->timer_fd_ < 0) return errno_message("timerfd_create");
+    h->wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (h->wake_fd_ < 0) return errno_message("eventfd");
+    for (int fd : {h->timer_fd_, h->wake_fd_}) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (::epoll_ctl(h->epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) return errno_message("epoll_ctl");
+    }
+
+    h->multi_ = curl_multi_init();
+    if (!h->multi_) return "curl_multi_init failed";
+    curl_multi_setopt(h->multi_, CURLMOPT_SOCKETFUNCTION, &AsyncHttp::on_socket);
+    curl_multi_setopt(h->multi_, CURLMOPT_SOCKETDATA, h.get());
+    curl_multi_setopt(h->multi_, CURLMOPT_TIMERFUNCTION, &AsyncHttp::on_timer);
+    curl_multi_setopt(h->multi_, CURLMOPT_TIMERDATA, h.get());
+    out = std::move(h);
+    return "";
+}
+
+AsyncHttp::~AsyncHttp() {
+    for (auto& [easy, t] : running_) {
+        curl_multi_remove_handle(multi_, easy);
+        curl_easy_cleanup(easy);
+        curl_slist_free_all(t->headers);
+    }
+    if (multi_) curl_multi_cleanup(multi_);
+    for (int fd : {epoll_fd_, timer_fd_, wake_fd_}) {
+        if (fd >= 0) ::close(fd);
+    }
+}
+
+void AsyncHttp::start(Request req, Done done) {
+    auto t = std::make_unique<Transfer>();
+    t->req = std::move(req);
+    t->done = std::move(done);
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        incoming_.push_back(std::move(t));
+    }
+    const uint64_t one = 1;
+    (void)!::write(wake_fd_, &one, sizeof(one));
+}
+
+// curl: watch `s` for `what` (or stop watching it).
+int AsyncHttp::on_socket(CURL*, curl_socket_t s, int what, void* self, void*) {
+    auto* h = static_cast<AsyncHttp*>(self);
+    if (what == CURL_POLL_REMOVE) {
+        // The socket may already be closed, which removed it from the set.
+        (void)::epoll_ctl(h->epoll_fd_, EPOLL_CTL_DEL, s, nullptr);
+        return 0;
+    }
+    epoll_event ev{};
+    ev.events = (what & CURL_POLL_IN ? EPOLLIN : 0u) | (what & CURL_POLL_OUT ? EPOLLOUT : 0u);
+    ev.data.fd = s;
+    if (::epoll_ctl(h->epoll_fd_, EPOLL_CTL_MOD, s, &ev) != 0 && errno == ENOENT) {
+        (void)::epoll_ctl(h->epoll_fd_, EPOLL_CTL_ADD, s, &ev);
+    }
+    return 0;
+}
+
+// curl: call curl_multi_socket_action(CURL_SOCKET_TIMEOUT) in `timeout_ms` (-1: never).
+int AsyncHttp::on_timer(CURLM*, long timeout_ms, void* self) {
+    auto* h = static_cast<AsyncHttp*>(self);
+    itimerspec spec{};
+    if (timeout_ms == 0) {
+        spec.it_value.tv_nsec = 1;  // a zero it_value would disarm the timer
+    } else if (timeout_ms > 0) {
+        spec.it_value.tv_sec = timeout_ms / 1000;
+        spec.it_value.tv_nsec = (timeout_ms % 1000) * 1000000;
+    }
+    (void)::timerfd_settime(h->timer_fd_, 0, &spec, nullptr);
+    return 0;
+}
+
+void AsyncHttp::add(std::unique_ptr<Transfer> t) {
+    CURL* c = curl_easy_init();
+    if (!c) {
+        t->res.error = "curl init failed";
+        t->done(t->res);
+        return;
+    }
+    t->easy = c;
+    curl_easy_setopt(c, CURLOPT_URL, t->req.url.c_str());
+    curl_easy_setopt(c, CURLOPT_CUSTOMREQUEST, t->req.method.c_str());
+    curl_easy_setopt(c, CURLOPT_WRITEFUNCTION, write_cb);
+    curl_easy_setopt(c, CURLOPT_WRITEDATA, &t->res);
+    curl_easy_setopt(c, CURLOPT_HEADERFUNCTION, header_cb);
+    curl_easy_setopt(c, CURLOPT_HEADERDATA, &t->res);
+    curl_easy_setopt(c, CURLOPT_USERAGENT, "RandomNameGenerator/1.0");
+    curl_easy_setopt(c, CURLOPT_TIMEOUT, t->req.timeout_seconds);
+    curl_easy_setopt(c, CURLOPT_NOSIGNAL, 1L);
+    for (const auto& header : t->req.headers) t->headers = curl_slist_append(t->headers, header.c_str());
+    curl_easy_setopt(c, CURLOPT_HTTPHEADER, t->headers);
+    if (!t->req.body.empty()) {
+        curl_easy_setopt(c, CURLOPT_POSTFIELDS, t->req.body.c_str());
+        curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE, static_cast<long>(t->req.body.size()));
+    }
+    running_[c] = std::move(t);
+    curl_multi_add_handle(multi_, c);
+}
+
+void AsyncHttp::on_ready() {
+    int still_running = 0;
+    uint64_t value = 0;
+    if (::read(wake_fd_, &value, sizeof(value)) == static_cast<ssize_t>(sizeof(value))) {
+        std::vector<std::unique_ptr<Transfer>> incoming;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            incoming.swap(incoming_);
+        }
+        for (auto& t : incoming) add(std::move(t));
+        // Start the new transfers now rather than on the timer curl just set to 0.
+        curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &still_running);
+    }
+    if (::read(timer_fd_, &value, sizeof(value)) == static_cast<ssize_t>(sizeof(value))) {
+        curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &still_running);
+    }
+
+    epoll_event events[64];
+    const int n = ::epoll_wait(epoll_fd_, events, 64, 0);
+    for (int i = 0; i < n; i++) {
+        const int fd = events[i].data.fd;
+        if (fd == wake_fd_ || fd == timer_fd_) continue;  // read above
+        int flags = 0;
+        if (events[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+        if (events[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+        curl_multi_socket_action(multi_, fd, flags, &still_running);
+    }
+    finish_done();
+}
+
+bool AsyncHttp::idle() {
+    std::lock_guard<std::mutex> lk(mu_);
+    return incoming_.empty() && running_.empty();
+}
+
+void AsyncHttp::finish_done() {
+    int queued = 0;
+    while (CURLMsg* msg = curl_multi_info_read(multi_, &queued)) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        CURL* c = msg->easy_handle;
+        const CURLcode rc = msg->data.result;
+        auto it = running_.find(c);
+        std::unique_ptr<Transfer> t = std::move(it->second);
+        running_.erase(it);
+        if (rc != CURLE_OK) {
+            t->res.error = std::string("curl request failed: ") + curl_easy_strerror(rc);
+        } else {
+            curl_easy_getinfo(c, CURLINFO_RESPONSE_CODE, &t->res.status);
+        }
+        curl_multi_remove_handle(multi_, c);
+        curl_easy_cleanup(c);
+        curl_slist_free_all(t->headers);
+        t->done(t->res);
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <curl/curl.h>
+
+// Outbound HTTP requests without a thread per request: libcurl's multi interface, driven by
+// the caller's event loop through curl's socket and timer callbacks.
+//
+// Every fd curl wants watched, a timerfd for curl's timeouts and an eventfd for new
+// requests are registered in one epoll set, so the loop only has to watch fd(): when it is
+// readable, the loop calls on_ready(), which moves every transfer as far as it can go
+// without blocking and runs the completion of each one that finished.
+class AsyncHttp {
+public:
+    struct Request {
+        std::string method = "GET";
+        std::string url;
+        std::vector<std::string> headers;  // "Name: value"
+        std::string body;
+        long timeout_seconds = 20;
+    };
+
+    struct Response {
+        std::string error;  // set when there is no HTTP response (connect failure, timeout)
+        long status = 0;
+        std::string body;
+        std::string etag;
+    };
+
+    // Runs on the loop thread, inside on_ready().
+    using Done = std::function<void(Response& res)>;
+
+    // Returns empty string on success; otherwise an error message.
+    static std::string create(std::unique_ptr<AsyncHttp>& out);
+    ~AsyncHttp();
+
+    AsyncHttp(const AsyncHttp&) = delete;
+    AsyncHttp& operator=(const AsyncHttp&) = delete;
+
+    // Any thread (including from a completion): queues `req` and returns at once.
+    void start(Request req, Done done);
+
+    // The fd for the loop to watch for readability.
+    int fd() const { return epoll_fd_; }
+
+    // Loop thread, once fd() is readable (extra calls are harmless).
+    void on_ready();
+
+    // Loop thread: no request queued or in progress.
+    bool idle();
+
+private:
+    struct Transfer {
+        CURL* easy = nullptr;
+        curl_slist* headers = nullptr;
+        Request req;
+        Response res;
+        Done done;
+    };
+
+    AsyncHttp() = default;
+
+    CURLM* multi_ = nullptr;
+    int epoll_fd_ = -1;
+    int timer_fd_ = -1;
+    int wake_fd_ = -1;
+
+    std::mutex mu_;
+    std::vector<std::unique_ptr<Transfer>> incoming_;  // guarded by mu_
+    std::unordered_map<CURL*, std::unique_ptr<Transfer>> running_;  // loop thread only
+
+    static int on_socket(CURL* easy, curl_socket_t s, int what, void* self, void* socketp);
+    static int on_timer(CURLM* multi, long timeout_ms, void* self);
+    void add(std::unique_ptr<Transfer> t);
+    void finish_done();
+};
@@ -0,0 +1,124 @@
+#include "availability_stats.hpp"
+
+#include <algorithm>
+
+#include "bitset_simd.hpp"
+#include "name_index.hpp"
+#include "namegen.hpp"
+
+// Past this (64 MiB of bitset) rebuild() walks the members instead.
+static constexpr size_t kMaxBitsetWords = size_t{1} << 23;
+
+// Set bits of `words` in the bit range [begin, end).
+static uint64_t popcount_range(const uint64_t* words, uint64_t begin, uint64_t end) {
+    if (begin >= end) return 0;
+    const size_t bw = static_cast<size_t>(begin / 64);
+    const size_t ew = static_cast<size_t>((end - 1) / 64);
+    const uint64_t lo_mask = ~uint64_t{0} << (begin % 64);
+    const uint64_t hi_mask = ~uint64_t{0} >> (63 - (end - 1) % 64);
+    if (bw == ew) return static_cast<uint64_t>(__builtin_popcountll(words[bw] & lo_mask & hi_mask));
+    return static_cast<uint64_t>(__builtin_popcountll(words[bw] & lo_mask)) +
+           bitset_simd::popcount(words + bw + 1, ew - bw - 1) +
+           static_cast<uint64_t>(__builtin_popcountll(words[ew] & hi_mask));
+}
+
+static std::unique_ptr<std::atomic<uint64_t>[]> to_atomics(const std::vector<uint64_t>& v) {
+    std::unique_ptr<std::atomic<uint64_t>[]> out(new std::atomic<uint64_t>[v.size()]);
+    for (size_t i = 0; i < v.size(); i++) out[i].store(v[i], std::memory_order_relaxed);
+    return out;
+}
+
+void AvailabilityStats::rebuild(const UsedView& used) {
+    const size_t firsts = namegen::first_name_count();
+    const size_t lasts = std::max<size_t>(1, namegen::surname_count());
+    n_ = namegen::universe_size();
+    lasts_ = lasts;
+    row_len_ = std::max<uint64_t>(1, static_cast<uint64_t>(namegen::middle_slot_count()) * lasts);
+
+    const NameIndex& index = NameIndex::instance();
+    first_id_.resize(firsts);
+    gender_of_.resize(firsts);
+    first_total_.assign(firsts, 0);
+    surname_id_.resize(lasts);
+    surname_total_.assign(lasts, 0);
+    gender_total_[0] = gender_total_[1] = 0;
+    for (size_t f = 0; f < firsts; f++) {
+        first_id_[f] = index.first_name_id(f);
+        gender_of_[f] = static_cast<uint8_t>(namegen::first_name_gender(f));
+        first_total_[first_id_[f]] += row_len_;
+        gender_total_[gender_of_[f]] += row_len_;
+    }
+    for (size_t l = 0; l < lasts; l++) {
+        surname_id_[l] = index.surname_id(l);
+        surname_total_[surname_id_[l]] += n_ / lasts;
+    }
+
+    std::vector<uint64_t> first_used(firsts, 0);
+    std::vector<uint64_t> surname_used(lasts, 0);
+    uint64_t gender_used[2] = {0, 0};
+    const size_t nwords = static_cast<size_t>((n_ + 63) / 64);
+    if (nwords <= kMaxBitsetWords) {
+        // Clearing the members from an all-ones bitset leaves the unused names. Each first
+        // name is one contiguous range of it, so its count is a vectorized popcount.
+        std::vector<uint64_t> words(nwords, ~uint64_t{0});
+        const uint64_t tail = (n_ % 64) ? (~uint64_t{0} >> (64 - n_ % 64)) : ~uint64_t{0};
+        if (nwords) words.back() = tail;
+        used.clear_members_in(words.data(), nwords);
+        for (size_t f = 0; f < firsts; f++) {
+            const uint64_t n = row_len_ - popcount_range(words.data(), f * row_len_, (f + 1) * row_len_);
+            first_used[first_id_[f]] += n;
+            gender_used[gender_of_[f]] += n;
+        }
+        // Surnames stride across the rows: walk the used bits.
+        for (size_t w = 0; w < nwords; w++) {
+            uint64_t m = ~words[w] & (w + 1 == nwords ? tail : ~uint64_t{0});
+            while (m) {
+                const uint64_t idx = w * 64 + static_cast<uint64_t>(__builtin_ctzll(m));
+                m &= m - 1;
+                surname_used[surname_id_[idx % lasts_]]++;
+            }
+        }
+    } else {
+        used.visit([&](uint64_t idx) {
+            if (idx >= n_) return;
+            const size_t f = static_cast<size_t>(idx / row_len_);
+            first_used[first_id_[f]]++;
+            gender_used[gender_of_[f]]++;
+            surname_used[surname_id_[idx % lasts_]]++;
+        });
+    }
+    first_used_ = to_atomics(first_used);
+    surname_used_ = to_atomics(surname_used);
+    for (int g = 0; g < 2; g++) gender_used_[g].store(gender_used[g], std::memory_order_relaxed);
+}
+
+void AvailabilityStats::adjust(uint64_t idx, uint64_t delta) {
+    if (idx >= n_) return;  // a stale index from before a universe swap; rebuild() follows
+    const size_t f = static_cast<size_t>(idx / row_len_);
+    first_used_[first_id_[f]].fetch_add(delta, std::memory_order_relaxed);
+    surname_used_[surname_id_[idx % lasts_]].fetch_add(delta, std::memory_order_relaxed);
+    gender_used_[gender_of_[f]].fetch_add(delta, std::memory_order_relaxed);
+}
+
+static AvailabilityStats::Count count_of(uint64_t total, uint64_t used) {
+    return {total, used < total ? total - used : 0};
+}
+
+AvailabilityStats::Count AvailabilityStats::all() const {
+    return count_of(n_, gender_used_[0].load(std::memory_order_relaxed) + gender_used_[1].load(std::memory_order_relaxed));
+}
+
+AvailabilityStats::Count AvailabilityStats::gender(int g) const {
+    if (g < 0 || g > 1) return {};
+    return count_of(gender_total_[g], gender_used_[g].load(std::memory_order_relaxed));
+}
+
+AvailabilityStats::Count AvailabilityStats::first_name(uint32_t id) const {
+    if (id >= first_total_.size()) return {};
+    return count_of(first_total_[id], first_used_[id].load(std::memory_order_relaxed));
+}
+
+AvailabilityStats::Count AvailabilityStats::surname(uint32_t id) const {
+    if (id >= surname_total_.size()) return {};
+    return count_of(surname_total_[id], surname_used_[id].load(std::memory_order_relaxed));
+}
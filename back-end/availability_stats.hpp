@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "sharded_used_set.hpp"
+
+// Used/remaining name counts per first name, per surname and per gender, kept in step with
+// a history store's used set so a query is O(1) instead of a scan of the universe.
+//
+// First names and surnames are counted by their NameIndex id (names that differ only in
+// case are one entry, as in filters). The store attaches this as its used set's observer:
+// every mark and unmark adjusts the counters of that index (relaxed atomics, so concurrent
+// generates need no extra lock), and rebuild() recounts from scratch whenever the whole
+// set is replaced (load, universe swap, prefork resync).
+class AvailabilityStats : public ShardedUsedSet::Observer {
+public:
+    struct Count {
+        uint64_t total = 0;
+        uint64_t remaining = 0;
+    };
+
+    // Sizes the counters for the active universe and recounts them from `used`. Needs
+    // exclusive access: no concurrent marks or queries.
+    void rebuild(const UsedView& used);
+
+    void on_insert(uint64_t idx) override { adjust(idx, 1); }
+    void on_erase(uint64_t idx) override { adjust(idx, ~uint64_t{0}); }
+
+    Count all() const;
+    Count gender(int g) const;            // static_cast<int>(namegen::Gender)
+    Count first_name(uint32_t id) const;  // NameIndex::parse_first_name
+    Count surname(uint32_t id) const;     // NameIndex::parse_filter (NameFilter::surname)
+
+private:
+    uint64_t n_ = 0;
+    uint64_t lasts_ = 1;
+    uint64_t row_len_ = 1;  // indices per first name (middle slots x surnames)
+    std::vector<uint32_t> first_id_;    // by first-name index
+    std::vector<uint32_t> surname_id_;  // by surname index
+    std::vector<uint8_t> gender_of_;    // by first-name index
+    std::vector<uint64_t> first_total_;    // by id
+    std::vector<uint64_t> surname_total_;  // by id
+    std::unique_ptr<std::atomic<uint64_t>[]> first_used_;    // by id
+    std::unique_ptr<std::atomic<uint64_t>[]> surname_used_;  // by id
+    uint64_t gender_total_[2] = {0, 0};
+    std::atomic<uint64_t> gender_used_[2] = {{0}, {0}};
+
+    // Adds `delta` (1 or -1 mod 2^64) to the counters of `idx`.
+    void adjust(uint64_t idx, uint64_t delta);
+};
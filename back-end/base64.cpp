@@ -0,0 +1,277 @@
+#include "base64.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE64_X86 1
+#endif
+
+namespace base64 {
+
+static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Decoding table: the sextet, or one of these.
+constexpr int8_t kInvalid = -1;
+constexpr int8_t kSpace = -2;
+constexpr int8_t kPad = -3;
+
+struct DecodeTable {
+    int8_t v[256];
+    DecodeTable() {
+        for (int8_t& x : v) x = kInvalid;
+        for (int i = 0; i < 64; i++) v[static_cast<uint8_t>(kAlphabet[i])] = static_cast<int8_t>(i);
+        for (char c : {' ', '\t', '\n', '\r'}) v[static_cast<uint8_t>(c)] = kSpace;
+        v[static_cast<uint8_t>('=')] = kPad;
+    }
+};
+static const DecodeTable kDecode;
+
+// The SIMD decoders store a full vector per step, up to this many bytes past the last one
+// they produce.
+constexpr size_t kDecodeSlack = 16;
+
+#ifdef BASE64_X86
+// Encoding (Muła and Lemire, "Faster Base64 Encoding and Decoding Using AVX2
+// Instructions"): spread each 3 input bytes over a 32-bit lane, cut out the four sextets
+// with two multiplies, then map sextets to ASCII by adding a per-range offset.
+
+__attribute__((target("ssse3"))) static __m128i enc_translate(__m128i idx) {
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    // 0..25 -> 13 ('A'), 26..51 -> 0 ('a'), 52..61 -> 1..10 ('0'), 62 -> 11, 63 -> 12
+    __m128i range = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+    return _mm_add_epi8(idx, _mm_shuffle_epi8(offsets, range));
+}
+
+__attribute__((target("ssse3"))) static size_t encode_ssse3(const uint8_t* in, size_t n, char* out) {
+    const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 12, out += 16) {
+        const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), spread);
+        const __m128i hi = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        const __m128i lo = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), enc_translate(_mm_or_si128(hi, lo)));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static __m256i enc_translate_avx2(__m256i idx) {
+    const __m256i offsets = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m256i range = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+    range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+    return _mm256_add_epi8(idx, _mm256_shuffle_epi8(offsets, range));
+}
+
+// 24 bytes per step, 12 in each 128-bit lane (pshufb does not cross lanes).
+__attribute__((target("avx2"))) static size_t encode_avx2(const uint8_t* in, size_t n, char* out) {
+    const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    size_t i = 0;
+    for (; i + 28 <= n; i += 24, out += 32) {
+        __m256i v = _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+        v = _mm256_inserti128_si256(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12)), 1);
+        v = _mm256_shuffle_epi8(v, spread);
+        const __m256i hi =
+            _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        const __m256i lo =
+            _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), enc_translate_avx2(_mm256_or_si256(hi, lo)));
+    }
+    return i;
+}
+
+// Decoding (same paper): classify each character by its high and low nibble, which both
+// validates it and picks the offset that turns it into its sextet, then pack four sextets
+// into three bytes with two multiply-adds. A block with anything but alphabet characters
+// (whitespace, '=', garbage) stops the loop; the scalar code takes it from there.
+
+__attribute__((target("ssse3"))) static size_t decode_ssse3(const char* in, size_t n, uint8_t* out) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+                                         0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16, out += 12) {
+        __m128i str = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+        const __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(str, mask_2f));
+        const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xFFFF) break;
+        const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(str, mask_2f), hi_nibbles));
+        str = _mm_add_epi8(str, roll);
+        __m128i packed = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+        packed = _mm_madd_epi16(packed, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(packed, pack));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t decode_avx2(const char* in, size_t n, uint8_t* out) {
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+                                            0x1B, 0x1B, 0x1B, 0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32, out += 24) {
+        __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(str, mask_2f));
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi)) break;
+        const __m256i roll =
+            _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f), hi_nibbles));
+        str = _mm256_add_epi8(str, roll);
+        __m256i packed = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        packed = _mm256_madd_epi16(packed, _mm256_set1_epi32(0x00011000));
+        packed = _mm256_shuffle_epi8(packed, pack);
+        // 12 bytes at the bottom of each lane: close the gap between them.
+        packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), packed);
+    }
+    return i;
+}
+
+static bool has_avx2() {
+    static const bool v = __builtin_cpu_supports("avx2");
+    return v;
+}
+
+static bool has_ssse3() {
+    static const bool v = __builtin_cpu_supports("ssse3");
+    return v;
+}
+#endif
+
+// Whole 3-byte groups from the front of `in`; returns the bytes consumed (4/3 as many
+// characters written).
+static size_t encode_blocks(const uint8_t* in, size_t n, char* out) {
+    size_t i = 0;
+#ifdef BASE64_X86
+    if (has_avx2()) i = encode_avx2(in, n, out);
+    if (has_ssse3()) i += encode_ssse3(in + i, n - i, out + i / 3 * 4);
+#endif
+    for (; i + 3 <= n; i += 3) {
+        const uint32_t v = (uint32_t{in[i]} << 16) | (uint32_t{in[i + 1]} << 8) | in[i + 2];
+        char* o = out + i / 3 * 4;
+        o[0] = kAlphabet[v >> 18];
+        o[1] = kAlphabet[(v >> 12) & 0x3F];
+        o[2] = kAlphabet[(v >> 6) & 0x3F];
+        o[3] = kAlphabet[v & 0x3F];
+    }
+    return i;
+}
+
+// Whole blocks of alphabet characters from the front of `in`, up to the first block that
+// has anything else; returns the characters consumed (3/4 as many bytes written, and up
+// to kDecodeSlack bytes past them overwritten).
+static size_t decode_blocks(const char* in, size_t n, uint8_t* out) {
+    size_t i = 0;
+#ifdef BASE64_X86
+    if (has_avx2()) i = decode_avx2(in, n, out);
+    if (has_ssse3()) i += decode_ssse3(in + i, n - i, out + i / 4 * 3);
+#else
+    (void)in;
+    (void)n;
+    (void)out;
+#endif
+    return i;
+}
+
+size_t encoded_size(size_t n) {
+    return (n + 2) / 3 * 4;
+}
+
+void encode(const uint8_t* in, size_t n, std::string& out) {
+    const size_t at = out.size();
+    out.resize(at + encoded_size(n));
+    char* o = &out[at];
+    const size_t done = encode_blocks(in, n, o);
+    o += done / 3 * 4;
+    const size_t rest = n - done;
+    if (rest == 0) return;
+    const uint32_t v = (uint32_t{in[done]} << 16) | (rest == 2 ? uint32_t{in[done + 1]} << 8 : 0);
+    o[0] = kAlphabet[v >> 18];
+    o[1] = kAlphabet[(v >> 12) & 0x3F];
+    o[2] = rest == 2 ? kAlphabet[(v >> 6) & 0x3F] : '=';
+    o[3] = '=';
+}
+
+std::string Decoder::update(std::string_view in, std::vector<uint8_t>& out) {
+    const size_t at = out.size();
+    out.resize(at + in.size() / 4 * 3 + 3 + kDecodeSlack);
+    uint8_t* o = out.data() + at;
+    const char* p = in.data();
+    const char* const end = p + in.size();
+    // Cleared when the kernels stop at a block; set again once the scalar code has got past
+    // what stopped them (whitespace, typically a line break).
+    bool try_blocks = true;
+    std::string err;
+    while (p < end) {
+        if (try_blocks && have_ == 0 && padding_ == 0) {
+            const size_t n = decode_blocks(p, static_cast<size_t>(end - p), o);
+            p += n;
+            o += n / 4 * 3;
+            try_blocks = false;
+            if (p == end) break;
+        }
+        const int8_t v = kDecode.v[static_cast<uint8_t>(*p++)];
+        if (v >= 0 && padding_ == 0) {
+            acc_ = (acc_ << 6) | static_cast<uint32_t>(v);
+            if (++have_ == 4) {
+                o[0] = static_cast<uint8_t>(acc_ >> 16);
+                o[1] = static_cast<uint8_t>(acc_ >> 8);
+                o[2] = static_cast<uint8_t>(acc_);
+                o += 3;
+                acc_ = 0;
+                have_ = 0;
+            }
+        } else if (v == kSpace) {
+            try_blocks = true;
+        } else if (v == kPad && have_ >= 2 && have_ + padding_ < 4) {
+            // "xx==" or "xxx=": the last quad, cut short.
+            if (have_ + ++padding_ == 4) {
+                if (have_ == 2) {
+                    *o++ = static_cast<uint8_t>(acc_ >> 4);
+                } else {
+                    *o++ = static_cast<uint8_t>(acc_ >> 10);
+                    *o++ = static_cast<uint8_t>(acc_ >> 2);
+                }
+                acc_ = 0;
+                have_ = 0;
+            }
+        } else {
+            err = "invalid base64 character";
+            break;
+        }
+    }
+    out.resize(static_cast<size_t>(o - out.data()));
+    return err;
+}
+
+std::string Decoder::finish() {
+    if (have_ != 0) return "invalid base64 length";
+    return "";
+}
+
+std::string decode(std::string_view in, std::vector<uint8_t>& out) {
+    out.clear();
+    Decoder d;
+    auto err = d.update(in, out);
+    if (err.empty()) err = d.finish();
+    return err;
+}
+
+}  // namespace base64
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Base64 (standard alphabet, '=' padding) for history blobs. The bulk of the data goes
+// through SSSE3 or AVX2 kernels (12/24 bytes <-> 16/32 characters per step) picked at
+// runtime, like bitset_simd; the ends, whitespace and anything unusual go through the
+// scalar code. Both directions write straight into the caller's buffer.
+namespace base64 {
+
+size_t encoded_size(size_t n);
+
+// Appends the base64 of in[0..n) to `out`.
+void encode(const uint8_t* in, size_t n, std::string& out);
+
+// Streaming decoder: feed the text in chunks of any size (split anywhere, ASCII whitespace
+// anywhere is skipped) and call finish() at the end. Decoded bytes are appended to `out`.
+// Each returns empty string on success; otherwise an error message, after which the
+// decoder must not be used again.
+class Decoder {
+public:
+    std::string update(std::string_view in, std::vector<uint8_t>& out);
+    std::string finish();
+
+private:
+    uint32_t acc_ = 0;     // sextets of the current quad, oldest first
+    int have_ = 0;         // sextets in acc_ (0..3)
+    int padding_ = 0;      // '=' seen; only whitespace may follow the quad they end
+};
+
+// One-shot: replaces `out` with the decoded bytes of `in`.
+std::string decode(std::string_view in, std::vector<uint8_t>& out);
+
+}  // namespace base64
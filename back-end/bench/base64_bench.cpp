@@ -0,0 +1,174 @@
+// Throughput of the base64 codec against the byte-at-a-time version it replaced, for
+// history-blob-sized inputs.
+//
+// Build (from repo root):
+//   g++ -std=c++17 -O2 -Iback-end back-end/bench/base64_bench.cpp back-end/base64.cpp -o base64_bench
+//
+// Usage: base64_bench [megabytes]
+// Checks first that both decoders agree (random sizes, with and without line breaks every
+// 76 characters), then prints GB/s of input for encode and decode.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "base64.hpp"
+
+namespace {
+
+// The previous implementation (history_store_gist.cpp), kept as the baseline.
+const char* kAlph = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string old_encode(const std::vector<uint8_t>& in) {
+    std::string out;
+    out.reserve(((in.size() + 2) / 3) * 4);
+    size_t i = 0;
+    while (i < in.size()) {
+        uint32_t a = in[i++];
+        uint32_t b = (i < in.size()) ? in[i++] : 0;
+        uint32_t c = (i < in.size()) ? in[i++] : 0;
+        uint32_t triple = (a << 16) | (b << 8) | c;
+        out.push_back(kAlph[(triple >> 18) & 0x3F]);
+        out.push_back(kAlph[(triple >> 12) & 0x3F]);
+        out.push_back((i - 1 <= in.size()) ? kAlph[(triple >> 6) & 0x3F] : '=');
+        out.push_back((i <= in.size()) ? kAlph[triple & 0x3F] : '=');
+    }
+    size_t mod = in.size() % 3;
+    if (mod == 1) {
+        out[out.size() - 2] = '=';
+        out[out.size() - 1] = '=';
+    } else if (mod == 2) {
+        out[out.size() - 1] = '=';
+    }
+    return out;
+}
+
+int old_val(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return 26 + (c - 'a');
+    if (c >= '0' && c <= '9') return 52 + (c - '0');
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+std::string old_decode(const std::string& b64, std::vector<uint8_t>& out) {
+    out.clear();
+    std::string s;
+    s.reserve(b64.size());
+    for (unsigned char c : b64) {
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') continue;
+        s.push_back(static_cast<char>(c));
+    }
+    if (s.size() % 4 != 0) return "invalid base64 length";
+    out.reserve((s.size() / 4) * 3);
+    for (size_t i = 0; i < s.size(); i += 4) {
+        int v0 = old_val(s[i]);
+        int v1 = old_val(s[i + 1]);
+        int v2 = (s[i + 2] == '=') ? 0 : old_val(s[i + 2]);
+        int v3 = (s[i + 3] == '=') ? 0 : old_val(s[i + 3]);
+        if (v0 < 0 || v1 < 0 || v2 < 0 || v3 < 0) return "invalid base64 character";
+        uint32_t triple = (static_cast<uint32_t>(v0) << 18) | (static_cast<uint32_t>(v1) << 12) |
+                          (static_cast<uint32_t>(v2) << 6) | static_cast<uint32_t>(v3);
+        out.push_back(static_cast<uint8_t>((triple >> 16) & 0xFF));
+        if (s[i + 2] != '=') out.push_back(static_cast<uint8_t>((triple >> 8) & 0xFF));
+        if (s[i + 3] != '=') out.push_back(static_cast<uint8_t>(triple & 0xFF));
+    }
+    return "";
+}
+
+std::string wrap76(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i += 76) {
+        out.append(s, i, 76);
+        out += "\r\n";
+    }
+    return out;
+}
+
+bool check(std::mt19937& rng) {
+    for (int round = 0; round < 2000; round++) {
+        std::vector<uint8_t> in(rng() % 600);
+        for (auto& b : in) b = static_cast<uint8_t>(rng());
+        std::string enc;
+        base64::encode(in.data(), in.size(), enc);
+        if (enc != old_encode(in)) {
+            std::printf("encode mismatch at %zu bytes\n", in.size());
+            return false;
+        }
+        for (const std::string& text : {enc, wrap76(enc), " " + enc + "\n"}) {
+            std::vector<uint8_t> out;
+            if (!base64::decode(text, out).empty() || out != in) {
+                std::printf("decode mismatch at %zu bytes\n", in.size());
+                return false;
+            }
+            // The same text fed in pieces.
+            base64::Decoder d;
+            out.clear();
+            for (size_t i = 0; i < text.size();) {
+                const size_t n = std::min<size_t>(rng() % 50, text.size() - i);
+                if (!d.update(std::string_view(text).substr(i, n), out).empty()) return false;
+                i += n;
+            }
+            if (!d.finish().empty() || out != in) {
+                std::printf("streaming decode mismatch at %zu bytes\n", in.size());
+                return false;
+            }
+        }
+    }
+    std::vector<uint8_t> out;
+    for (const char* bad : {"abc", "a===", "ab=c", "ab==ab==", "ab*d", "abc=="}) {
+        if (base64::decode(bad, out).empty()) {
+            std::printf("accepted invalid input '%s'\n", bad);
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class Fn>
+double gb_per_s(size_t bytes, Fn&& fn) {
+    double best = 1e30;
+    for (int i = 0; i < 5; i++) {
+        const auto t0 = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    }
+    return static_cast<double>(bytes) / best / 1e9;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const size_t mb = argc > 1 ? static_cast<size_t>(std::max(1, std::atoi(argv[1]))) : 64;
+    std::mt19937 rng(12345);
+    if (!check(rng)) return 1;
+    std::printf("check: ok\n");
+
+    std::vector<uint8_t> blob(mb << 20);
+    for (auto& b : blob) b = static_cast<uint8_t>(rng());
+    std::string text;
+    base64::encode(blob.data(), blob.size(), text);
+    const std::string wrapped = wrap76(text);
+
+    std::string enc;
+    std::vector<uint8_t> dec;
+    std::printf("%zu MiB blob, GB/s of input (best of 5)\n", mb);
+    std::printf("%-24s %8s %8s\n", "", "old", "new");
+    std::printf("%-24s %8.2f %8.2f\n", "encode",
+                gb_per_s(blob.size(), [&]() { enc = old_encode(blob); }),
+                gb_per_s(blob.size(), [&]() {
+                    enc.clear();
+                    base64::encode(blob.data(), blob.size(), enc);
+                }));
+    std::printf("%-24s %8.2f %8.2f\n", "decode",
+                gb_per_s(text.size(), [&]() { (void)old_decode(text, dec); }),
+                gb_per_s(text.size(), [&]() { (void)base64::decode(text, dec); }));
+    std::printf("%-24s %8.2f %8.2f\n", "decode (76-char lines)",
+                gb_per_s(wrapped.size(), [&]() { (void)old_decode(wrapped, dec); }),
+                gb_per_s(wrapped.size(), [&]() { (void)base64::decode(wrapped, dec); }));
+    return 0;
+}
@@ -0,0 +1,106 @@
+// Blob payload size and encode/decode time of each history codec across fill levels,
+// with the codec predict() picks for each.
+//
+// Build (from repo root):
+//   g++ -std=c++17 -O2 -Iback-end back-end/bench/history_codec_bench.cpp back-end/history_codec.cpp
+//       back-end/used_set.cpp back-end/bitset_simd.cpp -lz -o history_codec_bench
+//
+// Usage: history_codec_bench [universe_size]
+// Each fill level is a random used set (every index used with probability `fill`) in a
+// UsedSet; encode is one visit of it, decode goes back into a fresh UsedSet, and every
+// round trip is checked. Times are the best of 3.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "history_codec.hpp"
+#include "used_set.hpp"
+
+namespace {
+
+using history_codec::Codec;
+
+template <class Fn>
+double best_ms(Fn&& fn) {
+    double best = 1e30;
+    for (int i = 0; i < 3; i++) {
+        const auto t0 = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    }
+    return best * 1e3;
+}
+
+bool run_level(uint64_t n, double fill, std::mt19937_64& rng) {
+    UsedSet used;
+    std::bernoulli_distribution coin(fill);
+    for (uint64_t i = 0; i < n; i++) {
+        if (coin(rng)) used.insert(i);
+    }
+    const uint64_t m = used.size();
+    const Codec predicted = history_codec::predict(m, n);
+
+    uint64_t smallest = UINT64_MAX;
+    Codec smallest_codec = Codec::Raw;
+    std::printf("fill %8.4f%%  used %10llu  predict %s\n", fill * 100, static_cast<unsigned long long>(m),
+                history_codec::name(predicted));
+    for (int ci = 0; ci < history_codec::kCodecs; ci++) {
+        const Codec c = static_cast<Codec>(ci);
+        std::vector<uint8_t> payload;
+        uint64_t raw_len = 0;
+        std::string err;
+        const double enc_ms = best_ms([&]() {
+            history_codec::Encoder enc(c, n, m, 6);
+            used.for_each([&](uint64_t idx) { enc.add(idx); });
+            err = enc.finish(payload, raw_len);
+        });
+        if (!err.empty()) {
+            std::printf("%s: encode failed: %s\n", history_codec::name(c), err.c_str());
+            return false;
+        }
+
+        UsedSet back;
+        const double dec_ms = best_ms([&]() {
+            back.clear();
+            err = history_codec::decode(c, payload.data(), payload.size(), raw_len, m, n,
+                                        [&](const uint64_t* idx, size_t k) {
+                                            for (size_t i = 0; i < k; i++) back.insert(idx[i]);
+                                        });
+        });
+        bool same = err.empty() && back.size() == m;
+        if (same) used.for_each([&](uint64_t idx) { same = same && back.contains(idx); });
+        if (!same) {
+            std::printf("%s: round trip failed %s\n", history_codec::name(c), err.c_str());
+            return false;
+        }
+
+        if (c != Codec::Zlib && payload.size() < smallest) {
+            smallest = payload.size();
+            smallest_codec = c;
+        }
+        std::printf("  %-10s %12zu bytes  (est %12llu)  %9.2f bits/used  encode %8.2f ms  decode %8.2f ms\n",
+                    history_codec::name(c), payload.size(),
+                    static_cast<unsigned long long>(history_codec::estimated_size(c, m, n)),
+                    m ? static_cast<double>(payload.size()) * 8 / static_cast<double>(m) : 0.0, enc_ms, dec_ms);
+    }
+    if (smallest_codec != predicted) {
+        std::printf("  (smallest fast codec was %s)\n", history_codec::name(smallest_codec));
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const uint64_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : (uint64_t{1} << 24);
+    std::mt19937_64 rng(12345);
+    std::printf("universe %llu\n", static_cast<unsigned long long>(n));
+    for (double fill : {0.00001, 0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999, 0.99999}) {
+        if (!run_level(n, fill, rng)) return 1;
+    }
+    return 0;
+}
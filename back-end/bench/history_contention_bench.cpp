@@ -0,0 +1,89 @@
+// Throughput of concurrent HistoryStore::generate_and_mark at 1, 4, 16 and 64 threads,
+// with the used set in one shard (a single lock) and in 64.
+//
+// Build (from repo root):
+//   g++ -std=c++17 -O2 -pthread -Iback-end back-end/bench/history_contention_bench.cpp
+//       back-end/history_store_gist.cpp back-end/namegen.cpp back-end/used_set.cpp
+//       back-end/sharded_used_set.cpp back-end/bitset_simd.cpp back-end/name_index.cpp
+//       back-end/weighted_sampler.cpp back-end/universe_migration.cpp back-end/trace.cpp
+//       back-end/shared_used_bits.cpp back-end/mapped_history.cpp back-end/issuance_log.cpp
+//       back-end/async_http.cpp back-end/replication.cpp back-end/base64.cpp back-end/history_codec.cpp back-end/availability_stats.cpp
+//       -lcurl -lz -o history_contention_bench
+//
+// Usage: history_contention_bench [names_per_run] [names_per_request]
+// Each run starts from an empty mapped history file in a temp directory (HISTORY_FORMAT and
+// HISTORY_SHARDS are set by the benchmark) and issues names_per_run names (default 20000,
+// in requests of 5). Prints requests/s and the number of persists, which shows how many
+// requests each group commit covered.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "history_store.hpp"
+#include "namegen.hpp"
+
+static bool run(const std::string& dir, int shards, int threads, int total, int per_request) {
+    const std::string path = dir + "/history-" + std::to_string(shards) + "-" + std::to_string(threads);
+    ::setenv("HISTORY_SHARDS", std::to_string(shards).c_str(), 1);
+    HistoryStore store(path, /*allow_remote=*/false);
+    if (auto err = store.init(); !err.empty()) {
+        std::fprintf(stderr, "init failed: %s\n", err.c_str());
+        return false;
+    }
+    const uint64_t persists_before = store.io_stats().persists;
+
+    const int requests = total / per_request;
+    std::atomic<int> next{0};
+    std::atomic<int> failed{0};
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back([&]() {
+            std::vector<std::string> names;
+            while (next.fetch_add(1) < requests) {
+                if (!store.generate_and_mark(per_request, names).empty()) failed++;
+            }
+        });
+    }
+    for (auto& th : pool) th.join();
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    std::printf("%-8d %-8d %-12.0f %-10llu %d\n", shards, threads, requests / secs,
+                static_cast<unsigned long long>(store.io_stats().persists - persists_before), failed.load());
+    ::unlink(path.c_str());
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const int total = argc > 1 ? std::atoi(argv[1]) : 20000;
+    const int per_request = argc > 2 ? std::atoi(argv[2]) : 5;
+    if (total <= 0 || per_request <= 0 || static_cast<size_t>(total) > namegen::universe_size()) {
+        std::fprintf(stderr, "names_per_run must be in [1, %zu]\n", namegen::universe_size());
+        return 1;
+    }
+
+    char tmpl[] = "/tmp/history-bench-XXXXXX";
+    if (!::mkdtemp(tmpl)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    ::setenv("HISTORY_FORMAT", "mapped", 1);
+
+    std::printf("universe=%zu names/run=%d names/request=%d cpus=%u\n", namegen::universe_size(), total,
+                per_request, std::thread::hardware_concurrency());
+    std::printf("%-8s %-8s %-12s %-10s %s\n", "shards", "threads", "req/s", "persists", "failed");
+    for (int shards : {1, 64}) {
+        for (int threads : {1, 4, 16, 64}) {
+            if (!run(tmpl, shards, threads, total, per_request)) return 1;
+        }
+    }
+    // Manifests written next to the history files.
+    std::string cleanup = std::string("rm -rf ") + tmpl;
+    return std::system(cleanup.c_str()) == 0 ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+// Throughput of WeightedSampler as the universe fills up.
+//
+// Build (from repo root):
+//   g++ -std=c++17 -O2 -Iback-end back-end/bench/weighted_sampler_bench.cpp
+//       back-end/weighted_sampler.cpp back-end/used_set.cpp back-end/bitset_simd.cpp
+//       back-end/namegen.cpp -o weighted_sampler_bench
+//
+// Uses Zipf-like weights (rank^-1) for first names and surnames and prints ns/pick for
+// every 10% of the universe consumed, up to 99%.
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+#include "namegen.hpp"
+#include "used_set.hpp"
+#include "weighted_sampler.hpp"
+
+int main() {
+    NameWeights w;
+    w.first.resize(namegen::first_name_count());
+    w.last.resize(namegen::surname_count());
+    for (size_t i = 0; i < w.first.size(); i++) w.first[i] = 1.0 / static_cast<double>(i + 1);
+    for (size_t i = 0; i < w.last.size(); i++) w.last[i] = 1.0 / static_cast<double>(i + 1);
+
+    const size_t n = namegen::universe_size();
+    UsedSet used;
+    std::mt19937 rng(12345);
+    WeightedSampler sampler(w, used);
+
+    std::printf("universe=%zu\n", n);
+    std::printf("%-12s %-12s %s\n", "fill", "picks", "ns/pick");
+    for (int decile = 1; decile <= 10; decile++) {
+        const size_t target = (decile == 10) ? n * 99 / 100 : n * static_cast<size_t>(decile) / 10;
+        const size_t start = used.size();
+        auto t0 = std::chrono::steady_clock::now();
+        while (used.size() < target) {
+            size_t idx = 0;
+            if (!sampler.pick(used, rng, idx)) {
+                std::printf("sampler exhausted early at %zu\n", used.size());
+                return 1;
+            }
+            used.insert(idx);
+            sampler.on_marked(idx);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        const double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        const size_t picks = used.size() - start;
+        std::printf("%3d%%%-8s %-12zu %.1f\n", decile == 10 ? 99 : decile * 10, "", picks,
+                    picks ? ns / static_cast<double>(picks) : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "bitset_simd.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITSET_SIMD_X86 1
+#endif
+
+namespace bitset_simd {
+
+static void and_into_scalar(uint64_t* dst, const uint64_t* src, size_t nwords) {
+    for (size_t i = 0; i < nwords; i++) dst[i] &= src[i];
+}
+
+static void andnot_into_scalar(uint64_t* dst, const uint64_t* src, size_t nwords) {
+    for (size_t i = 0; i < nwords; i++) dst[i] &= ~src[i];
+}
+
+static size_t popcount_scalar(const uint64_t* words, size_t nwords) {
+    size_t total = 0;
+    for (size_t i = 0; i < nwords; i++) total += static_cast<size_t>(__builtin_popcountll(words[i]));
+    return total;
+}
+
+#ifdef BITSET_SIMD_X86
+__attribute__((target("avx2"))) static void and_into_avx2(uint64_t* dst, const uint64_t* src, size_t nwords) {
+    size_t i = 0;
+    for (; i + 4 <= nwords; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_and_si256(a, b));
+    }
+    and_into_scalar(dst + i, src + i, nwords - i);
+}
+
+__attribute__((target("avx2"))) static void andnot_into_avx2(uint64_t* dst, const uint64_t* src, size_t nwords) {
+    size_t i = 0;
+    for (; i + 4 <= nwords; i += 4) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        // andnot(b, a) = ~b & a
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_andnot_si256(b, a));
+    }
+    andnot_into_scalar(dst + i, src + i, nwords - i);
+}
+
+// Nibble-lookup popcount (Mula): pshufb per nibble, horizontal sums via SAD.
+__attribute__((target("avx2"))) static size_t popcount_avx2(const uint64_t* words, size_t nwords) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= nwords; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        __m256i lo = _mm256_and_si256(v, low_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    return static_cast<size_t>(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + popcount_scalar(words + i, nwords - i);
+}
+
+static bool has_avx2() {
+    static const bool v = __builtin_cpu_supports("avx2");
+    return v;
+}
+#endif
+
+void and_into(uint64_t* dst, const uint64_t* src, size_t nwords) {
+#ifdef BITSET_SIMD_X86
+    if (has_avx2()) return and_into_avx2(dst, src, nwords);
+#endif
+    and_into_scalar(dst, src, nwords);
+}
+
+void andnot_into(uint64_t* dst, const uint64_t* src, size_t nwords) {
+#ifdef BITSET_SIMD_X86
+    if (has_avx2()) return andnot_into_avx2(dst, src, nwords);
+#endif
+    andnot_into_scalar(dst, src, nwords);
+}
+
+size_t popcount(const uint64_t* words, size_t nwords) {
+#ifdef BITSET_SIMD_X86
+    if (has_avx2()) return popcount_avx2(words, nwords);
+#endif
+    return popcount_scalar(words, nwords);
+}
+
+}  // namespace bitset_simd
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Word-level bitset kernels over little-endian uint64_t words (bit i lives in word i/64).
+// AVX2 versions are picked at runtime when the CPU supports them; otherwise scalar.
+namespace bitset_simd {
+
+// dst[i] &= src[i]
+void and_into(uint64_t* dst, const uint64_t* src, size_t nwords);
+
+// dst[i] &= ~src[i]
+void andnot_into(uint64_t* dst, const uint64_t* src, size_t nwords);
+
+size_t popcount(const uint64_t* words, size_t nwords);
+
+}  // namespace bitset_simd
@@ -0,0 +1,384 @@
+#include "history_codec.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+namespace history_codec {
+
+namespace {
+
+constexpr size_t kBatch = 4096;         // indices per sink() call
+constexpr size_t kInflateChunk = 1 << 16;
+constexpr unsigned kMaxLowBits = 56;    // one unaligned 8-byte load covers any low part
+
+void push_varint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+bool read_varint(const uint8_t*& p, const uint8_t* end, uint64_t& out) {
+    out = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        const uint8_t b = *p++;
+        out |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Little-endian load of up to 8 bytes.
+uint64_t load_le(const uint8_t* p, size_t n) {
+    uint64_t w = 0;
+    std::memcpy(&w, p, std::min<size_t>(n, 8));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+void append_le(std::vector<uint8_t>& out, const std::vector<uint64_t>& words, size_t nbytes) {
+    for (size_t i = 0; i < nbytes; i++) out.push_back(static_cast<uint8_t>(words[i / 8] >> (8 * (i % 8))));
+}
+
+// Elias-Fano split: floor(log2(n / m)) low bits per member.
+unsigned low_bits_for(uint64_t m, uint64_t n) {
+    if (m == 0 || n <= m) return 0;
+    return std::min(kMaxLowBits, static_cast<unsigned>(63 - __builtin_clzll(n / m)));
+}
+
+double varint_len(double v) {
+    return v < 128 ? 1 : 1 + std::floor(std::log2(v) / 7);
+}
+
+class Batcher {
+public:
+    explicit Batcher(const std::function<void(const uint64_t*, size_t)>& sink) : sink_(sink) {}
+    void push(uint64_t idx) {
+        buf_[k_++] = idx;
+        if (k_ == kBatch) flush();
+    }
+    void flush() {
+        if (k_) sink_(buf_, k_);
+        k_ = 0;
+    }
+
+private:
+    const std::function<void(const uint64_t*, size_t)>& sink_;
+    uint64_t buf_[kBatch];
+    size_t k_ = 0;
+};
+
+std::string decode_zlib(const uint8_t* payload, size_t len, uint64_t raw_len, uint64_t count, uint64_t n,
+                        Batcher& out) {
+    if (len > UINT_MAX) return "history decompress failed";
+    z_stream zs{};
+    if (::inflateInit(&zs) != Z_OK) return "history decompress failed";
+    zs.next_in = const_cast<Bytef*>(payload);
+    zs.avail_in = static_cast<uInt>(len);
+
+    // Inflate a chunk at a time; a varint cut by the chunk end is carried to the next one.
+    std::vector<uint8_t> buf(kInflateChunk + 16);
+    size_t have = 0;
+    uint64_t produced = 0, seen = 0, prev = 0;
+    std::string err;
+    for (;;) {
+        zs.next_out = buf.data() + have;
+        zs.avail_out = static_cast<uInt>(kInflateChunk);
+        const int zrc = ::inflate(&zs, Z_NO_FLUSH);
+        if (zrc != Z_OK && zrc != Z_STREAM_END) {
+            err = "history decompress failed";
+            break;
+        }
+        const size_t got = kInflateChunk - zs.avail_out;
+        produced += got;
+        have += got;
+        if (produced > raw_len) {
+            err = "history decompress failed";
+            break;
+        }
+
+        const uint8_t* p = buf.data();
+        const uint8_t* end = p + have;
+        while (p < end && seen < count) {
+            const uint8_t* q = p;
+            uint64_t delta = 0;
+            if (!read_varint(q, end, delta)) {
+                if (end - p >= 10) err = "history index list is corrupted";
+                break;
+            }
+            p = q;
+            const uint64_t idx = (seen == 0) ? delta : prev + delta;
+            if (idx >= n || (seen > 0 && (delta == 0 || idx < prev))) {
+                err = "history index list is corrupted";
+                break;
+            }
+            out.push(idx);
+            prev = idx;
+            seen++;
+        }
+        if (!err.empty()) break;
+        if (seen == count && p < end) {
+            err = "history index list has trailing bytes";
+            break;
+        }
+        have = static_cast<size_t>(end - p);
+        std::memmove(buf.data(), p, have);
+        if (zrc == Z_STREAM_END) break;
+    }
+    ::inflateEnd(&zs);
+    if (!err.empty()) return err;
+    if (produced != raw_len) return "history decompress failed";
+    if (have != 0 || seen != count) return "history index list is truncated";
+    return "";
+}
+
+std::string decode_elias_fano(const uint8_t* payload, size_t len, uint64_t count, uint64_t n, Batcher& out) {
+    if (len < 1) return "history index list is truncated";
+    const unsigned L = payload[0];
+    if (L > kMaxLowBits) return "history index list is corrupted";
+    if (L && count > (static_cast<uint64_t>(len) * 8) / L) return "history index list is truncated";
+    const size_t low_len = static_cast<size_t>((count * L + 7) / 8);
+    if (1 + low_len > len) return "history index list is truncated";
+    const uint8_t* low = payload + 1;
+    const uint8_t* high = low + low_len;
+    const size_t high_len = len - 1 - low_len;
+    const uint64_t mask = L ? (~uint64_t{0} >> (64 - L)) : 0;
+    const uint64_t max_high = n >> L;
+
+    uint64_t i = 0, prev = 0;
+    for (size_t b = 0; b < high_len; b += 8) {
+        uint64_t w = load_le(high + b, high_len - b);
+        while (w) {
+            if (i == count) return "history index list has trailing bytes";
+            const uint64_t h = static_cast<uint64_t>(b) * 8 + static_cast<uint64_t>(__builtin_ctzll(w)) - i;
+            w &= w - 1;
+            uint64_t lo = 0;
+            if (L) {
+                const uint64_t bit = i * L;
+                const size_t at = static_cast<size_t>(bit >> 3);
+                lo = (load_le(low + at, low_len - at) >> (bit & 7)) & mask;
+            }
+            if (h > max_high) return "history index list is corrupted";
+            const uint64_t idx = (h << L) | lo;
+            if (idx >= n || (i > 0 && idx <= prev)) return "history index list is corrupted";
+            out.push(idx);
+            prev = idx;
+            i++;
+        }
+    }
+    if (i != count) return "history index list is truncated";
+    return "";
+}
+
+std::string decode_runs(const uint8_t* payload, size_t len, uint64_t count, uint64_t n, Batcher& out) {
+    const uint8_t* p = payload;
+    const uint8_t* end = payload + len;
+    uint64_t next = 0, seen = 0;  // next: first index after the previous run
+    while (p < end) {
+        uint64_t gap = 0, run = 0;
+        if (!read_varint(p, end, gap) || !read_varint(p, end, run)) return "history index list is truncated";
+        if (run == 0 || (seen > 0 && gap == 0) || gap > n - next) return "history index list is corrupted";
+        const uint64_t start = next + gap;
+        if (run > n - start || run > count - seen) return "history index list is corrupted";
+        for (uint64_t idx = start; idx < start + run; idx++) out.push(idx);
+        seen += run;
+        next = start + run;
+    }
+    if (seen != count) return "history index list is truncated";
+    return "";
+}
+
+std::string decode_raw(const uint8_t* payload, size_t len, uint64_t count, uint64_t n, Batcher& out) {
+    if (len != (n + 7) / 8) return "history raw length mismatch";
+    uint64_t seen = 0;
+    for (size_t b = 0; b < len; b += 8) {
+        uint64_t w = load_le(payload + b, len - b);
+        while (w) {
+            const uint64_t idx = static_cast<uint64_t>(b) * 8 + static_cast<uint64_t>(__builtin_ctzll(w));
+            w &= w - 1;
+            if (idx >= n || seen == count) return "history index list is corrupted";
+            out.push(idx);
+            seen++;
+        }
+    }
+    if (seen != count) return "history index list is corrupted";
+    return "";
+}
+
+}  // namespace
+
+const char* name(Codec c) {
+    switch (c) {
+        case Codec::Zlib: return "zlib";
+        case Codec::EliasFano: return "eliasfano";
+        case Codec::Runs: return "runs";
+        case Codec::Raw: return "raw";
+    }
+    return "?";
+}
+
+bool parse(const std::string& s, Codec& out) {
+    for (int i = 0; i < kCodecs; i++) {
+        if (s == name(static_cast<Codec>(i))) {
+            out = static_cast<Codec>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t estimated_size(Codec c, uint64_t m, uint64_t n) {
+    if (m > n) m = n;
+    switch (c) {
+        case Codec::Raw:
+            return (n + 7) / 8;
+        case Codec::EliasFano: {
+            const unsigned L = low_bits_for(m, n);
+            return 1 + (m * L + 7) / 8 + (m ? ((n >> L) + m + 7) / 8 : 0);
+        }
+        case Codec::Runs: {
+            if (m == 0) return 0;
+            // A member starts a run when the index before it is unused.
+            const double runs = static_cast<double>(m) * static_cast<double>(n - m) / static_cast<double>(n) + 1;
+            const double gap = static_cast<double>(n - m) / runs;
+            const double run = static_cast<double>(m) / runs;
+            return static_cast<uint64_t>(runs * (varint_len(gap) + varint_len(run)));
+        }
+        case Codec::Zlib: {
+            // zlib gets close to the entropy of the gaps (geometric with p = m/n).
+            if (m == 0) return 8;
+            if (m == n) return 8 + m / 1000;
+            const double p = static_cast<double>(m) / static_cast<double>(n);
+            const double bits = (-(1 - p) * std::log2(1 - p) - p * std::log2(p)) / p;
+            return 8 + static_cast<uint64_t>(static_cast<double>(m) * std::max(bits, 0.01) / 8);
+        }
+    }
+    return UINT64_MAX;
+}
+
+Codec predict(uint64_t m, uint64_t n) {
+    Codec best = Codec::Raw;
+    for (Codec c : {Codec::EliasFano, Codec::Runs}) {
+        if (estimated_size(c, m, n) < estimated_size(best, m, n)) best = c;
+    }
+    return best;
+}
+
+Encoder::Encoder(Codec c, uint64_t n, uint64_t expected, int zlib_level) : codec_(c), n_(n), zlib_level_(zlib_level) {
+    switch (codec_) {
+        case Codec::Zlib:
+            bytes_.reserve(static_cast<size_t>(expected) * 2);
+            break;
+        case Codec::EliasFano:
+            low_bits_ = low_bits_for(expected, n);
+            low_.reserve(static_cast<size_t>(expected * low_bits_ / 64 + 2));
+            high_.reserve(static_cast<size_t>(((n >> low_bits_) + expected) / 64 + 2));
+            break;
+        case Codec::Runs:
+            break;
+        case Codec::Raw:
+            bytes_.assign(static_cast<size_t>((n + 7) / 8), 0);
+            break;
+    }
+}
+
+void Encoder::add(uint64_t idx) {
+    switch (codec_) {
+        case Codec::Zlib:
+            push_varint(bytes_, count_ == 0 ? idx : idx - prev_);
+            break;
+        case Codec::EliasFano: {
+            const unsigned L = low_bits_;
+            if (L) {
+                const uint64_t lo = idx & (~uint64_t{0} >> (64 - L));
+                const uint64_t bit = count_ * L;
+                const size_t w = static_cast<size_t>(bit >> 6);
+                if (low_.size() < w + 2) low_.resize(w + 2, 0);
+                low_[w] |= lo << (bit & 63);
+                if ((bit & 63) + L > 64) low_[w + 1] |= lo >> (64 - (bit & 63));
+            }
+            const uint64_t pos = (idx >> L) + count_;
+            const size_t w = static_cast<size_t>(pos >> 6);
+            if (high_.size() <= w) high_.resize(w + 1, 0);
+            high_[w] |= uint64_t{1} << (pos & 63);
+            break;
+        }
+        case Codec::Runs:
+            if (count_ == 0) {
+                run_gap_ = idx;
+                run_start_ = idx;
+            } else if (idx != prev_ + 1) {
+                push_varint(bytes_, run_gap_);
+                push_varint(bytes_, prev_ - run_start_ + 1);
+                run_gap_ = idx - prev_ - 1;
+                run_start_ = idx;
+            }
+            break;
+        case Codec::Raw:
+            if (idx < n_) bytes_[static_cast<size_t>(idx >> 3)] |= static_cast<uint8_t>(1u << (idx & 7));
+            break;
+    }
+    prev_ = idx;
+    count_++;
+}
+
+std::string Encoder::finish(std::vector<uint8_t>& payload, uint64_t& raw_len) {
+    payload.clear();
+    switch (codec_) {
+        case Codec::Zlib: {
+            raw_len = bytes_.size();
+            uLongf comp_len = ::compressBound(static_cast<uLong>(bytes_.size()));
+            payload.resize(static_cast<size_t>(comp_len));
+            const int zrc = ::compress2(payload.data(), &comp_len, bytes_.data(), static_cast<uLong>(bytes_.size()),
+                                        zlib_level_);
+            if (zrc != Z_OK) return "history compress failed";
+            payload.resize(static_cast<size_t>(comp_len));
+            return "";
+        }
+        case Codec::EliasFano: {
+            const size_t low_len = static_cast<size_t>((count_ * low_bits_ + 7) / 8);
+            const size_t high_len = count_ ? static_cast<size_t>(((prev_ >> low_bits_) + count_ - 1) / 8 + 1) : 0;
+            payload.reserve(1 + low_len + high_len);
+            payload.push_back(static_cast<uint8_t>(low_bits_));
+            append_le(payload, low_, low_len);
+            append_le(payload, high_, high_len);
+            break;
+        }
+        case Codec::Runs:
+            if (count_) {
+                push_varint(bytes_, run_gap_);
+                push_varint(bytes_, prev_ - run_start_ + 1);
+            }
+            payload.swap(bytes_);
+            break;
+        case Codec::Raw:
+            payload.swap(bytes_);
+            break;
+    }
+    raw_len = payload.size();
+    return "";
+}
+
+std::string decode(Codec c, const uint8_t* payload, size_t len, uint64_t raw_len, uint64_t count, uint64_t n,
+                   const std::function<void(const uint64_t*, size_t)>& sink) {
+    Batcher out(sink);
+    std::string err;
+    switch (c) {
+        case Codec::Zlib: err = decode_zlib(payload, len, raw_len, count, n, out); break;
+        case Codec::EliasFano: err = decode_elias_fano(payload, len, count, n, out); break;
+        case Codec::Runs: err = decode_runs(payload, len, count, n, out); break;
+        case Codec::Raw: err = decode_raw(payload, len, count, n, out); break;
+        default: return "history codec unsupported";
+    }
+    if (err.empty()) out.flush();
+    return err;
+}
+
+}  // namespace history_codec
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Payload codecs for the history blob: the sorted used indices of a universe of size n.
+// Which one is smallest depends on the density m/n:
+//   Zlib      varint deltas through zlib (the version-2 payload); smallest when sparse,
+//             but the slowest both ways
+//   EliasFano low bits packed, high bits in unary: about 2 + log2(n/m) bits per member;
+//             best from empty up to roughly a quarter full
+//   Runs      varint (gap, run length) pairs: cost follows the number of unused holes, so
+//             it wins when nearly full
+//   Raw       flat bitset of n bits: the middle, and by far the fastest
+// The codec ID is stored in the blob header; every codec can be read whatever is chosen.
+namespace history_codec {
+
+enum class Codec : uint8_t { Zlib = 0, EliasFano = 1, Runs = 2, Raw = 3 };
+constexpr int kCodecs = 4;
+
+const char* name(Codec c);
+
+// "zlib", "eliasfano", "runs" or "raw". Returns false for anything else.
+bool parse(const std::string& s, Codec& out);
+
+// Expected payload bytes for m members of [0, n), assuming they are spread at random.
+uint64_t estimated_size(Codec c, uint64_t m, uint64_t n);
+
+// The fast codec (EliasFano, Runs or Raw) with the smallest estimated_size().
+Codec predict(uint64_t m, uint64_t n);
+
+// Codec choice for new blobs (HISTORY_CODEC, HISTORY_ZLIB_LEVEL).
+struct Options {
+    bool automatic = true;  // predict() per blob
+    Codec fixed = Codec::EliasFano;
+    int zlib_level = 6;
+
+    Codec choose(uint64_t m, uint64_t n) const { return automatic ? predict(m, n) : fixed; }
+};
+
+// Streaming encoder: add() every member once, in ascending order, then finish().
+// `expected` sizes the Elias-Fano split; the payload stays valid if the actual count
+// differs (the set may gain members while it is being visited).
+class Encoder {
+public:
+    Encoder(Codec c, uint64_t n, uint64_t expected, int zlib_level);
+
+    void add(uint64_t idx);
+    uint64_t count() const { return count_; }
+
+    // Replaces `payload` with the encoded members. `raw_len` is the payload size before
+    // zlib (equal to payload.size() for the other codecs).
+    // Returns empty string on success; otherwise an error message.
+    std::string finish(std::vector<uint8_t>& payload, uint64_t& raw_len);
+
+private:
+    Codec codec_;
+    uint64_t n_;
+    int zlib_level_;
+    uint64_t count_ = 0;
+    uint64_t prev_ = 0;
+    std::vector<uint8_t> bytes_;   // Zlib: varint stream; Runs: pairs; Raw: the bitset
+    std::vector<uint64_t> low_;    // EliasFano: count_ * low_bits_ bits
+    std::vector<uint64_t> high_;   // EliasFano: bit (idx >> low_bits_) + i for member i
+    unsigned low_bits_ = 0;
+    uint64_t run_start_ = 0;       // Runs: current run is [run_start_, prev_]
+    uint64_t run_gap_ = 0;         //       unused indices before it
+};
+
+// Calls sink(batch, k) with the members in ascending order, a few thousand at a time,
+// without materializing the whole list. `count` and `raw_len` come from the blob header.
+// Returns empty string on success; otherwise an error message (some batches may already
+// have been delivered).
+std::string decode(Codec c, const uint8_t* payload, size_t len, uint64_t raw_len, uint64_t count, uint64_t n,
+                   const std::function<void(const uint64_t*, size_t)>& sink);
+
+}  // namespace history_codec
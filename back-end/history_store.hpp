@@ -1,10 +1,31 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
 #include <string>
 #include <vector>
 
+#include "async_http.hpp"
+#include "availability_stats.hpp"
+#include "history_codec.hpp"
+#include "issuance_log.hpp"
+#include "mapped_history.hpp"
+#include "name_index.hpp"
+#include "sharded_used_set.hpp"
+#include "universe_migration.hpp"
+#include "used_set.hpp"
+#include "weighted_sampler.hpp"
+
+class ReplicationPrimary;
+class SharedUsedBits;
+
 // Compressed + base64-encoded "used name" store for global uniqueness across requests.
 //
 // Note: this is NOT encryption. Anyone with access to the backing store can decode it.
@@ -12,10 +33,63 @@
 //
 // Durable persistence options:
 // - If `HISTORY_GIST_ID` + `HISTORY_GITHUB_TOKEN` are set: stores a compressed blob in a GitHub Gist (durable).
+//   `HISTORY_GITHUB_API` points it at another API base (e.g. a stand-in server for testing).
 // - Otherwise: stores a compressed file at `HISTORY_FILE` (ephemeral on many hosts).
+//   With `HISTORY_FORMAT=mapped` the file is an uncompressed bitset that is mmap'd and
+//   updated in place instead (see MappedHistoryFile); existing files of either format are
+//   converted on load.
+// The blob payload codec (see history_codec.hpp) is picked per persist from the density of
+// the used set; `HISTORY_CODEC=zlib|eliasfano|runs|raw` pins one (`HISTORY_ZLIB_LEVEL`
+// sets the zlib level). Blobs in any codec, and the older formats, are always readable.
+//
+// Universe changes: next to the blob, the store keeps a manifest of every universe it has
+// written against (the name lists, in dictionary format, keyed by fingerprint: files under
+// `<history dir>/manifests/`, or extra gist files). A blob whose fingerprint no longer
+// matches the active universe is remapped onto it by name identity instead of rejected.
+//
+// Issuance log: on the file backend every issued name is also appended to
+// `<file>.log` (see IssuanceLog) before the history is persisted, so the store can list
+// what it handed out in a time range. `HISTORY_LOG=off` disables it, and so does prefork
+// mode: create_shared() closes it (workers claim names in the shared bitset, not through
+// this store).
+//
+// Thread safety: all public methods may be called concurrently. Unfiltered, unweighted
+// generation on the file backend runs in parallel (a shared lock on the store, then
+// per-shard locks in ShardedUsedSet, `HISTORY_SHARDS` shards); persisting is a group commit,
+// where one writer covers every request that marked names before it started. Everything
+// else takes the store lock exclusively.
+//
+// Multi-process use (prefork mode): the global store of each worker is attached to a
+// SharedUsedBits segment and never writes the file itself; per-tenant stores take an
+// exclusive flock() on `<file>.lock` and reload the blob around every generate.
+//
+// Replication (see replication.hpp): a primary's store publishes every group commit to a
+// ReplicationPrimary; a replica's store is read-only and fed by a ReplicationReplica.
 class HistoryStore {
 public:
-    explicit HistoryStore(std::string file_path);
+    // Cumulative persistence counters (reported per tenant by TenantRegistry).
+    struct IoStats {
+        uint64_t loads = 0;
+        uint64_t persists = 0;
+        uint64_t bytes_read = 0;
+        uint64_t bytes_written = 0;
+    };
+
+    struct MigrationStats {
+        uint64_t runs = 0;
+        uint64_t old_used = 0;  // indices in the old used set
+        uint64_t dropped = 0;   // old names that no longer exist
+        uint64_t new_used = 0;  // indices in the migrated used set
+        double seconds = 0;
+    };
+
+    // One streaming pass over `from`; `out` receives every index of the new universe whose
+    // full name was used. Thread-safe (touches no store state).
+    static MigrationStats remap_used(const UsedSet& from, const UniverseRemap& remap, UsedSet& out);
+
+    // `allow_remote = false` forces the file backend even when gist credentials are set
+    // (per-tenant stores always live on local disk).
+    explicit HistoryStore(std::string file_path, bool allow_remote = true);
 
     // Returns empty string on success; otherwise an error message.
     std::string init();
@@ -23,9 +97,131 @@ public:
     int remaining_unique() const;
     int total_unique() const;
 
+    // Unused names matching `filter` (not capped at kMaxCount). Scratch memory comes from `mr`.
+    size_t remaining_matching(const NameFilter& filter,
+                              std::pmr::memory_resource* mr = std::pmr::get_default_resource()) const;
+
+    // Name counts from the incrementally kept counters (AvailabilityStats), O(1): overall,
+    // per gender and, for ids other than -1, one first name / surname (NameIndex ids).
+    // In prefork mode only `all` is filled in (from the shared set): the counters follow
+    // this worker's view, which lags behind names other workers issued.
+    struct Availability {
+        AvailabilityStats::Count all;
+        AvailabilityStats::Count gender[2];
+        AvailabilityStats::Count first_name;
+        AvailabilityStats::Count surname;
+        bool per_attribute = true;  // gender, first_name and surname are filled in
+    };
+    Availability availability(int64_t first_id = -1, int64_t surname_id = -1) const;
+
+    using NameList = std::pmr::vector<std::pmr::string>;
+
     // Generates `count` unique names (globally unique across all prior calls),
-    // persists history, and returns empty string on success; otherwise an error.
-    std::string generate_and_mark(int count, std::vector<std::string>& out_names);
+    // restricted to names matching `filter`, persists history, and returns empty
+    // string on success; otherwise an error. The names and all per-call scratch memory
+    // come from `out_names`' resource (the request arena on the HTTP path). With
+    // `out_indices`, also the universe index of each name, in the same order.
+    std::string generate_and_mark(int count, NameList& out_names, const NameFilter& filter = NameFilter{},
+                                  std::pmr::vector<size_t>* out_indices = nullptr);
+    std::string generate_and_mark(int count, std::vector<std::string>& out_names,
+                                  const NameFilter& filter = NameFilter{});
+
+    // One list of a generate_batch() call.
+    struct BatchItem {
+        explicit BatchItem(std::pmr::memory_resource* mr) : error(mr), names(mr), indices(mr) {}
+
+        int count = 0;
+        NameFilter filter;
+        std::pmr::string error;  // set when this item got no names
+        NameList names;
+        std::pmr::vector<size_t> indices;  // universe index of each name
+    };
+
+    // Generates a list for each item in one call: the lists are disjoint, items with the
+    // same filter are drawn in one sampling pass, and the history is persisted once for the
+    // whole batch. An item that cannot be served (bad count, not enough matching names)
+    // gets `error` and no names without affecting the others; items that already have an
+    // error are skipped. Returns empty string unless the batch as a whole failed (store not
+    // ready, persist error); no item has names then. Memory comes from `items`' resource.
+    std::string generate_batch(std::pmr::vector<BatchItem>& items);
+
+    // Gist backend, single process: makes generate_batch_async() persist through `http`
+    // (which must outlive the store) instead of blocking the calling thread on GitHub.
+    // No-op on other backends.
+    void set_async_http(AsyncHttp* http);
+    bool generates_async() const { return async_http_ != nullptr; }
+
+    // Runs on the thread that drives the AsyncHttp, once the batch is done: `err` and
+    // `items` as generate_batch() leaves them. The items' memory is the heap.
+    using BatchDone = std::function<void(const std::string& err, std::pmr::vector<BatchItem>& items)>;
+
+    // generate_batch() without waiting: copies `items` and returns at once. Requests that
+    // arrive while a round is in flight are served together by the next one, which reads the
+    // gist, picks for all of them and writes it back once. Without async persistence this
+    // just calls generate_batch() and then `done`.
+    void generate_batch_async(const std::pmr::vector<BatchItem>& items, BatchDone done);
+
+    // Calls fn(record, name) for every logged issuance with from_ms <= time < to_ms, oldest
+    // first, until it returns false. Names issued under `active` (the active universe when
+    // the caller started) come from it, those under other name lists are resolved through
+    // the universe manifests; `name` is empty when that is not possible.
+    // Returns empty string on success; otherwise an error message.
+    std::string for_each_issued(const namegen::UniversePtr& active, uint64_t from_ms, uint64_t to_ms,
+                                const std::function<bool(const IssuanceLog::Record&, std::string_view name)>& fn);
+    bool has_issuance_log() const { return log_ != nullptr; }
+
+    size_t used_count() const;
+    size_t memory_bytes() const;
+    IoStats io_stats() const;
+    const MigrationStats& last_migration() const { return migration_; }
+    // Mapped format: the pages load_mapped() had to repair, over every load so far.
+    MappedHistoryFile::Repairs page_repairs() const;
+
+    // Hot universe swap, split so the server keeps serving while the bulk of the work runs
+    // on another thread:
+    //   1) begin_universe_swap() snapshots the used set and starts journaling new marks;
+    //   2) the caller remaps the snapshot onto the new universe (UniverseRemap), off-thread;
+    //   3) after activating the new universe, finish_universe_swap() remaps the journal,
+    //      adopts the result and persists it (blob + new manifest).
+    UsedSet begin_universe_swap();
+    std::string finish_universe_swap(UsedSet migrated, MigrationStats stats, const UniverseRemap& remap);
+    void abort_universe_swap();
+
+    // Prefork mode. create_shared() copies the used set into a new shared segment (before
+    // forking) and makes it the source of truth: generate_and_mark then claims names there
+    // and waits for the persister instead of persisting, and there is no issuance log.
+    // persist_shared() is the persister: it writes the shared bits to the file. `out` must
+    // outlive the store.
+    std::string create_shared(std::unique_ptr<SharedUsedBits>& out);
+    std::string persist_shared();
+
+    // File backend only: serialize generate_and_mark across processes sharing the file.
+    void set_multi_process(bool on) { multi_process_ = on; }
+
+    // Replication. set_replica(true) before init() makes the store a replica: every generate
+    // fails and there is no issuance log until promote(), which persists the replicated
+    // state to this store's own file and makes it writable.
+    void set_replica(bool on) { read_only_ = on; }
+    bool read_only() const { return read_only_; }
+    std::string promote();
+
+    // Primary: commit_marks() hands every commit to `repl` (which must outlive the store).
+    // Single-process file backend only. Returns empty string on success; otherwise an error.
+    std::string set_replication(ReplicationPrimary* repl);
+
+    // Primary: the used set as a history blob, and the last commit sequence number it
+    // covers (it may cover later marks too).
+    std::string replication_snapshot(uint64_t& seq, std::vector<uint8_t>& blob) const;
+
+    // Replica: replaces the used set with a snapshot blob / adds one commit's marks. Both
+    // fail when the primary's name lists are not the active ones.
+    std::string replica_load(const std::vector<uint8_t>& blob);
+    std::string replica_apply(const uint64_t* idx, size_t n);
+
+    // Upgrade handoff (see upgrade.hpp): set before init(), which then takes the used set
+    // from the predecessor's snapshot (replication_snapshot()) instead of reading the
+    // backing store. HISTORY_FORMAT=mapped ignores it and maps the file as usual.
+    void set_initial_blob(std::vector<uint8_t> blob) { initial_blob_ = std::move(blob); }
 
 private:
     enum class Backend {
@@ -34,26 +230,114 @@ private:
     };
 
     std::string file_path_;
-    bool ready_ = false;
+    bool allow_remote_ = true;
+    std::atomic<bool> ready_{false};
 
-    std::vector<uint8_t> used_bits_; // bitset over namegen universe indices
-    size_t used_count_ = 0;
+    mutable std::shared_mutex mu_;  // see "Thread safety" above
+    ShardedUsedSet used_;           // set over namegen universe indices
+    AvailabilityStats avail_;       // observes used_; rebuilt by reset_used()
+    size_t shard_count_ = ShardedUsedSet::kDefaultShards;
+    std::unique_ptr<WeightedSampler> weighted_; // built lazily when NAME_WEIGHTS_FILE is set
+    IoStats io_;
+    MigrationStats migration_;
+    MappedHistoryFile::Repairs repairs_;
+    uint64_t manifest_fp_ = 0;       // universe whose manifest is known to be stored
+    bool journaling_ = false;
+    std::vector<uint64_t> journal_;  // indices marked since begin_universe_swap()
+    SharedUsedBits* shared_ = nullptr;  // prefork: used_ is this worker's (stale) view of it
+    bool multi_process_ = false;
+    bool mapped_format_ = false;                 // HISTORY_FORMAT=mapped
+    history_codec::Options codec_;               // HISTORY_CODEC, HISTORY_ZLIB_LEVEL
+    std::unique_ptr<MappedHistoryFile> mapped_;  // open while the file is in that format
+    std::unique_ptr<IssuanceLog> log_;           // file backend unless HISTORY_LOG=off
+    std::atomic<bool> read_only_{false};         // replica until promote()
+    uint64_t replica_fp_ = 0;                    // universe of the last snapshot loaded
+    std::vector<uint8_t> initial_blob_;          // set_initial_blob(), until init()
+    std::atomic<ReplicationPrimary*> repl_{nullptr};
+
+    // Group commit. Marks get increasing sequence numbers; a persist covers every sequence
+    // number handed out before it started.
+    mutable std::mutex pending_mu_;
+    uint64_t mark_seq_ = 0;              // guarded by pending_mu_
+    std::vector<size_t> pending_marks_;  // guarded by pending_mu_ (mapped format only)
+    mutable std::mutex persist_mu_;      // serializes writes; guards the fields below and io_
+    std::vector<size_t> persist_batch_;  // pending marks being written (kept for its capacity)
+    uint64_t attempted_seq_ = 0;
+    uint64_t durable_seq_ = 0;
+    std::string last_persist_error_;
 
     Backend backend_ = Backend::File;
     std::string gist_id_;
     std::string gist_filename_;
     std::string github_token_;
+    std::string github_api_;  // HISTORY_GITHUB_API, default https://api.github.com
+
+    // Async persistence rounds (generate_batch_async). The round fields belong to whoever
+    // set async_busy_: the thread that started the first round, then the AsyncHttp loop.
+    struct AsyncBatch {
+        AsyncBatch();
+        std::pmr::vector<BatchItem> items;
+        std::pmr::vector<std::pmr::vector<size_t>> picks;
+        std::pmr::vector<bool> valid;
+        BatchDone done;
+    };
+    AsyncHttp* async_http_ = nullptr;
+    std::mutex async_mu_;
+    std::vector<std::unique_ptr<AsyncBatch>> async_queue_;  // guarded by async_mu_
+    bool async_busy_ = false;                               // guarded by async_mu_
+    std::vector<std::unique_ptr<AsyncBatch>> async_round_;
+    int async_attempt_ = 0;
+    size_t async_written_ = 0;  // bytes of the PATCH in flight
 
+    // Callers hold mu_ exclusively unless noted.
+    void reset_used(const UsedView& from);
     std::string load_or_init_empty();
+    std::string load_initial_blob();
     std::string persist();
+    std::string persist_locked();  // persist_mu_ held
+    std::string commit_marks(const std::pmr::vector<size_t>& added);  // mu_ held, shared is enough
+    std::string load_mapped();
+    void note_repairs(const MappedHistoryFile::Repairs& r);  // mu_ held
+    std::string open_log();
+    bool can_generate_concurrently(const NameFilter& filter) const;
+    std::string generate_concurrent(int count, NameList& out_names,
+                                    std::pmr::vector<size_t>* out_indices);  // mu_ shared
+    std::string generate_shared(int count, NameList& out_names, const NameFilter& filter,
+                                std::pmr::vector<size_t>* out_indices);
+    // Both replace `picked` with `count` unused names matching `filter` and mark them (in
+    // used_ and the journal, or claimed in the shared bits); nothing is marked on failure.
+    std::string pick_locked(size_t count, const NameFilter& filter, std::mt19937& rng,
+                            std::pmr::vector<size_t>& picked);
+    std::string claim_shared(size_t count, const NameFilter& filter, std::mt19937& rng,
+                             std::pmr::vector<size_t>& picked);
+    // Fills each valid item's slot in `picks` with pick(count, filter, out), drawing each
+    // group of items with the same filter at once. Items that fail get their `error` set.
+    template <class Pick>
+    void pick_batch(std::pmr::vector<BatchItem>& items, std::pmr::vector<std::pmr::vector<size_t>>& picks,
+                    Pick&& pick);
 
     // Common helpers for encoding/compression
     std::string encode_to_blob(std::vector<uint8_t>& out_blob) const;
     std::string decode_from_blob(const std::vector<uint8_t>& blob);
+    std::string migrate_blob(const std::vector<uint8_t>& blob);
+
+    // Universe manifests
+    std::string manifest_path(uint64_t fp) const;
+    std::string read_manifest(uint64_t fp, std::vector<uint8_t>& out);
+    std::string ensure_manifest();
 
     // GitHub Gist helpers
     std::string gist_init();
+    std::string gist_reload();  // mu_ held exclusively
+    std::string gist_apply(std::string content_b64);  // mu_ held exclusively
+    std::string gist_url() const;
+    void async_read();
+    void async_on_read(AsyncHttp::Response& res);
+    void async_on_write(AsyncHttp::Response& res);
+    void async_finish_round(const std::string& err);
     std::string gist_read_content(std::string& out_content_b64);
+    std::string gist_read_file(const std::string& filename, std::string& out_content);
     std::string gist_write_content(const std::string& content_b64);
+    std::string gist_write_file(const std::string& filename, const std::string& content);
 };
 
@@ -10,14 +10,22 @@
 #include <limits>
 #include <random>
 #include <sstream>
+#include <unordered_map>
 
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <curl/curl.h>
 #include <zlib.h>
 
+#include "base64.hpp"
 #include "namegen.hpp"
+#include "replication.hpp"
+#include "shared_used_bits.hpp"
+#include "trace.hpp"
 
 using std::string;
 using std::vector;
@@ -44,7 +52,8 @@ static string read_all_bytes(const string& path, vector<uint8_t>& out) {
 }
 
 static string write_all_bytes_atomic(const string& path, const vector<uint8_t>& bytes) {
-    const string tmp = path + ".tmp";
+    // Per-process temp name: several processes may write the same (manifest) path.
+    const string tmp = path + ".tmp." + std::to_string(::getpid());
     {
         std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
         if (!out) return "could not open temp history file for writing";
@@ -62,6 +71,22 @@ static string write_all_bytes_atomic(const string& path, const vector<uint8_t>&
     return "";
 }
 
+// Exclusive flock() held for the lifetime of the object.
+namespace {
+struct FileLock {
+    int fd = -1;
+    ~FileLock() {
+        if (fd >= 0) ::close(fd);  // releases the lock
+    }
+    string acquire(const string& path) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) return "could not open history lock file: " + string(std::strerror(errno));
+        if (::flock(fd, LOCK_EX) != 0) return "could not lock history file: " + string(std::strerror(errno));
+        return "";
+    }
+};
+}  // namespace
+
 static void mkdirs_for_path(const string& path) {
     auto slash = path.find_last_of('/');
     if (slash == string::npos) return;
@@ -78,12 +103,15 @@ static void mkdirs_for_path(const string& path) {
     }
 }
 
-static bool get_bit(const vector<uint8_t>& bits, size_t i) {
-    return (bits[i / 8] >> (i % 8)) & 1u;
-}
-
-static void set_bit(vector<uint8_t>& bits, size_t i) {
-    bits[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+static void append_names(const std::pmr::vector<size_t>& picked, HistoryStore::NameList& out,
+                         std::pmr::vector<size_t>* out_indices) {
+    Trace::Span span("append_names");
+    if (out_indices) out_indices->insert(out_indices->end(), picked.begin(), picked.end());
+    out.reserve(out.size() + picked.size());
+    for (size_t idx : picked) {
+        out.emplace_back();
+        namegen::append_universe_name(idx, out.back());
+    }
 }
 
 static std::mt19937 seeded_rng() {
@@ -94,87 +122,49 @@ static std::mt19937 seeded_rng() {
     return std::mt19937(seq);
 }
 
-// Minimal base64 (standard alphabet, padding '=')
-static const char* B64_ALPH = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+// One generator per thread, seeded on first use and again after a fork so prefork workers
+// do not share a stream. Seeding per request cost a seed_seq allocation.
+static std::mt19937& thread_rng() {
+    static thread_local std::mt19937 rng;
+    static thread_local pid_t seeded_for = 0;
+    if (seeded_for != ::getpid()) {
+        Trace::Span span("seeded_rng");
+        rng = seeded_rng();
+        seeded_for = ::getpid();
+    }
+    return rng;
+}
 
 static string base64_encode_bytes(const vector<uint8_t>& in) {
+    Trace::Span span("base64_encode");
     string out;
-    out.reserve(((in.size() + 2) / 3) * 4);
-    size_t i = 0;
-    while (i < in.size()) {
-        uint32_t a = in[i++];
-        uint32_t b = (i < in.size()) ? in[i++] : 0;
-        uint32_t c = (i < in.size()) ? in[i++] : 0;
-        uint32_t triple = (a << 16) | (b << 8) | c;
-        out.push_back(B64_ALPH[(triple >> 18) & 0x3F]);
-        out.push_back(B64_ALPH[(triple >> 12) & 0x3F]);
-        out.push_back((i - 1 <= in.size()) ? B64_ALPH[(triple >> 6) & 0x3F] : '=');
-        out.push_back((i <= in.size()) ? B64_ALPH[triple & 0x3F] : '=');
-    }
-    // Fix padding when input length isn't multiple of 3
-    size_t mod = in.size() % 3;
-    if (mod == 1) {
-        out[out.size() - 2] = '=';
-        out[out.size() - 1] = '=';
-    } else if (mod == 2) {
-        out[out.size() - 1] = '=';
-    }
+    base64::encode(in.data(), in.size(), out);
     return out;
 }
 
-static int b64_val(char c) {
-    if (c >= 'A' && c <= 'Z') return c - 'A';
-    if (c >= 'a' && c <= 'z') return 26 + (c - 'a');
-    if (c >= '0' && c <= '9') return 52 + (c - '0');
-    if (c == '+') return 62;
-    if (c == '/') return 63;
-    return -1;
-}
-
-static string base64_decode_bytes(const string& b64, vector<uint8_t>& out) {
-    out.clear();
-    string s;
-    s.reserve(b64.size());
-    for (unsigned char c : b64) {
-        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') continue;
-        s.push_back(static_cast<char>(c));
-    }
-    if (s.size() % 4 != 0) return "invalid base64 length";
-
-    size_t pad = 0;
-    if (!s.empty() && s[s.size() - 1] == '=') pad++;
-    if (s.size() >= 2 && s[s.size() - 2] == '=') pad++;
-
-    out.reserve((s.size() / 4) * 3);
-    for (size_t i = 0; i < s.size(); i += 4) {
-        int v0 = b64_val(s[i]);
-        int v1 = b64_val(s[i + 1]);
-        int v2 = (s[i + 2] == '=') ? 0 : b64_val(s[i + 2]);
-        int v3 = (s[i + 3] == '=') ? 0 : b64_val(s[i + 3]);
-        if (v0 < 0 || v1 < 0 || v2 < 0 || v3 < 0) return "invalid base64 character";
-        uint32_t triple = (static_cast<uint32_t>(v0) << 18) |
-                          (static_cast<uint32_t>(v1) << 12) |
-                          (static_cast<uint32_t>(v2) << 6) |
-                          static_cast<uint32_t>(v3);
-        out.push_back(static_cast<uint8_t>((triple >> 16) & 0xFF));
-        if (s[i + 2] != '=') out.push_back(static_cast<uint8_t>((triple >> 8) & 0xFF));
-        if (s[i + 3] != '=') out.push_back(static_cast<uint8_t>(triple & 0xFF));
-    }
-    return "";
+// Whitespace anywhere in `b64` is skipped.
+static string base64_decode_bytes(std::string_view b64, vector<uint8_t>& out) {
+    Trace::Span span("base64_decode");
+    return base64::decode(b64, out);
 }
 
-static std::string trim_ascii_whitespace(std::string s) {
+static std::string_view trim_ascii_whitespace(std::string_view s) {
     auto is_ws = [](unsigned char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
-    while (!s.empty() && is_ws(static_cast<unsigned char>(s.front()))) s.erase(s.begin());
-    while (!s.empty() && is_ws(static_cast<unsigned char>(s.back()))) s.pop_back();
+    while (!s.empty() && is_ws(static_cast<unsigned char>(s.front()))) s.remove_prefix(1);
+    while (!s.empty() && is_ws(static_cast<unsigned char>(s.back()))) s.remove_suffix(1);
     return s;
 }
 
 static size_t min_history_blob_size() {
+    // Smallest valid blob (version 1):
     // magic(5) + ver(1) + u32 size + u64 fp + u32 raw_len + u32 comp_len + comp bytes
     return 5 + 1 + 4 + 8 + 4 + 4;
 }
 
+// Version 3 blob of `used` for a universe of size `n` (see encode_to_blob).
+static string encode_blob(const UsedView& used, uint64_t n, uint64_t fingerprint,
+                          const history_codec::Options& codec, vector<uint8_t>& out_blob);
+
 // -------------------------
 // Minimal GitHub API helpers (libcurl)
 // -------------------------
@@ -275,6 +265,53 @@ static string gist_extract_file_content(const string& json, const string& filena
     return "";
 }
 
+static vector<string> github_headers(const string& token, const string& if_match_etag) {
+    vector<string> headers = {"Accept: application/vnd.github+json", "Content-Type: application/json"};
+    if (!token.empty()) {
+        // GitHub accepts:
+        // - Classic PATs: "Authorization: token <TOKEN>"
+        // - Fine-grained PATs: "Authorization: Bearer <TOKEN>"
+        // We'll choose based on the token prefix (best-effort).
+        const bool looks_like_classic =
+            (token.rfind("ghp_", 0) == 0) || (token.rfind("gho_", 0) == 0) ||
+            (token.rfind("ghu_", 0) == 0) || (token.rfind("ghs_", 0) == 0) ||
+            (token.rfind("ghr_", 0) == 0);
+        headers.push_back(looks_like_classic ? ("Authorization: token " + token) : ("Authorization: Bearer " + token));
+    }
+    if (!if_match_etag.empty()) headers.push_back("If-Match: " + if_match_etag);
+    return headers;
+}
+
+// The file's content from a gist GET response.
+static string gist_get_result(long status, const string& body, const string& filename, string& out_content) {
+    out_content.clear();
+    if (status == 404) return "gist not found (check HISTORY_GIST_ID)";
+    if (status < 200 || status >= 300) {
+        std::ostringstream ss;
+        ss << "gist GET failed (HTTP " << status << ")";
+        return ss.str();
+    }
+    return gist_extract_file_content(body, filename, out_content);
+}
+
+static string gist_patch_body(const string& filename, const string& content) {
+    std::ostringstream body;
+    body << "{\"files\":{\"" << json_escape(filename) << "\":{\"content\":\""
+         << json_escape(content) << "\"}}}";
+    return body.str();
+}
+
+static string gist_patch_result(long status, const string& body) {
+    if (status >= 200 && status < 300) return "";
+    std::ostringstream ss;
+    ss << "gist PATCH failed (HTTP " << status << ")";
+    if (!body.empty()) {
+        // Include some response body for debugging (it's GitHub error JSON).
+        ss << ": " << body.substr(0, 500);
+    }
+    return ss.str();
+}
+
 static string http_request(
     const string& method,
     const string& url,
@@ -297,22 +334,7 @@ static string http_request(
     curl_easy_setopt(c, CURLOPT_TIMEOUT, 20L);
 
     struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "Accept: application/vnd.github+json");
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    if (!token.empty()) {
-        // GitHub accepts:
-        // - Classic PATs: "Authorization: token <TOKEN>"
-        // - Fine-grained PATs: "Authorization: Bearer <TOKEN>"
-        // We'll choose based on the token prefix (best-effort).
-        const bool looks_like_classic =
-            (token.rfind("ghp_", 0) == 0) || (token.rfind("gho_", 0) == 0) ||
-            (token.rfind("ghu_", 0) == 0) || (token.rfind("ghs_", 0) == 0) ||
-            (token.rfind("ghr_", 0) == 0);
-        const string auth = looks_like_classic ? ("Authorization: token " + token)
-                                               : ("Authorization: Bearer " + token);
-        headers = curl_slist_append(headers, auth.c_str());
-    }
-    if (!if_match_etag.empty()) headers = curl_slist_append(headers, ("If-Match: " + if_match_etag).c_str());
+    for (const auto& h : github_headers(token, if_match_etag)) headers = curl_slist_append(headers, h.c_str());
     curl_easy_setopt(c, CURLOPT_HTTPHEADER, headers);
 
     if (!body.empty()) {
@@ -320,7 +342,11 @@ static string http_request(
         curl_easy_setopt(c, CURLOPT_POSTFIELDSIZE, static_cast<long>(body.size()));
     }
 
-    CURLcode rc = curl_easy_perform(c);
+    CURLcode rc;
+    {
+        Trace::Span span("curl");
+        rc = curl_easy_perform(c);
+    }
     if (rc != CURLE_OK) {
         string err = curl_easy_strerror(rc);
         curl_slist_free_all(headers);
@@ -337,142 +363,458 @@ static string http_request(
 // -------------------------
 // HistoryStore
 // -------------------------
-HistoryStore::HistoryStore(std::string file_path) : file_path_(std::move(file_path)) {}
+HistoryStore::HistoryStore(std::string file_path, bool allow_remote)
+    : file_path_(std::move(file_path)), allow_remote_(allow_remote) {
+    used_.set_observer(&avail_);
+}
 
 std::string HistoryStore::init() {
+    std::unique_lock<std::shared_mutex> lk(mu_);
     curl_global_init(CURL_GLOBAL_DEFAULT);
 
     const char* gist = std::getenv("HISTORY_GIST_ID");
     const char* tok = std::getenv("HISTORY_GITHUB_TOKEN");
-    if (gist && *gist && tok && *tok) {
+    if (allow_remote_ && gist && *gist && tok && *tok) {
         backend_ = Backend::GitHubGist;
         gist_id_ = gist;
         github_token_ = tok;
         const char* fn = std::getenv("HISTORY_GIST_FILENAME");
         gist_filename_ = (fn && *fn) ? std::string(fn) : std::string("history.bin.b64");
+        const char* api = std::getenv("HISTORY_GITHUB_API");
+        github_api_ = (api && *api) ? std::string(api) : std::string("https://api.github.com");
         auto gerr = gist_init();
         if (!gerr.empty()) return gerr;
     } else {
         backend_ = Backend::File;
     }
 
-    auto err = load_or_init_empty();
+    if (const char* v = std::getenv("HISTORY_SHARDS"); v && std::atoi(v) > 0) {
+        shard_count_ = static_cast<size_t>(std::atoi(v));
+    }
+
+    if (const char* v = std::getenv("HISTORY_CODEC"); v && *v && string(v) != "auto") {
+        if (!history_codec::parse(v, codec_.fixed)) {
+            return "HISTORY_CODEC must be 'auto', 'zlib', 'eliasfano', 'runs' or 'raw'";
+        }
+        codec_.automatic = false;
+    }
+    if (const char* lvl = std::getenv("HISTORY_ZLIB_LEVEL"); lvl && *lvl) {
+        int v = std::atoi(lvl);
+        if (v >= 1 && v <= 9) codec_.zlib_level = v;
+    }
+
+    if (const char* fmt = std::getenv("HISTORY_FORMAT"); fmt && *fmt) {
+        const string f = fmt;
+        if (f == "mapped") {
+            if (backend_ != Backend::File) return "HISTORY_FORMAT=mapped needs the file backend";
+            if (namegen::universe_size() > MappedHistoryFile::kMaxUniverse) {
+                return "universe too large for HISTORY_FORMAT=mapped";
+            }
+            mapped_format_ = true;
+        } else if (f != "blob") {
+            return "HISTORY_FORMAT must be 'blob' or 'mapped'";
+        }
+    }
+
+    if (read_only_ && backend_ != Backend::File) return "a replica needs the file backend";
+
+    auto err = initial_blob_.empty() || mapped_format_ ? load_or_init_empty() : load_initial_blob();
     if (!err.empty()) return err;
 
+    if (!read_only_) {
+        auto lerr = open_log();
+        if (!lerr.empty()) return lerr;
+    }
+
     ready_ = true;
     return "";
 }
 
+std::string HistoryStore::open_log() {
+    const char* log_env = std::getenv("HISTORY_LOG");
+    if (backend_ != Backend::File || (log_env && string(log_env) == "off")) return "";
+    mkdirs_for_path(file_path_);
+    return IssuanceLog::open(file_path_ + ".log", log_);
+}
+
 int HistoryStore::total_unique() const {
     const auto n = namegen::universe_size();
     if (n > static_cast<size_t>(std::numeric_limits<int>::max())) return std::numeric_limits<int>::max();
     return static_cast<int>(n);
 }
 
+size_t HistoryStore::used_count() const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    return shared_ ? static_cast<size_t>(shared_->count()) : used_.size();
+}
+
+size_t HistoryStore::memory_bytes() const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    return used_.memory_bytes();
+}
+
+HistoryStore::IoStats HistoryStore::io_stats() const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    std::lock_guard<std::mutex> pl(persist_mu_);
+    return io_;
+}
+
 int HistoryStore::remaining_unique() const {
     if (!ready_) return 0;
     const size_t n = namegen::universe_size();
-    const size_t remaining = (used_count_ > n) ? 0 : (n - used_count_);
+    const size_t used = used_count();
+    const size_t remaining = (used > n) ? 0 : (n - used);
     const size_t cap = static_cast<size_t>(namegen::kMaxCount);
     const size_t r = remaining < cap ? remaining : cap;
     if (r > static_cast<size_t>(std::numeric_limits<int>::max())) return std::numeric_limits<int>::max();
     return static_cast<int>(r);
 }
 
+size_t HistoryStore::remaining_matching(const NameFilter& filter, std::pmr::memory_resource* mr) const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    if (!ready_) return 0;
+    if (shared_) return NameIndex::instance().count_remaining(filter, *shared_, mr);
+    return NameIndex::instance().count_remaining(filter, used_, mr);
+}
+
+HistoryStore::Availability HistoryStore::availability(int64_t first_id, int64_t surname_id) const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    Availability a;
+    if (!ready_) return a;
+    a.all = avail_.all();
+    if (shared_) {
+        const uint64_t used = shared_->count();
+        a.all.remaining = used < a.all.total ? a.all.total - used : 0;
+        a.per_attribute = false;
+        return a;
+    }
+    for (int g = 0; g < 2; g++) a.gender[g] = avail_.gender(g);
+    if (first_id >= 0) a.first_name = avail_.first_name(static_cast<uint32_t>(first_id));
+    if (surname_id >= 0) a.surname = avail_.surname(static_cast<uint32_t>(surname_id));
+    return a;
+}
+
+void HistoryStore::reset_used(const UsedView& from) {
+    used_.assign(namegen::universe_size(), shard_count_, from);
+    avail_.rebuild(used_);
+    weighted_.reset();
+}
+
 std::string HistoryStore::load_or_init_empty() {
-    const size_t n = namegen::universe_size();
-    used_bits_.assign((n + 7) / 8, 0);
-    used_count_ = 0;
+    reset_used(UsedSet{});
 
     vector<uint8_t> blob;
     if (backend_ == Backend::File) {
         if (!file_exists(file_path_)) return persist();
+        if (MappedHistoryFile::is_mapped_file(file_path_)) return load_mapped();
         auto rerr = read_all_bytes(file_path_, blob);
         if (!rerr.empty()) return rerr;
+        io_.loads++;
+        io_.bytes_read += blob.size();
     } else {
         std::string content_b64;
         auto rerr = gist_read_content(content_b64);
         if (!rerr.empty()) return rerr;
-        content_b64 = trim_ascii_whitespace(content_b64);
-        if (content_b64.empty() || content_b64 == "init") return persist();
-        auto derr = base64_decode_bytes(content_b64, blob);
+        io_.loads++;
+        io_.bytes_read += content_b64.size();
+        const std::string_view trimmed = trim_ascii_whitespace(content_b64);
+        if (trimmed.empty() || trimmed == "init") return persist();
+        auto derr = base64_decode_bytes(trimmed, blob);
         if (!derr.empty()) return derr;
         // If the gist contained something like "init" (which is valid-ish base64) or otherwise
         // tiny junk, treat it as "uninitialized" and overwrite with a real encrypted blob.
         if (blob.size() < min_history_blob_size()) return persist();
     }
-    return decode_from_blob(blob);
+    const uint64_t runs = migration_.runs;
+    auto derr = decode_from_blob(blob);
+    if (!derr.empty()) return derr;
+    // Store the migrated (or, for HISTORY_FORMAT=mapped, converted) history right away
+    // rather than on the next generate.
+    if (migration_.runs != runs || mapped_format_) return persist();
+    return "";
+}
+
+std::string HistoryStore::load_initial_blob() {
+    reset_used(UsedSet{});
+    vector<uint8_t> blob;
+    blob.swap(initial_blob_);
+    const uint64_t runs = migration_.runs;
+    auto derr = decode_from_blob(blob);
+    if (!derr.empty()) return derr;
+    // The predecessor persisted everything it issued before handing over; only a
+    // migration onto other name lists has something new to store.
+    if (migration_.runs != runs) return persist();
+    return "";
+}
+
+void HistoryStore::note_repairs(const MappedHistoryFile::Repairs& r) {
+    repairs_.pages.insert(repairs_.pages.end(), r.pages.begin(), r.pages.end());
+    repairs_.had_names += r.had_names;
+}
+
+MappedHistoryFile::Repairs HistoryStore::page_repairs() const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    return repairs_;
+}
+
+std::string HistoryStore::load_mapped() {
+    std::unique_ptr<MappedHistoryFile> f;
+    auto oerr = MappedHistoryFile::open(file_path_, f);
+    if (!oerr.empty()) return oerr;
+    io_.loads++;
+
+    const size_t n = namegen::universe_size();
+    if (f->universe_size() == n && f->fingerprint() == namegen::universe_fingerprint()) {
+        UsedSet loaded;
+        note_repairs(f->load_into(loaded));
+        reset_used(loaded);
+        if (mapped_format_) {
+            mapped_ = std::move(f);
+            return "";
+        }
+        mapped_.reset();
+        return persist();  // back to the blob format
+    }
+
+    // Written against other name lists: go through the blob migration path.
+    UsedSet old;
+    note_repairs(f->load_into(old));
+    vector<uint8_t> blob;
+    auto eerr = encode_blob(old, f->universe_size(), f->fingerprint(), codec_, blob);
+    if (!eerr.empty()) return eerr;
+    f.reset();
+    mapped_.reset();
+    auto merr = migrate_blob(blob);
+    if (!merr.empty()) return merr;
+    return persist();
 }
 
+// Full persist; also covers every pending mark.
 std::string HistoryStore::persist() {
+    std::lock_guard<std::mutex> pl(persist_mu_);
+    uint64_t covers = 0;
+    {
+        std::lock_guard<std::mutex> lk(pending_mu_);
+        pending_marks_.clear();
+        covers = mark_seq_;
+    }
+    auto err = log_ ? log_->flush(mapped_format_) : string();
+    if (err.empty()) err = persist_locked();
+    attempted_seq_ = covers;
+    if (err.empty()) durable_seq_ = covers;
+    else last_persist_error_ = err;
+    return err;
+}
+
+std::string HistoryStore::persist_locked() {
+    Trace::Span span("persist");
+    if (mapped_format_) {
+        const uint64_t n = namegen::universe_size();
+        const uint64_t fp = namegen::universe_fingerprint();
+        size_t synced = 0;
+        string err;
+        io_.persists++;
+        if (mapped_ && mapped_->universe_size() == n && mapped_->fingerprint() == fp) {
+            err = mapped_->store(used_, synced);
+        } else {
+            mkdirs_for_path(file_path_);
+            mapped_.reset();
+            err = MappedHistoryFile::create(file_path_, n, fp, used_, mapped_);
+            synced = static_cast<size_t>((n + 7) / 8);
+        }
+        if (!err.empty()) return err;
+        io_.bytes_written += synced;
+        (void)ensure_manifest();
+        return "";
+    }
+
     vector<uint8_t> blob;
     auto eerr = encode_to_blob(blob);
     if (!eerr.empty()) return eerr;
 
+    io_.persists++;
+    string err;
     if (backend_ == Backend::File) {
         mkdirs_for_path(file_path_);
-        return write_all_bytes_atomic(file_path_, blob);
+        io_.bytes_written += blob.size();
+        err = write_all_bytes_atomic(file_path_, blob);
+    } else {
+        const string content_b64 = base64_encode_bytes(blob);
+        io_.bytes_written += content_b64.size();
+        err = gist_write_content(content_b64);
     }
-    return gist_write_content(base64_encode_bytes(blob));
+    if (!err.empty()) return err;
+    (void)ensure_manifest();
+    return "";
 }
 
-std::string HistoryStore::generate_and_mark(int count, std::vector<std::string>& out_names) {
+// Makes `added` (already in used_) durable. Whoever gets persist_mu_ first writes on behalf
+// of every request that marked names before it, so under load most callers find their
+// marks already persisted and return without any I/O. With the mapped format only the
+// touched pages are written.
+std::string HistoryStore::commit_marks(const std::pmr::vector<size_t>& added) {
+    Trace::Span span("commit_marks");
+    uint64_t ticket = 0;
+    {
+        std::lock_guard<std::mutex> lk(pending_mu_);
+        if (mapped_) pending_marks_.insert(pending_marks_.end(), added.begin(), added.end());
+        if (log_ && !multi_process_) {
+            const auto now = std::chrono::system_clock::now().time_since_epoch();
+            log_->append(added.data(), added.size(),
+                         static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count()),
+                         namegen::universe_fingerprint());
+        }
+        ticket = ++mark_seq_;
+        if (auto* repl = repl_.load(std::memory_order_acquire)) repl->publish(ticket, added.data(), added.size());
+    }
+
+    std::lock_guard<std::mutex> pl(persist_mu_);
+    if (ticket <= durable_seq_) return "";
+    if (ticket <= attempted_seq_) return last_persist_error_;
+
+    uint64_t covers = 0;
+    {
+        std::lock_guard<std::mutex> lk(pending_mu_);
+        persist_batch_.swap(pending_marks_);
+        covers = mark_seq_;
+    }
+    // The log goes first: a crash in between leaves a record of a name that was never
+    // handed out, rather than a handed-out name with no record.
+    string err;
+    if (log_) {
+        Trace::Span log_span("log_flush");
+        err = log_->flush(mapped_format_);
+    }
+    if (!err.empty()) {
+        std::lock_guard<std::mutex> lk(pending_mu_);
+        pending_marks_.insert(pending_marks_.end(), persist_batch_.begin(), persist_batch_.end());
+        persist_batch_.clear();
+    } else if (mapped_) {
+        size_t synced = 0;
+        io_.persists++;
+        Trace::Span mark_span("mapped_mark");
+        err = mapped_->mark(persist_batch_, synced);
+        io_.bytes_written += synced;
+        if (err.empty()) {
+            (void)ensure_manifest();
+        } else {
+            std::lock_guard<std::mutex> lk(pending_mu_);
+            pending_marks_.insert(pending_marks_.end(), persist_batch_.begin(), persist_batch_.end());
+        }
+        persist_batch_.clear();
+    } else {
+        err = persist_locked();
+    }
+    attempted_seq_ = covers;
+    if (err.empty()) durable_seq_ = covers;
+    else last_persist_error_ = err;
+    return err;
+}
+
+std::string HistoryStore::for_each_issued(
+    const namegen::UniversePtr& active, uint64_t from_ms, uint64_t to_ms,
+    const std::function<bool(const IssuanceLog::Record&, std::string_view name)>& fn) {
+    if (!log_) return "the issuance log is off (file backend only, single process; HISTORY_LOG=off disables it)";
+    // Universes by fingerprint, looked up on first use.
+    std::unordered_map<uint64_t, namegen::UniversePtr> universes;
+    string name;
+    return log_->scan(from_ms, to_ms, [&](const IssuanceLog::Record& r) {
+        namegen::UniversePtr& u = universes[r.fingerprint];
+        if (!u) {
+            vector<uint8_t> manifest;
+            if (namegen::fingerprint_of(*active) == r.fingerprint) {
+                u = active;
+            } else if (read_manifest(r.fingerprint, manifest).empty()) {
+                (void)namegen::open_dictionary_bytes(std::move(manifest), "history manifest", u);
+            }
+        }
+        name.clear();
+        if (u && r.fingerprint == namegen::fingerprint_of(*u) && r.idx < namegen::size_of(*u)) {
+            name = namegen::full_name_of(*u, static_cast<size_t>(r.idx));
+        }
+        return fn(r, name);
+    });
+}
+
+bool HistoryStore::can_generate_concurrently(const NameFilter& filter) const {
+    return filter.any() && !filter.distinct() && !NameWeights::active() && backend_ == Backend::File && !shared_ &&
+           !multi_process_ && !journaling_;
+}
+
+std::string HistoryStore::generate_concurrent(int count, NameList& out_names, std::pmr::vector<size_t>* out_indices) {
+    auto& rng = thread_rng();
+    std::pmr::vector<size_t> picked(out_names.get_allocator().resource());
+    bool sampled;
+    {
+        Trace::Span span("sample_and_mark");
+        sampled = used_.sample_and_mark(static_cast<size_t>(count), rng, picked);
+    }
+    if (!sampled) {
+        const size_t n = namegen::universe_size();
+        const size_t used = used_.size();
+        std::ostringstream ss;
+        ss << "not enough unused names remaining (" << (used > n ? 0 : n - used) << " left)";
+        return ss.str();
+    }
+    auto perr = commit_marks(picked);
+    if (!perr.empty()) return perr;
+
+    append_names(picked, out_names, out_indices);
+    return "";
+}
+
+std::string HistoryStore::generate_and_mark(int count, std::vector<std::string>& out_names,
+                                            const NameFilter& filter) {
+    NameList names;
+    auto err = generate_and_mark(count, names, filter);
+    out_names.assign(names.begin(), names.end());
+    return err;
+}
+
+std::string HistoryStore::generate_and_mark(int count, NameList& out_names, const NameFilter& filter,
+                                            std::pmr::vector<size_t>* out_indices) {
     out_names.clear();
-    if (!ready_) return "history store not initialized";
+    if (out_indices) out_indices->clear();
     if (count <= 0) return "count must be >= 1";
     if (count > namegen::kMaxCount) return "count too large";
+    if (read_only_) return "read-only replica";
+    {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        if (!ready_) return "history store not initialized";
+        if (can_generate_concurrently(filter)) return generate_concurrent(count, out_names, out_indices);
+    }
+
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    if (shared_) return generate_shared(count, out_names, filter, out_indices);
+
+    // Another process may have written the file since we loaded it.
+    FileLock lock;
+    if (multi_process_ && backend_ == Backend::File) {
+        mkdirs_for_path(file_path_);
+        auto lerr = lock.acquire(file_path_ + ".lock");
+        if (!lerr.empty()) return lerr;
+        auto rerr = load_or_init_empty();
+        if (!rerr.empty()) return rerr;
+    }
 
     for (int attempt = 0; attempt < 3; attempt++) {
         if (backend_ == Backend::GitHubGist) {
-            std::string content_b64;
-            auto rerr = gist_read_content(content_b64);
+            auto rerr = gist_reload();
             if (!rerr.empty()) return rerr;
-            content_b64 = trim_ascii_whitespace(content_b64);
-            if (content_b64.empty() || content_b64 == "init") {
-                // Treat as brand-new history
-                used_bits_.assign((namegen::universe_size() + 7) / 8, 0);
-                used_count_ = 0;
-            } else {
-                vector<uint8_t> blob;
-                auto derr = base64_decode_bytes(content_b64, blob);
-                if (!derr.empty()) return derr;
-                if (blob.size() < min_history_blob_size()) {
-                    used_bits_.assign((namegen::universe_size() + 7) / 8, 0);
-                    used_count_ = 0;
-                } else {
-                auto uerr = decode_from_blob(blob);
-                if (!uerr.empty()) return uerr;
-                }
-            }
-        }
-
-        const size_t n = namegen::universe_size();
-        const size_t remaining = (used_count_ > n) ? 0 : (n - used_count_);
-        if (static_cast<size_t>(count) > remaining) {
-            std::ostringstream ss;
-            ss << "not enough unused names remaining (" << remaining << " left)";
-            return ss.str();
         }
 
-        std::vector<size_t> unused;
-        unused.reserve(remaining);
-        for (size_t i = 0; i < n; i++) if (!get_bit(used_bits_, i)) unused.push_back(i);
-        auto rng = seeded_rng();
-        std::shuffle(unused.begin(), unused.end(), rng);
+        std::pmr::vector<size_t> picked(out_names.get_allocator().resource());
+        auto serr = pick_locked(static_cast<size_t>(count), filter, thread_rng(), picked);
+        if (!serr.empty()) return serr;
 
-        out_names.reserve(static_cast<size_t>(count));
-        for (int i = 0; i < count; i++) {
-            size_t idx = unused[static_cast<size_t>(i)];
-            out_names.push_back(namegen::universe_name_at(idx));
-            set_bit(used_bits_, idx);
-        }
-        used_count_ += static_cast<size_t>(count);
+        append_names(picked, out_names, out_indices);
 
-        auto perr = persist();
+        auto perr = commit_marks(picked);
         if (perr.empty()) return "";
 
         if (perr.find("precondition failed") != std::string::npos || perr.find("412") != std::string::npos) {
             out_names.clear();
+            if (out_indices) out_indices->clear();
             continue;
         }
         return perr;
@@ -481,111 +823,888 @@ std::string HistoryStore::generate_and_mark(int count, std::vector<std::string>&
     return "could not persist history (concurrent updates); please retry";
 }
 
+static bool same_filter(const NameFilter& a, const NameFilter& b) {
+    return a.gender == b.gender && a.initial == b.initial && a.surname == b.surname &&
+           a.distinct_first == b.distinct_first && a.distinct_last == b.distinct_last;
+}
+
+template <class Pick>
+void HistoryStore::pick_batch(std::pmr::vector<BatchItem>& items, std::pmr::vector<std::pmr::vector<size_t>>& picks,
+                              Pick&& pick) {
+    std::pmr::memory_resource* mr = items.get_allocator().resource();
+    std::pmr::vector<bool> done(items.size(), false, mr);
+    std::pmr::vector<size_t> group(mr);
+    std::pmr::vector<size_t> drawn(mr);
+    for (size_t first = 0; first < items.size(); first++) {
+        if (done[first] || !items[first].error.empty()) continue;
+        group.clear();
+        size_t total = 0;
+        for (size_t i = first; i < items.size(); i++) {
+            if (done[i] || !items[i].error.empty() || !same_filter(items[i].filter, items[first].filter)) continue;
+            done[i] = true;
+            group.push_back(i);
+            total += static_cast<size_t>(items[i].count);
+        }
+        // The draw is in random order, so consecutive runs of it are independent samples.
+        if (pick(total, items[first].filter, drawn).empty()) {
+            size_t at = 0;
+            for (size_t i : group) {
+                const size_t n = static_cast<size_t>(items[i].count);
+                picks[i].assign(drawn.begin() + static_cast<std::ptrdiff_t>(at),
+                                drawn.begin() + static_cast<std::ptrdiff_t>(at + n));
+                at += n;
+            }
+            continue;
+        }
+        // Not enough for the whole group: serve its items one by one, in order.
+        for (size_t i : group) {
+            auto err = pick(static_cast<size_t>(items[i].count), items[i].filter, picks[i]);
+            if (!err.empty()) items[i].error = err;
+        }
+    }
+}
+
+// Re-reads the used set from the gist; the remote copy is the source of truth.
+std::string HistoryStore::gist_reload() {
+    std::string content_b64;
+    auto rerr = gist_read_content(content_b64);
+    if (!rerr.empty()) return rerr;
+    return gist_apply(std::move(content_b64));
+}
+
+std::string HistoryStore::gist_apply(std::string content_b64) {
+    io_.loads++;
+    io_.bytes_read += content_b64.size();
+    const std::string_view trimmed = trim_ascii_whitespace(content_b64);
+    if (trimmed.empty() || trimmed == "init") {
+        // Treat as brand-new history
+        reset_used(UsedSet{});
+        return "";
+    }
+    vector<uint8_t> blob;
+    auto derr = base64_decode_bytes(trimmed, blob);
+    if (!derr.empty()) return derr;
+    if (blob.size() < min_history_blob_size()) {
+        reset_used(UsedSet{});
+        return "";
+    }
+    return decode_from_blob(blob);
+}
+
+// Clears the names, sets the error of items with a bad count, and marks the items left to
+// serve in `valid`.
+static void validate_batch(std::pmr::vector<HistoryStore::BatchItem>& items, std::pmr::vector<bool>& valid) {
+    valid.assign(items.size(), false);
+    for (size_t i = 0; i < items.size(); i++) {
+        HistoryStore::BatchItem& item = items[i];
+        item.names.clear();
+        item.indices.clear();
+        if (!item.error.empty()) continue;
+        if (item.count <= 0) item.error = "count must be >= 1";
+        else if (item.count > namegen::kMaxCount) item.error = "count too large";
+        valid[i] = item.error.empty();
+    }
+}
+
+std::string HistoryStore::generate_batch(std::pmr::vector<BatchItem>& items) {
+    std::pmr::memory_resource* mr = items.get_allocator().resource();
+    std::pmr::vector<bool> valid(mr);
+    validate_batch(items, valid);
+    std::pmr::vector<std::pmr::vector<size_t>> picks(items.size(), mr);
+    std::pmr::vector<size_t> all(mr);
+    auto& rng = thread_rng();
+
+    // Collects every item's picks into `all` for the one commit.
+    auto gather = [&]() {
+        all.clear();
+        for (const auto& p : picks) all.insert(all.end(), p.begin(), p.end());
+    };
+    auto finish = [&]() {
+        for (size_t i = 0; i < items.size(); i++) append_names(picks[i], items[i].names, &items[i].indices);
+    };
+
+    if (read_only_) return "read-only replica";
+    {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        if (!ready_) return "history store not initialized";
+        bool concurrent = true;
+        for (const BatchItem& item : items) {
+            if (item.error.empty() && !can_generate_concurrently(item.filter)) concurrent = false;
+        }
+        if (concurrent) {
+            pick_batch(items, picks, [&](size_t n, const NameFilter&, std::pmr::vector<size_t>& out) -> string {
+                Trace::Span span("sample_and_mark");
+                if (used_.sample_and_mark(n, rng, out)) return "";
+                const size_t size = namegen::universe_size();
+                const size_t used = used_.size();
+                std::ostringstream ss;
+                ss << "not enough unused names remaining (" << (used > size ? 0 : size - used) << " left)";
+                return ss.str();
+            });
+            gather();
+            if (all.empty()) return "";
+            auto perr = commit_marks(all);
+            if (!perr.empty()) return perr;
+            finish();
+            return "";
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    if (shared_) {
+        pick_batch(items, picks, [&](size_t n, const NameFilter& filter, std::pmr::vector<size_t>& out) {
+            return claim_shared(n, filter, rng, out);
+        });
+        string derr;
+        {
+            Trace::Span span("wait_durable");
+            derr = shared_->wait_durable();
+        }
+        if (!derr.empty()) return derr;
+        io_.persists++;
+        finish();
+        return "";
+    }
+
+    FileLock lock;
+    if (multi_process_ && backend_ == Backend::File) {
+        mkdirs_for_path(file_path_);
+        auto lerr = lock.acquire(file_path_ + ".lock");
+        if (!lerr.empty()) return lerr;
+        auto rerr = load_or_init_empty();
+        if (!rerr.empty()) return rerr;
+    }
+
+    for (int attempt = 0; attempt < 3; attempt++) {
+        if (backend_ == Backend::GitHubGist) {
+            auto gerr = gist_reload();
+            if (!gerr.empty()) return gerr;
+        }
+        // An earlier attempt's picks and errors are redone against the reloaded history.
+        for (size_t i = 0; i < items.size(); i++) {
+            picks[i].clear();
+            if (valid[i]) items[i].error.clear();
+        }
+        pick_batch(items, picks, [&](size_t n, const NameFilter& filter, std::pmr::vector<size_t>& out) {
+            return pick_locked(n, filter, rng, out);
+        });
+        gather();
+        if (all.empty()) return "";
+
+        auto perr = commit_marks(all);
+        if (perr.empty()) {
+            finish();
+            return "";
+        }
+        if (perr.find("precondition failed") == std::string::npos && perr.find("412") == std::string::npos) return perr;
+    }
+
+    return "could not persist history (concurrent updates); please retry";
+}
+
+// -------------------------
+// Async gist persistence
+// -------------------------
+// A round is: GET the gist (the remote copy is the source of truth, as in gist_reload),
+// pick for every queued batch under a brief exclusive lock, PATCH the gist once, then run
+// each batch's continuation. The store lock is never held across a request, and no thread
+// waits on GitHub: the HTTP legs run on the AsyncHttp loop and the round continues from
+// their completions. A failed PATCH fails the whole round, like a failed commit_marks().
+HistoryStore::AsyncBatch::AsyncBatch()
+    : items(std::pmr::new_delete_resource()),
+      picks(std::pmr::new_delete_resource()),
+      valid(std::pmr::new_delete_resource()) {}
+
+void HistoryStore::set_async_http(AsyncHttp* http) {
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    async_http_ = backend_ == Backend::GitHubGist && !shared_ ? http : nullptr;
+}
+
+void HistoryStore::generate_batch_async(const std::pmr::vector<BatchItem>& items, BatchDone done) {
+    auto batch = std::make_unique<AsyncBatch>();
+    std::pmr::memory_resource* mr = batch->items.get_allocator().resource();
+    batch->items.reserve(items.size());
+    for (const BatchItem& item : items) {
+        BatchItem& copy = batch->items.emplace_back(mr);
+        copy.count = item.count;
+        copy.filter = item.filter;
+        copy.error = item.error;
+    }
+    batch->done = std::move(done);
+    if (!async_http_) {
+        const string err = generate_batch(batch->items);
+        batch->done(err, batch->items);
+        return;
+    }
+    validate_batch(batch->items, batch->valid);
+    if (!ready_) {
+        batch->done("history store not initialized", batch->items);
+        return;
+    }
+
+    bool start = false;
+    {
+        std::lock_guard<std::mutex> lk(async_mu_);
+        async_queue_.push_back(std::move(batch));
+        start = !async_busy_;
+        async_busy_ = true;
+        if (start) async_round_.swap(async_queue_);
+    }
+    if (start) {
+        async_attempt_ = 0;
+        async_read();
+    }
+}
+
+void HistoryStore::async_read() {
+    AsyncHttp::Request req;
+    req.url = gist_url();
+    req.headers = github_headers(github_token_, "");
+    async_http_->start(std::move(req), [this](AsyncHttp::Response& res) { async_on_read(res); });
+}
+
+void HistoryStore::async_on_read(AsyncHttp::Response& res) {
+    string content_b64;
+    string err = res.error;
+    if (err.empty()) err = gist_get_result(res.status, res.body, gist_filename_, content_b64);
+    if (!err.empty()) {
+        async_finish_round(err);
+        return;
+    }
+
+    vector<uint8_t> blob;
+    {
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        err = gist_apply(std::move(content_b64));
+        if (!err.empty()) {
+            lk.unlock();
+            async_finish_round(err);
+            return;
+        }
+        auto& rng = thread_rng();
+        bool any = false;
+        for (auto& batch : async_round_) {
+            // An earlier attempt's picks and errors are redone against the reloaded history.
+            batch->picks.assign(batch->items.size(), std::pmr::vector<size_t>());
+            for (size_t i = 0; i < batch->items.size(); i++) {
+                if (batch->valid[i]) batch->items[i].error.clear();
+            }
+            pick_batch(batch->items, batch->picks,
+                       [&](size_t n, const NameFilter& filter, std::pmr::vector<size_t>& out) {
+                           return pick_locked(n, filter, rng, out);
+                       });
+            for (const auto& p : batch->picks) any = any || !p.empty();
+        }
+        if (any) err = encode_to_blob(blob);
+        if (!any || !err.empty()) {
+            lk.unlock();
+            async_finish_round(err);
+            return;
+        }
+    }
+
+    const string content = base64_encode_bytes(blob);
+    async_written_ = content.size();
+    AsyncHttp::Request req;
+    req.method = "PATCH";
+    req.url = gist_url();
+    req.headers = github_headers(github_token_, "");
+    req.body = gist_patch_body(gist_filename_, content);
+    async_http_->start(std::move(req), [this](AsyncHttp::Response& res) { async_on_write(res); });
+}
+
+void HistoryStore::async_on_write(AsyncHttp::Response& res) {
+    string err = res.error;
+    if (err.empty()) err = gist_patch_result(res.status, res.body);
+    if (err.empty()) {
+        std::lock_guard<std::mutex> pl(persist_mu_);
+        io_.persists++;
+        io_.bytes_written += async_written_;
+        // Written once per universe, so this is the one blocking call left on the way.
+        (void)ensure_manifest();
+    } else if (res.status == 412) {
+        if (++async_attempt_ < 3) {
+            async_read();
+            return;
+        }
+        err = "could not persist history (concurrent updates); please retry";
+    }
+    async_finish_round(err);
+}
+
+void HistoryStore::async_finish_round(const std::string& err) {
+    for (auto& batch : async_round_) {
+        if (err.empty()) {
+            for (size_t i = 0; i < batch->items.size(); i++) {
+                if (i < batch->picks.size()) {
+                    append_names(batch->picks[i], batch->items[i].names, &batch->items[i].indices);
+                }
+            }
+        }
+        batch->done(err, batch->items);
+    }
+    async_round_.clear();
+    {
+        std::lock_guard<std::mutex> lk(async_mu_);
+        if (async_queue_.empty()) {
+            async_busy_ = false;
+            return;
+        }
+        async_round_.swap(async_queue_);
+    }
+    async_attempt_ = 0;
+    async_read();
+}
+
+std::string HistoryStore::pick_locked(size_t count, const NameFilter& filter, std::mt19937& rng,
+                                      std::pmr::vector<size_t>& picked) {
+    picked.clear();
+    const NameWeights* weights = NameWeights::active();
+    // Distinct draws come from NameIndex's grid sampler, which is uniform.
+    if (weights && filter.any() && !filter.distinct()) {
+        // Weighted picks are marked one by one so later picks in this call see them.
+        if (!weighted_) weighted_ = std::make_unique<WeightedSampler>(*weights, used_);
+        picked.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            size_t idx = 0;
+            if (!weighted_->pick(used_, rng, idx)) break;
+            used_.insert(idx);
+            weighted_->on_marked(idx);
+            picked.push_back(idx);
+        }
+        if (picked.size() != count) {
+            for (size_t idx : picked) used_.erase(idx);
+            picked.clear();
+            weighted_.reset();
+            return "not enough unused names with non-zero weight remaining";
+        }
+    } else {
+        string serr;
+        {
+            Trace::Span span("sample_unused");
+            serr = NameIndex::instance().sample_unused(filter, used_, count, rng, picked);
+        }
+        if (!serr.empty()) return serr;
+        for (size_t idx : picked) {
+            used_.insert(idx);
+            if (weighted_) weighted_->on_marked(idx);
+        }
+    }
+    if (journaling_) journal_.insert(journal_.end(), picked.begin(), picked.end());
+    return "";
+}
+
+// Prefork: the shared bitset decides who gets a name. used_ is only this worker's view of
+// it (its own claims, names inherited at fork time and names it lost a claim race on), so
+// sampling may propose names another worker already took; those claims fail and the name
+// is re-drawn. Once a request sees many such failures the view is refreshed from the
+// shared bits.
+std::string HistoryStore::generate_shared(int count, NameList& out_names, const NameFilter& filter,
+                                          std::pmr::vector<size_t>* out_indices) {
+    std::pmr::vector<size_t> picked(out_names.get_allocator().resource());
+    auto err = claim_shared(static_cast<size_t>(count), filter, thread_rng(), picked);
+    if (!err.empty()) return err;
+
+    string derr;
+    {
+        Trace::Span span("wait_durable");
+        derr = shared_->wait_durable();
+    }
+    if (!derr.empty()) return derr;
+    io_.persists++;
+
+    append_names(picked, out_names, out_indices);
+    return "";
+}
+
+std::string HistoryStore::claim_shared(size_t count, const NameFilter& filter, std::mt19937& rng,
+                                       std::pmr::vector<size_t>& picked) {
+    std::pmr::memory_resource* mr = picked.get_allocator().resource();
+    const size_t want = count;
+    const size_t resync_after = std::max<size_t>(64, want);
+    const NameWeights* weights = NameWeights::active();
+    const bool use_weights = weights && filter.any() && !filter.distinct();
+
+    auto resync = [&]() {
+        UsedSet current;
+        shared_->copy_to(current);
+        reset_used(current);
+    };
+
+    picked.clear();
+    picked.reserve(want);
+    size_t collisions = 0;
+    bool resynced = false;
+    string err;
+    while (picked.size() < want) {
+        std::pmr::vector<size_t> candidates(mr);
+        if (use_weights) {
+            if (!weighted_) weighted_ = std::make_unique<WeightedSampler>(*weights, used_);
+            size_t idx = 0;
+            if (weighted_->pick(used_, rng, idx)) {
+                candidates.push_back(idx);
+            } else {
+                err = "not enough unused names with non-zero weight remaining";
+            }
+        } else {
+            Trace::Span span("sample_unused");
+            err = NameIndex::instance().sample_unused(filter, used_, want - picked.size(), rng, candidates);
+        }
+        if (!err.empty()) {
+            // The view may hold names that were claimed and then released elsewhere.
+            if (resynced) break;
+            resync();
+            resynced = true;
+            err.clear();
+            continue;
+        }
+        for (size_t idx : candidates) {
+            used_.insert(idx);
+            if (weighted_) weighted_->on_marked(idx);
+            if (shared_->claim(idx)) {
+                picked.push_back(idx);
+            } else {
+                collisions++;
+            }
+        }
+        if (filter.distinct() && picked.size() < want) {
+            // Topping up a partial draw could repeat a first name or surname: redraw it all
+            // (the names lost to other workers are in used_ now).
+            for (size_t idx : picked) {
+                shared_->release(idx);
+                used_.erase(idx);
+            }
+            if (!picked.empty()) weighted_.reset();
+            picked.clear();
+        }
+        if (collisions > resync_after) {
+            resync();
+            collisions = 0;
+        }
+    }
+
+    if (!err.empty()) {
+        for (size_t idx : picked) {
+            shared_->release(idx);
+            used_.erase(idx);
+        }
+        picked.clear();
+        weighted_.reset();
+        return err;
+    }
+    return "";
+}
+
+std::string HistoryStore::create_shared(std::unique_ptr<SharedUsedBits>& out) {
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    if (!ready_) return "history store not initialized";
+    if (backend_ != Backend::File) return "shared history needs the file backend";
+    auto err = SharedUsedBits::create(namegen::universe_size(), used_, out);
+    if (!err.empty()) return err;
+    shared_ = out.get();
+    // Workers claim names in the shared bits, never through commit_marks, and each would
+    // scan its own copy of the log's index: there is no log to answer from.
+    if (log_) {
+        err = log_->flush(mapped_format_);
+        log_.reset();
+    }
+    return err;
+}
+
+std::string HistoryStore::persist_shared() {
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    UsedSet current;
+    shared_->copy_to(current);
+    reset_used(current);
+    return persist();
+}
+
 // -------------------------
 // Crypto blob format
 // -------------------------
-std::string HistoryStore::decode_from_blob(const std::vector<uint8_t>& blob) {
+namespace {
+
+struct BlobHeader {
+    uint8_t ver = 0;
+    history_codec::Codec codec = history_codec::Codec::Zlib;  // always Zlib before version 3
+    uint64_t universe_size = 0;
+    uint64_t fingerprint = 0;  // legacy (full-name) fingerprint for version 1
+    uint64_t count = 0;        // version 2 and later
+    uint64_t raw_len = 0;
+    uint64_t comp_len = 0;
+    size_t payload_off = 0;
+};
+
+}  // namespace
+
+static string parse_blob_header(const vector<uint8_t>& blob, BlobHeader& h) {
     // magic "RNGZ1"
     const uint8_t MAGIC[5] = {'R', 'N', 'G', 'Z', '1'};
-    const size_t MIN = min_history_blob_size();
-    if (blob.size() < MIN) return "history blob is corrupted (too small)";
+    if (blob.size() < min_history_blob_size()) return "history blob is corrupted (too small)";
     if (std::memcmp(blob.data(), MAGIC, 5) != 0) return "history blob has wrong magic/version";
 
     size_t off = 5;
-    uint8_t ver = blob[off++];
-    if (ver != 1) return "history blob version unsupported";
-
-    auto read_u32 = [&](uint32_t& out) {
-        out = 0;
-        out |= static_cast<uint32_t>(blob[off + 0]);
-        out |= static_cast<uint32_t>(blob[off + 1]) << 8;
-        out |= static_cast<uint32_t>(blob[off + 2]) << 16;
-        out |= static_cast<uint32_t>(blob[off + 3]) << 24;
-        off += 4;
+    h.ver = blob[off++];
+    if (h.ver < 1 || h.ver > 3) return "history blob version unsupported";
+
+    auto read_u32 = [&]() {
+        uint64_t out = 0;
+        for (int i = 0; i < 4; i++) out |= static_cast<uint64_t>(blob[off++]) << (8 * i);
+        return out;
     };
-    auto read_u64 = [&](uint64_t& out) {
-        out = 0;
+    auto read_u64 = [&]() {
+        uint64_t out = 0;
         for (int i = 0; i < 8; i++) out |= static_cast<uint64_t>(blob[off++]) << (8 * i);
+        return out;
     };
 
-    uint32_t stored_n = 0;
-    uint64_t stored_fp = 0;
-    uint32_t raw_len = 0;
-    uint32_t comp_len = 0;
-    read_u32(stored_n);
-    read_u64(stored_fp);
-    read_u32(raw_len);
-    read_u32(comp_len);
+    if (h.ver == 1) {
+        h.universe_size = read_u32();
+        h.fingerprint = read_u64();
+        h.raw_len = read_u32();
+        h.comp_len = read_u32();
+        if (h.raw_len != (h.universe_size + 7) / 8) return "history raw length mismatch";
+    } else {
+        if (blob.size() < off + (h.ver == 3 ? 1 : 0) + 8 * 5) return "history blob is corrupted (too small)";
+        if (h.ver == 3) {
+            const uint8_t c = blob[off++];
+            if (c >= history_codec::kCodecs) return "history blob codec unsupported";
+            h.codec = static_cast<history_codec::Codec>(c);
+        }
+        h.universe_size = read_u64();
+        h.fingerprint = read_u64();
+        h.count = read_u64();
+        h.raw_len = read_u64();
+        h.comp_len = read_u64();
+        if (h.count > h.universe_size) return "history raw length mismatch";
+        if (h.codec == history_codec::Codec::Zlib) {
+            if (h.raw_len > h.count * 10 || h.raw_len > (uint64_t{1} << 32)) return "history raw length mismatch";
+        } else if (h.raw_len != h.comp_len) {
+            return "history raw length mismatch";
+        }
+    }
+    if (off + h.comp_len != blob.size()) return "history compressed length mismatch";
+    h.payload_off = off;
+    return "";
+}
+
+// Calls fn(idx) for every used index in the blob, in ascending order. Indices are relative
+// to the universe the blob was written against (h.universe_size), not the active one.
+template <typename Fn>
+static string for_each_blob_index(const vector<uint8_t>& blob, const BlobHeader& h, Fn&& fn) {
+    if (h.ver == 1) {
+        // Version 1: flat bitset of the whole universe, through zlib.
+        vector<uint8_t> raw(static_cast<size_t>(h.raw_len));
+        uLongf dest_len = static_cast<uLongf>(raw.size());
+        int zrc = ::uncompress(raw.data(), &dest_len, blob.data() + h.payload_off, static_cast<uLong>(h.comp_len));
+        if (zrc != Z_OK || dest_len != raw.size()) return "history decompress failed";
+        for (size_t i = 0; i < raw.size(); i++) {
+            uint8_t byte = raw[i];
+            while (byte) {
+                const uint64_t idx = i * 8 + static_cast<uint64_t>(__builtin_ctz(byte));
+                if (idx < h.universe_size) fn(idx);
+                byte &= static_cast<uint8_t>(byte - 1);
+            }
+        }
+        return "";
+    }
+
+    // Version 2 (zlib'd varint deltas) and 3 (any codec): the sorted used indices, decoded a
+    // batch at a time without an intermediate buffer of the whole list.
+    Trace::Span span("decode_history");
+    return history_codec::decode(h.codec, blob.data() + h.payload_off, static_cast<size_t>(h.comp_len), h.raw_len,
+                                 h.count, h.universe_size, [&](const uint64_t* idx, size_t k) {
+                                     for (size_t i = 0; i < k; i++) fn(idx[i]);
+                                 });
+}
+
+static void remap_index(const UniverseRemap& remap, uint64_t idx, UsedSet& out,
+                        HistoryStore::MigrationStats& stats) {
+    bool kept = false;
+    remap.remap(idx, [&](uint64_t to) {
+        out.insert(to);
+        kept = true;
+    });
+    stats.old_used++;
+    if (!kept) stats.dropped++;
+}
+
+std::string HistoryStore::decode_from_blob(const std::vector<uint8_t>& blob) {
+    BlobHeader h;
+    auto herr = parse_blob_header(blob, h);
+    if (!herr.empty()) return herr;
 
+    // The size check comes first: the legacy fingerprint is O(universe).
     const size_t n = namegen::universe_size();
-    const size_t expected_bytes = (n + 7) / 8;
-    if (stored_n != static_cast<uint32_t>(n)) return "history universe size mismatch (names list changed?)";
-    if (stored_fp != namegen::universe_fingerprint()) return "history universe fingerprint mismatch (names list changed?)";
-    if (raw_len != static_cast<uint32_t>(expected_bytes)) return "history raw length mismatch";
-    if (off + comp_len != blob.size()) return "history compressed length mismatch";
-
-    vector<uint8_t> raw(expected_bytes);
-    uLongf dest_len = static_cast<uLongf>(raw.size());
-    int zrc = ::uncompress(raw.data(), &dest_len, blob.data() + off, comp_len);
-    if (zrc != Z_OK || dest_len != raw.size()) return "history decompress failed";
-
-    used_bits_ = std::move(raw);
-    used_count_ = 0;
-    for (size_t i = 0; i < n; i++) if (get_bit(used_bits_, i)) used_count_++;
+    if (h.universe_size != n ||
+        h.fingerprint != (h.ver == 1 ? namegen::universe_legacy_fingerprint() : namegen::universe_fingerprint())) {
+        return migrate_blob(blob);
+    }
+
+    UsedSet decoded;
+    auto ierr = for_each_blob_index(blob, h, [&](uint64_t idx) { decoded.insert(idx); });
+    if (!ierr.empty()) return ierr;
+
+    reset_used(decoded);
     return "";
 }
 
-std::string HistoryStore::encode_to_blob(std::vector<uint8_t>& out_blob) const {
-    const size_t n = namegen::universe_size();
-    const size_t expected_bytes = (n + 7) / 8;
-    if (used_bits_.size() != expected_bytes) return "internal error: bitset size mismatch";
+// The blob was written against other name lists: find them (the manifest stored next to
+// the blob, or the built-in lists, which version-1 blobs always used) and carry every used
+// full name over to the active universe.
+std::string HistoryStore::migrate_blob(const std::vector<uint8_t>& blob) {
+    const auto started = std::chrono::steady_clock::now();
+    BlobHeader h;
+    auto herr = parse_blob_header(blob, h);
+    if (!herr.empty()) return herr;
+
+    auto written_against = [&](const namegen::Universe& u) {
+        if (namegen::size_of(u) != h.universe_size) return false;
+        return h.fingerprint == (h.ver == 1 ? namegen::legacy_fingerprint_of(u) : namegen::fingerprint_of(u));
+    };
 
-    // Compress bitset
-    uLongf bound = ::compressBound(static_cast<uLong>(used_bits_.size()));
-    vector<uint8_t> comp(bound);
-    int level = 6;
-    if (const char* lvl = std::getenv("HISTORY_ZLIB_LEVEL"); lvl && *lvl) {
-        int v = std::atoi(lvl);
-        if (v >= 1 && v <= 9) level = v;
+    namegen::UniversePtr from;
+    vector<uint8_t> manifest;
+    if (h.ver >= 2 && read_manifest(h.fingerprint, manifest).empty()) {
+        auto merr = namegen::open_dictionary_bytes(std::move(manifest), "history manifest", from);
+        if (!merr.empty()) return "history manifest is unreadable: " + merr;
+        if (!written_against(*from)) return "history manifest does not match the history blob";
+    } else if (written_against(*namegen::builtin_universe())) {
+        from = namegen::builtin_universe();
+    } else {
+        return "history universe fingerprint mismatch (names list changed and the old lists are unknown)";
+    }
+
+    UniverseRemap remap(*from, *namegen::active_universe());
+    UsedSet migrated;
+    MigrationStats stats = migration_;
+    stats.old_used = stats.dropped = 0;
+    auto ierr = for_each_blob_index(blob, h, [&](uint64_t idx) { remap_index(remap, idx, migrated, stats); });
+    if (!ierr.empty()) return ierr;
+
+    stats.runs++;
+    stats.new_used = migrated.size();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    migration_ = stats;
+    reset_used(migrated);
+    return "";
+}
+
+HistoryStore::MigrationStats HistoryStore::remap_used(const UsedSet& from, const UniverseRemap& remap, UsedSet& out) {
+    const auto started = std::chrono::steady_clock::now();
+    MigrationStats stats;
+    out.clear();
+    from.for_each([&](uint64_t idx) { remap_index(remap, idx, out, stats); });
+    stats.new_used = out.size();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return stats;
+}
+
+UsedSet HistoryStore::begin_universe_swap() {
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    journaling_ = true;
+    journal_.clear();
+    UsedSet snapshot;
+    used_.visit([&](uint64_t idx) { snapshot.insert(idx); });
+    return snapshot;
+}
+
+std::string HistoryStore::finish_universe_swap(UsedSet migrated, MigrationStats stats, const UniverseRemap& remap) {
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    // Names issued while the snapshot was being remapped.
+    const auto started = std::chrono::steady_clock::now();
+    for (uint64_t idx : journal_) remap_index(remap, idx, migrated, stats);
+    journaling_ = false;
+    journal_.clear();
+
+    stats.runs = migration_.runs + 1;
+    stats.new_used = migrated.size();
+    stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    migration_ = stats;
+    reset_used(migrated);
+    // No commit is in flight (they hold mu_): every index published from here on is one of
+    // the new universe.
+    if (auto* repl = repl_.load(std::memory_order_acquire)) repl->resync();
+    return persist();
+}
+
+void HistoryStore::abort_universe_swap() {
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    journaling_ = false;
+    journal_.clear();
+}
+
+// -------------------------
+// Replication
+// -------------------------
+std::string HistoryStore::set_replication(ReplicationPrimary* repl) {
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    if (backend_ != Backend::File || shared_ || multi_process_) {
+        return "replication needs the file backend in a single process";
+    }
+    repl_.store(repl, std::memory_order_release);
+    return "";
+}
+
+std::string HistoryStore::replication_snapshot(uint64_t& seq, std::vector<uint8_t>& blob) const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    if (!ready_) return "history store not initialized";
+    // Commits mark used_ before taking their sequence number, so everything up to `seq` is
+    // in the set by the time it is encoded.
+    {
+        std::lock_guard<std::mutex> pl(pending_mu_);
+        seq = mark_seq_;
+    }
+    return encode_to_blob(blob);
+}
+
+std::string HistoryStore::replica_load(const std::vector<uint8_t>& blob) {
+    BlobHeader h;
+    auto herr = parse_blob_header(blob, h);
+    if (!herr.empty()) return herr;
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    // Marks that follow are indices into the primary's universe: it has to be this one.
+    if (h.ver < 2 || h.universe_size != namegen::universe_size() || h.fingerprint != namegen::universe_fingerprint()) {
+        return "the primary's name lists differ from the active ones";
+    }
+    auto derr = decode_from_blob(blob);
+    if (!derr.empty()) return derr;
+    replica_fp_ = h.fingerprint;
+    return "";
+}
+
+std::string HistoryStore::replica_apply(const uint64_t* idx, size_t n) {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    if (replica_fp_ != namegen::universe_fingerprint()) return "the name lists changed since the last snapshot";
+    const uint64_t universe = used_.universe();
+    for (size_t i = 0; i < n; i++) {
+        if (idx[i] >= universe) return "replicated index out of range";
+        used_.insert(idx[i]);
+    }
+    return "";
+}
+
+std::string HistoryStore::promote() {
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    if (!read_only_) return "";
+    weighted_.reset();  // built against a used set that has changed since
+    auto err = persist();
+    if (err.empty()) err = open_log();
+    if (!err.empty()) return err;
+    read_only_ = false;
+    return "";
+}
+
+// -------------------------
+// Universe manifests
+// -------------------------
+static string fingerprint_hex(uint64_t fp) {
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(fp));
+    return buf;
+}
+
+std::string HistoryStore::manifest_path(uint64_t fp) const {
+    if (backend_ == Backend::GitHubGist) return gist_filename_ + ".manifest-" + fingerprint_hex(fp);
+    const auto slash = file_path_.find_last_of('/');
+    const string dir = (slash == string::npos) ? string(".") : file_path_.substr(0, slash);
+    return dir + "/manifests/" + fingerprint_hex(fp) + ".dict";
+}
+
+std::string HistoryStore::read_manifest(uint64_t fp, std::vector<uint8_t>& out) {
+    out.clear();
+    const string path = manifest_path(fp);
+    if (backend_ == Backend::File) {
+        if (!file_exists(path)) return "history manifest not found";
+        return read_all_bytes(path, out);
+    }
+    string content_b64;
+    auto rerr = gist_read_file(path, content_b64);
+    if (!rerr.empty()) return rerr;
+    return base64_decode_bytes(content_b64, out);
+}
+
+// Manifests are content-addressed, so each is written once and never updated. Failures are
+// not reported to the caller (the blob itself is safely stored); the write is retried on the
+// next persist, and a missing manifest only matters if the lists change before then.
+std::string HistoryStore::ensure_manifest() {
+    const auto u = namegen::active_universe();
+    const uint64_t fp = namegen::fingerprint_of(*u);
+    if (manifest_fp_ == fp) return "";
+
+    const string path = manifest_path(fp);
+    if (backend_ == Backend::File && file_exists(path)) {
+        manifest_fp_ = fp;
+        return "";
+    }
+    vector<uint8_t> bytes;
+    namegen::serialize_dictionary(*u, bytes);
+    string err;
+    if (backend_ == Backend::File) {
+        mkdirs_for_path(path);
+        err = write_all_bytes_atomic(path, bytes);
+    } else {
+        // Note: the gist API truncates file contents over ~1 MB in responses, so this only
+        // carries small dictionaries through a list change.
+        err = gist_write_file(path, base64_encode_bytes(bytes));
+    }
+    if (!err.empty()) return err;
+    io_.bytes_written += bytes.size();
+    manifest_fp_ = fp;
+    return "";
+}
+
+static string encode_blob(const UsedView& used, uint64_t n, uint64_t fingerprint,
+                          const history_codec::Options& codec, vector<uint8_t>& out_blob) {
+    // The codec is picked from the density before the pass; marks may land while it runs,
+    // so the count written is what was actually visited, not used.size().
+    const history_codec::Codec c = codec.choose(used.size(), n);
+    vector<uint8_t> payload;
+    uint64_t raw_len = 0;
+    uint64_t count = 0;
+    {
+        Trace::Span span("encode_history");
+        history_codec::Encoder enc(c, n, used.size(), codec.zlib_level);
+        used.visit([&](uint64_t idx) { enc.add(idx); });
+        count = enc.count();
+        auto err = enc.finish(payload, raw_len);
+        if (!err.empty()) return err;
     }
-    uLongf comp_len = bound;
-    int zrc = ::compress2(comp.data(), &comp_len, used_bits_.data(),
-                          static_cast<uLong>(used_bits_.size()), level);
-    if (zrc != Z_OK) return "history compress failed";
-    comp.resize(static_cast<size_t>(comp_len));
 
-    // Format:
+    // Format (version 3; versions 1 and 2 are still read):
     // magic(5) "RNGZ1"
-    // ver(1) = 1
-    // universe_size u32
+    // ver(1) = 3
+    // codec(1) (history_codec::Codec)
+    // universe_size u64
     // universe_fingerprint u64
-    // raw_len u32
-    // comp_len u32
-    // comp bytes
+    // used_count u64
+    // raw_len u64 (payload bytes before zlib; equal to comp_len for the other codecs)
+    // comp_len u64
+    // payload bytes
     out_blob.clear();
-    out_blob.reserve(min_history_blob_size() + comp.size());
+    out_blob.reserve(7 + 8 * 5 + payload.size());
     const uint8_t MAGIC[5] = {'R', 'N', 'G', 'Z', '1'};
     out_blob.insert(out_blob.end(), MAGIC, MAGIC + 5);
-    out_blob.push_back(1);
+    out_blob.push_back(3);
+    out_blob.push_back(static_cast<uint8_t>(c));
 
-    auto push_u32 = [&](uint32_t v) {
-        out_blob.push_back(static_cast<uint8_t>(v & 0xFF));
-        out_blob.push_back(static_cast<uint8_t>((v >> 8) & 0xFF));
-        out_blob.push_back(static_cast<uint8_t>((v >> 16) & 0xFF));
-        out_blob.push_back(static_cast<uint8_t>((v >> 24) & 0xFF));
-    };
     auto push_u64 = [&](uint64_t v) {
         for (int i = 0; i < 8; i++) out_blob.push_back(static_cast<uint8_t>((v >> (8 * i)) & 0xFF));
     };
 
-    push_u32(static_cast<uint32_t>(n));
-    push_u64(namegen::universe_fingerprint());
-    push_u32(static_cast<uint32_t>(used_bits_.size()));
-    push_u32(static_cast<uint32_t>(comp.size()));
-    out_blob.insert(out_blob.end(), comp.begin(), comp.end());
+    push_u64(n);
+    push_u64(fingerprint);
+    push_u64(count);
+    push_u64(raw_len);
+    push_u64(payload.size());
+    out_blob.insert(out_blob.end(), payload.begin(), payload.end());
     return "";
 }
 
+std::string HistoryStore::encode_to_blob(std::vector<uint8_t>& out_blob) const {
+    return encode_blob(used_, namegen::universe_size(), namegen::universe_fingerprint(), codec_, out_blob);
+}
+
 // -------------------------
 // GitHub Gist backend
 // -------------------------
@@ -596,46 +1715,31 @@ std::string HistoryStore::gist_init() {
 }
 
 std::string HistoryStore::gist_read_content(std::string& out_content_b64) {
-    out_content_b64.clear();
+    return gist_read_file(gist_filename_, out_content_b64);
+}
+
+std::string HistoryStore::gist_read_file(const std::string& filename, std::string& out_content) {
+    out_content.clear();
     CurlBuf buf;
-    const string url = "https://api.github.com/gists/" + gist_id_;
-    auto err = http_request("GET", url, github_token_, "", "", buf);
+    auto err = http_request("GET", gist_url(), github_token_, "", "", buf);
     if (!err.empty()) return err;
-    if (buf.status == 404) return "gist not found (check HISTORY_GIST_ID)";
-    if (buf.status < 200 || buf.status >= 300) {
-        std::ostringstream ss;
-        ss << "gist GET failed (HTTP " << buf.status << ")";
-        return ss.str();
-    }
-    string content;
-    auto perr = gist_extract_file_content(buf.body, gist_filename_, content);
-    if (!perr.empty()) return perr;
-    out_content_b64 = content;
-    return "";
+    return gist_get_result(buf.status, buf.body, filename, out_content);
 }
 
 std::string HistoryStore::gist_write_content(const std::string& content_b64) {
-    const string url = "https://api.github.com/gists/" + gist_id_;
-    std::ostringstream body;
-    body << "{\"files\":{\"" << json_escape(gist_filename_) << "\":{\"content\":\""
-         << json_escape(content_b64) << "\"}}}";
+    return gist_write_file(gist_filename_, content_b64);
+}
 
+std::string HistoryStore::gist_write_file(const std::string& filename, const std::string& content) {
     CurlBuf patchbuf;
     // NOTE: GitHub gists do not allow conditional headers (like If-Match) on PATCH.
     // We'll do a simple PATCH; this is durable but not strongly concurrency-safe.
-    auto perr = http_request("PATCH", url, github_token_, body.str(), "", patchbuf);
+    auto perr = http_request("PATCH", gist_url(), github_token_, gist_patch_body(filename, content), "", patchbuf);
     if (!perr.empty()) return perr;
-    if (patchbuf.status < 200 || patchbuf.status >= 300) {
-        std::ostringstream ss;
-        ss << "gist PATCH failed (HTTP " << patchbuf.status << ")";
-        if (!patchbuf.body.empty()) {
-            // Include some response body for debugging (it's GitHub error JSON).
-            string b = patchbuf.body;
-            if (b.size() > 500) b.resize(500);
-            ss << ": " << b;
-        }
-        return ss.str();
-    }
-    return "";
+    return gist_patch_result(patchbuf.status, patchbuf.body);
+}
+
+std::string HistoryStore::gist_url() const {
+    return github_api_ + "/gists/" + gist_id_;
 }
 
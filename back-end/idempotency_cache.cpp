@@ -0,0 +1,89 @@
+#include "idempotency_cache.hpp"
+
+#include <iterator>
+
+// List node, map node and bucket, and the Entry fields besides the strings.
+static constexpr size_t kEntryOverhead = 160;
+
+IdempotencyCache::IdempotencyCache(const Config& config) : config_(config) {}
+
+size_t IdempotencyCache::cost(const Entry& e) {
+    return kEntryOverhead + e.key.capacity() + e.packed.capacity();
+}
+
+void IdempotencyCache::erase(std::list<Entry>::iterator it) {
+    bytes_ -= cost(*it);
+    by_key_.erase(it->key);
+    entries_.erase(it);
+}
+
+void IdempotencyCache::evict_expired(Clock::time_point now) {
+    while (!entries_.empty() && entries_.front().expires <= now) erase(entries_.begin());
+}
+
+IdempotencyCache::Lookup IdempotencyCache::begin(std::string_view key, uint64_t request, uint64_t universe,
+                                                 std::vector<uint64_t>& indices) {
+    indices.clear();
+    const auto now = Clock::now();
+    std::lock_guard<std::mutex> lk(mu_);
+    evict_expired(now);
+    if (auto found = by_key_.find(key); found != by_key_.end()) {
+        const Entry& e = *found->second;
+        if (e.request != request) return Lookup::Mismatch;
+        if (e.pending) return Lookup::InProgress;
+        if (e.universe == universe) {
+            const auto* p = reinterpret_cast<const uint8_t*>(e.packed.data());
+            const auto* end = p + e.packed.size();
+            while (p < end) {
+                uint64_t v = 0;
+                for (int shift = 0; p < end; shift += 7) {
+                    const uint8_t b = *p++;
+                    v |= static_cast<uint64_t>(b & 0x7F) << shift;
+                    if (!(b & 0x80)) break;
+                }
+                indices.push_back(v);
+            }
+            return Lookup::Hit;
+        }
+        erase(found->second);  // the name lists changed since
+    }
+
+    entries_.push_back(Entry{std::string(key), request, universe, now + config_.ttl, true, {}});
+    auto it = std::prev(entries_.end());
+    by_key_.emplace(it->key, it);
+    bytes_ += cost(*it);
+    while (bytes_ > config_.max_bytes && entries_.size() > 1) erase(entries_.begin());
+    return Lookup::Miss;
+}
+
+void IdempotencyCache::finish(std::string_view key, const size_t* indices, size_t n) {
+    std::string packed;
+    packed.reserve(n * 3);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v = indices[i];
+        while (v >= 0x80) {
+            packed.push_back(static_cast<char>((v & 0x7F) | 0x80));
+            v >>= 7;
+        }
+        packed.push_back(static_cast<char>(v));
+    }
+    packed.shrink_to_fit();
+
+    std::lock_guard<std::mutex> lk(mu_);
+    auto found = by_key_.find(key);
+    if (found == by_key_.end()) return;  // evicted meanwhile: the retry generates anew
+    Entry& e = *found->second;
+    if (!e.pending) return;
+    bytes_ -= cost(e);
+    e.packed = std::move(packed);
+    e.pending = false;
+    bytes_ += cost(e);
+    // Evicting oldest first may take this entry too, if it alone is over the bound.
+    while (bytes_ > config_.max_bytes && !entries_.empty()) erase(entries_.begin());
+}
+
+void IdempotencyCache::abandon(std::string_view key) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto found = by_key_.find(key);
+    if (found != by_key_.end() && found->second->pending) erase(found->second);
+}
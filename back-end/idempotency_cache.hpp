@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Responses of /api/generate by Idempotency-Key, so a client that timed out and retries
+// gets the names its first attempt was issued instead of burning new ones.
+//
+// An entry holds the universe indices of the names (varints, a few bytes per name), not
+// the names themselves: a replay renders them again, in whatever format the retry asks
+// for. Indices only mean something against the universe they were drawn from, so an entry
+// recorded under other name lists is dropped on lookup.
+//
+// Entries live for `ttl` from their first request. The list is in insertion order, which
+// with one TTL for all is also expiry order: expired entries come off its front, and so
+// do the oldest ones when the entries outgrow `max_bytes`. Both are O(1) per entry.
+//
+// Thread-safe. Per process, so single-process mode only: in prefork mode a retry may reach
+// another worker, and the server refuses Idempotency-Key instead.
+class IdempotencyCache {
+public:
+    static constexpr size_t kMaxKeyBytes = 255;
+
+    struct Config {
+        size_t max_bytes = 16 * 1024 * 1024;
+        std::chrono::seconds ttl{3600};
+    };
+
+    enum class Lookup {
+        Miss,        // the key is now reserved: finish() or abandon() it
+        Hit,         // `indices` are the recorded response
+        InProgress,  // the first request for the key has not finished yet
+        Mismatch,    // the key was used for a different request
+    };
+
+    explicit IdempotencyCache(const Config& config);
+
+    // `request` identifies what was asked for (parameters, tenant); `universe` is the
+    // active universe fingerprint.
+    Lookup begin(std::string_view key, uint64_t request, uint64_t universe, std::vector<uint64_t>& indices);
+
+    // Records the response of a reserved key / releases the reservation of a request that
+    // failed, so that a retry generates.
+    void finish(std::string_view key, const size_t* indices, size_t n);
+    void abandon(std::string_view key);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::string key;
+        uint64_t request = 0;
+        uint64_t universe = 0;
+        Clock::time_point expires;
+        bool pending = true;
+        std::string packed;  // LEB128 varint per index
+    };
+
+    Config config_;
+    std::mutex mu_;
+    std::list<Entry> entries_;  // oldest first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> by_key_;  // views into Entry::key
+    size_t bytes_ = 0;
+
+    static size_t cost(const Entry& e);
+    void erase(std::list<Entry>::iterator it);
+    void evict_expired(Clock::time_point now);
+};
@@ -0,0 +1,385 @@
+#include "issuance_log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static constexpr uint8_t kLogMagic[8] = {'R', 'N', 'G', 'L', 'O', 'G', '1', '\n'};
+static constexpr uint8_t kIdxMagic[8] = {'R', 'N', 'G', 'L', 'I', 'X', '1', '\n'};
+static constexpr size_t kEntrySize = 48;
+
+static size_t put_varint(uint8_t* out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = static_cast<uint8_t>(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(v);
+    return n;
+}
+
+static bool read_varint(const uint8_t*& p, const uint8_t* end, uint64_t& out) {
+    out = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        const uint8_t b = *p++;
+        out |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint64_t zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+static void put_u64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= static_cast<uint32_t>(p[i]) << (8 * i);
+    return v;
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    return v;
+}
+
+static uint32_t crc_of(const uint8_t* p, size_t n) {
+    return static_cast<uint32_t>(::crc32(0L, p, static_cast<uInt>(n)));
+}
+
+static std::string errno_message(const std::string& what) {
+    return what + ": " + std::strerror(errno);
+}
+
+static bool pread_all(int fd, uint8_t* p, size_t n, uint64_t off) {
+    while (n > 0) {
+        const ssize_t r = ::pread(fd, p, n, static_cast<off_t>(off));
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) continue;
+            return false;
+        }
+        p += r;
+        n -= static_cast<size_t>(r);
+        off += static_cast<uint64_t>(r);
+    }
+    return true;
+}
+
+static bool pwrite_all(int fd, const uint8_t* p, size_t n, uint64_t off) {
+    while (n > 0) {
+        const ssize_t w = ::pwrite(fd, p, n, static_cast<off_t>(off));
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= static_cast<size_t>(w);
+        off += static_cast<uint64_t>(w);
+    }
+    return true;
+}
+
+// Decodes one record of a block. `r` holds the previous record (zeroed at block start).
+static bool decode_record(const uint8_t*& p, const uint8_t* end, bool first, IssuanceLog::Record& r) {
+    uint64_t dseq = 0, dts = 0, didx = 0;
+    if (!read_varint(p, end, dseq) || !read_varint(p, end, dts) || !read_varint(p, end, didx)) return false;
+    if (dseq == 0 || (!first && dseq != 1)) return false;
+    r.seq += dseq;
+    r.ts_ms += dts;
+    r.idx = static_cast<uint64_t>(static_cast<int64_t>(r.idx) + unzigzag(didx));
+    return true;
+}
+
+std::string IssuanceLog::open(const std::string& path, std::unique_ptr<IssuanceLog>& out) {
+    std::unique_ptr<IssuanceLog> log(new IssuanceLog());
+    log->fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (log->fd_ < 0) return errno_message("could not open issuance log");
+    log->idx_fd_ = ::open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (log->idx_fd_ < 0) return errno_message("could not open issuance log index");
+    auto err = log->recover();
+    if (!err.empty()) return err;
+    out = std::move(log);
+    return "";
+}
+
+IssuanceLog::~IssuanceLog() {
+    if (fd_ >= 0) ::close(fd_);
+    if (idx_fd_ >= 0) ::close(idx_fd_);
+}
+
+std::string IssuanceLog::recover() {
+    struct stat st {};
+    if (::fstat(fd_, &st) != 0) return errno_message("could not stat issuance log");
+    const uint64_t log_size = static_cast<uint64_t>(st.st_size);
+    if (::fstat(idx_fd_, &st) != 0) return errno_message("could not stat issuance log index");
+    const uint64_t idx_size = static_cast<uint64_t>(st.st_size);
+
+    uint8_t magic[8];
+    if (log_size == 0) {
+        if (!pwrite_all(fd_, kLogMagic, 8, 0)) return errno_message("could not write issuance log");
+    } else if (log_size < 8 || !pread_all(fd_, magic, 8, 0) || std::memcmp(magic, kLogMagic, 8) != 0) {
+        return "issuance log has wrong magic";
+    }
+    if (idx_size == 0) {
+        if (!pwrite_all(idx_fd_, kIdxMagic, 8, 0)) return errno_message("could not write issuance log index");
+    } else if (idx_size < 8 || !pread_all(idx_fd_, magic, 8, 0) || std::memcmp(magic, kIdxMagic, 8) != 0) {
+        return "issuance log index has wrong magic";
+    }
+    const uint64_t have_log = std::max<uint64_t>(log_size, 8);
+
+    // Sealed blocks: entries must tile the log from its header onwards.
+    std::vector<uint8_t> entries(idx_size > 8 ? static_cast<size_t>(idx_size - 8) / kEntrySize * kEntrySize : 0);
+    if (!entries.empty() && !pread_all(idx_fd_, entries.data(), entries.size(), 8)) {
+        return errno_message("could not read issuance log index");
+    }
+    uint64_t pos = 8;
+    for (size_t off = 0; off < entries.size(); off += kEntrySize) {
+        const uint8_t* e = entries.data() + off;
+        Block b;
+        b.offset = get_u64(e);
+        b.first_seq = get_u64(e + 8);
+        b.first_ts = get_u64(e + 16);
+        b.last_ts = get_u64(e + 24);
+        b.count = get_u32(e + 32);
+        b.len = get_u32(e + 36);
+        b.crc = get_u32(e + 40);
+        b.sealed = true;
+        if (b.offset != pos || b.count == 0 || b.len < 8 || b.offset + b.len > have_log ||
+            b.first_seq < next_seq_ || b.first_ts < last_ts_ || b.last_ts < b.first_ts) {
+            break;
+        }
+        blocks_.push_back(b);
+        pos = b.offset + b.len;
+        next_seq_ = b.first_seq + b.count;
+        last_ts_ = b.last_ts;
+        records_ += b.count;
+    }
+    sealed_count_ = flushed_entries_ = blocks_.size();
+    if (::ftruncate(idx_fd_, static_cast<off_t>(8 + sealed_count_ * kEntrySize)) != 0) {
+        return errno_message("could not truncate issuance log index");
+    }
+
+    // Tail: the open block, and any block that was sealed but whose entry never made it.
+    std::vector<uint8_t> tail(static_cast<size_t>(have_log - pos));
+    if (!tail.empty() && !pread_all(fd_, tail.data(), tail.size(), pos)) return errno_message("could not read issuance log");
+    const uint8_t* p = tail.data();
+    const uint8_t* end = p + tail.size();
+    uint64_t good = pos;
+    end_ = pos;
+    while (end - p >= 8) {
+        Block b;
+        b.offset = end_;
+        b.len = 8;
+        const uint64_t fp = get_u64(p);
+        const uint8_t* rec = p + 8;
+        Record r;
+        while (b.count < kBlockRecords && rec < end) {
+            const uint8_t* next = rec;
+            if (!decode_record(next, end, b.count == 0, r)) break;
+            if ((b.count == 0 && r.seq < next_seq_) || r.ts_ms < last_ts_) break;
+            if (b.count == 0) {
+                b.first_seq = r.seq;
+                b.first_ts = r.ts_ms;
+            }
+            b.count++;
+            b.len += static_cast<uint32_t>(next - rec);
+            b.last_ts = r.ts_ms;
+            next_seq_ = r.seq + 1;
+            last_ts_ = r.ts_ms;
+            prev_idx_ = r.idx;
+            rec = next;
+        }
+        if (b.count == 0) break;  // a bare fingerprint: drop it
+        records_ += b.count;
+        open_payload_.assign(p, rec);
+        fingerprint_ = fp;
+        blocks_.push_back(b);
+        p = rec;
+        end_ = good = b.offset + b.len;
+        if (b.count < kBlockRecords) break;
+        seal_open_block();
+    }
+    if (good != log_size && ::ftruncate(fd_, static_cast<off_t>(good)) != 0) {
+        return errno_message("could not truncate issuance log");
+    }
+    flushed_ = end_ = good;
+    return "";
+}
+
+void IssuanceLog::push_bytes(const uint8_t* p, size_t n) {
+    unflushed_.insert(unflushed_.end(), p, p + n);
+    open_payload_.insert(open_payload_.end(), p, p + n);
+    end_ += n;
+}
+
+void IssuanceLog::seal_open_block() {
+    Block& b = blocks_.back();
+    b.crc = crc_of(open_payload_.data(), open_payload_.size());
+    b.sealed = true;
+    sealed_count_ = blocks_.size();
+    open_payload_.clear();
+}
+
+void IssuanceLog::append(const size_t* indices, size_t n, uint64_t ts_ms, uint64_t fingerprint) {
+    std::lock_guard<std::mutex> lk(mu_);
+    ts_ms = std::max(ts_ms, last_ts_);
+    uint8_t rec[30];
+    for (size_t i = 0; i < n; i++) {
+        const bool open = !blocks_.empty() && !blocks_.back().sealed;
+        if (open && fingerprint_ != fingerprint) seal_open_block();
+        if (blocks_.empty() || blocks_.back().sealed) {
+            Block b;
+            b.offset = end_;
+            b.first_seq = next_seq_;
+            b.first_ts = ts_ms;
+            blocks_.push_back(b);
+            fingerprint_ = fingerprint;
+            prev_idx_ = 0;
+            uint8_t fp[8];
+            put_u64(fp, fingerprint);
+            push_bytes(fp, 8);
+            blocks_.back().len = 8;
+        }
+        Block& b = blocks_.back();
+        size_t len = put_varint(rec, b.count == 0 ? next_seq_ : 1);
+        len += put_varint(rec + len, b.count == 0 ? ts_ms : ts_ms - last_ts_);
+        len += put_varint(rec + len, zigzag(static_cast<int64_t>(indices[i]) - static_cast<int64_t>(prev_idx_)));
+        push_bytes(rec, len);
+        b.len += static_cast<uint32_t>(len);
+        b.count++;
+        b.last_ts = ts_ms;
+        next_seq_++;
+        last_ts_ = ts_ms;
+        prev_idx_ = indices[i];
+        records_++;
+        if (b.count == kBlockRecords) seal_open_block();
+    }
+}
+
+std::string IssuanceLog::flush(bool sync) {
+    std::lock_guard<std::mutex> fl(flush_mu_);
+    std::vector<uint8_t>& data = flush_data_;
+    std::vector<uint8_t>& entries = flush_entries_;
+    uint64_t off = 0;
+    uint64_t first_entry = 0;
+    uint64_t entry_count = 0;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        data.assign(unflushed_.begin(), unflushed_.end());
+        off = flushed_;
+        first_entry = flushed_entries_;
+        entry_count = sealed_count_;
+        entries.resize(static_cast<size_t>(entry_count - first_entry) * kEntrySize);
+        for (uint64_t i = first_entry; i < entry_count; i++) {
+            const Block& b = blocks_[static_cast<size_t>(i)];
+            uint8_t* e = entries.data() + (i - first_entry) * kEntrySize;
+            put_u64(e, b.offset);
+            put_u64(e + 8, b.first_seq);
+            put_u64(e + 16, b.first_ts);
+            put_u64(e + 24, b.last_ts);
+            put_u32(e + 32, b.count);
+            put_u32(e + 36, b.len);
+            put_u32(e + 40, b.crc);
+            put_u32(e + 44, 0);
+        }
+    }
+    if (data.empty() && entries.empty()) return "";
+
+    // Records before the index entries that point at them.
+    if (!pwrite_all(fd_, data.data(), data.size(), off)) return errno_message("could not write issuance log");
+    if (sync && ::fdatasync(fd_) != 0) return errno_message("could not sync issuance log");
+    if (!entries.empty()) {
+        if (!pwrite_all(idx_fd_, entries.data(), entries.size(), 8 + first_entry * kEntrySize)) {
+            return errno_message("could not write issuance log index");
+        }
+        if (sync && ::fdatasync(idx_fd_) != 0) return errno_message("could not sync issuance log index");
+    }
+
+    std::lock_guard<std::mutex> lk(mu_);
+    unflushed_.erase(unflushed_.begin(), unflushed_.begin() + static_cast<std::ptrdiff_t>(data.size()));
+    flushed_ += data.size();
+    flushed_entries_ = entry_count;
+    return "";
+}
+
+// mu_ held.
+std::string IssuanceLog::read_range(uint64_t off, uint32_t len, std::vector<uint8_t>& out) const {
+    out.resize(len);
+    const uint64_t disk_end = std::min(off + len, flushed_);
+    if (off < disk_end && !pread_all(fd_, out.data(), static_cast<size_t>(disk_end - off), off)) {
+        return errno_message("could not read issuance log");
+    }
+    if (off + len > flushed_) {
+        const uint64_t from = std::max(off, flushed_);
+        std::memcpy(out.data() + (from - off), unflushed_.data() + (from - flushed_), static_cast<size_t>(off + len - from));
+    }
+    return "";
+}
+
+std::string IssuanceLog::scan(uint64_t from_ms, uint64_t to_ms, const std::function<bool(const Record&)>& fn) const {
+    if (from_ms >= to_ms) return "";
+    std::vector<uint8_t> payload;
+    // Block times only grow, so the first candidate is found by binary search. Each block
+    // is copied out under the lock, and fn runs without it.
+    size_t i = 0;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        i = static_cast<size_t>(std::partition_point(blocks_.begin(), blocks_.end(),
+                                                     [&](const Block& b) { return b.last_ts < from_ms; }) -
+                                blocks_.begin());
+    }
+    while (true) {
+        Block b;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (i >= blocks_.size() || blocks_[i].first_ts >= to_ms) return "";
+            b = blocks_[i];
+            auto err = read_range(b.offset, b.len, payload);
+            if (!err.empty()) return err;
+        }
+        if (b.sealed && crc_of(payload.data(), payload.size()) != b.crc) {
+            return "issuance log block at offset " + std::to_string(b.offset) + " is corrupted";
+        }
+        const uint8_t* p = payload.data() + 8;
+        const uint8_t* end = payload.data() + payload.size();
+        Record r;
+        r.fingerprint = get_u64(payload.data());
+        for (uint32_t k = 0; k < b.count; k++) {
+            if (!decode_record(p, end, k == 0, r)) {
+                return "issuance log block at offset " + std::to_string(b.offset) + " is corrupted";
+            }
+            if (r.ts_ms < from_ms) continue;
+            if (r.ts_ms >= to_ms) return "";
+            if (!fn(r)) return "";
+        }
+        i++;
+    }
+}
+
+uint64_t IssuanceLog::record_count() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return records_;
+}
+
+uint64_t IssuanceLog::size_bytes() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return end_ + 8 + sealed_count_ * kEntrySize;
+}
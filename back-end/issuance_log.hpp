@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Append-only log of issued names: one (sequence, timestamp, universe index) record per
+// name, so the history can answer "what was handed out, and when".
+//
+// `<path>` holds the records, `<path>.idx` a sparse time index over them.
+//
+// Log file: magic "RNGLOG1\n", then blocks back to back. A block is the universe
+// fingerprint (u64, so indices can be resolved after the name lists change) followed by up
+// to kBlockRecords records. Each record is three varints, deltas from the previous record
+// in the block (the first from 0): sequence, timestamp in ms (clamped to never go
+// backwards), and the zigzag-encoded index delta. That is about 5 bytes per name for the
+// built-in lists.
+//
+// Index file: magic "RNGLIX1\n", then one 48-byte entry per sealed block: offset, first
+// sequence, first and last timestamp (u64), record count, payload length, crc32 of the
+// payload, reserved (u32). A range query binary-searches the entries and reads only the
+// blocks whose time range overlaps it. The last block is open (not indexed yet); it is
+// rebuilt from the tail of the log on open, and a torn final record is truncated away.
+//
+// Thread-safe. Records become visible to scan() on append(), and durable on flush().
+class IssuanceLog {
+public:
+    static constexpr uint32_t kBlockRecords = 1024;
+
+    struct Record {
+        uint64_t seq = 0;
+        uint64_t ts_ms = 0;
+        uint64_t idx = 0;
+        uint64_t fingerprint = 0;  // universe the index belongs to
+    };
+
+    // Opens or creates the log. Returns empty string on success; otherwise an error message.
+    static std::string open(const std::string& path, std::unique_ptr<IssuanceLog>& out);
+    ~IssuanceLog();
+
+    IssuanceLog(const IssuanceLog&) = delete;
+    IssuanceLog& operator=(const IssuanceLog&) = delete;
+
+    // Buffers one record per index, in order, with consecutive sequence numbers.
+    void append(const size_t* indices, size_t n, uint64_t ts_ms, uint64_t fingerprint);
+
+    // Writes buffered records and index entries (and fdatasyncs them when `sync`).
+    // Returns empty string on success; otherwise an error message.
+    std::string flush(bool sync);
+
+    // Calls fn for every record with from_ms <= ts_ms < to_ms, in sequence order, until it
+    // returns false. Returns empty string on success; otherwise an error message.
+    std::string scan(uint64_t from_ms, uint64_t to_ms, const std::function<bool(const Record&)>& fn) const;
+
+    uint64_t record_count() const;
+    uint64_t size_bytes() const;
+
+private:
+    struct Block {
+        uint64_t offset = 0;  // in the log file, of the fingerprint
+        uint64_t first_seq = 0;
+        uint64_t first_ts = 0;
+        uint64_t last_ts = 0;
+        uint32_t count = 0;
+        uint32_t len = 0;     // payload bytes, fingerprint included
+        uint32_t crc = 0;     // sealed blocks only
+        bool sealed = false;
+    };
+
+    IssuanceLog() = default;
+
+    mutable std::mutex mu_;
+    std::mutex flush_mu_;
+    std::vector<uint8_t> flush_data_;     // flush() scratch, guarded by flush_mu_
+    std::vector<uint8_t> flush_entries_;
+    int fd_ = -1;
+    int idx_fd_ = -1;
+    std::vector<Block> blocks_;  // sealed blocks, then the open one (if any)
+    uint64_t fingerprint_ = 0;   // of the open block
+    uint64_t next_seq_ = 1;
+    uint64_t last_ts_ = 0;
+    uint64_t prev_idx_ = 0;      // of the open block's last record
+    uint64_t records_ = 0;
+
+    // Bytes not written yet: log [flushed_, end_) and index entries after flushed_entries_.
+    uint64_t flushed_ = 0;
+    uint64_t end_ = 0;
+    std::vector<uint8_t> unflushed_;
+    uint64_t flushed_entries_ = 0;
+    uint64_t sealed_count_ = 0;
+    std::vector<uint8_t> open_payload_;  // the open block, for its crc on sealing
+
+    std::string recover();
+    void seal_open_block();
+    void push_bytes(const uint8_t* p, size_t n);
+    std::string read_range(uint64_t off, uint32_t len, std::vector<uint8_t>& out) const;
+};
@@ -0,0 +1,332 @@
+#include "mapped_history.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+namespace {
+
+constexpr size_t kPageSize = 4096;
+constexpr uint64_t kBitsPerPage = kPageSize * 8;
+constexpr size_t kWordsPerPage = kPageSize / 8;
+constexpr uint8_t kMagic[8] = {'R', 'N', 'G', 'M', 'A', 'P', '1', 0};
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeaderBytes = 8 + 4 + 4 + 8 * 6 + 4;
+
+struct Header {
+    uint64_t universe_size = 0;
+    uint64_t fingerprint = 0;
+    uint64_t generation = 0;
+    uint64_t used_count = 0;
+    uint64_t data_pages = 0;
+    uint64_t data_off = 0;
+};
+
+uint32_t crc_of(const uint8_t* p, size_t len) {
+    return static_cast<uint32_t>(::crc32(0L, p, static_cast<uInt>(len)));
+}
+
+void put_le(uint8_t* p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+uint64_t get_le(const uint8_t* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    return v;
+}
+
+void write_header(uint8_t* slot, const Header& h) {
+    std::memset(slot, 0, kPageSize);
+    std::memcpy(slot, kMagic, 8);
+    put_le(slot + 8, kVersion, 4);
+    put_le(slot + 12, kPageSize, 4);
+    put_le(slot + 16, h.universe_size, 8);
+    put_le(slot + 24, h.fingerprint, 8);
+    put_le(slot + 32, h.generation, 8);
+    put_le(slot + 40, h.used_count, 8);
+    put_le(slot + 48, h.data_pages, 8);
+    put_le(slot + 56, h.data_off, 8);
+    put_le(slot + 64, crc_of(slot, 64), 4);
+}
+
+bool read_header(const uint8_t* slot, Header& h) {
+    if (std::memcmp(slot, kMagic, 8) != 0) return false;
+    if (get_le(slot + 8, 4) != kVersion || get_le(slot + 12, 4) != kPageSize) return false;
+    if (get_le(slot + 64, 4) != crc_of(slot, 64)) return false;
+    h.universe_size = get_le(slot + 16, 8);
+    h.fingerprint = get_le(slot + 24, 8);
+    h.generation = get_le(slot + 32, 8);
+    h.used_count = get_le(slot + 40, 8);
+    h.data_pages = get_le(slot + 48, 8);
+    h.data_off = get_le(slot + 56, 8);
+    return true;
+}
+
+uint64_t data_pages_for(uint64_t universe_size) {
+    return std::max<uint64_t>(1, (universe_size + kBitsPerPage - 1) / kBitsPerPage);
+}
+
+uint64_t data_off_for(uint64_t data_pages) {
+    return 2 * kPageSize + (data_pages * 4 + kPageSize - 1) / kPageSize * kPageSize;
+}
+
+uint32_t zero_page_crc() {
+    static const uint32_t crc = [] {
+        static const uint8_t zeros[kPageSize] = {};
+        return crc_of(zeros, kPageSize);
+    }();
+    return crc;
+}
+
+}  // namespace
+
+static_assert(kHeaderBytes == 68, "header layout");
+
+bool MappedHistoryFile::is_mapped_file(const std::string& path) {
+    // Either header slot may be the only one written so far.
+    std::vector<uint8_t> head(kPageSize + 8);
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (!f) return false;
+    const size_t got = std::fread(head.data(), 1, head.size(), f);
+    std::fclose(f);
+    if (got >= 8 && std::memcmp(head.data(), kMagic, 8) == 0) return true;
+    return got == head.size() && std::memcmp(head.data() + kPageSize, kMagic, 8) == 0;
+}
+
+std::string MappedHistoryFile::open(const std::string& path, std::unique_ptr<MappedHistoryFile>& out) {
+    out.reset();
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) return "could not open history file: " + std::string(std::strerror(errno));
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return "could not stat history file";
+    }
+    const size_t len = static_cast<size_t>(st.st_size);
+    if (len < 3 * kPageSize) {
+        ::close(fd);
+        return "history file is corrupted (too small)";
+    }
+    void* map = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return "mmap of history file failed: " + std::string(std::strerror(errno));
+
+    std::unique_ptr<MappedHistoryFile> f(new MappedHistoryFile());
+    f->base_ = static_cast<uint8_t*>(map);
+    f->len_ = len;
+
+    Header a;
+    Header b;
+    const bool a_ok = read_header(f->base_, a);
+    const bool b_ok = read_header(f->base_ + kPageSize, b);
+    if (!a_ok && !b_ok) return "history file has no valid header";
+    const Header& h = (a_ok && (!b_ok || a.generation >= b.generation)) ? a : b;
+
+    if (h.data_pages != data_pages_for(h.universe_size) || h.data_off != data_off_for(h.data_pages) ||
+        h.data_off + h.data_pages * kPageSize != len) {
+        return "history file layout does not match its header";
+    }
+    f->universe_size_ = h.universe_size;
+    f->fingerprint_ = h.fingerprint;
+    f->generation_ = h.generation;
+    f->used_count_ = h.used_count;
+    f->data_pages_ = h.data_pages;
+    f->data_off_ = h.data_off;
+    out = std::move(f);
+    return "";
+}
+
+std::string MappedHistoryFile::create(const std::string& path, uint64_t universe_size, uint64_t fingerprint,
+                                      const UsedView& used, std::unique_ptr<MappedHistoryFile>& out) {
+    out.reset();
+    if (universe_size > kMaxUniverse) return "universe too large for HISTORY_FORMAT=mapped";
+    Header h;
+    h.universe_size = universe_size;
+    h.fingerprint = fingerprint;
+    h.generation = 1;
+    h.data_pages = data_pages_for(universe_size);
+    h.data_off = data_off_for(h.data_pages);
+    const size_t len = static_cast<size_t>(h.data_off + h.data_pages * kPageSize);
+
+    // Build the whole file under a temp name, then rename it into place.
+    const std::string tmp = path + ".tmp." + std::to_string(::getpid());
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return "could not create history file: " + std::string(std::strerror(errno));
+    if (::ftruncate(fd, static_cast<off_t>(len)) != 0) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        return "could not size history file: " + std::string(std::strerror(errno));
+    }
+    void* map = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        return "mmap of history file failed: " + std::string(std::strerror(errno));
+    }
+
+    uint8_t* base = static_cast<uint8_t*>(map);
+    auto* words = reinterpret_cast<uint64_t*>(base + h.data_off);
+    used.visit([&](uint64_t idx) {
+        if (idx >= universe_size) return;
+        words[idx / 64] |= 1ULL << (idx % 64);
+        h.used_count++;
+    });
+    auto* crcs = reinterpret_cast<uint32_t*>(base + 2 * kPageSize);
+    for (uint64_t p = 0; p < h.data_pages; p++) {
+        const uint8_t* page = base + h.data_off + p * kPageSize;
+        const auto* pw = reinterpret_cast<const uint64_t*>(page);
+        const bool zero = std::all_of(pw, pw + kWordsPerPage, [](uint64_t w) { return w == 0; });
+        crcs[p] = zero ? zero_page_crc() : crc_of(page, kPageSize);
+    }
+    write_header(base + (h.generation % 2) * kPageSize, h);
+
+    std::string err;
+    if (::msync(map, len, MS_SYNC) != 0 || ::fsync(fd) != 0) err = "could not sync history file: " + std::string(std::strerror(errno));
+    ::munmap(map, len);
+    ::close(fd);
+    if (err.empty() && std::rename(tmp.c_str(), path.c_str()) != 0) err = std::string("rename() failed: ") + std::strerror(errno);
+    if (!err.empty()) {
+        ::unlink(tmp.c_str());
+        return err;
+    }
+    return open(path, out);
+}
+
+MappedHistoryFile::~MappedHistoryFile() {
+    if (base_) ::munmap(base_, len_);
+}
+
+uint64_t* MappedHistoryFile::page_words(uint64_t page) const {
+    return reinterpret_cast<uint64_t*>(base_ + data_off_ + page * kPageSize);
+}
+
+uint32_t* MappedHistoryFile::checksums() const {
+    return reinterpret_cast<uint32_t*>(base_ + 2 * kPageSize);
+}
+
+MappedHistoryFile::Repairs MappedHistoryFile::load_into(UsedSet& out) {
+    out.clear();
+    Repairs repairs;
+    std::vector<uint64_t>& repaired = repairs.pages;
+    for (uint64_t p = 0; p < data_pages_; p++) {
+        const uint64_t* pw = page_words(p);
+        bool zero = true;
+        for (size_t w = 0; w < kWordsPerPage; w++) {
+            uint64_t word = pw[w];
+            if (word) zero = false;
+            while (word) {
+                const uint64_t idx = p * kBitsPerPage + w * 64 + static_cast<uint64_t>(__builtin_ctzll(word));
+                if (idx < universe_size_) out.insert(idx);
+                word &= word - 1;
+            }
+        }
+        const uint32_t crc = zero ? zero_page_crc() : crc_of(reinterpret_cast<const uint8_t*>(pw), kPageSize);
+        if (crc != checksums()[p]) {
+            repaired.push_back(p);
+            if (checksums()[p] != zero_page_crc()) repairs.had_names++;
+        }
+    }
+    if (!repaired.empty() || used_count_ != out.size()) {
+        // Recommit so the checksums and used count describe what we just accepted.
+        used_count_ = out.size();
+        size_t synced = 0;
+        (void)commit(repaired, synced);
+    }
+    return repairs;
+}
+
+std::string MappedHistoryFile::mark(const std::vector<size_t>& added, size_t& bytes_synced) {
+    std::vector<uint64_t>& dirty = mark_pages_;
+    dirty.clear();
+    dirty.reserve(added.size());
+    for (size_t idx : added) {
+        if (idx >= universe_size_) continue;
+        uint64_t& word = reinterpret_cast<uint64_t*>(base_ + data_off_)[idx / 64];
+        const uint64_t bit = 1ULL << (idx % 64);
+        if (word & bit) continue;
+        word |= bit;
+        used_count_++;
+        dirty.push_back(idx / kBitsPerPage);
+    }
+    return commit(dirty, bytes_synced);
+}
+
+std::string MappedHistoryFile::store(const UsedView& used, size_t& bytes_synced) {
+    std::vector<uint64_t> dirty;
+    std::vector<uint64_t> want(kWordsPerPage, 0);
+    uint64_t cur = 0;
+    auto emit = [&]() {
+        uint64_t* have = page_words(cur);
+        if (std::memcmp(have, want.data(), kPageSize) != 0) {
+            std::memcpy(have, want.data(), kPageSize);
+            dirty.push_back(cur);
+        }
+        std::fill(want.begin(), want.end(), 0);
+        cur++;
+    };
+    used_count_ = 0;
+    used.visit([&](uint64_t idx) {
+        if (idx >= universe_size_) return;
+        while (cur < idx / kBitsPerPage) emit();
+        want[(idx % kBitsPerPage) / 64] |= 1ULL << (idx % 64);
+        used_count_++;
+    });
+    while (cur < data_pages_) emit();
+    return commit(dirty, bytes_synced);
+}
+
+std::string MappedHistoryFile::sync_range(size_t off, size_t len) const {
+    static const size_t sys_page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const size_t start = off / sys_page * sys_page;
+    if (::msync(base_ + start, off + len - start, MS_SYNC) != 0) {
+        return "msync of history file failed: " + std::string(std::strerror(errno));
+    }
+    return "";
+}
+
+std::string MappedHistoryFile::commit(std::vector<uint64_t>& dirty_pages, size_t& bytes_synced) {
+    bytes_synced = 0;
+    std::sort(dirty_pages.begin(), dirty_pages.end());
+    dirty_pages.erase(std::unique(dirty_pages.begin(), dirty_pages.end()), dirty_pages.end());
+
+    // 1) data pages and their checksums, flushed in contiguous runs
+    for (size_t i = 0; i < dirty_pages.size();) {
+        size_t j = i + 1;
+        while (j < dirty_pages.size() && dirty_pages[j] == dirty_pages[j - 1] + 1) j++;
+        for (size_t k = i; k < j; k++) {
+            checksums()[dirty_pages[k]] = crc_of(reinterpret_cast<const uint8_t*>(page_words(dirty_pages[k])), kPageSize);
+        }
+        const size_t len = (j - i) * kPageSize;
+        auto err = sync_range(static_cast<size_t>(data_off_ + dirty_pages[i] * kPageSize), len);
+        if (!err.empty()) return err;
+        err = sync_range(2 * kPageSize + dirty_pages[i] * 4, (j - i) * 4);
+        if (!err.empty()) return err;
+        bytes_synced += len;
+        i = j;
+    }
+
+    // 2) the next generation, into the slot the current one is not in
+    Header h;
+    h.universe_size = universe_size_;
+    h.fingerprint = fingerprint_;
+    h.generation = generation_ + 1;
+    h.used_count = used_count_;
+    h.data_pages = data_pages_;
+    h.data_off = data_off_;
+    const size_t slot = static_cast<size_t>(h.generation % 2) * kPageSize;
+    write_header(base_ + slot, h);
+    auto err = sync_range(slot, kPageSize);
+    if (!err.empty()) return err;
+    bytes_synced += kPageSize;
+    generation_ = h.generation;
+    return "";
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "used_set.hpp"
+
+// Uncompressed history file that is memory-mapped and updated in place
+// (`HISTORY_FORMAT=mapped`), as an alternative to rewriting a compressed blob per change.
+//
+// Layout (little-endian, 4 KiB pages):
+//   page 0, 1   header slots A and B
+//   pages 2..   crc32 of every data page
+//   then        data pages: flat bitset over the universe (bit i of byte i / 8)
+// Header: magic "RNGMAP1\0", version u32, page size u32, universe size u64, fingerprint u64,
+// generation u64, used count u64, data page count u64, data offset u64, crc32 u32.
+//
+// A commit flips bits in the mapping, updates the touched pages' checksums, msyncs those
+// pages, then writes the next generation into the *other* header slot and msyncs it. On
+// open, the valid slot with the highest generation wins, so a torn header write falls back
+// to the previous one. A data page whose checksum fails was being written at crash time;
+// whichever mix of old and new bits it holds is safe to keep (set bits only ever belong to
+// names that were issued or were about to be), so it is accepted and its checksum repaired.
+class MappedHistoryFile {
+public:
+    // Bitset budget; larger universes need the compressed blob format.
+    static constexpr uint64_t kMaxUniverse = uint64_t{1} << 35;  // 4 GiB file
+
+    static bool is_mapped_file(const std::string& path);
+
+    // Returns empty string on success; otherwise an error message.
+    static std::string open(const std::string& path, std::unique_ptr<MappedHistoryFile>& out);
+    // Writes a fresh file (temp + rename) holding `used`, and maps it.
+    static std::string create(const std::string& path, uint64_t universe_size, uint64_t fingerprint,
+                              const UsedView& used, std::unique_ptr<MappedHistoryFile>& out);
+    ~MappedHistoryFile();
+
+    MappedHistoryFile(const MappedHistoryFile&) = delete;
+    MappedHistoryFile& operator=(const MappedHistoryFile&) = delete;
+
+    uint64_t universe_size() const { return universe_size_; }
+    uint64_t fingerprint() const { return fingerprint_; }
+    uint64_t generation() const { return generation_; }
+
+    // Data pages whose checksum failed on load and were accepted as they were (see above).
+    // `had_names` counts those whose stored checksum is not the empty page's: names were
+    // committed there, so bits that are now clear may be lost data rather than a torn write.
+    struct Repairs {
+        std::vector<uint64_t> pages;
+        size_t had_names = 0;
+    };
+
+    // Replaces `out` with the file's members, repairing checksums as needed.
+    Repairs load_into(UsedSet& out);
+
+    // Commits newly used indices: O(touched pages). `bytes_synced` is the amount flushed.
+    std::string mark(const std::vector<size_t>& added, size_t& bytes_synced);
+    // Commits the file to exactly `used` (writing only the pages that differ).
+    std::string store(const UsedView& used, size_t& bytes_synced);
+
+private:
+    MappedHistoryFile() = default;
+
+    uint8_t* base_ = nullptr;
+    size_t len_ = 0;
+    uint64_t universe_size_ = 0;
+    uint64_t fingerprint_ = 0;
+    uint64_t generation_ = 0;
+    uint64_t used_count_ = 0;
+    uint64_t data_pages_ = 0;
+    uint64_t data_off_ = 0;
+    std::vector<uint64_t> mark_pages_;  // mark() scratch, kept for its capacity
+
+    uint64_t* page_words(uint64_t page) const;
+    uint32_t* checksums() const;
+    std::string commit(std::vector<uint64_t>& dirty_pages, size_t& bytes_synced);
+    std::string sync_range(size_t off, size_t len) const;
+};
@@ -0,0 +1,608 @@
+#include "name_index.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "bitset_simd.hpp"
+#include "namegen.hpp"
+#include "trace.hpp"
+
+// Flat per-attribute bitmaps are used while they fit in this budget.
+static constexpr size_t kFlatBitmapBudgetBytes = 64u * 1024 * 1024;
+// Product spaces up to this size are sampled exactly by enumerating them into a bitset.
+static constexpr size_t kEnumerateMax = size_t{1} << 22;
+
+static std::string lower_ascii(std::string_view s) {
+    std::string out(s);
+    for (auto& c : out) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return out;
+}
+
+static int compare_ci(std::string_view a, std::string_view b) {
+    const size_t n = std::min(a.size(), b.size());
+    for (size_t i = 0; i < n; i++) {
+        const int ca = std::tolower(static_cast<unsigned char>(a[i]));
+        const int cb = std::tolower(static_cast<unsigned char>(b[i]));
+        if (ca != cb) return ca < cb ? -1 : 1;
+    }
+    return a.size() == b.size() ? 0 : (a.size() < b.size() ? -1 : 1);
+}
+
+// Sorts the indices [0, n) by name_at(i), case-insensitively (a sorted permutation, 4 bytes
+// per name, instead of a hash map of strings keeps this small for dictionaries with
+// millions of names), and maps each index to the lowest index with the same name.
+template <class NameAt>
+static void group_names(size_t n, NameAt name_at, std::vector<uint32_t>& order, std::vector<uint32_t>& id_of) {
+    order.resize(n);
+    for (size_t j = 0; j < n; j++) order[j] = static_cast<uint32_t>(j);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        const int c = compare_ci(name_at(a), name_at(b));
+        return c != 0 ? c < 0 : a < b;
+    });
+    id_of.assign(n, 0);
+    uint32_t id = 0;
+    for (size_t k = 0; k < n; k++) {
+        const uint32_t j = order[k];
+        if (k == 0 || compare_ci(name_at(order[k - 1]), name_at(j)) != 0) id = j;
+        id_of[j] = id;
+    }
+}
+
+// Indices whose name equals `key` (case-insensitively), ascending.
+template <class NameAt>
+static std::vector<uint32_t> same_name(const std::vector<uint32_t>& order, NameAt name_at, std::string_view key) {
+    auto lo = std::lower_bound(order.begin(), order.end(), key,
+                               [&](uint32_t j, std::string_view k) { return compare_ci(name_at(j), k) < 0; });
+    std::vector<uint32_t> out;
+    for (auto it = lo; it != order.end() && compare_ci(name_at(*it), key) == 0; ++it) out.push_back(*it);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+static void set_word_bit(std::vector<uint64_t>& words, size_t i) {
+    words[i / 64] |= 1ULL << (i % 64);
+}
+
+static std::string not_enough(size_t remaining) {
+    std::ostringstream ss;
+    ss << "not enough unused names remaining (" << remaining << " left)";
+    return ss.str();
+}
+
+static std::unique_ptr<const NameIndex>& instance_slot() {
+    static std::unique_ptr<const NameIndex> idx;
+    return idx;
+}
+
+static std::mutex& instance_mu() {
+    static std::mutex mu;
+    return mu;
+}
+
+const NameIndex& NameIndex::instance() {
+    std::lock_guard<std::mutex> lk(instance_mu());
+    auto& idx = instance_slot();
+    if (!idx) idx.reset(new NameIndex());
+    return *idx;
+}
+
+void NameIndex::reset() {
+    std::lock_guard<std::mutex> lk(instance_mu());
+    instance_slot().reset();
+}
+
+NameIndex::NameIndex() {
+    n_ = namegen::universe_size();
+    firsts_ = namegen::first_name_count();
+    middles_ = namegen::middle_slot_count();
+    lasts_ = namegen::surname_count();
+
+    const size_t bitmap_bytes = (n_ + 7) / 8;
+    flat_ = bitmap_bytes <= kFlatBitmapBudgetBytes / (28 + lasts_);
+    if (!flat_) return;
+
+    ensure_attrs();
+    nwords_ = (n_ + 63) / 64;
+    all_.assign(nwords_, 0);
+    for (auto& g : gender_) g.assign(nwords_, 0);
+    initial_.assign(26, std::vector<uint64_t>(nwords_, 0));
+    surname_.assign(lasts_, {});
+    for (size_t j = 0; j < lasts_; j++) {
+        if (surname_id_of_col_[j] == j) surname_[j].assign(nwords_, 0);
+    }
+
+    const size_t row_len = middles_ * lasts_;
+    for (size_t f = 0; f < firsts_; f++) {
+        const int g = static_cast<int>(namegen::first_name_gender(f));
+        const int letter = initial_of_first_[f] ? initial_of_first_[f] - 'A' : -1;
+        for (size_t c = 0; c < row_len; c++) {
+            const size_t i = f * row_len + c;
+            set_word_bit(all_, i);
+            set_word_bit(gender_[g], i);
+            if (letter >= 0) set_word_bit(initial_[static_cast<size_t>(letter)], i);
+            set_word_bit(surname_[static_cast<size_t>(surname_id_of_col_[c % lasts_])], i);
+        }
+    }
+}
+
+void NameIndex::ensure_attrs() const {
+    std::call_once(attrs_once_, [this] {
+        initial_of_first_.assign(firsts_, 0);
+        for (size_t f = 0; f < firsts_; f++) {
+            const std::string_view first = namegen::first_name_at(f);
+            const int c = first.empty() ? 0 : std::toupper(static_cast<unsigned char>(first[0]));
+            if (c >= 'A' && c <= 'Z') initial_of_first_[f] = static_cast<uint8_t>(c);
+        }
+        group_names(lasts_, namegen::surname_at, surname_order_, surname_id_of_col_);
+        group_names(firsts_, namegen::first_name_at, first_order_, first_id_of_row_);
+    });
+}
+
+std::vector<uint32_t> NameIndex::surname_cols(int id) const {
+    ensure_attrs();
+    return same_name(surname_order_, namegen::surname_at, namegen::surname_at(static_cast<size_t>(id)));
+}
+
+std::vector<uint32_t> NameIndex::first_rows(uint32_t id) const {
+    ensure_attrs();
+    return same_name(first_order_, namegen::first_name_at, namegen::first_name_at(id));
+}
+
+std::string NameIndex::parse_filter(std::string_view gender, std::string_view initial, std::string_view surname,
+                                    NameFilter& out, std::string_view distinct) const {
+    out = NameFilter{};
+    while (!distinct.empty()) {
+        const size_t sep = distinct.find_first_of(",+ ");
+        const std::string what = lower_ascii(distinct.substr(0, sep));
+        distinct.remove_prefix(sep == std::string_view::npos ? distinct.size() : sep + 1);
+        if (what == "first") out.distinct_first = true;
+        else if (what == "last") out.distinct_last = true;
+        else if (!what.empty()) return "distinct must be first, last or first,last";
+    }
+    if (!gender.empty()) {
+        const std::string g = lower_ascii(gender);
+        if (g == "m" || g == "male" || g == "boy") {
+            out.gender = static_cast<int>(namegen::Gender::Male);
+        } else if (g == "f" || g == "female" || g == "girl") {
+            out.gender = static_cast<int>(namegen::Gender::Female);
+        } else {
+            return "gender must be m or f";
+        }
+    }
+    if (!initial.empty()) {
+        const unsigned char c = static_cast<unsigned char>(initial[0]);
+        if (initial.size() != 1 || !std::isalpha(c)) return "initial must be a single letter";
+        out.initial = static_cast<char>(std::toupper(c));
+    }
+    if (!surname.empty()) {
+        ensure_attrs();
+        auto it = std::lower_bound(surname_order_.begin(), surname_order_.end(), surname,
+                                   [](uint32_t j, std::string_view k) { return compare_ci(namegen::surname_at(j), k) < 0; });
+        if (it == surname_order_.end() || compare_ci(namegen::surname_at(*it), surname) != 0) return "unknown surname";
+        out.surname = static_cast<int>(surname_id_of_col_[*it]);
+    }
+    return "";
+}
+
+std::string NameIndex::parse_first_name(std::string_view first, uint32_t& out) const {
+    ensure_attrs();
+    auto it = std::lower_bound(first_order_.begin(), first_order_.end(), first,
+                               [](uint32_t j, std::string_view k) { return compare_ci(namegen::first_name_at(j), k) < 0; });
+    if (it == first_order_.end() || compare_ci(namegen::first_name_at(*it), first) != 0) return "unknown first name";
+    out = first_id_of_row_[*it];
+    return "";
+}
+
+uint32_t NameIndex::first_name_id(size_t first_idx) const {
+    ensure_attrs();
+    return first_id_of_row_[first_idx];
+}
+
+uint32_t NameIndex::surname_id(size_t last_idx) const {
+    ensure_attrs();
+    return surname_id_of_col_[last_idx];
+}
+
+bool NameIndex::matches(const NameFilter& filter, size_t idx) const {
+    if (filter.any()) return idx < n_;
+    if (idx >= n_) return false;
+    ensure_attrs();
+    const size_t f = idx / (middles_ * lasts_);
+    const size_t l = idx % lasts_;
+    if (filter.gender >= 0 && static_cast<int>(namegen::first_name_gender(f)) != filter.gender) return false;
+    if (filter.initial && initial_of_first_[f] != static_cast<uint8_t>(filter.initial)) return false;
+    if (filter.surname >= 0 && surname_id_of_col_[l] != static_cast<uint32_t>(filter.surname)) return false;
+    return true;
+}
+
+// -------------------------
+// Flat bitmaps (small universes)
+// -------------------------
+void NameIndex::flat_candidates(const NameFilter& filter, const UsedView& used, std::pmr::vector<uint64_t>& out_words) const {
+    out_words.assign(all_.begin(), all_.end());
+    if (filter.gender >= 0) bitset_simd::and_into(out_words.data(), gender_[filter.gender].data(), nwords_);
+    if (filter.initial) {
+        bitset_simd::and_into(out_words.data(), initial_[static_cast<size_t>(filter.initial - 'A')].data(), nwords_);
+    }
+    if (filter.surname >= 0) {
+        bitset_simd::and_into(out_words.data(), surname_[static_cast<size_t>(filter.surname)].data(), nwords_);
+    }
+    used.clear_members_in(out_words.data(), nwords_);
+}
+
+// -------------------------
+// Product space (large universes)
+// -------------------------
+size_t NameIndex::distinct_capacity(const NameFilter& filter) const {
+    if (!filter.distinct()) return SIZE_MAX;
+    ensure_attrs();
+    const Product p = product_for(filter);
+    size_t cap = p.total;
+    if (filter.distinct_first) {
+        std::unordered_set<uint32_t> ids;
+        for (size_t i = 0; i < p.row_count; i++) ids.insert(first_id_of_row_[p.all_rows ? i : p.rows[i]]);
+        cap = std::min(cap, ids.size());
+    }
+    if (filter.distinct_last) {
+        std::unordered_set<uint32_t> ids;
+        for (size_t i = 0; i < p.col_count; i++) ids.insert(surname_id_of_col_[p.all_cols ? i : p.cols[i]]);
+        cap = std::min(cap, ids.size());
+    }
+    return cap;
+}
+
+NameIndex::Product NameIndex::product_for(const NameFilter& filter) const {
+    Product p;
+    if (filter.gender >= 0 || filter.initial) {
+        ensure_attrs();
+        p.all_rows = false;
+        for (size_t f = 0; f < firsts_; f++) {
+            if (filter.gender >= 0 && static_cast<int>(namegen::first_name_gender(f)) != filter.gender) continue;
+            if (filter.initial && initial_of_first_[f] != static_cast<uint8_t>(filter.initial)) continue;
+            p.rows.push_back(static_cast<uint32_t>(f));
+        }
+    }
+    if (filter.surname >= 0) {
+        ensure_attrs();
+        p.all_cols = false;
+        p.cols = surname_cols(filter.surname);
+    }
+    p.row_count = p.all_rows ? firsts_ : p.rows.size();
+    p.col_count = p.all_cols ? lasts_ : p.cols.size();
+    p.total = p.row_count * middles_ * p.col_count;
+    return p;
+}
+
+size_t NameIndex::count_matching(const NameFilter& filter) const {
+    if (filter.any()) return n_;
+    if (flat_) {
+        std::pmr::vector<uint64_t> words;
+        flat_candidates(filter, UsedSet{}, words);
+        return bitset_simd::popcount(words.data(), words.size());
+    }
+    return product_for(filter).total;
+}
+
+size_t NameIndex::count_used_matching(const NameFilter& filter, const UsedView& used) const {
+    if (filter.any()) return used.size();
+    size_t count = 0;
+    used.visit([&](uint64_t idx) {
+        if (matches(filter, static_cast<size_t>(idx))) count++;
+    });
+    return count;
+}
+
+size_t NameIndex::count_remaining(const NameFilter& filter, const UsedView& used,
+                                  std::pmr::memory_resource* mr) const {
+    if (flat_ && !filter.any()) {
+        std::pmr::vector<uint64_t> words(mr);
+        flat_candidates(filter, used, words);
+        return bitset_simd::popcount(words.data(), words.size());
+    }
+    const size_t total = count_matching(filter);
+    const size_t used_matching = count_used_matching(filter, used);
+    return used_matching > total ? 0 : total - used_matching;
+}
+
+std::string NameIndex::sample_unused(const NameFilter& filter, const UsedView& used, size_t k,
+                                     std::mt19937& rng, std::pmr::vector<size_t>& out_idx) const {
+    out_idx.clear();
+    std::pmr::memory_resource* mr = out_idx.get_allocator().resource();
+    if (filter.distinct()) return sample_distinct(filter, used, k, rng, out_idx);
+    if (flat_) {
+        std::pmr::vector<uint64_t> words(mr);
+        {
+            Trace::Span span("unused_scan");
+            flat_candidates(filter, used, words);
+        }
+        sample(words, k, rng, out_idx);
+        if (out_idx.size() != k) return not_enough(bitset_simd::popcount(words.data(), words.size()));
+        return "";
+    }
+
+    const Product p = product_for(filter);
+    const size_t remaining = p.total - std::min(p.total, count_used_matching(filter, used));
+    if (k > remaining) return not_enough(remaining);
+
+    // rank <-> universe index within the product rows x middles x cols
+    const size_t row_len = middles_ * lasts_;
+    auto index_of_rank = [&](size_t r) {
+        const size_t ci = r % p.col_count;
+        const size_t rest = r / p.col_count;
+        const size_t m = rest % middles_;
+        const size_t ri = rest / middles_;
+        const size_t f = p.all_rows ? ri : p.rows[ri];
+        const size_t l = p.all_cols ? ci : p.cols[ci];
+        return f * row_len + m * lasts_ + l;
+    };
+
+    if (p.total <= kEnumerateMax) {
+        Trace::Span span("unused_scan");
+        std::pmr::vector<uint64_t> words((p.total + 63) / 64, ~0ULL, mr);
+        if (p.total % 64) words.back() = (1ULL << (p.total % 64)) - 1;
+        used.visit([&](uint64_t idx) {
+            if (!matches(filter, static_cast<size_t>(idx))) return;
+            const size_t f = static_cast<size_t>(idx) / row_len;
+            const size_t m = (static_cast<size_t>(idx) / lasts_) % middles_;
+            const size_t l = static_cast<size_t>(idx) % lasts_;
+            const size_t ri = p.all_rows ? f
+                : static_cast<size_t>(std::lower_bound(p.rows.begin(), p.rows.end(), f) - p.rows.begin());
+            const size_t ci = p.all_cols ? l
+                : static_cast<size_t>(std::lower_bound(p.cols.begin(), p.cols.end(), l) - p.cols.begin());
+            const size_t r = (ri * middles_ + m) * p.col_count + ci;
+            words[r / 64] &= ~(1ULL << (r % 64));
+        });
+        std::pmr::vector<size_t> ranks(mr);
+        sample(words, k, rng, ranks);
+        if (ranks.size() != k) return not_enough(remaining);
+        out_idx.reserve(k);
+        for (size_t r : ranks) out_idx.push_back(index_of_rank(r));
+        return "";
+    }
+
+    // Huge product space: draw ranks and reject used ones. The space is far larger than
+    // anything issued so far in practice; the attempt cap only guards pathological fills.
+    std::pmr::unordered_set<size_t> picked(mr);
+    picked.reserve(k * 2);
+    std::uniform_int_distribution<size_t> dist(0, p.total - 1);
+    size_t attempts = 0;
+    const size_t max_attempts = 64 * k + 4096;
+    while (out_idx.size() < k) {
+        if (++attempts > max_attempts) return "could not find unused names (universe nearly exhausted for this filter)";
+        const size_t idx = index_of_rank(dist(rng));
+        if (used.contains(idx) || !picked.insert(idx).second) continue;
+        out_idx.push_back(idx);
+    }
+    return "";
+}
+
+// -------------------------
+// Distinct draws (distinct=first,last)
+// -------------------------
+namespace {
+
+// Prefix sums over per-column values, updated in O(log n).
+struct Fenwick {
+    Fenwick(size_t n, std::pmr::memory_resource* mr) : tree(n + 1, 0, mr) {}
+    void add(size_t i, int64_t delta) {
+        for (++i; i < tree.size(); i += i & (~i + 1)) tree[i] += delta;
+    }
+    std::pmr::vector<int64_t> tree;
+};
+
+}  // namespace
+
+// The matching names form a grid: rows (first names) x middles x columns (surnames). The
+// sampler keeps, per column, how many of its cells are used (or already picked) within the
+// rows still allowed; a column's weight is then base - used[c], where base = allowed rows x
+// middles. Two Fenwick trees over the columns (allowed-column count and used count) make a
+// weighted column draw O(log columns); the cell is then drawn within that column, by
+// rejection while at least a quarter of it is free and by a scan of it otherwise. Taking a
+// surname removes its columns from the trees; taking a first name removes its rows and
+// subtracts the used cells recorded for them. Nothing retries against the whole grid, so
+// the cost does not grow as the universe fills.
+std::string NameIndex::sample_distinct(const NameFilter& filter, const UsedView& used, size_t k,
+                                       std::mt19937& rng, std::pmr::vector<size_t>& out_idx) const {
+    Trace::Span span("sample_distinct");
+    std::pmr::memory_resource* mr = out_idx.get_allocator().resource();
+    ensure_attrs();
+    const char* what = filter.distinct_first && filter.distinct_last ? "first names and surnames"
+                       : filter.distinct_first                       ? "first names"
+                                                                     : "surnames";
+    const size_t cap = distinct_capacity(filter);
+    if (k > cap) {
+        std::ostringstream ss;
+        ss << "only " << cap << " names can have distinct " << what;
+        return ss.str();
+    }
+    auto not_enough_distinct = [&]() {
+        std::ostringstream ss;
+        ss << "not enough unused names with distinct " << what << " (" << out_idx.size() << " found)";
+        out_idx.clear();
+        return ss.str();
+    };
+
+    const Product p = product_for(filter);
+    const size_t row_len = middles_ * lasts_;
+    auto row_at = [&](size_t ri) { return p.all_rows ? ri : static_cast<size_t>(p.rows[ri]); };
+    auto col_at = [&](size_t ci) { return p.all_cols ? ci : static_cast<size_t>(p.cols[ci]); };
+    auto row_pos = [&](size_t f) -> size_t {
+        if (p.all_rows) return f;
+        auto it = std::lower_bound(p.rows.begin(), p.rows.end(), f);
+        return it != p.rows.end() && *it == f ? static_cast<size_t>(it - p.rows.begin()) : SIZE_MAX;
+    };
+    auto col_pos = [&](size_t l) -> size_t {
+        if (p.all_cols) return l;
+        auto it = std::lower_bound(p.cols.begin(), p.cols.end(), l);
+        return it != p.cols.end() && *it == l ? static_cast<size_t>(it - p.cols.begin()) : SIZE_MAX;
+    };
+
+    // Allowed rows: `live` in any order, `slot` locating each row in it (for O(1) removal).
+    std::pmr::vector<uint32_t> live(p.row_count, mr);
+    std::pmr::vector<uint32_t> slot(p.row_count, mr);
+    for (size_t i = 0; i < p.row_count; i++) live[i] = slot[i] = static_cast<uint32_t>(i);
+    std::pmr::vector<bool> col_taken(p.col_count, false, mr);
+    std::pmr::vector<int64_t> col_used(p.col_count, 0, mr);
+    // Used cells per row, by column, to update col_used when the row is taken.
+    std::pmr::unordered_map<uint32_t, std::pmr::vector<uint32_t>> row_cells(mr);
+    std::pmr::unordered_set<size_t> picked(mr);
+    picked.reserve(k * 2);
+
+    Fenwick cols_left(p.col_count, mr);
+    Fenwick cells_used(p.col_count, mr);
+    for (size_t i = 0; i < p.col_count; i++) cols_left.add(i, 1);
+    int64_t cols_left_total = static_cast<int64_t>(p.col_count);
+    int64_t cells_used_total = 0;
+
+    auto count_used = [&](size_t ri, size_t ci) {
+        col_used[ci]++;
+        cells_used.add(ci, 1);
+        cells_used_total++;
+        if (filter.distinct_first) row_cells[static_cast<uint32_t>(ri)].push_back(static_cast<uint32_t>(ci));
+    };
+    {
+        Trace::Span scan_span("unused_scan");
+        used.visit([&](uint64_t idx) {
+            if (!matches(filter, static_cast<size_t>(idx))) return;
+            const size_t ri = row_pos(static_cast<size_t>(idx) / row_len);
+            const size_t ci = col_pos(static_cast<size_t>(idx) % lasts_);
+            if (ri != SIZE_MAX && ci != SIZE_MAX) count_used(ri, ci);
+        });
+    }
+
+    auto take_col = [&](size_t ci) {
+        if (col_taken[ci]) return;
+        col_taken[ci] = true;
+        cols_left.add(ci, -1);
+        cols_left_total--;
+        cells_used.add(ci, -col_used[ci]);
+        cells_used_total -= col_used[ci];
+    };
+    auto take_row = [&](size_t ri) {
+        const uint32_t s = slot[ri];
+        if (s == UINT32_MAX) return;
+        live[s] = live.back();
+        slot[live[s]] = s;
+        live.pop_back();
+        slot[ri] = UINT32_MAX;
+        auto it = row_cells.find(static_cast<uint32_t>(ri));
+        if (it == row_cells.end()) return;
+        for (uint32_t ci : it->second) {
+            col_used[ci]--;
+            if (col_taken[ci]) continue;
+            cells_used.add(ci, -1);
+            cells_used_total--;
+        }
+        row_cells.erase(it);
+    };
+
+    size_t top = 1;
+    while (top * 2 <= p.col_count) top *= 2;
+    std::pmr::vector<size_t> free_cells(mr);
+    out_idx.reserve(k);
+    while (out_idx.size() < k) {
+        const int64_t base = static_cast<int64_t>(live.size() * middles_);
+        const int64_t total = cols_left_total * base - cells_used_total;
+        if (total <= 0) return not_enough_distinct();
+
+        // Column: the first whose prefix weight exceeds u (weights are base - used).
+        int64_t u = std::uniform_int_distribution<int64_t>(0, total - 1)(rng);
+        size_t ci = 0;
+        for (size_t step = top; step; step >>= 1) {
+            const size_t next = ci + step;
+            if (next > p.col_count) continue;
+            const int64_t w = cols_left.tree[next] * base - cells_used.tree[next];
+            if (w <= u) {
+                ci = next;
+                u -= w;
+            }
+        }
+        const size_t l = col_at(ci);
+        auto cell = [&](size_t ri, size_t m) { return row_at(ri) * row_len + m * lasts_ + l; };
+        auto is_free = [&](size_t idx) { return !used.contains(idx) && !picked.count(idx); };
+
+        size_t idx = SIZE_MAX;
+        if ((base - col_used[ci]) * 4 >= base) {
+            std::uniform_int_distribution<size_t> pick_row(0, live.size() - 1);
+            std::uniform_int_distribution<size_t> pick_middle(0, middles_ - 1);
+            for (int attempt = 0; attempt < 64 && idx == SIZE_MAX; attempt++) {
+                const size_t c = cell(live[pick_row(rng)], pick_middle(rng));
+                if (is_free(c)) idx = c;
+            }
+        }
+        if (idx == SIZE_MAX) {
+            free_cells.clear();
+            for (uint32_t ri : live) {
+                for (size_t m = 0; m < middles_; m++) {
+                    if (is_free(cell(ri, m))) free_cells.push_back(cell(ri, m));
+                }
+            }
+            if (free_cells.empty()) return not_enough_distinct();
+            idx = free_cells[std::uniform_int_distribution<size_t>(0, free_cells.size() - 1)(rng)];
+        }
+        picked.insert(idx);
+        out_idx.push_back(idx);
+
+        const size_t ri = row_pos(idx / row_len);
+        if (filter.distinct_last) {
+            for (uint32_t col : surname_cols(static_cast<int>(surname_id_of_col_[l]))) {
+                if (const size_t pos = col_pos(col); pos != SIZE_MAX) take_col(pos);
+            }
+        } else {
+            count_used(ri, ci);
+        }
+        if (filter.distinct_first) {
+            for (uint32_t row : first_rows(first_id_of_row_[idx / row_len])) {
+                if (const size_t pos = row_pos(row); pos != SIZE_MAX) take_row(pos);
+            }
+        }
+    }
+    return "";
+}
+
+void NameIndex::sample(const std::pmr::vector<uint64_t>& words, size_t k, std::mt19937& rng,
+                       std::pmr::vector<size_t>& out_idx) {
+    out_idx.clear();
+    std::pmr::memory_resource* mr = out_idx.get_allocator().resource();
+    const size_t total = bitset_simd::popcount(words.data(), words.size());
+    if (k == 0 || k > total) return;
+
+    // Floyd's algorithm: k distinct ranks in [0, total) without materializing the candidates.
+    std::pmr::unordered_set<size_t> picked(mr);
+    picked.reserve(k * 2);
+    for (size_t j = total - k; j < total; j++) {
+        const size_t t = std::uniform_int_distribution<size_t>(0, j)(rng);
+        if (!picked.insert(t).second) picked.insert(j);
+    }
+    std::pmr::vector<size_t> ranks(picked.begin(), picked.end(), mr);
+    std::sort(ranks.begin(), ranks.end());
+
+    // Map ranks to bit positions with one forward pass over the words.
+    out_idx.reserve(k);
+    size_t seen = 0;
+    size_t r = 0;
+    for (size_t w = 0; w < words.size() && r < ranks.size(); w++) {
+        uint64_t word = words[w];
+        const size_t pc = static_cast<size_t>(__builtin_popcountll(word));
+        if (seen + pc <= ranks[r]) {
+            seen += pc;
+            continue;
+        }
+        while (word) {
+            const int bit = __builtin_ctzll(word);
+            if (r < ranks.size() && seen == ranks[r]) {
+                out_idx.push_back(w * 64 + static_cast<size_t>(bit));
+                r++;
+            }
+            seen++;
+            word &= word - 1;
+        }
+    }
+    Trace::Span span("shuffle");
+    std::shuffle(out_idx.begin(), out_idx.end(), rng);
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "used_set.hpp"
+
+// Attribute filter for constrained sampling (`gender=f&initial=A&surname=Patel`).
+// Unset fields match everything; set fields are AND-ed together.
+struct NameFilter {
+    int gender = -1;   // -1 = any, else static_cast<int>(namegen::Gender)
+    char initial = 0;  // 0 = any, else 'A'..'Z' (first letter of the first name)
+    int surname = -1;  // -1 = any, else surname id (lowest surname index with that name)
+    // Not attributes but constraints on one draw (`distinct=first,last`): no two names it
+    // returns share a first name / a surname (compared case-insensitively).
+    bool distinct_first = false;
+    bool distinct_last = false;
+
+    bool any() const { return gender < 0 && initial == 0 && surname < 0; }
+    bool distinct() const { return distinct_first || distinct_last; }
+};
+
+// Attribute indexes over the name universe, used to sample unused names matching a filter.
+//
+// Small universes (the built-in lists) get per-attribute bitmaps over universe indices:
+// a query ANDs the selected bitmaps and clears used indices, O(universe / 64) vectorized
+// word operations regardless of selectivity or fill level.
+//
+// Large (dictionary) universes can have billions of indices, so bitmaps over the universe
+// are not an option. Every filter attribute belongs to either the first name (gender,
+// initial) or the surname, so the matching set is a product rows x middles x columns:
+// it is counted arithmetically, and sampled by drawing ranks in that product (exactly,
+// by enumeration, when the product is small; by rejecting used indices otherwise).
+class NameIndex {
+public:
+    static const NameIndex& instance();
+    // Drops the index so the next instance() rebuilds it for the active universe.
+    static void reset();
+
+    // Parses query-string values ("m"/"f", a letter, a surname, "first"/"last"/"first,last").
+    // Empty values mean "any". Returns empty string on success; otherwise an error message.
+    std::string parse_filter(std::string_view gender, std::string_view initial, std::string_view surname,
+                             NameFilter& out, std::string_view distinct = {}) const;
+
+    // Case-insensitive first-name lookup; `out` is its id (the lowest first-name index with
+    // that name, like NameFilter::surname). Returns empty string on success; otherwise an
+    // error message.
+    std::string parse_first_name(std::string_view first, uint32_t& out) const;
+
+    // Id of a first-name index / surname index (see parse_first_name).
+    uint32_t first_name_id(size_t first_idx) const;
+    uint32_t surname_id(size_t last_idx) const;
+
+    // Most names one draw with `filter`'s distinct constraints can return (used or not):
+    // the number of different first names and/or surnames matching it. SIZE_MAX without
+    // constraints.
+    size_t distinct_capacity(const NameFilter& filter) const;
+
+    // Number of universe indices matching `filter` (used or not).
+    size_t count_matching(const NameFilter& filter) const;
+
+    // Number of unused names matching `filter`. Scratch bitsets come from `mr`.
+    size_t count_remaining(const NameFilter& filter, const UsedView& used,
+                           std::pmr::memory_resource* mr = std::pmr::get_default_resource()) const;
+
+    // Picks `k` distinct unused indices matching `filter` uniformly at random (with distinct
+    // constraints: each pick is uniform over the unused matching names that keep the draw
+    // distinct). Scratch memory comes from `out_idx`'s resource.
+    // Returns empty string on success; otherwise an error message.
+    std::string sample_unused(const NameFilter& filter, const UsedView& used, size_t k,
+                              std::mt19937& rng, std::pmr::vector<size_t>& out_idx) const;
+
+    // Picks `k` distinct set bits of `words` uniformly at random (k <= popcount(words)).
+    static void sample(const std::pmr::vector<uint64_t>& words, size_t k, std::mt19937& rng,
+                       std::pmr::vector<size_t>& out_idx);
+
+    // True when `idx` matches `filter`.
+    bool matches(const NameFilter& filter, size_t idx) const;
+
+private:
+    NameIndex();
+
+    // Matching first-name rows and surname columns; empty vectors + flags mean "all".
+    struct Product {
+        bool all_rows = true;
+        bool all_cols = true;
+        std::vector<uint32_t> rows; // sorted first-name indices
+        std::vector<uint32_t> cols; // sorted surname indices
+        size_t row_count = 0;
+        size_t col_count = 0;
+        size_t total = 0;
+    };
+
+    size_t n_ = 0;
+    size_t firsts_ = 0;
+    size_t middles_ = 1;
+    size_t lasts_ = 0;
+    bool flat_ = false;
+
+    // Flat mode only.
+    size_t nwords_ = 0;
+    std::vector<uint64_t> all_;                    // bits [0, n) set
+    std::vector<uint64_t> gender_[2];
+    std::vector<std::vector<uint64_t>> initial_;   // 'A'..'Z'
+    std::vector<std::vector<uint64_t>> surname_;   // by surname id (empty for non-ids)
+
+    // Both modes; built on first use so a large dictionary is not scanned at startup.
+    mutable std::once_flag attrs_once_;
+    mutable std::vector<uint8_t> initial_of_first_;   // 'A'..'Z' or 0
+    mutable std::vector<uint32_t> surname_order_;     // surname indices sorted case-insensitively
+    mutable std::vector<uint32_t> surname_id_of_col_; // surname index -> id
+    mutable std::vector<uint32_t> first_order_;       // first-name indices sorted case-insensitively
+    mutable std::vector<uint32_t> first_id_of_row_;   // first-name index -> id
+    void ensure_attrs() const;
+    std::vector<uint32_t> surname_cols(int id) const;
+    std::vector<uint32_t> first_rows(uint32_t id) const;
+
+    std::string sample_distinct(const NameFilter& filter, const UsedView& used, size_t k, std::mt19937& rng,
+                                std::pmr::vector<size_t>& out_idx) const;
+
+    void flat_candidates(const NameFilter& filter, const UsedView& used, std::pmr::vector<uint64_t>& out_words) const;
+    Product product_for(const NameFilter& filter) const;
+    size_t count_used_matching(const NameFilter& filter, const UsedView& used) const;
+};
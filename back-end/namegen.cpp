@@ -1,10 +1,19 @@
 #include "namegen.hpp"
 
 #include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <limits>
-#include <numeric>
 #include <random>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace namegen {
 
@@ -100,78 +109,431 @@ static std::mt19937 seeded_rng() {
     return std::mt19937(seq);
 }
 
-static const std::vector<std::string>& all_full_names() {
-    static const std::vector<std::string> all = []() {
-        const auto& boys = boy_first_names();
-        const auto& girls = girl_first_names();
-        const auto& lasts = surnames_list();
+// -------------------------
+// Universe (built-in lists or a memory-mapped dictionary)
+// -------------------------
+
+// One name list: a built-in vector, or a slice of a dictionary image.
+struct NameList {
+    const std::vector<std::string>* builtin = nullptr;
+    const uint32_t* offsets = nullptr; // count + 1 entries, relative to `data`
+    const char* data = nullptr;
+    size_t count = 0;
+    size_t data_len = 0;
+
+    size_t size() const { return builtin ? builtin->size() : count; }
+
+    std::string_view at(size_t i) const {
+        if (builtin) return (*builtin)[i];
+        const uint32_t b = offsets[i];
+        const uint32_t e = offsets[i + 1];
+        if (e < b || e > data_len) return {}; // corrupt entry; never read out of bounds
+        return std::string_view(data + b, e - b);
+    }
+};
+
+struct Universe {
+    NameList lists[4]; // indexed by ListKind
+    size_t firsts = 0;
+    size_t middle_slots = 1; // 1 + number of middle names (slot 0 = no middle name)
+    size_t size = 0;
+    uint64_t fingerprint = 0;
+    std::string source = "built-in";
+    std::shared_ptr<const void> storage; // keeps the mapping / byte image alive
+
+    const NameList& boys() const { return lists[0]; }
+    const NameList& girls() const { return lists[1]; }
+    const NameList& middles() const { return lists[2]; }
+    const NameList& lasts() const { return lists[3]; }
+};
 
-        std::vector<std::string> out;
-        out.reserve((boys.size() + girls.size()) * lasts.size());
+namespace {
+
+constexpr uint64_t FNV_OFFSET = 1469598103934665603ULL;
+constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+void fnv_bytes(uint64_t& h, std::string_view s) {
+    for (unsigned char c : s) {
+        h ^= static_cast<uint64_t>(c);
+        h *= FNV_PRIME;
+    }
+}
+
+void fnv_sep(uint64_t& h, unsigned char sep) {
+    h ^= static_cast<uint64_t>(sep);
+    h *= FNV_PRIME;
+}
 
-        for (const auto& first : boys) {
-            for (const auto& last : lasts) out.push_back(first + " " + last);
+// FNV-1a over the four lists (names separated by 0xFF, lists by 0xFE). Stored in the
+// dictionary header, and checked against the lists when one is opened.
+uint64_t lists_fingerprint(const NameList* lists) {
+    uint64_t h = FNV_OFFSET;
+    for (int k = 0; k < 4; k++) {
+        for (size_t i = 0; i < lists[k].size(); i++) {
+            fnv_bytes(h, lists[k].at(i));
+            fnv_sep(h, 0xFF);
         }
-        for (const auto& first : girls) {
-            for (const auto& last : lasts) out.push_back(first + " " + last);
+        fnv_sep(h, 0xFE);
+    }
+    return h;
+}
+
+std::string finalize(Universe& u) {
+    u.firsts = u.boys().size() + u.girls().size();
+    u.middle_slots = u.middles().size() + 1;
+    const size_t lasts = u.lasts().size();
+    if (u.firsts == 0 || lasts == 0) return "name dictionary needs at least one first name and one surname";
+    const size_t max = std::numeric_limits<size_t>::max();
+    if (u.firsts > max / u.middle_slots || u.firsts * u.middle_slots > max / lasts) {
+        return "name dictionary universe overflows 64 bits";
+    }
+    u.size = u.firsts * u.middle_slots * lasts;
+    return "";
+}
+
+UniversePtr make_builtin() {
+    auto b = std::make_shared<Universe>();
+    static const std::vector<std::string> no_middles;
+    b->lists[0].builtin = &boy_first_names();
+    b->lists[1].builtin = &girl_first_names();
+    b->lists[2].builtin = &no_middles;
+    b->lists[3].builtin = &surnames_list();
+    (void)finalize(*b);
+    b->fingerprint = lists_fingerprint(b->lists);
+    return b;
+}
+
+UniversePtr& active_slot() {
+    static UniversePtr u = builtin_universe();
+    return u;
+}
+
+const Universe& universe() {
+    return *active_slot();
+}
+
+// Dictionary image layout (little-endian):
+//   magic "RNGD1" (5) | version u8 = 1 | reserved u16
+//   content fingerprint u64 (lists_fingerprint)
+//   4 x { count u64, offsets_pos u64, data_pos u64, data_len u64 }  (boys, girls, middles, surnames)
+//   per list: u32 offsets[count + 1] (4-byte aligned), then the concatenated name bytes
+constexpr size_t kDictHeaderSize = 5 + 1 + 2 + 8 + 4 * 32;
+
+uint64_t read_le64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    return v;
+}
+
+// Parses a dictionary image at `base` (which must stay valid as long as `u` lives).
+std::string parse_image(const uint8_t* base, size_t len, Universe& u) {
+    if (len < kDictHeaderSize) return "name dictionary too small";
+    if (std::memcmp(base, "RNGD1", 5) != 0 || base[5] != 1) return "name dictionary has wrong magic/version";
+    if (reinterpret_cast<uintptr_t>(base) % 4 != 0) return "name dictionary image is misaligned";
+
+    u.fingerprint = read_le64(base + 8);
+    for (int i = 0; i < 4; i++) {
+        const uint8_t* d = base + 16 + 32 * i;
+        const uint64_t count = read_le64(d);
+        const uint64_t offsets_pos = read_le64(d + 8);
+        const uint64_t data_pos = read_le64(d + 16);
+        const uint64_t data_len = read_le64(d + 24);
+        const bool ok = (offsets_pos % 4 == 0) && count < len / 4 &&
+                        offsets_pos + (count + 1) * 4 <= len && data_pos <= len &&
+                        data_len <= len - data_pos && data_len <= std::numeric_limits<uint32_t>::max();
+        if (!ok) return "name dictionary list table is corrupted";
+        NameList& l = u.lists[i];
+        l.offsets = reinterpret_cast<const uint32_t*>(base + offsets_pos);
+        l.data = reinterpret_cast<const char*>(base + data_pos);
+        l.count = static_cast<size_t>(count);
+        l.data_len = static_cast<size_t>(data_len);
+        if (l.offsets[0] != 0 || l.offsets[count] != data_len) return "name dictionary offsets are corrupted";
+    }
+    auto err = finalize(u);
+    if (!err.empty()) return err;
+    // Histories store indices under this fingerprint: lists edited behind a stale one would
+    // turn every stored index into another name, with no migration.
+    if (lists_fingerprint(u.lists) != u.fingerprint) return "name dictionary fingerprint does not match its lists";
+    return "";
+}
+
+void serialize_lists(const NameList* lists, std::vector<uint8_t>& out) {
+    out.assign(kDictHeaderSize, 0);
+    std::memcpy(out.data(), "RNGD1", 5);
+    out[5] = 1;
+    auto put_le64 = [&](size_t pos, uint64_t v) {
+        for (int b = 0; b < 8; b++) out[pos + b] = static_cast<uint8_t>((v >> (8 * b)) & 0xFF);
+    };
+    put_le64(8, lists_fingerprint(lists));
+
+    for (int i = 0; i < 4; i++) {
+        const NameList& names = lists[i];
+        while (out.size() % 4) out.push_back(0);
+        const size_t offsets_pos = out.size();
+        uint32_t off = 0;
+        for (size_t k = 0; k <= names.size(); k++) {
+            for (int b = 0; b < 4; b++) out.push_back(static_cast<uint8_t>((off >> (8 * b)) & 0xFF));
+            if (k < names.size()) off += static_cast<uint32_t>(names.at(k).size());
         }
-        return out;
-    }();
-    return all;
+        const size_t data_pos = out.size();
+        for (size_t k = 0; k < names.size(); k++) {
+            const std::string_view n = names.at(k);
+            out.insert(out.end(), n.begin(), n.end());
+        }
+
+        const size_t d = 16 + 32 * static_cast<size_t>(i);
+        put_le64(d, names.size());
+        put_le64(d + 8, offsets_pos);
+        put_le64(d + 16, data_pos);
+        put_le64(d + 24, off);
+    }
+}
+
+}  // namespace
+
+UniversePtr active_universe() {
+    return active_slot();
+}
+
+UniversePtr builtin_universe() {
+    static const UniversePtr b = make_builtin();
+    return b;
+}
+
+void set_active_universe(UniversePtr u) {
+    if (u) active_slot() = std::move(u);
+}
+
+std::string open_dictionary(const std::string& path, UniversePtr& out) {
+    out.reset();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return "could not open name dictionary: " + std::string(std::strerror(errno));
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return "could not stat name dictionary";
+    }
+    const size_t len = static_cast<size_t>(st.st_size);
+    if (len < kDictHeaderSize) {
+        ::close(fd);
+        return "name dictionary too small";
+    }
+    void* map = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return "mmap of name dictionary failed: " + std::string(std::strerror(errno));
+    // Lookups are random single-name reads; don't let the kernel read ahead megabytes.
+    (void)::madvise(map, len, MADV_RANDOM);
+
+    auto u = std::make_shared<Universe>();
+    u->source = path;
+    u->storage = std::shared_ptr<const void>(map, [len](const void* p) { ::munmap(const_cast<void*>(p), len); });
+    auto err = parse_image(static_cast<const uint8_t*>(map), len, *u);
+    if (!err.empty()) return err;
+    out = std::move(u);
+    return "";
+}
+
+std::string open_dictionary_bytes(std::vector<uint8_t> bytes, const std::string& source, UniversePtr& out) {
+    out.reset();
+    auto owned = std::make_shared<std::vector<uint8_t>>(std::move(bytes));
+    auto u = std::make_shared<Universe>();
+    u->source = source;
+    auto err = parse_image(owned->data(), owned->size(), *u);
+    if (!err.empty()) return err;
+    u->storage = owned;
+    out = std::move(u);
+    return "";
+}
+
+void serialize_dictionary(const Universe& u, std::vector<uint8_t>& out) {
+    serialize_lists(u.lists, out);
+}
+
+std::string load_dictionary(const std::string& path) {
+    UniversePtr u;
+    auto err = open_dictionary(path, u);
+    if (!err.empty()) return err;
+    set_active_universe(std::move(u));
+    return "";
+}
+
+std::string load_dictionary_from_env() {
+    const char* path = std::getenv("NAME_DICT_FILE");
+    if (!path || !*path) return "";
+    return load_dictionary(path);
+}
+
+std::string write_dictionary(const std::string& path,
+                             const std::vector<std::string>& boys,
+                             const std::vector<std::string>& girls,
+                             const std::vector<std::string>& middles,
+                             const std::vector<std::string>& lasts) {
+    const std::vector<std::string>* in[4] = {&boys, &girls, &middles, &lasts};
+    NameList views[4];
+    for (int i = 0; i < 4; i++) {
+        views[i].builtin = in[i];
+        uint64_t total = 0;
+        for (const auto& n : *in[i]) total += n.size();
+        if (total > std::numeric_limits<uint32_t>::max()) return "name list too large for dictionary format";
+    }
+    std::vector<uint8_t> out;
+    serialize_lists(views, out);
+
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f) return "could not open dictionary for writing";
+        f.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+        if (!f) return "failed while writing dictionary";
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) return "could not rename dictionary into place";
+    return "";
+}
+
+size_t list_size(const Universe& u, ListKind k) {
+    return u.lists[static_cast<int>(k)].size();
+}
+
+std::string_view list_name_at(const Universe& u, ListKind k, size_t i) {
+    return u.lists[static_cast<int>(k)].at(i);
+}
+
+uint64_t fingerprint_of(const Universe& u) {
+    return u.fingerprint;
+}
+
+size_t size_of(const Universe& u) {
+    return u.size;
+}
+
+const std::string& source_of(const Universe& u) {
+    return u.source;
+}
+
+const std::string& dictionary_source() {
+    return universe().source;
 }
 
 int max_unique_count() {
-    const auto& all = all_full_names();
-    if (all.size() > static_cast<size_t>(std::numeric_limits<int>::max())) {
+    const size_t n = universe().size;
+    if (n > static_cast<size_t>(std::numeric_limits<int>::max())) {
         return std::numeric_limits<int>::max();
     }
-    return static_cast<int>(all.size());
+    return static_cast<int>(n);
 }
 
 size_t universe_size() {
-    return all_full_names().size();
+    return universe().size;
+}
+
+size_t first_name_count() {
+    return universe().firsts;
+}
+
+size_t middle_slot_count() {
+    return universe().middle_slots;
+}
+
+size_t surname_count() {
+    return universe().lasts().size();
+}
+
+std::string_view first_name_at(size_t first_idx) {
+    const auto& u = universe();
+    if (first_idx < u.boys().size()) return u.boys().at(first_idx);
+    return u.girls().at(first_idx - u.boys().size());
+}
+
+std::string_view middle_name_at(size_t middle_slot) {
+    if (middle_slot == 0) return {};
+    return universe().middles().at(middle_slot - 1);
+}
+
+std::string_view surname_at(size_t last_idx) {
+    return universe().lasts().at(last_idx);
 }
 
-const std::string& universe_name_at(size_t idx) {
-    return all_full_names().at(idx);
+Gender first_name_gender(size_t first_idx) {
+    return first_idx < universe().boys().size() ? Gender::Male : Gender::Female;
+}
+
+template <typename Str>
+static void append_full_name(const Universe& u, size_t idx, Str& out) {
+    const size_t lasts = u.lasts().size();
+    const size_t last = idx % lasts;
+    const size_t row = idx / lasts;
+    const size_t middle = row % u.middle_slots;
+    const size_t first = row / u.middle_slots;
+
+    const std::string_view f = first < u.boys().size() ? u.boys().at(first) : u.girls().at(first - u.boys().size());
+    const std::string_view m = middle ? u.middles().at(middle - 1) : std::string_view{};
+    const std::string_view l = u.lasts().at(last);
+    out.reserve(out.size() + f.size() + m.size() + l.size() + 2);
+    out.append(f);
+    if (!m.empty()) {
+        out.push_back(' ');
+        out.append(m);
+    }
+    out.push_back(' ');
+    out.append(l);
+}
+
+std::string full_name_of(const Universe& u, size_t idx) {
+    std::string out;
+    append_full_name(u, idx, out);
+    return out;
+}
+
+std::string universe_name_at(size_t idx) {
+    return full_name_of(universe(), idx);
+}
+
+void append_universe_name(size_t idx, std::pmr::string& out) {
+    append_full_name(universe(), idx, out);
 }
 
 uint64_t universe_fingerprint() {
-    // FNV-1a 64-bit over all bytes of all names.
-    const uint64_t FNV_OFFSET = 1469598103934665603ULL;
-    const uint64_t FNV_PRIME = 1099511628211ULL;
-    uint64_t h = FNV_OFFSET;
+    return universe().fingerprint;
+}
 
-    const auto& all = all_full_names();
-    for (const auto& s : all) {
-        for (unsigned char c : s) {
-            h ^= static_cast<uint64_t>(c);
-            h *= FNV_PRIME;
-        }
+uint64_t legacy_fingerprint_of(const Universe& u) {
+    // FNV-1a 64-bit over all bytes of all full names, in index order (history blob v1).
+    if (u.size > std::numeric_limits<uint32_t>::max()) return 0;
+    uint64_t h = FNV_OFFSET;
+    for (size_t i = 0; i < u.size; i++) {
+        fnv_bytes(h, full_name_of(u, i));
         // Separator so ["ab","c"] != ["a","bc"]
-        h ^= static_cast<uint64_t>(0xFF);
-        h *= FNV_PRIME;
+        fnv_sep(h, 0xFF);
     }
     return h;
 }
 
+uint64_t universe_legacy_fingerprint() {
+    return legacy_fingerprint_of(universe());
+}
+
 std::vector<std::string> generate_names(int count) {
     if (count <= 0 || count > kMaxCount) return {};
 
-    const auto& all = all_full_names();
-    if (count > static_cast<int>(all.size())) return {};
+    const size_t n = universe_size();
+    if (static_cast<size_t>(count) > n) return {};
 
     auto rng = seeded_rng();
 
-    std::vector<size_t> idx(all.size());
-    std::iota(idx.begin(), idx.end(), 0);
+    // Floyd's algorithm: `count` distinct indices without materializing the universe.
+    std::unordered_set<size_t> picked;
+    picked.reserve(static_cast<size_t>(count) * 2);
+    for (size_t j = n - static_cast<size_t>(count); j < n; j++) {
+        const size_t t = std::uniform_int_distribution<size_t>(0, j)(rng);
+        if (!picked.insert(t).second) picked.insert(j);
+    }
+    std::vector<size_t> idx(picked.begin(), picked.end());
     std::shuffle(idx.begin(), idx.end(), rng);
 
     std::vector<std::string> out;
     out.reserve(static_cast<size_t>(count));
-    for (int i = 0; i < count; i++) out.push_back(all[idx[static_cast<size_t>(i)]]);
+    for (size_t i : idx) out.push_back(universe_name_at(i));
     return out;
 }
 
 }  // namespace namegen
-
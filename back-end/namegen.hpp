@@ -2,23 +2,89 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace namegen {
 
 constexpr int kMaxCount = 5000;
 
-// Maximum number of unique full-name combinations available.
+// Name lists come from the built-in tables, or from a binary dictionary file
+// (`NAME_DICT_FILE`, written by back-end/tools/namedict.cpp) that is memory-mapped rather
+// than read: names are served straight from the mapping, so startup cost and RSS do not
+// grow with the dictionary size.
+//
+// Returns empty string on success; otherwise an error message (built-in lists stay active).
+// Must be called before any other function here is used from another thread.
+std::string load_dictionary(const std::string& path);
+std::string load_dictionary_from_env();
+
+std::string write_dictionary(const std::string& path,
+                             const std::vector<std::string>& boys,
+                             const std::vector<std::string>& girls,
+                             const std::vector<std::string>& middles,
+                             const std::vector<std::string>& lasts);
+
+// "built-in" or the dictionary path.
+const std::string& dictionary_source();
+
+// A loaded, immutable name universe. The active one backs every function in this header;
+// others (e.g. the universe an old history blob was written against) are only inspected,
+// for migration.
+struct Universe;
+using UniversePtr = std::shared_ptr<const Universe>;
+
+enum class ListKind { Boys = 0, Girls = 1, Middles = 2, Surnames = 3 };
+
+UniversePtr active_universe();
+UniversePtr builtin_universe();
+// Swaps the active universe. The caller must ensure nothing else is using namegen meanwhile.
+void set_active_universe(UniversePtr u);
+
+std::string open_dictionary(const std::string& path, UniversePtr& out);
+std::string open_dictionary_bytes(std::vector<uint8_t> bytes, const std::string& source, UniversePtr& out);
+void serialize_dictionary(const Universe& u, std::vector<uint8_t>& out);
+
+size_t list_size(const Universe& u, ListKind k);
+std::string_view list_name_at(const Universe& u, ListKind k, size_t i);
+uint64_t fingerprint_of(const Universe& u);
+uint64_t legacy_fingerprint_of(const Universe& u);
+size_t size_of(const Universe& u);
+const std::string& source_of(const Universe& u);
+std::string full_name_of(const Universe& u, size_t idx);
+
+// Maximum number of unique full-name combinations available (clamped to INT_MAX).
 // If you request more than this, uniqueness is impossible.
 int max_unique_count();
 
 // Stable "universe" of possible full names.
 // These are used by the server-side global history store.
 size_t universe_size();
-const std::string& universe_name_at(size_t idx);
+std::string universe_name_at(size_t idx);
+// Same name, appended to `out` (no temporary string).
+void append_universe_name(size_t idx, std::pmr::string& out);
 uint64_t universe_fingerprint();
 
+// Fingerprint used by version-1 history blobs (hash over every full name; O(universe)).
+uint64_t universe_legacy_fingerprint();
+
+// Universe layout:
+//   index = (first_idx * middle_slot_count() + middle_slot) * surname_count() + last_idx
+// First names are all boy names followed by all girl names. Middle slot 0 means "no middle
+// name"; without middle names there is exactly one slot, so index = first * surnames + last.
+enum class Gender { Male, Female };
+
+size_t first_name_count();
+size_t middle_slot_count();
+size_t surname_count();
+std::string_view first_name_at(size_t first_idx);
+std::string_view middle_name_at(size_t middle_slot); // empty for slot 0
+std::string_view surname_at(size_t last_idx);
+Gender first_name_gender(size_t first_idx);
+
 // Generates `count` full names ("First Last").
 // Guarantees: within a single call, names are unique (no duplicates),
 // as long as `count <= max_unique_count()` and `count <= kMaxCount`.
@@ -27,4 +93,3 @@ uint64_t universe_fingerprint();
 std::vector<std::string> generate_names(int count);
 
 }  // namespace namegen
-
@@ -0,0 +1,470 @@
+#include "replication.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "history_store.hpp"
+
+namespace {
+
+enum FrameType : uint8_t {
+    kStart = 1,
+    kSnapshot = 2,
+    kMarks = 3,
+    kHeartbeat = 4,
+};
+
+constexpr char kMagic[4] = {'N', 'G', 'R', '1'};
+constexpr size_t kHelloBytes = 4 + 8 + 8;
+constexpr size_t kFrameHeaderBytes = 1 + 8 + 4;
+constexpr size_t kMaxFramesPerWake = 64;
+
+std::string errno_message(const char* what) {
+    return std::string(what) + ": " + std::strerror(errno);
+}
+
+uint64_t unix_ms() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                     std::chrono::system_clock::now().time_since_epoch())
+                                     .count());
+}
+
+void set_timeouts(int fd, int recv_ms, int send_ms) {
+    timeval rt{recv_ms / 1000, (recv_ms % 1000) * 1000};
+    timeval st{send_ms / 1000, (send_ms % 1000) * 1000};
+    (void)::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &rt, sizeof(rt));
+    (void)::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &st, sizeof(st));
+    const int one = 1;
+    (void)::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+std::string send_all(int fd, const void* data, size_t len, int flags = 0) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        const ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL | flags);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? std::string("send timed out") : errno_message("send");
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return "";
+}
+
+std::string recv_all(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        const ssize_t n = ::recv(fd, p, len, 0);
+        if (n == 0) return "connection closed";
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? std::string("timed out") : errno_message("recv");
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return "";
+}
+
+std::string send_frame(int fd, FrameType type, uint64_t seq, const void* payload, size_t len) {
+    if (len > UINT32_MAX) return "frame too large";
+    uint8_t hdr[kFrameHeaderBytes];
+    const uint32_t len32 = static_cast<uint32_t>(len);
+    hdr[0] = type;
+    std::memcpy(hdr + 1, &seq, 8);
+    std::memcpy(hdr + 9, &len32, 4);
+    auto err = send_all(fd, hdr, sizeof(hdr), len ? MSG_MORE : 0);
+    if (err.empty() && len) err = send_all(fd, payload, len);
+    return err;
+}
+
+}  // namespace
+
+// -------------------------
+// ReplicationPrimary
+// -------------------------
+std::string ReplicationPrimary::start(int port, HistoryStore& store, std::shared_mutex& swap_mu,
+                                      std::unique_ptr<ReplicationPrimary>& out) {
+    out.reset();
+    std::unique_ptr<ReplicationPrimary> p(new ReplicationPrimary());
+    p->store_ = &store;
+    p->swap_mu_ = &swap_mu;
+    std::random_device rd;
+    p->run_id_ = ((static_cast<uint64_t>(rd()) << 32) ^ rd() ^ unix_ms()) | 1;  // never 0
+
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return errno_message("socket");
+    const int one = 1;
+    (void)::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 16) != 0) {
+        const auto err = errno_message("replication listen");
+        ::close(fd);
+        return err;
+    }
+    p->listen_fd_ = fd;
+    p->accept_thread_ = std::thread([raw = p.get()]() { raw->accept_loop(); });
+    out = std::move(p);
+    return "";
+}
+
+ReplicationPrimary::~ReplicationPrimary() {
+    std::vector<std::shared_ptr<Replica>> replicas;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stopping_ = true;
+        replicas = replicas_;
+        for (const auto& r : replicas) ::shutdown(r->fd, SHUT_RDWR);
+    }
+    cv_.notify_all();
+    ::shutdown(listen_fd_, SHUT_RDWR);  // wakes accept()
+    if (accept_thread_.joinable()) accept_thread_.join();
+    for (const auto& r : replicas) {
+        if (r->thread.joinable()) r->thread.join();
+        ::close(r->fd);
+    }
+    ::close(listen_fd_);
+}
+
+void ReplicationPrimary::publish(uint64_t seq, const size_t* idx, size_t n) {
+    Entry e{seq, std::vector<uint64_t>(idx, idx + n)};
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        backlog_marks_ += n;
+        backlog_.push_back(std::move(e));
+        seq_ = seq;
+        while (backlog_marks_ > kBacklogMarks && backlog_.size() > 1) {
+            trimmed_seq_ = backlog_.front().seq;
+            backlog_marks_ -= backlog_.front().idx.size();
+            backlog_.pop_front();
+        }
+    }
+    cv_.notify_all();
+}
+
+void ReplicationPrimary::resync() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        resync_seq_ = seq_;
+        generation_++;
+    }
+    cv_.notify_all();
+}
+
+uint64_t ReplicationPrimary::seq() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return seq_;
+}
+
+std::vector<ReplicationPrimary::ReplicaInfo> ReplicationPrimary::replicas() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::vector<ReplicaInfo> out;
+    for (const auto& r : replicas_) {
+        if (r->done) continue;
+        out.push_back(ReplicaInfo{r->peer, r->sent_seq.load()});
+    }
+    return out;
+}
+
+void ReplicationPrimary::accept_loop() {
+    for (;;) {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        const int fd = ::accept4(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len, SOCK_CLOEXEC);
+        std::lock_guard<std::mutex> lk(mu_);
+        if (stopping_) {
+            if (fd >= 0) ::close(fd);
+            return;
+        }
+        if (fd < 0) continue;  // EINTR, ECONNABORTED, out of fds: the next accept retries
+
+        // Reap replicas that disconnected (their threads have nothing left to lock).
+        for (auto it = replicas_.begin(); it != replicas_.end();) {
+            if ((*it)->done) {
+                (*it)->thread.join();
+                ::close((*it)->fd);
+                it = replicas_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        auto r = std::make_shared<Replica>();
+        r->fd = fd;
+        char host[INET_ADDRSTRLEN] = "?";
+        (void)::inet_ntop(AF_INET, &addr.sin_addr, host, sizeof(host));
+        r->peer = std::string(host) + ":" + std::to_string(ntohs(addr.sin_port));
+        r->thread = std::thread([this, r]() {
+            (void)stream_to(*r);
+            ::shutdown(r->fd, SHUT_RDWR);
+            r->done = true;
+        });
+        replicas_.push_back(std::move(r));
+    }
+}
+
+// Serves one replica until it disconnects; returns why.
+std::string ReplicationPrimary::stream_to(Replica& r) {
+    set_timeouts(r.fd, 10000, 10000);
+    char hello[kHelloBytes];
+    auto err = recv_all(r.fd, hello, sizeof(hello));
+    if (!err.empty()) return err;
+    if (std::memcmp(hello, kMagic, sizeof(kMagic)) != 0) return "not a replica";
+    uint64_t their_run = 0;
+    uint64_t sent = 0;
+    std::memcpy(&their_run, hello + 4, 8);
+    std::memcpy(&sent, hello + 12, 8);
+    err = send_frame(r.fd, kStart, run_id_, nullptr, 0);
+    if (!err.empty()) return err;
+
+    uint64_t generation = 0;
+    bool snapshot = false;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        generation = generation_;
+        // Indices up to resync_seq_ belong to the name lists before a swap.
+        snapshot = their_run != run_id_ || sent == 0 || sent < trimmed_seq_ || sent <= resync_seq_ || sent > seq_;
+    }
+    std::vector<Entry> batch;
+    for (;;) {
+        if (snapshot) {
+            uint64_t seq = 0;
+            std::vector<uint8_t> blob;
+            {
+                std::shared_lock<std::shared_mutex> swap_lock(*swap_mu_);
+                err = store_->replication_snapshot(seq, blob);
+            }
+            if (err.empty()) err = send_frame(r.fd, kSnapshot, seq, blob.data(), blob.size());
+            if (!err.empty()) return err;
+            sent = seq;
+            r.sent_seq = sent;
+            snapshot = false;
+        }
+
+        batch.clear();
+        uint64_t latest = 0;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait_for(lk, std::chrono::milliseconds(kHeartbeatMs),
+                         [&]() { return stopping_ || generation_ != generation || seq_ > sent; });
+            if (stopping_) return "primary stopping";
+            if (generation_ != generation || sent < trimmed_seq_) {
+                generation = generation_;
+                snapshot = true;
+                continue;
+            }
+            auto it = std::lower_bound(backlog_.begin(), backlog_.end(), sent + 1,
+                                       [](const Entry& e, uint64_t seq) { return e.seq < seq; });
+            for (; it != backlog_.end() && batch.size() < kMaxFramesPerWake; ++it) batch.push_back(*it);
+            latest = seq_;
+        }
+
+        if (batch.empty()) {
+            err = send_frame(r.fd, kHeartbeat, latest, nullptr, 0);
+            if (!err.empty()) return err;
+            continue;
+        }
+        for (const Entry& e : batch) {
+            err = send_frame(r.fd, kMarks, e.seq, e.idx.data(), e.idx.size() * sizeof(uint64_t));
+            if (!err.empty()) return err;
+            sent = e.seq;
+            r.sent_seq = sent;
+        }
+    }
+}
+
+// -------------------------
+// ReplicationReplica
+// -------------------------
+std::string ReplicationReplica::start(const std::string& primary, HistoryStore& store, std::shared_mutex& swap_mu,
+                                      std::unique_ptr<ReplicationReplica>& out) {
+    out.reset();
+    const size_t colon = primary.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == primary.size()) {
+        return "the primary must be given as host:port";
+    }
+    std::unique_ptr<ReplicationReplica> r(new ReplicationReplica());
+    r->store_ = &store;
+    r->swap_mu_ = &swap_mu;
+    r->host_ = primary.substr(0, colon);
+    r->port_ = primary.substr(colon + 1);
+    r->status_.primary = primary;
+    r->thread_ = std::thread([raw = r.get()]() { raw->run(); });
+    out = std::move(r);
+    return "";
+}
+
+ReplicationReplica::~ReplicationReplica() {
+    stop();
+}
+
+void ReplicationReplica::stop() {
+    stop_ = true;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (fd_ >= 0) ::shutdown(fd_, SHUT_RDWR);
+    }
+    if (thread_.joinable()) thread_.join();
+}
+
+ReplicationReplica::Status ReplicationReplica::status() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return status_;
+}
+
+void ReplicationReplica::run() {
+    while (!stop_) {
+        int fd = -1;
+        auto err = connect_to_primary(fd);
+        if (err.empty()) {
+            err = follow(fd);
+            std::lock_guard<std::mutex> lk(mu_);
+            fd_ = -1;
+            ::close(fd);
+        }
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            status_.connected = false;
+            status_.error = err;
+        }
+        // Retry once a second.
+        for (int i = 0; i < 10 && !stop_; i++) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+// Non-blocking connect, so an unreachable primary costs at most kTimeoutMs.
+std::string ReplicationReplica::connect_to_primary(int& out_fd) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (const int rc = ::getaddrinfo(host_.c_str(), port_.c_str(), &hints, &res); rc != 0) {
+        return std::string("getaddrinfo: ") + gai_strerror(rc);
+    }
+    std::string err = "no address for " + host_;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        const int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, ai->ai_protocol);
+        if (fd < 0) {
+            err = errno_message("socket");
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            fd_ = fd;
+        }
+        int rc = ::connect(fd, ai->ai_addr, ai->ai_addrlen);
+        if (rc != 0 && errno == EINPROGRESS) {
+            pollfd p{fd, POLLOUT, 0};
+            rc = ::poll(&p, 1, kTimeoutMs);
+            int so_error = 0;
+            socklen_t len = sizeof(so_error);
+            if (rc == 1 && ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len) == 0 && so_error == 0) {
+                rc = 0;
+            } else {
+                errno = rc == 0 ? ETIMEDOUT : (so_error ? so_error : errno);
+                rc = -1;
+            }
+        }
+        if (rc == 0 && !stop_) {
+            (void)::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            out_fd = fd;
+            ::freeaddrinfo(res);
+            return "";
+        }
+        err = stop_ ? std::string("stopped") : errno_message("connect");
+        std::lock_guard<std::mutex> lk(mu_);
+        fd_ = -1;
+        ::close(fd);
+    }
+    ::freeaddrinfo(res);
+    return err;
+}
+
+// Applies the primary's stream until the connection fails; returns why.
+std::string ReplicationReplica::follow(int fd) {
+    // The primary sends at least a heartbeat every kHeartbeatMs.
+    set_timeouts(fd, kTimeoutMs, kTimeoutMs);
+    char hello[kHelloBytes];
+    std::memcpy(hello, kMagic, sizeof(kMagic));
+    std::memcpy(hello + 4, &run_id_, 8);
+    std::memcpy(hello + 12, &applied_, 8);
+    auto err = send_all(fd, hello, sizeof(hello));
+    if (!err.empty()) return err;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        status_.connected = true;
+        status_.error.clear();
+    }
+
+    std::vector<uint8_t> payload;
+    std::vector<uint64_t> marks;
+    for (;;) {
+        uint8_t hdr[kFrameHeaderBytes];
+        err = recv_all(fd, hdr, sizeof(hdr));
+        if (!err.empty()) return "primary: " + err;
+        uint64_t seq = 0;
+        uint32_t len = 0;
+        std::memcpy(&seq, hdr + 1, 8);
+        std::memcpy(&len, hdr + 9, 4);
+        payload.resize(len);
+        if (len) {
+            err = recv_all(fd, payload.data(), len);
+            if (!err.empty()) return "primary: " + err;
+        }
+
+        uint64_t primary_seq = seq;
+        switch (hdr[0]) {
+        case kStart:
+            // A new run numbers its commits from scratch: only a snapshot can follow.
+            if (seq != run_id_) {
+                run_id_ = seq;
+                applied_ = 0;
+            }
+            primary_seq = 0;
+            break;
+        case kSnapshot: {
+            std::shared_lock<std::shared_mutex> swap_lock(*swap_mu_);
+            err = store_->replica_load(payload);
+            if (!err.empty()) return err;
+            applied_ = seq;
+            break;
+        }
+        case kMarks: {
+            if (len % sizeof(uint64_t) != 0) return "malformed marks frame";
+            marks.resize(len / sizeof(uint64_t));
+            std::memcpy(marks.data(), payload.data(), len);
+            std::shared_lock<std::shared_mutex> swap_lock(*swap_mu_);
+            err = store_->replica_apply(marks.data(), marks.size());
+            if (!err.empty()) return err;
+            applied_ = seq;
+            break;
+        }
+        case kHeartbeat:
+            break;
+        default:
+            return "unknown frame type " + std::to_string(hdr[0]);
+        }
+
+        std::lock_guard<std::mutex> lk(mu_);
+        status_.applied_seq = applied_;
+        if (hdr[0] == kStart) status_.primary_seq = applied_;
+        status_.primary_seq = std::max(status_.primary_seq, primary_seq);
+        status_.last_contact_ms = unix_ms();
+    }
+}
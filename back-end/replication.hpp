@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HistoryStore;
+
+// Primary/replica log shipping for the global history store (single-process file backend).
+//
+// The primary (REPLICATION_LISTEN=<port>) publishes the marks of every group commit with
+// the commit's sequence number (HistoryStore::commit_marks) into an in-memory backlog and
+// streams it over TCP to each connected replica. A replica (REPLICA_OF=<host>:<port>)
+// keeps an up-to-date used set from that stream and serves reads locally; its store is
+// read-only until it is promoted (SIGUSR1), which persists the replicated state to its
+// own HISTORY_FILE and, with REPLICATION_LISTEN set, makes it a primary for the others.
+//
+// Stream (native byte order; both ends are this program on the same architecture):
+//   replica -> primary, once:  "NGR1", u64 run id, u64 last applied seq
+//   primary -> replica frames: u8 type, u64 seq, u32 payload bytes, payload
+//     kSnapshot: a history blob (the HISTORY_FILE format) covering marks up to seq
+//     kMarks:    u64 indices marked by the commit numbered seq
+//     kHeartbeat: no payload; seq is the primary's latest (every kHeartbeatMs when idle)
+//     kStart:    no payload; seq is the primary's run id (first frame)
+// A replica that reconnects to the same run resumes from its last seq when the backlog
+// still holds it; otherwise (new run, backlog overrun, name lists changed) it gets a
+// snapshot. Marks are idempotent inserts, so a snapshot may overlap the marks after it.
+//
+// Indices only mean something against one universe, which namegen swaps without locking:
+// both ends take the server's swap lock (`swap_mu`, shared) around encoding and applying,
+// and a swap on the primary (resync()) sends every replica a fresh snapshot.
+class ReplicationPrimary {
+public:
+    static constexpr size_t kBacklogMarks = 1u << 20;  // indices kept for resuming replicas
+    static constexpr int kHeartbeatMs = 1000;
+
+    struct ReplicaInfo {
+        std::string peer;
+        uint64_t sent_seq = 0;
+    };
+
+    // Listens on `port` and serves replicas from `store` on background threads.
+    // Returns empty string on success; otherwise an error message.
+    static std::string start(int port, HistoryStore& store, std::shared_mutex& swap_mu,
+                             std::unique_ptr<ReplicationPrimary>& out);
+    ~ReplicationPrimary();
+
+    // Called by the store, in sequence order, with the marks of commit `seq`.
+    void publish(uint64_t seq, const size_t* idx, size_t n);
+
+    // Called by the store once indices changed meaning (universe swap).
+    void resync();
+
+    uint64_t run_id() const { return run_id_; }
+    uint64_t seq() const;
+    std::vector<ReplicaInfo> replicas() const;
+
+private:
+    struct Entry {
+        uint64_t seq;
+        std::vector<uint64_t> idx;
+    };
+    struct Replica {
+        int fd = -1;  // closed once `thread` is joined
+        std::string peer;
+        std::thread thread;
+        std::atomic<uint64_t> sent_seq{0};
+        std::atomic<bool> done{false};
+    };
+
+    ReplicationPrimary() = default;
+
+    HistoryStore* store_ = nullptr;
+    std::shared_mutex* swap_mu_ = nullptr;
+    int listen_fd_ = -1;
+    uint64_t run_id_ = 0;
+    std::thread accept_thread_;
+
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Entry> backlog_;  // guarded by mu_, ascending seq
+    size_t backlog_marks_ = 0;   // guarded by mu_
+    uint64_t seq_ = 0;           // guarded by mu_: latest published
+    uint64_t trimmed_seq_ = 0;   // guarded by mu_: entries up to here are gone
+    uint64_t resync_seq_ = 0;    // guarded by mu_: entries up to here predate a swap
+    uint64_t generation_ = 0;    // guarded by mu_: resync() count
+    bool stopping_ = false;      // guarded by mu_
+    std::vector<std::shared_ptr<Replica>> replicas_;  // guarded by mu_
+
+    void accept_loop();
+    std::string stream_to(Replica& r);
+};
+
+class ReplicationReplica {
+public:
+    static constexpr int kTimeoutMs = 3000;  // no frame for this long: reconnect
+
+    struct Status {
+        std::string primary;
+        bool connected = false;
+        uint64_t applied_seq = 0;
+        uint64_t primary_seq = 0;
+        uint64_t last_contact_ms = 0;  // unix ms, 0 = never
+        std::string error;             // last failure
+    };
+
+    // Follows the primary at `host:port` into `store` on a background thread.
+    // Returns empty string on success; otherwise an error message.
+    static std::string start(const std::string& primary, HistoryStore& store, std::shared_mutex& swap_mu,
+                             std::unique_ptr<ReplicationReplica>& out);
+    ~ReplicationReplica();
+
+    // Stops following (promotion); returns once the thread has exited.
+    void stop();
+
+    Status status() const;
+
+private:
+    ReplicationReplica() = default;
+
+    HistoryStore* store_ = nullptr;
+    std::shared_mutex* swap_mu_ = nullptr;
+    std::string host_;
+    std::string port_;
+    std::thread thread_;
+    std::atomic<bool> stop_{false};
+
+    mutable std::mutex mu_;
+    int fd_ = -1;            // guarded by mu_: the connection, for stop() to shut down
+    Status status_;          // guarded by mu_
+    uint64_t run_id_ = 0;    // follower thread only
+    uint64_t applied_ = 0;   // follower thread only
+
+    void run();
+    std::string connect_to_primary(int& fd);
+    std::string follow(int fd);
+};
@@ -0,0 +1,42 @@
+#include "request_arena.hpp"
+
+#include <algorithm>
+
+RequestArena& RequestArena::for_this_thread() {
+    static thread_local RequestArena arena;
+    return arena;
+}
+
+RequestArena::RequestArena()
+    : capacity_(kInitialBytes),
+      buffer_(new std::byte[kInitialBytes]) {
+    arena_.emplace(buffer_.get(), capacity_, &upstream_);
+}
+
+void RequestArena::reset() {
+    arena_->release();
+    if (upstream_.borrowed == 0 || capacity_ >= kMaxBytes) {
+        upstream_.borrowed = 0;
+        return;
+    }
+    // The last request did not fit: grow so the next one like it does.
+    const size_t want = std::min(kMaxBytes, std::max(capacity_ * 2, capacity_ + upstream_.borrowed));
+    upstream_.borrowed = 0;
+    arena_.reset();
+    buffer_.reset(new std::byte[want]);
+    capacity_ = want;
+    arena_.emplace(buffer_.get(), capacity_, &upstream_);
+}
+
+void* RequestArena::Upstream::do_allocate(size_t bytes, size_t align) {
+    borrowed += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, align);
+}
+
+void RequestArena::Upstream::do_deallocate(void* p, size_t bytes, size_t align) {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+}
+
+bool RequestArena::Upstream::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+// Per-request memory for the HTTP path.
+//
+// Each thread owns one arena: a monotonic_buffer_resource over a buffer that lives as long
+// as the thread. Everything a request builds (the raw request, headers, query parameters,
+// picked indices, names, the response) is allocated from it, and reset() drops all of it
+// at once without giving the buffer back. When a request outgrows the buffer the overflow
+// comes from the heap, and the next reset() grows the buffer to that high-water mark (up
+// to kMaxBytes), so in steady state a request does no global heap allocation.
+//
+// Arenas are thread_local: a request must be served start to finish on the thread whose
+// arena it uses, and nothing allocated from it may outlive the Scope.
+class RequestArena {
+public:
+    static constexpr size_t kInitialBytes = 64 * 1024;
+    static constexpr size_t kMaxBytes = 8 * 1024 * 1024;
+
+    static RequestArena& for_this_thread();
+
+    std::pmr::memory_resource* resource() { return &*arena_; }
+
+    // Frees everything allocated since the last reset.
+    void reset();
+
+    size_t capacity() const { return capacity_; }
+
+    // Resets the arena when it goes out of scope. Declare it before the objects that use
+    // the arena so they are destroyed first.
+    class Scope {
+    public:
+        explicit Scope(RequestArena& a) : arena_(a) {}
+        ~Scope() { arena_.reset(); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        RequestArena& arena_;
+    };
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+private:
+    // Heap fallback that remembers how much the arena had to borrow.
+    class Upstream : public std::pmr::memory_resource {
+    public:
+        size_t borrowed = 0;
+
+    private:
+        void* do_allocate(size_t bytes, size_t align) override;
+        void do_deallocate(void* p, size_t bytes, size_t align) override;
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+    };
+
+    RequestArena();
+
+    size_t capacity_ = 0;
+    std::unique_ptr<std::byte[]> buffer_;
+    Upstream upstream_;
+    std::optional<std::pmr::monotonic_buffer_resource> arena_;
+};
+
+// Number of global operator new calls made by the calling thread so far (see
+// alloc_counter.cpp). Used by `server --alloc-check`.
+uint64_t thread_heap_allocations();
@@ -1,30 +1,75 @@
 #include <algorithm>
+#include <charconv>
 #include <chrono>
 #include <cctype>
 #include <cerrno>
 #include <cstring>
+#include <cstdio>
 #include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <limits>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <memory_resource>
 #include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include "admission.hpp"
+#include "async_http.hpp"
 #include "history_store.hpp"
+#include "idempotency_cache.hpp"
+#include "name_index.hpp"
 #include "namegen.hpp"
+#include "replication.hpp"
+#include "request_arena.hpp"
+#include "shared_used_bits.hpp"
+#include "tenant_registry.hpp"
+#include "trace.hpp"
+#include "universe_migration.hpp"
+#include "upgrade.hpp"
+#include "uring_engine.hpp"
+#include "weighted_sampler.hpp"
 
 using namespace std;
 
 static std::unique_ptr<HistoryStore> g_history;
+// The global history loads on a background thread (load_history) while the listener is
+// already up; g_history_init_error is written before the state leaves Loading.
+enum class HistoryState { Loading, Ready, Failed };
+static std::atomic<HistoryState> g_history_state{HistoryState::Loading};
 static std::string g_history_init_error;
+static std::unique_ptr<TenantRegistry> g_tenants;
+static std::unique_ptr<ClientRateLimiter> g_rate_limit;  // null: no per-client limit
+static std::unique_ptr<IdempotencyCache> g_idempotency;  // null: Idempotency-Key is ignored
+// Prefork: the workers' caches would not see each other's keys, so a key is refused (501)
+// rather than replayed by one worker and generated anew by the next.
+static bool g_idempotency_refused = false;
+static std::unique_ptr<AsyncHttp> g_outbound;  // gist I/O, driven by serve()'s loop
+// Log shipping (REPLICATION_LISTEN / REPLICA_OF). The primary is never destroyed: it may
+// be started by a promotion while request threads read it.
+static std::atomic<ReplicationPrimary*> g_repl_primary{nullptr};
+static std::unique_ptr<ReplicationReplica> g_repl_replica;
 
 static bool file_exists(const string& path) {
     ifstream in(path, ios::binary);
@@ -47,24 +92,30 @@ static string detect_frontend_root() {
     return "front-end"; // fallback
 }
 
-static string http_date_now() {
+static std::string_view http_date_now() {
     // Minimal; browsers don't require a correct Date header for local dev.
     return "Sat, 01 Jan 2000 00:00:00 GMT";
 }
 
-static string content_type_for_path(const string& path) {
+static constexpr std::string_view kTextPlain = "text/plain; charset=utf-8";
+static constexpr std::string_view kJson = "application/json; charset=utf-8";
+static constexpr std::string_view kNdjson = "application/x-ndjson; charset=utf-8";
+static constexpr std::string_view kCsv = "text/csv; charset=utf-8";
+
+static std::string_view content_type_for_path(std::string_view path) {
     auto dot = path.find_last_of('.');
-    string ext = (dot == string::npos) ? "" : path.substr(dot + 1);
+    std::string_view ext = (dot == string::npos) ? "" : path.substr(dot + 1);
     if (ext == "html") return "text/html; charset=utf-8";
     if (ext == "css") return "text/css; charset=utf-8";
     if (ext == "js") return "application/javascript; charset=utf-8";
-    if (ext == "json") return "application/json; charset=utf-8";
-    return "text/plain; charset=utf-8";
+    if (ext == "json") return kJson;
+    return kTextPlain;
 }
 
-static string json_escape(const string& s) {
-    string out;
-    out.reserve(s.size() + 8);
+// Appends to std::string or std::pmr::string (request arena) alike.
+template <typename Str>
+static void append_json_escaped(Str& out, std::string_view s) {
+    out.reserve(out.size() + s.size() + 8);
     for (unsigned char c : s) {
         switch (c) {
             case '\\': out += "\\\\"; break;
@@ -84,10 +135,94 @@ static string json_escape(const string& s) {
                 }
         }
     }
+}
+
+static string json_escape(std::string_view s) {
+    string out;
+    append_json_escaped(out, s);
     return out;
 }
 
-static string normalize_method(const string& m) {
+template <typename Str>
+static void append_number(Str& out, uint64_t v) {
+    char buf[24];
+    auto r = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, static_cast<size_t>(r.ptr - buf));
+}
+
+// UTC, millisecond precision: 2024-05-01T12:00:00.000Z
+template <typename Str>
+static void append_iso_time(Str& out, uint64_t ms) {
+    const time_t secs = static_cast<time_t>(ms / 1000);
+    tm t{};
+    gmtime_r(&secs, &t);
+    char buf[32];
+    const int n = std::snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ", t.tm_year + 1900,
+                                t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, static_cast<int>(ms % 1000));
+    out.append(buf, static_cast<size_t>(n));
+}
+
+// Unix seconds, or UTC ISO 8601 (2024-05-01, 2024-05-01T12:00, 2024-05-01T12:00:00.250Z).
+// Percent-encoded characters are decoded, since browsers send ':' as %3A.
+static bool parse_time_ms(std::string_view s, uint64_t& out) {
+    char buf[40];
+    size_t len = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (len + 1 >= sizeof(buf)) return false;
+        unsigned v = 0;
+        const char* hex = s.data() + i + 1;
+        if (s[i] == '%' && i + 2 < s.size() && std::from_chars(hex, hex + 2, v, 16).ptr == hex + 2) {
+            buf[len++] = static_cast<char>(v);
+            i += 2;
+        } else {
+            buf[len++] = s[i];
+        }
+    }
+    buf[len] = '\0';
+    if (len == 0) return false;
+
+    uint64_t secs = 0;
+    if (std::from_chars(buf, buf + len, secs).ptr == buf + len) {
+        if (secs > std::numeric_limits<uint64_t>::max() / 1000) return false;
+        out = secs * 1000;
+        return true;
+    }
+
+    int y = 0, mo = 0, d = 0, h = 0, mi = 0, sec = 0, ms = 0, n = 0;
+    if (std::sscanf(buf, "%4d-%2d-%2d%n", &y, &mo, &d, &n) != 3) return false;
+    const char* p = buf + n;
+    if (*p == 'T' || *p == ' ') {
+        if (std::sscanf(p + 1, "%2d:%2d%n", &h, &mi, &n) != 2) return false;
+        p += 1 + n;
+        if (*p == ':') {
+            if (std::sscanf(p + 1, "%2d%n", &sec, &n) != 1) return false;
+            p += 1 + n;
+            if (*p == '.') {
+                int digits = 0;
+                for (p++; std::isdigit(static_cast<unsigned char>(*p)); p++, digits++) {
+                    if (digits < 3) ms = ms * 10 + (*p - '0');
+                }
+                if (digits == 0) return false;
+                for (; digits < 3; digits++) ms *= 10;
+            }
+        }
+    }
+    if (*p == 'Z') p++;
+    if (*p || y < 1970 || mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || sec > 60) return false;
+    tm t{};
+    t.tm_year = y - 1900;
+    t.tm_mon = mo - 1;
+    t.tm_mday = d;
+    t.tm_hour = h;
+    t.tm_min = mi;
+    t.tm_sec = sec;
+    const time_t ts = timegm(&t);
+    if (ts < 0) return false;
+    out = static_cast<uint64_t>(ts) * 1000 + static_cast<uint64_t>(ms);
+    return true;
+}
+
+static string normalize_method(std::string_view m) {
     string out;
     out.reserve(m.size());
     for (unsigned char c : m) {
@@ -96,13 +231,15 @@ static string normalize_method(const string& m) {
     return out;
 }
 
-static unordered_map<string, string> parse_query(const string& query) {
-    unordered_map<string, string> out;
+// Keys and values point into the request target.
+using QueryParams = std::pmr::unordered_map<std::string_view, std::string_view>;
+
+static void parse_query(std::string_view query, QueryParams& out) {
     size_t i = 0;
     while (i < query.size()) {
         size_t amp = query.find('&', i);
         if (amp == string::npos) amp = query.size();
-        string part = query.substr(i, amp - i);
+        std::string_view part = query.substr(i, amp - i);
         size_t eq = part.find('=');
         if (eq == string::npos) {
             out[part] = "";
@@ -111,108 +248,895 @@ static unordered_map<string, string> parse_query(const string& query) {
         }
         i = amp + 1;
     }
-    return out;
 }
 
 // -----------------------------
 // HTTP handling
 // -----------------------------
+// Requests and responses live in the serving thread's RequestArena (see serve()); views
+// point into the raw request, which outlives both.
+struct HttpRequest {
+    explicit HttpRequest(std::pmr::memory_resource* mr) : headers(mr) {}
+
+    std::string_view method;
+    std::string_view target;
+    std::string_view client;  // peer address
+    std::pmr::unordered_map<std::string_view, std::string_view> headers; // keys lower-cased
+};
+
+// Writes part of a streamed body; returns false once the client is gone.
+using BodySink = std::function<bool(std::string_view)>;
+using BodyStream = std::function<void(const BodySink& send)>;
+
+struct HttpResponse;
+// Sends the response to a deferred request; call it once, from any thread.
+using ResponseSink = std::function<void(HttpResponse& res)>;
+using Deferred = std::function<void(ResponseSink reply)>;
+
 struct HttpResponse {
+    explicit HttpResponse(std::pmr::memory_resource* mr) : body(mr), headers(mr) {}
+
     int status = 200;
-    string content_type = "text/plain; charset=utf-8";
-    string body;
-    unordered_map<string, string> headers;
+    std::string_view content_type = kTextPlain;
+    std::pmr::string body;
+    std::pmr::unordered_map<std::string_view, std::pmr::string> headers;  // names are literals
+    // When set, replaces `body`: it runs after the headers are sent, and the response has
+    // no Content-Length (closing the connection ends it).
+    BodyStream stream;
+    // When set, the response is not ready: the request thread calls it with a sink for the
+    // real response and moves on to the next request. It must not refer to the arena.
+    Deferred defer;
 };
 
-static string status_text(int code) {
+// Headers on every API response.
+static void set_api_headers(HttpResponse& res) {
+    res.headers["Cache-Control"] = "no-store";
+    res.headers["Access-Control-Allow-Origin"] = "*";
+    res.headers["Access-Control-Allow-Methods"] = "GET, HEAD";
+    res.headers["Access-Control-Allow-Headers"] = "X-Tenant, Idempotency-Key";
+}
+
+static const char* status_text(int code) {
     switch (code) {
         case 200: return "OK";
         case 400: return "Bad Request";
         case 404: return "Not Found";
         case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 422: return "Unprocessable Content";
+        case 429: return "Too Many Requests";
         case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
         default: return "OK";
     }
 }
 
-static HttpResponse handle_request(const string& method, const string& target) {
-    HttpResponse res;
-    res.headers["Cache-Control"] = "no-store";
-    res.headers["Access-Control-Allow-Origin"] = "*";
-    res.headers["Access-Control-Allow-Methods"] = "GET, HEAD";
+// Turns `res` into a JSON error, keeping its headers.
+static void set_json_error(HttpResponse& res, int status, std::string_view message) {
+    res.status = status;
+    res.content_type = kJson;
+    res.body = "{\"error\":\"";
+    append_json_escaped(res.body, message);
+    res.body += "\"}";
+}
+
+static void handle_tenant_stats(HttpResponse& res) {
+    res.content_type = kJson;
+    if (!g_tenants) {
+        res.body = "{\"tenants\":[]}";
+        return;
+    }
+    const auto t = g_tenants->totals();
+    ostringstream ss;
+    ss << "{\"hot\":" << t.hot << ",\"known\":" << t.known << ",\"memory_bytes\":" << t.memory_bytes
+       << ",\"hits\":" << t.hits << ",\"misses\":" << t.misses << ",\"evictions\":" << t.evictions
+       << ",\"tenants\":[";
+    bool first = true;
+    for (const auto& st : g_tenants->snapshot()) {
+        if (!first) ss << ",";
+        first = false;
+        ss << "{\"id\":\"" << json_escape(st.id) << "\",\"hot\":" << (st.hot ? "true" : "false")
+           << ",\"used\":" << st.used << ",\"memory_bytes\":" << st.memory_bytes
+           << ",\"evictions\":" << st.evictions << ",\"loads\":" << st.io.loads
+           << ",\"persists\":" << st.io.persists << ",\"bytes_read\":" << st.io.bytes_read
+           << ",\"bytes_written\":" << st.io.bytes_written << "}";
+    }
+    ss << "]}";
+    res.body.assign(ss.str());
+}
+
+// GET /api/replication: this process's role and how far behind the other side is.
+static void handle_replication_status(HttpResponse& res) {
+    res.content_type = kJson;
+    ostringstream ss;
+    if (g_history && g_history->read_only() && g_repl_replica) {
+        const auto st = g_repl_replica->status();
+        ss << "{\"role\":\"replica\",\"primary\":\"" << json_escape(st.primary)
+           << "\",\"connected\":" << (st.connected ? "true" : "false") << ",\"applied_seq\":" << st.applied_seq
+           << ",\"primary_seq\":" << st.primary_seq
+           << ",\"lag\":" << (st.primary_seq > st.applied_seq ? st.primary_seq - st.applied_seq : 0)
+           << ",\"last_contact_ms\":" << st.last_contact_ms << ",\"error\":\"" << json_escape(st.error) << "\"}";
+    } else if (const ReplicationPrimary* p = g_repl_primary.load()) {
+        const uint64_t seq = p->seq();
+        char run_id[17];
+        std::snprintf(run_id, sizeof(run_id), "%016llx", static_cast<unsigned long long>(p->run_id()));
+        ss << "{\"role\":\"primary\",\"run_id\":\"" << run_id << "\",\"seq\":" << seq << ",\"replicas\":[";
+        bool first = true;
+        for (const auto& r : p->replicas()) {
+            if (!first) ss << ",";
+            first = false;
+            ss << "{\"peer\":\"" << json_escape(r.peer) << "\",\"sent_seq\":" << r.sent_seq
+               << ",\"lag\":" << (seq > r.sent_seq ? seq - r.sent_seq : 0) << "}";
+        }
+        ss << "]}";
+    } else {
+        ss << "{\"role\":\"standalone\"}";
+    }
+    res.body.assign(ss.str());
+}
+
+// Picks the default store or the tenant's store. On failure fills `res` with the error
+// response and returns false.
+static bool resolve_history(std::string_view tenant, HistoryStore*& out,
+                            std::shared_ptr<HistoryStore>& tenant_hold, HttpResponse& res) {
+    out = nullptr;
+    if (!tenant.empty()) {
+        const string id(tenant);
+        if (!TenantRegistry::is_valid_tenant_id(id)) {
+            set_json_error(res, 400, "invalid tenant id");
+            return false;
+        }
+        auto terr = g_tenants ? g_tenants->acquire(id, tenant_hold) : "tenants disabled";
+        if (!terr.empty()) {
+            set_json_error(res, 500, "history store unavailable: " + terr);
+            return false;
+        }
+        out = tenant_hold.get();
+        return true;
+    }
+    const HistoryState state = g_history_state.load(std::memory_order_acquire);
+    if (state == HistoryState::Loading) {
+        res.headers["Retry-After"] = "1";
+        set_json_error(res, 503, "history store is still loading");
+        return false;
+    }
+    if (!g_history || state == HistoryState::Failed) {
+        set_json_error(res, 500, "history store unavailable: " + g_history_init_error);
+        return false;
+    }
+    out = g_history.get();
+    return true;
+}
+
+// Startup metrics, in ms since the process started; -1 until it happens.
+static const std::chrono::steady_clock::time_point g_started = std::chrono::steady_clock::now();
+static std::atomic<int64_t> g_listening_ms{-1};
+static std::atomic<int64_t> g_first_byte_ms{-1};
+static std::atomic<int64_t> g_ready_ms{-1};
+
+static int64_t ms_since_start() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - g_started)
+        .count();
+}
+
+static void append_startup_ms(ostringstream& ss, const char* key, const std::atomic<int64_t>& v) {
+    ss << "\"" << key << "\":";
+    if (const int64_t ms = v.load(std::memory_order_relaxed); ms >= 0) ss << ms;
+    else ss << "null";
+}
+
+// GET /healthz: the process serves requests. GET /readyz: it also has its history (503
+// while loading, or if loading failed), with the startup metrics either way, and once
+// ready the mapped-file pages whose checksum failed on load (see MappedHistoryFile).
+static void handle_health(bool ready_check, HttpResponse& res) {
+    res.content_type = kJson;
+    const HistoryState state = g_history_state.load(std::memory_order_acquire);
+    ostringstream ss;
+    if (!ready_check) {
+        ss << "{\"status\":\"ok\",\"uptime_ms\":" << ms_since_start() << "}";
+        res.body.assign(ss.str());
+        return;
+    }
+    const char* name = state == HistoryState::Ready ? "ready" : state == HistoryState::Loading ? "loading" : "failed";
+    if (state != HistoryState::Ready) res.status = 503;
+    ss << "{\"ready\":" << (state == HistoryState::Ready ? "true" : "false") << ",\"history\":\"" << name << "\"";
+    if (state == HistoryState::Failed) ss << ",\"error\":\"" << json_escape(g_history_init_error) << "\"";
+    if (state == HistoryState::Ready) {
+        const auto repairs = g_history->page_repairs();
+        ss << ",\"repaired_pages\":" << repairs.pages.size() << ",\"repaired_pages_with_names\":" << repairs.had_names;
+    }
+    ss << ",\"startup\":{";
+    append_startup_ms(ss, "listening_ms", g_listening_ms);
+    ss << ",";
+    append_startup_ms(ss, "first_byte_ms", g_first_byte_ms);
+    ss << ",";
+    append_startup_ms(ss, "ready_ms", g_ready_ms);
+    ss << "}}";
+    res.body.assign(ss.str());
+}
+
+// Body of /api/history: {"issued":[{"seq":..,"time":"..","name":".."},...]}, sent in
+// chunks as the log is decoded. An error after the first chunk can no longer change the
+// status, so it is reported as a trailing "error" field.
+static void stream_history(HistoryStore& history, const namegen::UniversePtr& active, uint64_t from_ms,
+                           uint64_t to_ms, const BodySink& send) {
+    constexpr size_t kChunk = 16 * 1024;
+    string buf = "{\"issued\":[";
+    buf.reserve(kChunk + 256);
+    bool first = true;
+    bool gone = false;
+    auto err = history.for_each_issued(active, from_ms, to_ms, [&](const IssuanceLog::Record& r, std::string_view name) {
+        if (!first) buf += ",";
+        first = false;
+        buf += "{\"seq\":";
+        append_number(buf, r.seq);
+        buf += ",\"time\":\"";
+        append_iso_time(buf, r.ts_ms);
+        buf += "\",\"name\":";
+        if (name.empty()) {
+            buf += "null";
+        } else {
+            buf += "\"";
+            append_json_escaped(buf, name);
+            buf += "\"";
+        }
+        buf += "}";
+        if (buf.size() < kChunk) return true;
+        gone = !send(buf);
+        buf.clear();
+        return !gone;
+    });
+    if (gone) return;
+    buf += "]";
+    if (!err.empty()) {
+        buf += ",\"error\":\"";
+        append_json_escaped(buf, err);
+        buf += "\"";
+    }
+    buf += "}";
+    send(buf);
+}
+
+// Strips a "/t/<tenant>" prefix from `path` and returns the tenant (empty if none).
+static std::string_view split_tenant(std::string_view& path) {
+    if (path.rfind("/t/", 0) != 0) return {};
+    const size_t slash = path.find('/', 3);
+    const std::string_view tenant = path.substr(3, slash == string::npos ? string::npos : slash - 3);
+    path = (slash == string::npos) ? std::string_view("/") : path.substr(slash);
+    return tenant;
+}
+
+static void append_count(ostringstream& ss, const AvailabilityStats::Count& c) {
+    ss << "\"total\":" << c.total << ",\"used\":" << c.total - c.remaining << ",\"remaining\":" << c.remaining;
+}
+
+// GET /api/stats[?first=<name>][&surname=<name>]: used/remaining names overall, per gender
+// and for the given first name / surname, from counters the store keeps up to date (O(1),
+// unlike /api/remaining, which scans). With SERVER_WORKERS > 1, overall only.
+static void handle_availability(std::string_view query, std::string_view tenant, bool is_head,
+                                std::pmr::memory_resource* mr, HttpResponse& res) {
+    QueryParams params(mr);
+    parse_query(query, params);
+    HistoryStore* history = nullptr;
+    std::shared_ptr<HistoryStore> tenant_history;
+    if (!resolve_history(tenant, history, tenant_history, res)) return;
+
+    const NameIndex& index = NameIndex::instance();
+    uint32_t first_id = 0;
+    NameFilter surname;
+    const auto first = params["first"];
+    if (!first.empty()) {
+        if (auto ferr = index.parse_first_name(first, first_id); !ferr.empty()) {
+            set_json_error(res, 400, ferr);
+            return;
+        }
+    }
+    if (auto serr = index.parse_filter({}, {}, params["surname"], surname); !serr.empty()) {
+        set_json_error(res, 400, serr);
+        return;
+    }
+    const auto a = history->availability(first.empty() ? -1 : int64_t{first_id}, surname.surname);
+    res.content_type = kJson;
+    if (is_head) return;
+
+    ostringstream ss;
+    ss << "{";
+    append_count(ss, a.all);
+    if (!a.per_attribute) {
+        ss << "}";
+        res.body.assign(ss.str());
+        return;
+    }
+    ss << ",\"gender\":{\"m\":{";
+    append_count(ss, a.gender[static_cast<int>(namegen::Gender::Male)]);
+    ss << "},\"f\":{";
+    append_count(ss, a.gender[static_cast<int>(namegen::Gender::Female)]);
+    ss << "}}";
+    if (!first.empty()) {
+        ss << ",\"first_name\":{\"name\":\"" << json_escape(namegen::first_name_at(first_id)) << "\",";
+        append_count(ss, a.first_name);
+        ss << "}";
+    }
+    if (surname.surname >= 0) {
+        ss << ",\"surname\":{\"name\":\"" << json_escape(namegen::surname_at(static_cast<size_t>(surname.surname)))
+           << "\",";
+        append_count(ss, a.surname);
+        ss << "}";
+    }
+    ss << "}";
+    res.body.assign(ss.str());
+}
+
+template <class Str, class Names>
+static void append_names_json(Str& out, const Names& names) {
+    out += "[";
+    for (size_t i = 0; i < names.size(); i++) {
+        if (i) out += ",";
+        out += "\"";
+        append_json_escaped(out, names[i]);
+        out += "\"";
+    }
+    out += "]";
+}
+
+// Output of /api/generate: one JSON object (the default), or one record per name that the
+// client can use as it arrives: NDJSON ({"name":".."} lines), CSV (a "name" column) or
+// plain text lines.
+enum class NamesFormat { Json, Ndjson, Csv, Text };
+
+static std::string_view content_type_of(NamesFormat f) {
+    switch (f) {
+        case NamesFormat::Ndjson: return kNdjson;
+        case NamesFormat::Csv: return kCsv;
+        case NamesFormat::Text: return kTextPlain;
+        default: return kJson;
+    }
+}
+
+// `format=json|ndjson|csv|text` wins; otherwise the first supported media type in Accept
+// (q-values are not weighed). Returns false for an unknown `format`.
+static bool negotiate_names_format(std::string_view format, std::string_view accept, NamesFormat& out) {
+    out = NamesFormat::Json;
+    if (!format.empty()) {
+        if (format == "json") out = NamesFormat::Json;
+        else if (format == "ndjson") out = NamesFormat::Ndjson;
+        else if (format == "csv") out = NamesFormat::Csv;
+        else if (format == "text") out = NamesFormat::Text;
+        else return false;
+        return true;
+    }
+    while (!accept.empty()) {
+        const size_t comma = accept.find(',');
+        std::string_view type = accept.substr(0, comma);
+        accept.remove_prefix(comma == string::npos ? accept.size() : comma + 1);
+        type = type.substr(0, type.find(';'));
+        while (!type.empty() && type.front() == ' ') type.remove_prefix(1);
+        while (!type.empty() && type.back() == ' ') type.remove_suffix(1);
+        if (type == "application/x-ndjson" || type == "application/ndjson" || type == "application/jsonl") {
+            out = NamesFormat::Ndjson;
+            return true;
+        }
+        if (type == "text/csv") {
+            out = NamesFormat::Csv;
+            return true;
+        }
+        if (type == "text/plain") {
+            out = NamesFormat::Text;
+            return true;
+        }
+        if (type == "application/json" || type == "*/*") return true;
+    }
+    return true;
+}
+
+// One record of a line-oriented format (not Json).
+template <typename Str>
+static void append_name_record(Str& out, std::string_view name, NamesFormat f) {
+    if (f == NamesFormat::Ndjson) {
+        out += "{\"name\":\"";
+        append_json_escaped(out, name);
+        out += "\"}\n";
+    } else if (f == NamesFormat::Csv) {
+        if (name.find_first_of(",\"\r\n") == std::string_view::npos) {
+            out += name;
+        } else {
+            out += "\"";
+            for (char c : name) {
+                if (c == '"') out += '"';
+                out += c;
+            }
+            out += "\"";
+        }
+        out += "\r\n";
+    } else {
+        out += name;
+        out += "\n";
+    }
+}
+
+template <typename Str, typename Names>
+static void append_names_as(Str& out, const Names& names, NamesFormat f) {
+    if (f == NamesFormat::Json) {
+        out += "{\"names\":";
+        append_names_json(out, names);
+        out += "}";
+        return;
+    }
+    if (f == NamesFormat::Csv) out += "name\r\n";
+    for (const auto& name : names) append_name_record(out, name, f);
+}
+
+// Line-oriented body of /api/generate, sent in chunks as it is formatted.
+static void stream_names(const HistoryStore::NameList& names, NamesFormat f, const BodySink& send) {
+    constexpr size_t kChunk = 16 * 1024;
+    string buf;
+    buf.reserve(kChunk + 256);
+    if (f == NamesFormat::Csv) buf += "name\r\n";
+    for (const auto& name : names) {
+        append_name_record(buf, name, f);
+        if (buf.size() < kChunk) continue;
+        if (!send(buf)) return;
+        buf.clear();
+    }
+    if (!buf.empty()) send(buf);
+}
+
+static void batch_response(const std::string& err, const std::pmr::vector<HistoryStore::BatchItem>& items,
+                           bool is_head, HttpResponse& res) {
+    if (!err.empty()) {
+        set_json_error(res, 500, err);
+        return;
+    }
+    res.content_type = kJson;
+    if (is_head) return;
+    Trace::Span span("names_json");
+    res.body = "{\"results\":[";
+    for (size_t i = 0; i < items.size(); i++) {
+        const HistoryStore::BatchItem& item = items[i];
+        if (i) res.body += ",";
+        if (!item.error.empty()) {
+            res.body += "{\"error\":\"";
+            append_json_escaped(res.body, item.error);
+            res.body += "\"}";
+            continue;
+        }
+        res.body += "{\"names\":";
+        append_names_json(res.body, item.names);
+        res.body += "}";
+    }
+    res.body += "]}";
+}
+
+// Answers through the AsyncHttp loop once the gist round that covers `items` is done.
+// A reserved `idempotency_key` (single only) is finished with the names, or released.
+static void defer_batch(HttpResponse& res, const std::pmr::vector<HistoryStore::BatchItem>& items, bool single,
+                        bool is_head, NamesFormat format = NamesFormat::Json, std::string idempotency_key = {}) {
+    // Copied now: `items` lives in the request arena.
+    auto batch = std::make_shared<std::pmr::vector<HistoryStore::BatchItem>>(std::pmr::new_delete_resource());
+    for (const auto& item : items) {
+        auto& copy = batch->emplace_back(std::pmr::new_delete_resource());
+        copy.count = item.count;
+        copy.filter = item.filter;
+        copy.error = item.error;
+    }
+    res.defer = [batch, single, is_head, format, idempotency_key](ResponseSink reply) {
+        g_history->generate_batch_async(*batch, [reply, single, is_head, format, idempotency_key](
+                                                    const std::string& err,
+                                                    std::pmr::vector<HistoryStore::BatchItem>& out) {
+            if (!idempotency_key.empty()) {
+                if (err.empty() && out[0].error.empty()) {
+                    g_idempotency->finish(idempotency_key, out[0].indices.data(), out[0].indices.size());
+                } else {
+                    g_idempotency->abandon(idempotency_key);
+                }
+            }
+            HttpResponse res(std::pmr::new_delete_resource());
+            set_api_headers(res);
+            if (single) res.headers["Vary"] = "Accept";
+            if (!single) {
+                batch_response(err, out, is_head, res);
+            } else if (!err.empty() || !out[0].error.empty()) {
+                set_json_error(res, 500, err.empty() ? std::string_view(out[0].error) : std::string_view(err));
+            } else {
+                res.content_type = content_type_of(format);
+                if (!is_head) append_names_as(res.body, out[0].names, format);
+            }
+            reply(res);
+        });
+    };
+}
+
+static constexpr size_t kMaxBatchItems = 64;
+static constexpr int kMaxBatchNames = 20000;
+
+// GET /api/generate/batch?r=<count>[,gender=..][,initial=..][,surname=..]&r=...
+// One list per `r`, in order: {"results":[{"names":[...]},{"error":"..."},...]}. A bad or
+// unservable item only fails its own entry.
+static void handle_generate_batch(std::string_view query, std::string_view tenant, std::string_view client,
+                                  bool is_head, HttpResponse& res) {
+    std::pmr::memory_resource* mr = res.body.get_allocator().resource();
+    std::pmr::vector<HistoryStore::BatchItem> items(mr);
+    int total = 0;
+    for (size_t i = 0; i < query.size();) {
+        size_t amp = query.find('&', i);
+        if (amp == string::npos) amp = query.size();
+        const std::string_view part = query.substr(i, amp - i);
+        i = amp + 1;
+        if (part.substr(0, 2) != "r=") continue;
+        if (items.size() == kMaxBatchItems) {
+            set_json_error(res, 400, "a batch takes at most 64 lists");
+            return;
+        }
+        HistoryStore::BatchItem& item = items.emplace_back(mr);
+        std::string_view spec = part.substr(2);
+        const std::string_view count_str = spec.substr(0, spec.find(','));
+        if (std::from_chars(count_str.data(), count_str.data() + count_str.size(), item.count).ec != std::errc()) {
+            item.count = 0;
+        }
+        std::string_view gender, initial, surname, distinct;
+        spec.remove_prefix(std::min(spec.size(), count_str.size() + 1));
+        while (!spec.empty()) {
+            const std::string_view kv = spec.substr(0, spec.find(','));
+            spec.remove_prefix(std::min(spec.size(), kv.size() + 1));
+            const size_t eq = kv.find('=');
+            const std::string_view key = kv.substr(0, eq);
+            const std::string_view value = eq == string::npos ? std::string_view() : kv.substr(eq + 1);
+            if (key == "gender") gender = value;
+            else if (key == "initial") initial = value;
+            else if (key == "surname") surname = value;
+            else if (key == "distinct") distinct = value;
+            else item.error = "unknown parameter (expected gender, initial, surname or distinct)";
+        }
+        if (item.error.empty()) {
+            if (auto ferr = NameIndex::instance().parse_filter(gender, initial, surname, item.filter, distinct);
+                !ferr.empty()) {
+                item.error = ferr;
+            }
+        }
+        if (item.error.empty() && item.count > 0) total += std::min(item.count, namegen::kMaxCount);
+    }
+    if (items.empty()) {
+        set_json_error(res, 400,
+                       "no lists requested (r=<count>[,gender=..][,initial=..][,surname=..][,distinct=first+last], "
+                       "repeated)");
+        return;
+    }
+    if (total > kMaxBatchNames) {
+        set_json_error(res, 400, "a batch takes at most 20000 names in total");
+        return;
+    }
+
+    HistoryStore* history = nullptr;
+    std::shared_ptr<HistoryStore> tenant_history;
+    if (!resolve_history(tenant, history, tenant_history, res)) return;
+    if (history->read_only()) {
+        set_json_error(res, 503, "read-only replica (SIGUSR1 promotes it)");
+        return;
+    }
+
+    uint32_t retry_after = 0;
+    if (g_rate_limit && total > 0 && !g_rate_limit->take(client, total, retry_after)) {
+        if (retry_after == 0) {
+            string msg = "rate limit exceeded: the batch asks for more names than the per-client burst of ";
+            append_number(msg, static_cast<uint64_t>(g_rate_limit->burst()));
+            set_json_error(res, 429, msg + " (CLIENT_NAMES_BURST)");
+            return;
+        }
+        append_number(res.headers["Retry-After"], retry_after);
+        set_json_error(res, 429, "rate limit exceeded: too many names per second from this client");
+        return;
+    }
+
+    if (history->generates_async()) {
+        defer_batch(res, items, /*single=*/false, is_head);
+        return;
+    }
+
+    string gen_err;
+    {
+        Trace::Span span("generate_batch");
+        gen_err = history->generate_batch(items);
+    }
+    if (tenant_history) g_tenants->trim();
+    batch_response(gen_err, items, is_head, res);
+}
+
+// The reserved Idempotency-Key of the /api/generate being handled: released when it goes
+// out of scope, unless finished or handed on to a deferred response.
+class IdempotencyReservation {
+public:
+    IdempotencyReservation() = default;
+    IdempotencyReservation(const IdempotencyReservation&) = delete;
+    IdempotencyReservation& operator=(const IdempotencyReservation&) = delete;
+    ~IdempotencyReservation() {
+        if (!key_.empty()) g_idempotency->abandon(key_);
+    }
 
-    const string m = normalize_method(method);
+    void reserve(std::string key) { key_ = std::move(key); }
+    void finish(const std::pmr::vector<size_t>& indices) {
+        if (!key_.empty()) g_idempotency->finish(key_, indices.data(), indices.size());
+        key_.clear();
+    }
+    std::string release() { return std::exchange(key_, std::string()); }
+
+private:
+    std::string key_;
+};
+
+// What an Idempotency-Key stands for: the parameters that pick the names. Not the format,
+// which a replay renders anew.
+static uint64_t generate_request_id(QueryParams& params) {
+    uint64_t h = 1469598103934665603ULL;  // FNV-1a
+    for (const char* name : {"count", "gender", "initial", "surname", "distinct"}) {
+        for (char c : params[name]) h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+        h = (h ^ 0xFF) * 1099511628211ULL;  // separator no parameter contains
+    }
+    return h;
+}
+
+// Body of a successful /api/generate.
+static void send_names(HistoryStore::NameList& names, NamesFormat format, bool is_head, HttpResponse& res) {
+    std::pmr::memory_resource* mr = res.body.get_allocator().resource();
+    res.content_type = content_type_of(format);
+    if (is_head) return;
+    if (format != NamesFormat::Json) {
+        // Moved into the request arena, which lives until the stream has run; the
+        // closure only holds a pointer.
+        std::pmr::polymorphic_allocator<HistoryStore::NameList> alloc(mr);
+        HistoryStore::NameList* kept = alloc.allocate(1);
+        alloc.construct(kept, std::move(names));
+        res.stream = [kept, format](const BodySink& send) { stream_names(*kept, format, send); };
+        return;
+    }
+    Trace::Span span("names_json");
+    res.body.reserve(16 + names.size() * 24);
+    append_names_as(res.body, names, format);
+}
+
+static void handle_request(const HttpRequest& req, HttpResponse& res) {
+    std::pmr::memory_resource* mr = res.body.get_allocator().resource();
+    set_api_headers(res);
+
+    const string m = normalize_method(req.method);
     const bool is_get = (m == "GET");
     const bool is_head = (m == "HEAD");
     if (!is_get && !is_head) {
         res.status = 405;
         res.body = "Method Not Allowed\n";
-        return res;
+        return;
+    }
+
+    std::string_view path = req.target;
+    std::string_view query;
+    if (auto q = req.target.find('?'); q != string::npos) {
+        path = req.target.substr(0, q);
+        query = req.target.substr(q + 1);
+    }
+
+    // Tenant namespace: "/t/<tenant>/..." path prefix, else the X-Tenant header.
+    std::string_view tenant = split_tenant(path);
+    if (tenant.empty()) {
+        if (auto h = req.headers.find("x-tenant"); h != req.headers.end()) tenant = h->second;
     }
 
-    string path = target;
-    string query;
-    if (auto q = target.find('?'); q != string::npos) {
-        path = target.substr(0, q);
-        query = target.substr(q + 1);
+    if (path == "/api/tenants") {
+        handle_tenant_stats(res);
+        return;
+    }
+
+    if (path == "/healthz" || path == "/readyz") {
+        handle_health(path == "/readyz", res);
+        if (is_head) res.body.clear();
+        return;
+    }
+
+    if (path == "/api/replication") {
+        handle_replication_status(res);
+        if (is_head) res.body.clear();
+        return;
+    }
+
+    if (path == "/api/trace") {
+        if (!Trace::enabled()) {
+            set_json_error(res, 404, "tracing is off (set TRACE_SAMPLE)");
+            return;
+        }
+        res.content_type = kJson;
+        if (is_head) return;
+        std::string json;
+        Trace::write_json(json);
+        res.body.assign(json);
+        return;
+    }
+
+    if (path == "/api/stats") {
+        handle_availability(query, tenant, is_head, mr, res);
+        return;
+    }
+
+    if (path == "/api/remaining") {
+        QueryParams params(mr);
+        parse_query(query, params);
+        HistoryStore* history = nullptr;
+        std::shared_ptr<HistoryStore> tenant_history;
+        if (!resolve_history(tenant, history, tenant_history, res)) return;
+
+        NameFilter filter;
+        if (auto ferr = NameIndex::instance().parse_filter(params["gender"], params["initial"], params["surname"], filter);
+            !ferr.empty()) {
+            set_json_error(res, 400, ferr);
+            return;
+        }
+        res.content_type = kJson;
+        const size_t remaining = history->remaining_matching(filter, mr);
+        if (is_head) return;
+        res.body = "{\"remaining\":";
+        append_number(res.body, remaining);
+        res.body += "}";
+        return;
+    }
+
+    if (path == "/api/history") {
+        QueryParams params(mr);
+        parse_query(query, params);
+        HistoryStore* history = nullptr;
+        std::shared_ptr<HistoryStore> tenant_history;
+        if (!resolve_history(tenant, history, tenant_history, res)) return;
+        if (!history->has_issuance_log()) {
+            set_json_error(res, 404, "the issuance log is off (file backend only, single process; HISTORY_LOG=off disables it)");
+            return;
+        }
+
+        uint64_t from_ms = 0;
+        uint64_t to_ms = std::numeric_limits<uint64_t>::max();
+        if (const auto v = params["from"]; !v.empty() && !parse_time_ms(v, from_ms)) {
+            set_json_error(res, 400, "from must be unix seconds or an ISO 8601 UTC time");
+            return;
+        }
+        if (const auto v = params["to"]; !v.empty() && !parse_time_ms(v, to_ms)) {
+            set_json_error(res, 400, "to must be unix seconds or an ISO 8601 UTC time");
+            return;
+        }
+        res.content_type = kJson;
+        if (is_head) return;
+        // Sent after the swap lock is released: the lists may change meanwhile.
+        res.stream = [history, tenant_history, active = namegen::active_universe(), from_ms,
+                      to_ms](const BodySink& send) { stream_history(*history, active, from_ms, to_ms, send); };
+        return;
+    }
+
+    if (path == "/api/generate/batch") {
+        handle_generate_batch(query, tenant, req.client, is_head, res);
+        return;
     }
 
     if (path == "/api/generate") {
-        auto params = parse_query(query);
+        QueryParams params(mr);
+        parse_query(query, params);
+        NamesFormat format;
+        const auto accept = req.headers.find("accept");
+        if (!negotiate_names_format(params["format"], accept == req.headers.end() ? "" : accept->second, format)) {
+            set_json_error(res, 400, "format must be json, ndjson, csv or text");
+            return;
+        }
+        res.headers["Vary"] = "Accept";
+        // Like stoi: leading digits count, anything unparsable is 0.
         int count = 0;
-        try {
-            count = stoi(params["count"]);
-        } catch (...) {
-            count = 0;
+        const std::string_view count_str = params["count"];
+        if (std::from_chars(count_str.data(), count_str.data() + count_str.size(), count).ec != std::errc()) count = 0;
+
+        HistoryStore* history = nullptr;
+        std::shared_ptr<HistoryStore> tenant_history;
+        if (!resolve_history(tenant, history, tenant_history, res)) return;
+        if (history->read_only()) {
+            set_json_error(res, 503, "read-only replica (SIGUSR1 promotes it)");
+            return;
         }
 
-        if (!g_history || !g_history_init_error.empty()) {
-            res.status = 500;
-            res.content_type = "application/json; charset=utf-8";
-            std::ostringstream err;
-            err << "{\"error\":\"history store unavailable: " << json_escape(g_history_init_error) << "\"}";
-            res.body = err.str();
-            return res;
+        NameFilter filter;
+        if (auto ferr = NameIndex::instance().parse_filter(params["gender"], params["initial"], params["surname"],
+                                                           filter, params["distinct"]);
+            !ferr.empty()) {
+            set_json_error(res, 400, ferr);
+            return;
+        }
+
+        // A retry of a request with the same key gets the same names back, without
+        // touching the history store.
+        HistoryStore::NameList names(mr);
+        IdempotencyReservation idempotency;
+        const auto h = req.headers.find("idempotency-key");
+        if (h != req.headers.end() && g_idempotency_refused) {
+            set_json_error(res, 501, "Idempotency-Key is not supported with SERVER_WORKERS > 1");
+            return;
+        }
+        if (h != req.headers.end() && g_idempotency) {
+            if (h->second.empty() || h->second.size() > IdempotencyCache::kMaxKeyBytes) {
+                set_json_error(res, 400, "Idempotency-Key must be 1 to 255 characters");
+                return;
+            }
+            string key(tenant);
+            key += '\n';
+            key += h->second;
+            std::vector<uint64_t> replay;
+            switch (g_idempotency->begin(key, generate_request_id(params), namegen::universe_fingerprint(), replay)) {
+                case IdempotencyCache::Lookup::Hit:
+                    names.reserve(replay.size());
+                    for (uint64_t idx : replay) {
+                        names.emplace_back();
+                        namegen::append_universe_name(static_cast<size_t>(idx), names.back());
+                    }
+                    res.headers["Idempotent-Replayed"] = "true";
+                    send_names(names, format, is_head, res);
+                    return;
+                case IdempotencyCache::Lookup::InProgress:
+                    res.headers["Retry-After"] = "1";
+                    set_json_error(res, 409, "a request with this Idempotency-Key is still in progress");
+                    return;
+                case IdempotencyCache::Lookup::Mismatch:
+                    set_json_error(res, 422, "this Idempotency-Key was used with other parameters");
+                    return;
+                case IdempotencyCache::Lookup::Miss:
+                    idempotency.reserve(std::move(key));
+                    break;
+            }
         }
 
-        const int remaining = g_history->remaining_unique();
+        int remaining = history->remaining_unique();
+        if (!filter.any()) {
+            remaining = static_cast<int>(std::min<size_t>(history->remaining_matching(filter, mr),
+                                                          static_cast<size_t>(namegen::kMaxCount)));
+        }
+        if (filter.distinct()) {
+            remaining = static_cast<int>(std::min<size_t>(NameIndex::instance().distinct_capacity(filter),
+                                                          static_cast<size_t>(remaining)));
+        }
         if (count <= 0 || count > remaining) {
             res.status = 400;
-            res.content_type = "application/json; charset=utf-8";
-            std::ostringstream err;
-            err << "{\"error\":\"count must be an integer between 1 and " << remaining << "\"}";
-            res.body = err.str();
-            return res;
+            res.content_type = kJson;
+            res.body = "{\"error\":\"count must be an integer between 1 and ";
+            append_number(res.body, static_cast<uint64_t>(std::max(remaining, 0)));
+            res.body += "\"}";
+            return;
         }
 
-        std::vector<std::string> names;
-        auto gen_err = g_history->generate_and_mark(count, names);
-        if (!gen_err.empty()) {
-            res.status = 500;
-            res.content_type = "application/json; charset=utf-8";
-            std::ostringstream err;
-            err << "{\"error\":\"" << json_escape(gen_err) << "\"}";
-            res.body = err.str();
-            return res;
+        uint32_t retry_after = 0;
+        if (g_rate_limit && !g_rate_limit->take(req.client, count, retry_after)) {
+            append_number(res.headers["Retry-After"], retry_after);
+            set_json_error(res, 429, "rate limit exceeded: too many names per second from this client");
+            return;
         }
 
-        ostringstream ss;
-        ss << "{\"names\":[";
-        for (size_t i = 0; i < names.size(); i++) {
-            if (i) ss << ",";
-            ss << "\"" << json_escape(names[i]) << "\"";
+        if (history->generates_async()) {
+            std::pmr::vector<HistoryStore::BatchItem> items(mr);
+            HistoryStore::BatchItem& item = items.emplace_back(mr);
+            item.count = count;
+            item.filter = filter;
+            defer_batch(res, items, /*single=*/true, is_head, format, idempotency.release());
+            return;
         }
-        ss << "]}";
 
-        res.content_type = "application/json; charset=utf-8";
-        res.body = is_head ? "" : ss.str();
-        return res;
+        std::pmr::vector<size_t> indices(mr);
+        string gen_err;
+        {
+            Trace::Span span("generate_and_mark");
+            gen_err = history->generate_and_mark(count, names, filter, g_idempotency ? &indices : nullptr);
+        }
+        if (tenant_history) g_tenants->trim();
+        if (!gen_err.empty()) {
+            set_json_error(res, 500, gen_err);
+            return;
+        }
+        idempotency.finish(indices);
+        send_names(names, format, is_head, res);
+        return;
     }
 
     // Static files
     const string frontend_root = detect_frontend_root();
 
-    string rel = path;
+    string rel(path);
     if (rel == "/" || rel == "") rel = "/index.html";
     if (!rel.empty() && rel[0] == '/') rel = rel.substr(1); // strip leading '/'
 
@@ -222,77 +1146,251 @@ static HttpResponse handle_request(const string& method, const string& target) {
     if (file_path.find("..") != string::npos) {
         res.status = 400;
         res.body = "Bad Request\n";
-        return res;
+        return;
     }
 
     string body = read_file(file_path);
     if (body.empty()) {
         res.status = 404;
         res.body = "Not Found\n";
-        return res;
+        return;
     }
 
     res.content_type = content_type_for_path(file_path);
-    res.body = is_head ? "" : body;
-    return res;
+    if (!is_head) res.body.assign(body);
 }
 
-static string build_http_response(const HttpResponse& r) {
-    ostringstream ss;
-    ss << "HTTP/1.1 " << r.status << " " << status_text(r.status) << "\r\n";
-    ss << "Date: " << http_date_now() << "\r\n";
-    ss << "Connection: close\r\n";
-    ss << "Content-Type: " << r.content_type << "\r\n";
-    ss << "Content-Length: " << r.body.size() << "\r\n";
-    for (const auto& [k, v] : r.headers) ss << k << ": " << v << "\r\n";
-    ss << "\r\n";
-    ss << r.body;
-    return ss.str();
+static void build_http_response(const HttpResponse& r, std::pmr::string& out) {
+    out.reserve(256 + r.body.size());
+    out += "HTTP/1.1 ";
+    append_number(out, static_cast<uint64_t>(r.status));
+    out += " ";
+    out += status_text(r.status);
+    out += "\r\nDate: ";
+    out += http_date_now();
+    out += "\r\nConnection: close\r\nContent-Type: ";
+    out += r.content_type;
+    out += "\r\n";
+    if (!r.stream) {
+        out += "Content-Length: ";
+        append_number(out, r.body.size());
+        out += "\r\n";
+    }
+    for (const auto& [k, v] : r.headers) {
+        out += k;
+        out += ": ";
+        out += v;
+        out += "\r\n";
+    }
+    out += "\r\n";
+    out += r.body;
 }
 
-static bool read_until_headers_end(int fd, string& out) {
-    out.clear();
-    char buf[4096];
-    while (out.find("\r\n\r\n") == string::npos) {
-        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+// Lower-cases header names in place in `raw`, so `out` can point into it.
+static void parse_headers(std::pmr::string& raw, std::pmr::unordered_map<std::string_view, std::string_view>& out) {
+    size_t pos = raw.find("\r\n");
+    while (pos != string::npos) {
+        pos += 2;
+        size_t end = raw.find("\r\n", pos);
+        if (end == string::npos || end == pos) break;
+        const std::string_view line(raw.data() + pos, end - pos);
+        size_t colon = line.find(':');
+        if (colon != string::npos) {
+            for (size_t i = pos; i < pos + colon; i++) {
+                raw[i] = static_cast<char>(std::tolower(static_cast<unsigned char>(raw[i])));
+            }
+            size_t v = colon + 1;
+            while (v < line.size() && (line[v] == ' ' || line[v] == '\t')) v++;
+            out[line.substr(0, colon)] = line.substr(v);
+        }
+        pos = end;
+    }
+}
+
+// Request line: METHOD SP TARGET SP HTTP/1.1
+static void parse_request_line(std::string_view raw, std::string_view& method, std::string_view& target) {
+    const std::string_view line = raw.substr(0, raw.find("\r\n"));
+    const size_t sp1 = line.find(' ');
+    const size_t start = (sp1 == string::npos) ? line.size() : line.find_first_not_of(' ', sp1);
+    const size_t sp2 = (start == string::npos) ? string::npos : line.find(' ', start);
+    method = line.substr(0, std::min(sp1, line.size()));
+    target = {};
+    if (start != string::npos) target = line.substr(start, sp2 == string::npos ? string::npos : sp2 - start);
+}
+
+// Parses the request in `raw` (from `client`) and writes the HTTP response to `out`, or
+// only its headers when the body is streamed (`stream` is then set), or nothing when the
+// response is deferred (`deferred` is then set). Everything is allocated from `out`'s
+// resource.
+static void respond(std::pmr::string& raw, std::string_view client, std::pmr::string& out, BodyStream& stream,
+                    Deferred& deferred) {
+    std::pmr::memory_resource* mr = out.get_allocator().resource();
+    HttpRequest req(mr);
+    HttpResponse res(mr);
+
+    {
+        Trace::Span span("parse_request");
+        parse_request_line(raw, req.method, req.target);
+        req.client = client;
+        parse_headers(raw, req.headers);
+    }
+
+    if (req.method.empty() || req.target.empty()) {
+        res.status = 400;
+        res.body = "Bad Request\n";
+    } else {
+        try {
+            Trace::Span span("handle_request");
+            handle_request(req, res);
+        } catch (...) {
+            res.status = 500;
+            res.content_type = kTextPlain;
+            res.headers.clear();
+            res.stream = nullptr;
+            res.defer = nullptr;
+            res.body = "Internal Server Error\n";
+        }
+    }
+    if (res.defer) {
+        deferred = std::move(res.defer);
+        return;
+    }
+    {
+        Trace::Span span("build_response");
+        build_http_response(res, out);
+    }
+    stream = std::move(res.stream);
+}
+
+// Network syscalls made outside the io_uring engine (`server --io-bench` reports them).
+static std::atomic<uint64_t> g_net_syscalls{0};
+
+static bool send_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+        g_net_syscalls++;
+        const ssize_t n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
         if (n <= 0) return false;
-        out.append(buf, buf + n);
-        if (out.size() > 64 * 1024) return false;  // prevent abuse
+        data.remove_prefix(static_cast<size_t>(n));
     }
     return true;
 }
 
-int main(int argc, char** argv) {
-    int port = 8080;
-    if (const char* env_port = getenv("PORT"); env_port && *env_port) {
-        port = atoi(env_port);
+// -------------------------
+// Name list reload (SIGHUP)
+// -------------------------
+// Re-reads NAME_DICT_FILE (or the built-in lists if unset) without a restart. The global
+// history is remapped onto the new lists on a worker thread while requests keep being
+// served against the old ones; names issued meanwhile are journaled by the store and
+// remapped when the swap is finished on the main thread. Tenants are simply evicted and
+// migrate from their manifests on their next load.
+static volatile sig_atomic_t g_reload_requested = 0;
+
+static void on_sighup(int) {
+    g_reload_requested = 1;
+}
+
+struct UniverseReload {
+    namegen::UniversePtr from;
+    namegen::UniversePtr next;
+    std::unique_ptr<UniverseRemap> remap;
+    UsedSet migrated;
+    HistoryStore::MigrationStats stats;
+    std::thread worker;
+    std::atomic<bool> done{false};
+};
+static std::unique_ptr<UniverseReload> g_reload;
+// Request threads hold it shared while they build a response, not while they send it (a
+// stream pins what it needs); the swap to new lists takes it exclusively.
+static std::shared_mutex g_swap_mu;
+
+static bool history_ready() {
+    return g_history && g_history_state.load(std::memory_order_acquire) == HistoryState::Ready;
+}
+
+static void log_migration(const char* what, const HistoryStore::MigrationStats& st) {
+    cerr << what << ": " << st.old_used << " used names remapped to " << st.new_used << " ("
+         << st.dropped << " no longer exist) in " << st.seconds << "s\n";
+}
+
+static void log_page_repairs(const MappedHistoryFile::Repairs& r) {
+    if (r.pages.empty()) return;
+    constexpr size_t kListed = 32;
+    cerr << "History: accepted " << r.pages.size() << " mapped page(s) that failed their checksum (pages";
+    for (size_t i = 0; i < r.pages.size() && i < kListed; i++) cerr << " " << r.pages[i];
+    if (r.pages.size() > kListed) cerr << " ...";
+    cerr << ")\n";
+    if (r.had_names > 0) {
+        cerr << "WARNING: " << r.had_names << " of them held names at their last commit. Unless the server "
+             << "crashed while writing them, the file is damaged and names whose bits were lost will be issued again\n";
     }
-    if (argc >= 2) port = atoi(argv[1]);
-    if (port <= 0) port = 8080;
+}
 
-    // Global history store (encrypted on disk).
-    {
-        const char* env_file = getenv("HISTORY_FILE");
-        std::string file_path = env_file && *env_file ? std::string(env_file) : std::string("data/history.bin");
-        g_history = std::make_unique<HistoryStore>(file_path);
-        g_history_init_error = g_history->init();
-        if (!g_history_init_error.empty()) {
-            cerr << "History store init failed: " << g_history_init_error << "\n";
-        } else {
-            cerr << "History store ready. Total unique: " << g_history->total_unique()
-                 << ", remaining: " << g_history->remaining_unique()
-                 << ", file: " << file_path << "\n";
+static void start_universe_reload() {
+    if (g_reload) {
+        cerr << "Name reload already in progress\n";
+        return;
+    }
+    namegen::UniversePtr next;
+    if (const char* path = getenv("NAME_DICT_FILE"); path && *path) {
+        if (auto err = namegen::open_dictionary(path, next); !err.empty()) {
+            cerr << "Name reload failed (keeping current lists): " << err << "\n";
+            return;
         }
+    } else {
+        next = namegen::builtin_universe();
+    }
+    if (namegen::fingerprint_of(*next) == namegen::universe_fingerprint()) {
+        cerr << "Name reload: lists unchanged\n";
+        return;
     }
 
+    auto r = std::make_unique<UniverseReload>();
+    r->from = namegen::active_universe();
+    r->next = std::move(next);
+    UsedSet snapshot = history_ready() ? g_history->begin_universe_swap() : UsedSet{};
+    UniverseReload* rp = r.get();
+    r->worker = std::thread([rp, snapshot = std::move(snapshot)]() {
+        rp->remap = std::make_unique<UniverseRemap>(*rp->from, *rp->next);
+        rp->stats = HistoryStore::remap_used(snapshot, *rp->remap, rp->migrated);
+        rp->done = true;
+    });
+    g_reload = std::move(r);
+    cerr << "Name reload: remapping history onto " << namegen::source_of(*g_reload->next) << "\n";
+}
+
+static void finish_universe_reload() {
+    if (!g_reload || !g_reload->done) return;
+    g_reload->worker.join();
+    auto r = std::move(g_reload);
+    std::unique_lock<std::shared_mutex> swap_lock(g_swap_mu);
+
+    namegen::set_active_universe(r->next);
+    NameIndex::reset();
+    if (auto werr = NameWeights::load_active_from_env(); !werr.empty()) {
+        cerr << "Name weights not reloaded (sampling stays uniform): " << werr << "\n";
+    }
+    if (history_ready()) {
+        if (auto err = g_history->finish_universe_swap(std::move(r->migrated), r->stats, *r->remap); !err.empty()) {
+            cerr << "History not persisted after name reload: " << err << "\n";
+        }
+        log_migration("History migrated", g_history->last_migration());
+    }
+    if (g_tenants) g_tenants->evict_all();
+    cerr << "Names: " << namegen::dictionary_source() << " (" << namegen::universe_size() << " combinations)\n";
+}
+
+static int open_listener(int port, bool reuse_port) {
     int server_fd = ::socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
         cerr << "socket() failed: " << strerror(errno) << "\n";
-        return 1;
+        return -1;
     }
 
     int opt = 1;
     ::setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Every prefork worker binds the same port; the kernel spreads connections over them.
+    if (reuse_port) ::setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
@@ -302,51 +1400,1035 @@ int main(int argc, char** argv) {
     if (::bind(server_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
         cerr << "bind() failed: " << strerror(errno) << "\n";
         ::close(server_fd);
-        return 1;
+        return -1;
     }
 
-    if (::listen(server_fd, 16) != 0) {
+    if (::listen(server_fd, SOMAXCONN) != 0) {
         cerr << "listen() failed: " << strerror(errno) << "\n";
         ::close(server_fd);
-        return 1;
+        return -1;
     }
+    return server_fd;
+}
 
-    cout << "C++ server running on http://127.0.0.1:" << port << "\n";
-    cout << "API: GET /api/generate?count=10\n";
+// -------------------------
+// Replication (SIGUSR1 promotes a replica)
+// -------------------------
+static volatile sig_atomic_t g_promote_requested = 0;
 
-    while (true) {
-        int client_fd = ::accept(server_fd, nullptr, nullptr);
-        if (client_fd < 0) continue;
+static void on_sigusr1(int) {
+    g_promote_requested = 1;
+}
+
+// REPLICATION_LISTEN=<port>: serve replicas from the global store.
+static void start_replication_primary() {
+    const char* v = getenv("REPLICATION_LISTEN");
+    if (!v || atoi(v) <= 0) return;
+    std::unique_ptr<ReplicationPrimary> p;
+    auto err = ReplicationPrimary::start(atoi(v), *g_history, g_swap_mu, p);
+    if (err.empty()) err = g_history->set_replication(p.get());
+    if (!err.empty()) {
+        cerr << "Replication not started: " << err << "\n";
+        return;
+    }
+    cerr << "Replication: serving replicas on port " << atoi(v) << "\n";
+    g_repl_primary = p.release();
+}
+
+// The primary is gone: stop following it, write the replicated history to our own file
+// and take writes (and, with REPLICATION_LISTEN, replicas) from now on.
+static void promote_replica() {
+    if (!history_ready() || !g_history->read_only() || !g_repl_replica) {
+        cerr << "Promotion ignored: not a replica\n";
+        return;
+    }
+    g_repl_replica->stop();
+    const auto st = g_repl_replica->status();
+    if (auto err = g_history->promote(); !err.empty()) {
+        cerr << "Promotion failed (still read-only): " << err << "\n";
+        return;
+    }
+    cerr << "Promoted to primary at replicated seq " << st.applied_seq << ", remaining: "
+         << g_history->remaining_unique() << "\n";
+    start_replication_primary();
+}
+
+static volatile sig_atomic_t g_stop_requested = 0;
+
+static void on_stop(int) {
+    g_stop_requested = 1;
+}
+
+// SIGUSR2 writes the recorded trace to TRACE_FILE, where "%p" stands for the process id
+// (default /tmp/name-server-trace-<pid>.json). In prefork mode the parent passes it on to
+// every worker.
+static volatile sig_atomic_t g_trace_dump_requested = 0;
+
+static void on_sigusr2(int) {
+    g_trace_dump_requested = 1;
+}
+
+static void dump_trace() {
+    if (!Trace::enabled()) {
+        cerr << "Tracing is off (set TRACE_SAMPLE); nothing to dump\n";
+        return;
+    }
+    string path;
+    if (const char* v = getenv("TRACE_FILE"); v && *v) {
+        path = v;
+        if (auto pos = path.find("%p"); pos != string::npos) path.replace(pos, 2, std::to_string(::getpid()));
+    } else {
+        path = "/tmp/name-server-trace-" + std::to_string(::getpid()) + ".json";
+    }
+    if (auto err = Trace::write_file(path); !err.empty()) {
+        cerr << "Trace dump failed: " << err << "\n";
+        return;
+    }
+    cerr << "Trace written to " << path << "\n";
+}
+
+// SIGQUIT upgrades the binary in place (single process; see start_upgrade()).
+static volatile sig_atomic_t g_upgrade_requested = 0;
+
+static void on_sigquit(int) {
+    g_upgrade_requested = 1;
+}
+
+static void install_signal_handlers() {
+    struct sigaction sa {};
+    sa.sa_handler = on_sighup;
+    sigemptyset(&sa.sa_mask);
+    ::sigaction(SIGHUP, &sa, nullptr);
+    sa.sa_handler = on_sigusr2;
+    ::sigaction(SIGUSR2, &sa, nullptr);
+    sa.sa_handler = on_sigusr1;
+    ::sigaction(SIGUSR1, &sa, nullptr);
+    sa.sa_handler = on_sigquit;
+    ::sigaction(SIGQUIT, &sa, nullptr);
+}
+
+// -------------------------
+// Connections
+// -------------------------
+// serve() runs the accept loop: it reads request heads from up to kMaxPendingConns
+// connections at once (so a slow client holds up nobody), then queues each complete
+// request in a WorkQueue lane for the request threads (SERVER_THREADS, default 4). A
+// request whose lane is full, or that waited too long in it, is answered with 503 and
+// Retry-After instead; see admission.hpp.
+//
+// The loop is poll() by default. With IO_ENGINE=uring it is an io_uring (see
+// uring_engine.hpp), which also sends the responses; if the kernel can't do that, serve()
+// says so and uses poll().
+static constexpr size_t kMaxPendingConns = 1024;
+static constexpr size_t kMaxRequestHead = 64 * 1024;
+static constexpr auto kHeadTimeout = std::chrono::seconds(10);
+static constexpr int kSendTimeoutSeconds = 10;
+static constexpr uint32_t kOverloadRetryAfterSeconds = 1;
+
+static int g_request_threads = 4;
+static WorkQueue::Config g_queue_config;
+static bool g_want_uring = false;
+static std::unique_ptr<UringEngine> g_uring;  // set by serve() when the ring is in use
+static std::atomic<bool> g_serve_stop{false};  // ends serve(); only --io-bench sets it
+
+struct PendingConn {
+    int fd = -1;
+    std::string raw;
+    std::string client;
+    WorkQueue::Clock::time_point deadline;
+};
+
+// Generating names, streaming history and dumping traces are the expensive requests.
+static WorkQueue::Lane lane_for(std::string_view raw) {
+    std::string_view method, path;
+    parse_request_line(raw, method, path);
+    path = path.substr(0, path.find('?'));
+    split_tenant(path);
+    const bool bulk = path == "/api/generate" || path == "/api/generate/batch" || path == "/api/history" ||
+                      path == "/api/trace";
+    return bulk ? WorkQueue::kBulk : WorkQueue::kInteractive;
+}
+
+static void send_and_close(int fd, std::string_view response) {
+    if (g_uring) {
+        g_uring->send_and_close(fd, response);
+        return;
+    }
+    (void)send_all(fd, response);
+    g_net_syscalls++;
+    ::close(fd);
+}
+
+static void send_overloaded(int fd) {
+    RequestArena& arena = RequestArena::for_this_thread();
+    RequestArena::Scope scope(arena);
+    HttpResponse res(arena.resource());
+    res.headers["Cache-Control"] = "no-store";
+    append_number(res.headers["Retry-After"], kOverloadRetryAfterSeconds);
+    set_json_error(res, 503, "server overloaded, retry later");
+    std::pmr::string out(arena.resource());
+    build_http_response(res, out);
+    send_and_close(fd, out);
+}
 
-        string raw;
-        if (!read_until_headers_end(client_fd, raw)) {
-            ::close(client_fd);
+static void request_thread(WorkQueue& queue) {
+    RequestArena& arena = RequestArena::for_this_thread();
+    Trace::set_thread_name("request");
+    WorkQueue::Job job;
+    while (true) {
+        bool shed = false;
+        queue.pop(job, shed);
+        Trace::Request traced("request");
+        if (Trace::active()) Trace::record("queue_wait", job.enqueued, Trace::Clock::now());
+        if (shed) {
+            send_overloaded(job.fd);
+            queue.done(job.lane);
             continue;
         }
+        {
+            // Everything below comes from this thread's arena and is freed by the Scope.
+            RequestArena::Scope scope(arena);
+            std::pmr::string raw(job.raw, arena.resource());
+            std::pmr::string response(arena.resource());
+            BodyStream stream;
+            Deferred deferred;
+            std::shared_lock<std::shared_mutex> swap_lock(g_swap_mu);
+            respond(raw, job.client, response, stream, deferred);
+            if (g_first_byte_ms.load(std::memory_order_relaxed) < 0) {
+                int64_t unset = -1;
+                g_first_byte_ms.compare_exchange_strong(unset, ms_since_start());
+            }
+            const int fd = job.fd;
+            Trace::Span span(deferred ? "defer" : stream ? "send_stream" : "send");
+            if (deferred) {
+                // Starts the generate: under the swap lock, like respond().
+                deferred([fd](HttpResponse& res) {
+                    std::pmr::string out(res.body.get_allocator().resource());
+                    build_http_response(res, out);
+                    send_and_close(fd, out);
+                });
+            } else {
+                // Built (names are strings by now; a stream pins what it still needs): a slow
+                // client must not hold up a swap to new lists.
+                swap_lock.unlock();
+                if (!stream) {
+                    send_and_close(fd, response);
+                } else {
+                    // Streams are written from this thread, with the socket blocking either way.
+                    if (g_uring) {
+                        timeval tv{kSendTimeoutSeconds, 0};
+                        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+                    }
+                    if (send_all(fd, response)) stream([fd](std::string_view chunk) { return send_all(fd, chunk); });
+                    g_net_syscalls++;
+                    ::close(fd);
+                }
+            }
+        }
+        queue.done(job.lane);
+    }
+}
 
-        // Request line: METHOD SP TARGET SP HTTP/1.1
-        size_t line_end = raw.find("\r\n");
-        string req_line = (line_end == string::npos) ? raw : raw.substr(0, line_end);
-        istringstream rl(req_line);
-        string method, target, version;
-        rl >> method >> target >> version;
+static void accept_pending(int server_fd, std::vector<PendingConn>& pending) {
+    while (pending.size() < kMaxPendingConns) {
+        sockaddr_storage addr{};
+        socklen_t len = sizeof(addr);
+        g_net_syscalls++;
+        const int fd = ::accept4(server_fd, reinterpret_cast<sockaddr*>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
 
-        HttpResponse res;
-        if (method.empty() || target.empty()) {
-            res.status = 400;
-            res.body = "Bad Request\n";
-        } else {
-            try {
-                res = handle_request(method, target);
-            } catch (...) {
-                res.status = 500;
-                res.body = "Internal Server Error\n";
+        PendingConn c;
+        c.fd = fd;
+        c.deadline = WorkQueue::Clock::now() + kHeadTimeout;
+        char host[INET6_ADDRSTRLEN] = "";
+        if (addr.ss_family == AF_INET) {
+            ::inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(&addr)->sin_addr, host, sizeof(host));
+        } else if (addr.ss_family == AF_INET6) {
+            ::inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6*>(&addr)->sin6_addr, host, sizeof(host));
+        }
+        c.client = host;
+        pending.push_back(std::move(c));
+    }
+}
+
+// Reads what is available from `c`. Returns false when the connection is done with
+// (complete or dead); c.fd is -1 if it was closed.
+static bool read_pending(PendingConn& c) {
+    char buf[4096];
+    while (true) {
+        g_net_syscalls++;
+        const ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (n <= 0 || c.raw.size() + static_cast<size_t>(n) > kMaxRequestHead) {
+            g_net_syscalls++;
+            ::close(c.fd);
+            c.fd = -1;
+            return false;
+        }
+        // Only the new bytes (and the 3 before them) can complete the blank line.
+        const size_t from = c.raw.size() < 3 ? 0 : c.raw.size() - 3;
+        c.raw.append(buf, static_cast<size_t>(n));
+        if (c.raw.find("\r\n\r\n", from) != string::npos) return false;
+    }
+}
+
+static void enqueue(WorkQueue& queue, int fd, std::string& raw, std::string& client) {
+    WorkQueue::Job job;
+    job.fd = fd;
+    job.lane = lane_for(raw);
+    job.raw = std::move(raw);
+    job.client = std::move(client);
+    if (!queue.push(job)) send_overloaded(job.fd);
+}
+
+static void enqueue(WorkQueue& queue, PendingConn& c) {
+    // Request threads block on the socket, but not forever on a client that stops reading.
+    const int flags = ::fcntl(c.fd, F_GETFL);
+    ::fcntl(c.fd, F_SETFL, flags & ~O_NONBLOCK);
+    timeval tv{kSendTimeoutSeconds, 0};
+    ::setsockopt(c.fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    g_net_syscalls += 3;
+
+    enqueue(queue, c.fd, c.raw, c.client);
+}
+
+// Sets g_uring if IO_ENGINE=uring and the kernel supports it.
+static void start_uring(int server_fd) {
+    UringEngine::Limits limits;
+    limits.max_conns = kMaxPendingConns;
+    limits.max_head = kMaxRequestHead;
+    limits.head_timeout = kHeadTimeout;
+    if (auto err = UringEngine::create(server_fd, limits, g_uring); !err.empty()) {
+        cerr << "io_uring engine unavailable (using poll): " << err << "\n";
+        return;
+    }
+    g_uring->set_want_peer(g_rate_limit != nullptr);
+    cerr << "I/O engine: io_uring\n";
+}
+
+// -------------------------
+// Binary upgrade (SIGQUIT; see upgrade.hpp)
+// -------------------------
+// The binary at the path this process was started from (UPGRADE_BINARY overrides it), so
+// an upgrade runs whatever has been installed there since.
+static std::string g_exe_path;
+static char** g_argv = nullptr;
+
+static constexpr auto kUpgradeStartTimeout = std::chrono::seconds(60);  // spawn to kReady
+static constexpr auto kUpgradeDrainTimeout = std::chrono::seconds(30);
+static constexpr auto kUpgradeHandoffTimeout = std::chrono::seconds(30);  // state sent to kServing
+
+// The old process's side, stepped from serve()'s idle callback.
+struct Upgrade {
+    enum class Step { Starting, Draining, HandedOver };
+    std::unique_ptr<UpgradeChannel> channel;
+    Step step = Step::Starting;
+    WorkQueue::Clock::time_point deadline;
+};
+static std::unique_ptr<Upgrade> g_upgrade;  // set while one is in progress
+
+// While draining and after the handoff, serve() leaves the listener to the backlog.
+static bool upgrade_stopped_accepting() {
+    return g_upgrade && g_upgrade->step != Upgrade::Step::Starting;
+}
+
+static void start_upgrade() {
+    if (g_upgrade) {
+        cerr << "Upgrade already in progress\n";
+        return;
+    }
+    std::string why;
+    if (g_uring) {
+        why = "needs IO_ENGINE=poll";
+    } else if (!history_ready()) {
+        why = "the history is not loaded";
+    } else if (g_history->read_only() || g_repl_primary.load()) {
+        why = "not supported with replication";
+    } else if (g_exe_path.empty()) {
+        why = "the binary's path is unknown (set UPGRADE_BINARY)";
+    }
+    auto u = std::make_unique<Upgrade>();
+    if (why.empty()) why = UpgradeChannel::spawn(g_exe_path, g_argv, u->channel);
+    if (!why.empty()) {
+        cerr << "Upgrade ignored: " << why << "\n";
+        return;
+    }
+    u->deadline = WorkQueue::Clock::now() + kUpgradeStartTimeout;
+    cerr << "Upgrade: started " << g_exe_path << " as pid " << u->channel->successor() << "\n";
+    g_upgrade = std::move(u);
+}
+
+// `drained`: no connection, queued request or outbound persist is left. Returns false once
+// the successor serves, which ends serve().
+static bool step_upgrade(int server_fd, bool drained) {
+    Upgrade& u = *g_upgrade;
+    const pid_t pid = u.channel->successor();
+    const auto now = WorkQueue::Clock::now();
+    const int m = u.channel->poll_message();
+    auto abort = [&](const std::string& why) {
+        cerr << "Upgrade aborted (still serving): " << why << "\n";
+        u.channel->kill_successor();
+        g_upgrade.reset();
+        return true;
+    };
+    if (m < 0) return abort("successor exited");
+
+    switch (u.step) {
+    case Upgrade::Step::Starting:
+        if (m == UpgradeChannel::kReady) {
+            cerr << "Upgrade: pid " << pid << " is ready; draining\n";
+            u.step = Upgrade::Step::Draining;
+            u.deadline = now + kUpgradeDrainTimeout;
+            return true;
+        }
+        break;
+    case Upgrade::Step::Draining:
+        if (drained) {
+            // Nothing can mark names any more: the used set is final.
+            uint64_t seq = 0;
+            std::vector<uint8_t> blob;
+            std::string err;
+            {
+                std::shared_lock<std::shared_mutex> swap_lock(g_swap_mu);
+                err = g_history->replication_snapshot(seq, blob);
+            }
+            if (err.empty()) err = u.channel->send_state(server_fd, blob);
+            if (!err.empty()) return abort(err);
+            cerr << "Upgrade: handed the listener and " << g_history->used_count() << " used names (" << blob.size()
+                 << " byte blob) to pid " << pid << "\n";
+            u.step = Upgrade::Step::HandedOver;
+            u.deadline = now + kUpgradeHandoffTimeout;
+            return true;
+        }
+        break;
+    case Upgrade::Step::HandedOver:
+        if (m == UpgradeChannel::kServing) {
+            cerr << "Upgrade: pid " << pid << " is serving; exiting\n";
+            return false;
+        }
+        break;
+    }
+    if (now >= u.deadline) return abort("timed out");
+    return true;
+}
+
+static void serve(int server_fd, bool allow_reload) {
+    if (g_want_uring) start_uring(server_fd);
+    WorkQueue::Config qc = g_queue_config;
+    qc.bulk_concurrency = static_cast<size_t>(std::max(1, g_request_threads - 1));
+    // Never destroyed: the request threads run until the process exits.
+    WorkQueue& queue = *new WorkQueue(qc);
+    for (int i = 0; i < g_request_threads; i++) std::thread(request_thread, std::ref(queue)).detach();
+
+    std::vector<PendingConn> pending;
+    // Between batches of I/O, at least every 200 ms.
+    auto idle = [allow_reload, server_fd, &queue, &pending]() {
+        // A reload waits for the history to load: it swaps the lists the load decodes against.
+        if (g_reload_requested && allow_reload && g_history_state.load() != HistoryState::Loading) {
+            g_reload_requested = 0;
+            start_universe_reload();
+        }
+        finish_universe_reload();
+        if (g_trace_dump_requested) {
+            g_trace_dump_requested = 0;
+            dump_trace();
+        }
+        if (g_promote_requested) {
+            g_promote_requested = 0;
+            promote_replica();
+        }
+        if (g_upgrade_requested && allow_reload) {
+            g_upgrade_requested = 0;
+            start_upgrade();
+        }
+        if (g_upgrade) {
+            const bool drained = pending.empty() && queue.idle() && (!g_outbound || g_outbound->idle());
+            if (!step_upgrade(server_fd, drained)) return false;
+        }
+        return !g_serve_stop;
+    };
+
+    if (g_uring) {
+        if (g_outbound) g_uring->watch(g_outbound->fd(), []() { g_outbound->on_ready(); });
+        g_uring->run([&queue](int fd, std::string& raw, std::string& client) { enqueue(queue, fd, raw, client); },
+                     idle);
+        return;
+    }
+
+    ::fcntl(server_fd, F_SETFL, ::fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+    std::vector<pollfd> fds;
+    while (idle()) {
+        // Stop accepting while the pending set is full; the kernel backlog holds the rest.
+        const bool accepting = pending.size() < kMaxPendingConns && !upgrade_stopped_accepting();
+        fds.clear();
+        for (const auto& c : pending) fds.push_back(pollfd{c.fd, POLLIN, 0});
+        const size_t listen_at = fds.size();
+        if (accepting) fds.push_back(pollfd{server_fd, POLLIN, 0});
+        const size_t outbound_at = fds.size();
+        if (g_outbound) fds.push_back(pollfd{g_outbound->fd(), POLLIN, 0});
+        // Wake up periodically so a reload finishes (and heads time out) even while idle;
+        // an upgrade in its handoff has connections waiting in the backlog.
+        g_net_syscalls++;
+        if (::poll(fds.data(), fds.size(), upgrade_stopped_accepting() ? 5 : 200) < 0 && errno != EINTR) continue;
+
+        const auto now = WorkQueue::Clock::now();
+        for (size_t i = pending.size(); i-- > 0;) {
+            PendingConn& c = pending[i];
+            bool keep = true;
+            if (fds[i].revents != 0) {
+                keep = read_pending(c);
+                if (!keep && c.fd >= 0) enqueue(queue, c);
+            } else if (now >= c.deadline) {
+                g_net_syscalls++;
+                ::close(c.fd);
+                keep = false;
+            }
+            if (!keep) {
+                if (i + 1 != pending.size()) c = std::move(pending.back());
+                pending.pop_back();
+            }
+        }
+        if (accepting && (fds[listen_at].revents & POLLIN)) accept_pending(server_fd, pending);
+        if (g_outbound && fds[outbound_at].revents != 0) g_outbound->on_ready();
+    }
+    for (const auto& c : pending) ::close(c.fd);
+}
+
+// -------------------------
+// Prefork mode (SERVER_WORKERS > 1)
+// -------------------------
+// The parent loads everything, moves the global used set into shared memory, then forks
+// the workers, which each bind the port with SO_REUSEPORT and serve requests. The parent
+// serves nothing: it is the only writer of HISTORY_FILE (persisting on behalf of waiting
+// workers, see SharedUsedBits) and restarts workers that crash.
+static pid_t spawn_worker(int port) {
+    // Until the child has reset its handlers it would run the parent's on_stop, and a stop
+    // signal meant for it would be lost: hold them back across fork().
+    sigset_t stop, saved;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGTERM);
+    sigaddset(&stop, SIGINT);
+    ::sigprocmask(SIG_BLOCK, &stop, &saved);
+    const pid_t pid = ::fork();
+    if (pid != 0) {
+        ::sigprocmask(SIG_SETMASK, &saved, nullptr);
+        return pid;
+    }
+
+    ::signal(SIGTERM, SIG_DFL);
+    ::signal(SIGINT, SIG_DFL);
+    ::signal(SIGHUP, SIG_IGN);
+    ::sigprocmask(SIG_SETMASK, &saved, nullptr);
+    int server_fd = open_listener(port, /*reuse_port=*/true);
+    if (server_fd < 0) ::_exit(1);
+    g_listening_ms = ms_since_start();
+    serve(server_fd, /*allow_reload=*/false);
+    ::_exit(0);
+}
+
+static int run_prefork(int port, int workers) {
+    std::unique_ptr<SharedUsedBits> bits;
+    if (!history_ready()) {
+        cerr << "Prefork mode needs a working history store: " << g_history_init_error << "\n";
+        return 1;
+    }
+    const bool had_log = g_history->has_issuance_log();
+    if (auto err = g_history->create_shared(bits); !err.empty()) {
+        cerr << "Prefork mode unavailable: " << err << "\n";
+        return 1;
+    }
+    if (had_log) cerr << "The issuance log is off with SERVER_WORKERS > 1; /api/history answers 404\n";
+    g_tenants->set_multi_process(true);
+
+    struct sigaction sa {};
+    sa.sa_handler = on_stop;
+    sigemptyset(&sa.sa_mask);
+    ::sigaction(SIGTERM, &sa, nullptr);
+    ::sigaction(SIGINT, &sa, nullptr);
+    install_signal_handlers();
+
+    std::vector<pid_t> pids;
+    for (int i = 0; i < workers; i++) pids.push_back(spawn_worker(port));
+    cout << "C++ server running on http://127.0.0.1:" << port << " (" << workers << " worker processes)\n";
+    cout << "API: GET /api/generate?count=10  (per tenant: /t/<tenant>/api/generate or X-Tenant header)\n";
+
+    auto persist = [&]() {
+        const uint32_t epoch = bits->begin_persist();
+        auto err = g_history->persist_shared();
+        if (!err.empty()) cerr << "History persist failed: " << err << "\n";
+        bits->end_persist(epoch, err.empty());
+    };
+
+    int exit_code = 0;
+    while (!g_stop_requested) {
+        if (g_reload_requested) {
+            g_reload_requested = 0;
+            cerr << "Name reload is not supported with SERVER_WORKERS > 1; restart instead\n";
+        }
+        if (g_upgrade_requested) {
+            g_upgrade_requested = 0;
+            cerr << "Binary upgrade is not supported with SERVER_WORKERS > 1; restart instead\n";
+        }
+        if (g_trace_dump_requested) {
+            // The workers serve the requests, so they hold the traces.
+            g_trace_dump_requested = 0;
+            for (pid_t pid : pids) {
+                if (pid > 0) ::kill(pid, SIGUSR2);
+            }
+        }
+        if (bits->wait_persist_request(200)) persist();
+
+        int status = 0;
+        pid_t pid;
+        while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+            auto it = std::find(pids.begin(), pids.end(), pid);
+            if (it == pids.end()) continue;
+            if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+                // Startup failure (e.g. bind()); restarting would just fail again.
+                cerr << "Worker " << pid << " exited with status " << WEXITSTATUS(status) << "\n";
+                g_stop_requested = 1;
+                exit_code = 1;
+                *it = -1;
+                continue;
+            }
+            if (g_stop_requested) {
+                // Shutting down (maybe this very worker failed): no replacement.
+                *it = -1;
+                continue;
+            }
+            cerr << "Worker " << pid << " died; restarting\n";
+            *it = spawn_worker(port);
+        }
+    }
+
+    for (pid_t pid : pids) {
+        if (pid > 0) ::kill(pid, SIGTERM);
+    }
+    for (pid_t pid : pids) {
+        if (pid > 0) ::waitpid(pid, nullptr, 0);
+    }
+    persist();
+    return exit_code;
+}
+
+// -------------------------
+// Allocation check (`server --alloc-check [requests]`)
+// -------------------------
+// Serves generate/remaining requests in-process, through the same parse/handle/build path
+// as serve(), against a throwaway history (mapped format) in a temp directory, and counts
+// global operator new calls per request. The first kAllocCheckWarmup requests are not
+// counted: they build the name index and size the arena. The used set still grows now and
+// then as it fills, so the check fails when any request kind averages 0.25 allocations or
+// more; anything allocated on every request shows up as at least 1.
+static constexpr int kAllocCheckWarmup = 200;
+
+static int run_alloc_check(int requests) {
+    char dir[] = "/tmp/alloc-check-XXXXXX";
+    if (!::mkdtemp(dir)) {
+        cerr << "alloc check: mkdtemp failed: " << strerror(errno) << "\n";
+        return 1;
+    }
+    ::setenv("HISTORY_FORMAT", "mapped", 1);
+    g_history = std::make_unique<HistoryStore>(string(dir) + "/history.bin", /*allow_remote=*/false);
+    g_history_init_error = g_history->init();
+    if (!g_history_init_error.empty()) {
+        cerr << "alloc check: history init failed: " << g_history_init_error << "\n";
+        return 1;
+    }
+    g_history_state = HistoryState::Ready;
+
+    static const char* const kRequests[] = {
+        "GET /api/generate?count=10 HTTP/1.1\r\nHost: localhost\r\nUser-Agent: alloc-check\r\n"
+        "Accept: application/json\r\n\r\n",
+        "GET /api/generate?count=3&gender=f HTTP/1.1\r\nHost: localhost\r\n\r\n",
+        "GET /api/remaining?gender=m HTTP/1.1\r\nHost: localhost\r\n\r\n",
+    };
+    constexpr size_t kinds = sizeof(kRequests) / sizeof(kRequests[0]);
+    // Stay well clear of exhausting the universe (10 + 3 names per round).
+    const int max_requests = static_cast<int>(std::min<size_t>(namegen::universe_size() / 2 / 13 * kinds, 1000000));
+    requests = std::max(1, std::min(requests, max_requests - kAllocCheckWarmup));
+
+    RequestArena& arena = RequestArena::for_this_thread();
+    uint64_t allocs[kinds] = {};
+    uint64_t worst[kinds] = {};
+    int failures = 0;
+    for (int i = 0; i < kAllocCheckWarmup + requests; i++) {
+        const size_t kind = static_cast<size_t>(i) % kinds;
+        RequestArena::Scope scope(arena);
+        std::pmr::string raw(kRequests[kind], arena.resource());
+        std::pmr::string response(arena.resource());
+        BodyStream stream;
+        Deferred deferred;
+        const uint64_t before = thread_heap_allocations();
+        respond(raw, "alloc-check", response, stream, deferred);
+        const uint64_t n = thread_heap_allocations() - before;
+        if (response.compare(0, 12, "HTTP/1.1 200") != 0) failures++;
+        if (i < kAllocCheckWarmup) continue;
+        allocs[kind] += n;
+        worst[kind] = std::max(worst[kind], n);
+    }
+    g_history.reset();
+    (void)std::system((string("rm -rf ") + dir).c_str());
+
+    bool ok = failures == 0;
+    const uint64_t per_kind = static_cast<uint64_t>(requests) / kinds;
+    for (size_t k = 0; k < kinds; k++) {
+        const std::string_view req = kRequests[k];
+        cout << req.substr(4, req.find(' ', 4) - 4) << ": " << allocs[k] << " allocations in " << per_kind
+             << " requests, worst request " << worst[k] << "\n";
+        if (allocs[k] * 4 >= per_kind) ok = false;
+    }
+    cout << "arena " << arena.capacity() / 1024 << " KiB, " << failures << " failed requests\n";
+    cout << (ok ? "OK" : "FAIL") << "\n";
+    return ok ? 0 : 1;
+}
+
+// -------------------------
+// Tenant eviction check (`server --tenant-check [threads]`)
+// -------------------------
+// `threads` threads drain three tenants of a registry that keeps one in memory, 50 names
+// per generate, so nearly every acquire() evicts a tenant some other thread may still be
+// generating for. Fails if a tenant gets a name twice or more names than the universe.
+static int run_tenant_check(int threads) {
+    char dir[] = "/tmp/tenant-check-XXXXXX";
+    if (!::mkdtemp(dir)) {
+        cerr << "tenant check: mkdtemp failed: " << strerror(errno) << "\n";
+        return 1;
+    }
+    static const char* const kTenants[] = {"a", "b", "c"};
+    constexpr size_t kTenantCount = sizeof(kTenants) / sizeof(kTenants[0]);
+    constexpr int kBatch = 50;
+    TenantRegistry registry(dir, /*max_hot=*/1, std::numeric_limits<size_t>::max());
+
+    std::mutex mu;
+    // By universe index: a few full names occur at more than one index.
+    std::unordered_set<size_t> issued[kTenantCount];
+    uint64_t names[kTenantCount] = {};
+    uint64_t duplicates[kTenantCount] = {};
+    std::atomic<bool> drained[kTenantCount] = {};
+    std::atomic<int> errors{0};
+
+    auto run = [&](size_t first) {
+        HistoryStore::NameList out;
+        std::pmr::vector<size_t> indices;
+        for (size_t i = first;; i++) {
+            size_t t = i % kTenantCount;
+            size_t tries = 0;
+            while (drained[t] && tries < kTenantCount) t = (t + 1) % kTenantCount, tries++;
+            if (tries == kTenantCount) return;
+            std::shared_ptr<HistoryStore> store;
+            if (auto err = registry.acquire(kTenants[t], store); !err.empty()) {
+                cerr << "tenant check: " << err << "\n";
+                errors++;
+                return;
+            }
+            out.clear();
+            if (!store->generate_and_mark(kBatch, out, NameFilter{}, &indices).empty()) {
+                drained[t] = true;  // fewer than kBatch names left
+                continue;
+            }
+            store.reset();
+            registry.trim();
+            std::lock_guard<std::mutex> lk(mu);
+            names[t] += indices.size();
+            for (size_t idx : indices) {
+                if (!issued[t].insert(idx).second) duplicates[t]++;
             }
         }
+    };
+    threads = std::max(1, threads);
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) pool.emplace_back(run, static_cast<size_t>(i));
+    for (auto& th : pool) th.join();
+    (void)std::system((string("rm -rf ") + dir).c_str());
 
-        string response = build_http_response(res);
-        (void)::send(client_fd, response.data(), response.size(), 0);
-        ::close(client_fd);
+    bool ok = errors == 0;
+    const uint64_t universe = namegen::universe_size();
+    for (size_t t = 0; t < kTenantCount; t++) {
+        cout << "tenant " << kTenants[t] << ": " << names[t] << " names, " << duplicates[t] << " duplicates (universe "
+             << universe << ")\n";
+        if (duplicates[t] != 0 || names[t] > universe || names[t] + kBatch <= universe) ok = false;
     }
+    cout << registry.totals().evictions << " evictions\n";
+    cout << (ok ? "OK" : "FAIL") << "\n";
+    return ok ? 0 : 1;
 }
 
+// -------------------------
+// I/O engine benchmark (`server --io-bench [requests] [clients]`)
+// -------------------------
+// Runs serve() on a loopback port with the poll loop, then with io_uring, and drives it
+// from `clients` threads making one request per connection (GET /api/tenants, which
+// touches no history, so mostly the network path is measured). Prints requests/s and the
+// server's network syscalls per request, counted in-process (g_net_syscalls plus the
+// engine's own count); the clients' syscalls are not included.
+static bool io_bench_client(int port, int requests, std::atomic<int>& failures) {
+    static const char kRequest[] = "GET /api/tenants HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    char buf[4096];
+    for (int i = 0; i < requests; i++) {
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        string reply;
+        if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+            ::send(fd, kRequest, sizeof(kRequest) - 1, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(kRequest) - 1)) {
+            ssize_t n;
+            while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) reply.append(buf, static_cast<size_t>(n));
+        }
+        ::close(fd);
+        if (reply.compare(0, 12, "HTTP/1.1 200") != 0) failures++;
+    }
+    return true;
+}
+
+static int run_io_bench(int requests, int clients) {
+    clients = std::max(1, clients);
+    requests = std::max(clients, requests) / clients * clients;
+    cout << requests << " requests from " << clients << " clients, " << g_request_threads << " request threads\n";
+    cout << "engine   req/s      syscalls/req  failed\n";
+    bool ok = true;
+    for (const bool uring : {false, true}) {
+        g_want_uring = uring;
+        const int server_fd = open_listener(0, /*reuse_port=*/false);
+        if (server_fd < 0) return 1;
+        sockaddr_in bound{};
+        socklen_t len = sizeof(bound);
+        ::getsockname(server_fd, reinterpret_cast<sockaddr*>(&bound), &len);
+        const int port = ntohs(bound.sin_port);
+
+        g_serve_stop = false;
+        const uint64_t net_before = g_net_syscalls;
+        std::thread server([server_fd]() { serve(server_fd, /*allow_reload=*/false); });
+        std::atomic<int> failures{0};
+        const auto t0 = std::chrono::steady_clock::now();
+        std::vector<std::thread> pool;
+        for (int c = 0; c < clients; c++) {
+            pool.emplace_back([&]() { io_bench_client(port, requests / clients, failures); });
+        }
+        for (auto& t : pool) t.join();
+        const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        const uint64_t syscalls = g_net_syscalls - net_before + (g_uring ? g_uring->syscalls() : 0);
+        g_serve_stop = true;
+        server.join();
+        ::close(server_fd);
+
+        const char* name = !uring ? "poll" : g_uring ? "io_uring" : "poll*";
+        std::printf("%-8s %-10.0f %-13.2f %d\n", name, requests / secs, static_cast<double>(syscalls) / requests,
+                    failures.load());
+        if (failures != 0) ok = false;
+    }
+    if (!g_uring) cout << "* io_uring unavailable, measured poll again\n";
+    return ok ? 0 : 1;
+}
+
+// Loads the global history and starts what needs it (replication, async gist I/O), then
+// marks it ready. Single-process mode runs it on its own thread once the listener is up.
+static void load_history(const std::string& file_path, const char* replica_of) {
+    g_history_init_error = g_history->init();
+    if (g_history_init_error.empty() && replica_of) {
+        if (auto err = ReplicationReplica::start(replica_of, *g_history, g_swap_mu, g_repl_replica); !err.empty()) {
+            g_history_init_error = "REPLICA_OF: " + err;
+        } else {
+            cerr << "Replica of " << replica_of << " (read-only; SIGUSR1 promotes it)\n";
+        }
+    } else if (g_history_init_error.empty()) {
+        // Log shipping: a replica follows its primary until promoted; a primary serves replicas.
+        start_replication_primary();
+    }
+    if (!g_history_init_error.empty()) {
+        cerr << "History store init failed: " << g_history_init_error << "\n";
+        g_history_state.store(HistoryState::Failed, std::memory_order_release);
+        return;
+    }
+    if (g_outbound) {
+        g_history->set_async_http(g_outbound.get());
+        if (g_history->generates_async()) cerr << "Gist I/O: curl multi on the accept loop\n";
+    }
+    if (g_history->last_migration().runs > 0) log_migration("History migrated", g_history->last_migration());
+    log_page_repairs(g_history->page_repairs());
+    g_ready_ms = ms_since_start();
+    const int64_t first_byte = g_first_byte_ms.load();
+    cerr << "History store ready. Total unique: " << g_history->total_unique()
+         << ", remaining: " << g_history->remaining_unique() << ", file: " << file_path << " (ready after "
+         << g_ready_ms.load() << " ms";
+    if (first_byte >= 0) cerr << "; first response after " << first_byte << " ms";
+    cerr << ")\n";
+    g_history_state.store(HistoryState::Ready, std::memory_order_release);
+}
+
+// Successor side: takes the listener and the used set over from the process that started
+// this one. Returns the listener, or -1 (the predecessor then goes on serving).
+static int take_over(UpgradeChannel& predecessor, const std::string& file_path) {
+    int server_fd = -1;
+    std::vector<uint8_t> blob;
+    // Covers the predecessor's drain; if that fails, it kills this process anyway.
+    const int wait_ms =
+        static_cast<int>(std::chrono::milliseconds(kUpgradeDrainTimeout + kUpgradeHandoffTimeout).count());
+    auto err = predecessor.send_message(UpgradeChannel::kReady);
+    if (err.empty()) err = predecessor.receive_state(wait_ms, server_fd, blob);
+    if (!err.empty()) {
+        cerr << "Upgrade failed: " << err << "\n";
+        return -1;
+    }
+    const size_t blob_bytes = blob.size();
+    g_history->set_initial_blob(std::move(blob));
+    load_history(file_path, nullptr);
+    if (g_history_state.load() == HistoryState::Ready) err = predecessor.send_message(UpgradeChannel::kServing);
+    else err = "history not loaded";
+    if (!err.empty()) {
+        cerr << "Upgrade failed: " << err << "\n";
+        ::close(server_fd);
+        return -1;
+    }
+    cerr << "Upgrade: took over the listener and " << g_history->used_count() << " used names (" << blob_bytes
+         << " byte blob)\n";
+    return server_fd;
+}
+
+int main(int argc, char** argv) {
+    int port = 8080;
+    if (const char* env_port = getenv("PORT"); env_port && *env_port) {
+        port = atoi(env_port);
+    }
+    if (argc >= 2) port = atoi(argv[1]);
+    if (port <= 0) port = 8080;
+
+    g_argv = argv;
+    if (const char* v = getenv("UPGRADE_BINARY"); v && *v) {
+        g_exe_path = v;
+    } else {
+        char exe[4096];
+        const ssize_t n = ::readlink("/proc/self/exe", exe, sizeof(exe));
+        if (n > 0 && static_cast<size_t>(n) < sizeof(exe)) g_exe_path.assign(exe, static_cast<size_t>(n));
+    }
+    // Started by SIGQUIT on a running server: take over its listener below.
+    std::unique_ptr<UpgradeChannel> predecessor;
+    if (auto err = UpgradeChannel::inherit(predecessor); !err.empty()) {
+        cerr << "Upgrade failed: " << err << "\n";
+        return 1;
+    }
+
+    if (auto derr = namegen::load_dictionary_from_env(); !derr.empty()) {
+        cerr << "Name dictionary not loaded (using built-in lists): " << derr << "\n";
+    }
+    cerr << "Names: " << namegen::dictionary_source() << " (" << namegen::universe_size() << " combinations)\n";
+
+    if (const char* v = getenv("SERVER_THREADS"); v && atoi(v) > 0) g_request_threads = atoi(v);
+    if (const char* v = getenv("IO_ENGINE"); v && *v) {
+        g_want_uring = std::string_view(v) == "uring";
+        if (!g_want_uring && std::string_view(v) != "poll") cerr << "Unknown IO_ENGINE '" << v << "' (using poll)\n";
+    }
+    if (const char* v = getenv("QUEUE_MAX"); v && atoi(v) > 0) {
+        g_queue_config.max_per_lane = static_cast<size_t>(atoi(v));
+    }
+    if (const char* v = getenv("QUEUE_TARGET_MS"); v && atoi(v) > 0) {
+        g_queue_config.target = std::chrono::milliseconds(atoi(v));
+    }
+    if (const char* v = getenv("QUEUE_INTERVAL_MS"); v && atoi(v) > 0) {
+        g_queue_config.interval = std::chrono::milliseconds(atoi(v));
+    }
+    // Off by default: behind a proxy every request comes from the same address.
+    if (const char* v = getenv("CLIENT_NAMES_PER_SEC"); v && atof(v) > 0) {
+        const double rate = atof(v);
+        double burst = std::max(rate, static_cast<double>(namegen::kMaxCount));
+        if (const char* b = getenv("CLIENT_NAMES_BURST"); b && atof(b) > 0) burst = std::max(atof(b), burst);
+        g_rate_limit = std::make_unique<ClientRateLimiter>(rate, burst);
+        cerr << "Per-client limit: " << rate << " names/s, bursts of " << burst << "\n";
+    }
+    // Idempotency-Key on /api/generate: replays for IDEMPOTENCY_TTL_S seconds, from a cache
+    // of at most IDEMPOTENCY_CACHE_MB (0 turns it off).
+    {
+        IdempotencyCache::Config ic;
+        if (const char* v = getenv("IDEMPOTENCY_CACHE_MB"); v && *v) {
+            ic.max_bytes = static_cast<size_t>(std::max(0.0, atof(v)) * 1024 * 1024);
+        }
+        if (const char* v = getenv("IDEMPOTENCY_TTL_S"); v && atoi(v) > 0) ic.ttl = std::chrono::seconds(atoi(v));
+        if (ic.max_bytes > 0) g_idempotency = std::make_unique<IdempotencyCache>(ic);
+    }
+    // A fraction of requests, e.g. 0.01; 1 traces every request.
+    if (const char* v = getenv("TRACE_SAMPLE"); v && atof(v) > 0) {
+        Trace::configure(atof(v));
+        cerr << "Tracing " << Trace::sample_rate() * 100 << "% of requests (GET /api/trace, or SIGUSR2)\n";
+    }
+
+    if (argc >= 2 && std::string_view(argv[1]) == "--alloc-check") {
+        return run_alloc_check(argc >= 3 ? atoi(argv[2]) : 10000);
+    }
+    if (argc >= 2 && std::string_view(argv[1]) == "--tenant-check") {
+        return run_tenant_check(argc >= 3 ? atoi(argv[2]) : 8);
+    }
+    if (argc >= 2 && std::string_view(argv[1]) == "--io-bench") {
+        return run_io_bench(argc >= 3 ? atoi(argv[2]) : 20000, argc >= 4 ? atoi(argv[3]) : 8);
+    }
+
+    int workers = 1;
+    if (const char* v = getenv("SERVER_WORKERS"); v && atoi(v) > 1) workers = atoi(v);
+    if (workers > 1 && g_idempotency) {
+        g_idempotency.reset();
+        g_idempotency_refused = true;
+        cerr << "Idempotency-Key is not supported with SERVER_WORKERS > 1; requests carrying it get 501\n";
+    }
+    const char* replica_of = getenv("REPLICA_OF");
+    if (replica_of && !*replica_of) replica_of = nullptr;
+    if (workers > 1 && (replica_of || getenv("REPLICATION_LISTEN"))) {
+        cerr << "REPLICA_OF and REPLICATION_LISTEN need SERVER_WORKERS=1\n";
+        return 1;
+    }
+    if (predecessor && workers > 1) {
+        cerr << "Upgrade failed: needs SERVER_WORKERS=1\n";
+        return 1;
+    }
+
+    // Global history store (encrypted on disk); loaded by load_history() below.
+    const char* env_file = getenv("HISTORY_FILE");
+    const std::string file_path = env_file && *env_file ? std::string(env_file) : std::string("data/history.bin");
+    {
+        g_history = std::make_unique<HistoryStore>(file_path);
+        if (replica_of) g_history->set_replica(true);
+
+        const char* env_dir = getenv("HISTORY_TENANT_DIR");
+        std::string tenant_dir = env_dir && *env_dir ? std::string(env_dir) : std::string("data/tenants");
+        size_t max_hot = 256;
+        size_t max_mb = 64;
+        if (const char* v = getenv("HISTORY_TENANT_CACHE"); v && atoi(v) > 0) max_hot = static_cast<size_t>(atoi(v));
+        if (const char* v = getenv("HISTORY_TENANT_MEM_MB"); v && atoi(v) > 0) max_mb = static_cast<size_t>(atoi(v));
+        g_tenants = std::make_unique<TenantRegistry>(tenant_dir, max_hot, max_mb * 1024 * 1024);
+
+        if (auto werr = NameWeights::load_active_from_env(); !werr.empty()) {
+            cerr << "Name weights not loaded (sampling stays uniform): " << werr << "\n";
+        } else if (NameWeights::active()) {
+            cerr << "Name weights loaded from " << getenv("NAME_WEIGHTS_FILE") << "\n";
+        }
+    }
+
+    // The workers fork from a loaded store.
+    if (workers > 1) {
+        load_history(file_path, nullptr);
+        return run_prefork(port, workers);
+    }
+
+    // Gist reads and writes then run on the accept loop instead of holding request threads.
+    const char* gist = getenv("HISTORY_GIST_ID");
+    const char* token = getenv("HISTORY_GITHUB_TOKEN");
+    if (gist && *gist && token && *token) {
+        if (auto err = AsyncHttp::create(g_outbound); !err.empty()) {
+            cerr << "Async gist I/O unavailable (persisting from request threads): " << err << "\n";
+        }
+    }
+
+    // Static files, /healthz and /readyz are served while the history loads; the history
+    // endpoints answer 503 until it is ready. A successor of an upgrade starts out ready.
+    int server_fd = predecessor ? take_over(*predecessor, file_path) : open_listener(port, /*reuse_port=*/false);
+    if (server_fd < 0) return 1;
+    g_listening_ms = ms_since_start();
+    cout << "C++ server running on http://127.0.0.1:" << port << "\n";
+    cout << "API: GET /api/generate?count=10  (per tenant: /t/<tenant>/api/generate or X-Tenant header)\n";
+    if (!predecessor) std::thread(load_history, file_path, replica_of).detach();
+    predecessor.reset();
+    install_signal_handlers();
+    serve(server_fd, /*allow_reload=*/true);
+}
@@ -0,0 +1,150 @@
+#include "sharded_used_set.hpp"
+
+#include <algorithm>
+
+ShardedUsedSet::ShardedUsedSet() {
+    clear();
+}
+
+void ShardedUsedSet::assign(uint64_t universe, size_t shards, const UsedView& from) {
+    universe_ = universe;
+    const uint64_t max_shards = std::max<uint64_t>(1, universe / kMinShardWidth);
+    const uint64_t count = std::max<uint64_t>(1, std::min<uint64_t>(shards, max_shards));
+    width_ = std::max<uint64_t>(1, (universe + count - 1) / count);
+
+    shards_.clear();
+    for (uint64_t i = 0; i < count; i++) {
+        auto s = std::make_unique<Shard>();
+        s->begin = std::min(universe, i * width_);
+        s->end = (i + 1 == count) ? universe : std::min(universe, (i + 1) * width_);
+        shards_.push_back(std::move(s));
+    }
+    from.visit([&](uint64_t idx) { insert_quietly(idx); });
+}
+
+void ShardedUsedSet::clear() {
+    assign(universe_, shards_.empty() ? kDefaultShards : shards_.size(), UsedSet{});
+}
+
+ShardedUsedSet::Shard& ShardedUsedSet::shard_of(uint64_t idx) const {
+    // Out-of-universe indices (only possible through misuse) land in the last shard.
+    const size_t i = static_cast<size_t>(std::min<uint64_t>(idx / width_, shards_.size() - 1));
+    return *shards_[i];
+}
+
+bool ShardedUsedSet::contains(uint64_t idx) const {
+    Shard& s = shard_of(idx);
+    std::lock_guard<std::mutex> lk(s.mu);
+    return s.set.contains(idx);
+}
+
+size_t ShardedUsedSet::size() const {
+    uint64_t total = 0;
+    for (const auto& s : shards_) total += s->used.load(std::memory_order_relaxed);
+    return static_cast<size_t>(total);
+}
+
+void ShardedUsedSet::clear_members_in(uint64_t* words, size_t nwords) const {
+    for (const auto& s : shards_) {
+        std::lock_guard<std::mutex> lk(s->mu);
+        s->set.clear_members_in(words, nwords);
+    }
+}
+
+void ShardedUsedSet::visit(const std::function<void(uint64_t)>& fn) const {
+    // Shards are ordered ranges, so this is ascending overall.
+    for (const auto& s : shards_) {
+        std::lock_guard<std::mutex> lk(s->mu);
+        s->set.for_each(fn);
+    }
+}
+
+bool ShardedUsedSet::insert_quietly(uint64_t idx) {
+    Shard& s = shard_of(idx);
+    std::lock_guard<std::mutex> lk(s.mu);
+    if (!s.set.insert(idx)) return false;
+    s.used.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ShardedUsedSet::insert(uint64_t idx) {
+    if (!insert_quietly(idx)) return false;
+    if (observer_) observer_->on_insert(idx);
+    return true;
+}
+
+bool ShardedUsedSet::erase(uint64_t idx) {
+    {
+        Shard& s = shard_of(idx);
+        std::lock_guard<std::mutex> lk(s.mu);
+        if (!s.set.erase(idx)) return false;
+        s.used.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if (observer_) observer_->on_erase(idx);
+    return true;
+}
+
+size_t ShardedUsedSet::memory_bytes() const {
+    size_t total = sizeof(*this) + shards_.size() * sizeof(Shard);
+    for (const auto& s : shards_) {
+        std::lock_guard<std::mutex> lk(s->mu);
+        total += s->set.memory_bytes();
+    }
+    return total;
+}
+
+bool ShardedUsedSet::draw_in(Shard& s, std::mt19937& rng, uint64_t& out) {
+    std::lock_guard<std::mutex> lk(s.mu);
+    const uint64_t width = s.end - s.begin;
+    const uint64_t free = width - s.set.size();
+    if (free == 0) return false;
+
+    if (free * 8 >= width) {
+        // Mostly unused: rejection sampling, < 8 tries expected.
+        std::uniform_int_distribution<uint64_t> dist(s.begin, s.end - 1);
+        do {
+            out = dist(rng);
+        } while (s.set.contains(out));
+    } else {
+        // Nearly full: pick a rank among the unused indices and walk to it.
+        uint64_t rank = std::uniform_int_distribution<uint64_t>(0, free - 1)(rng);
+        for (out = s.begin;; out++) {
+            if (s.set.contains(out)) continue;
+            if (rank-- == 0) break;
+        }
+    }
+    s.set.insert(out);
+    s.used.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool ShardedUsedSet::sample_and_mark(size_t k, std::mt19937& rng, std::pmr::vector<size_t>& out) {
+    out.clear();
+    out.reserve(k);
+    std::pmr::vector<uint64_t> free(shards_.size(), out.get_allocator().resource());
+    while (out.size() < k) {
+        uint64_t total = 0;
+        for (size_t i = 0; i < shards_.size(); i++) {
+            const Shard& s = *shards_[i];
+            const uint64_t used = std::min(s.used.load(std::memory_order_relaxed), s.end - s.begin);
+            free[i] = (s.end - s.begin) - used;
+            total += free[i];
+        }
+        if (total < k - out.size()) {
+            for (size_t idx : out) erase(idx);
+            out.clear();
+            return false;
+        }
+
+        uint64_t x = std::uniform_int_distribution<uint64_t>(0, total - 1)(rng);
+        size_t i = 0;
+        while (x >= free[i]) x -= free[i++];
+        // The count was read unlocked; another thread may have filled the shard since.
+        uint64_t idx = 0;
+        if (draw_in(*shards_[i], rng, idx)) {
+            out.push_back(static_cast<size_t>(idx));
+            if (observer_) observer_->on_insert(idx);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "used_set.hpp"
+
+// Used set split into shards over contiguous ranges of the universe, each with its own
+// lock, UsedSet and used count, so concurrent generate requests can mark names in
+// parallel.
+//
+// sample_and_mark() draws one name at a time: a shard is chosen with probability
+// proportional to its unused count (the per-shard counts are atomics, read without
+// locking), then an unused index is drawn uniformly inside it under that shard's lock.
+// That is a uniform draw over all unused names, without a global lock.
+//
+// Single-index operations lock one shard. Whole-set operations (reset, assign) are not
+// synchronized against anything and need the caller to exclude other users.
+class ShardedUsedSet : public UsedView {
+public:
+    static constexpr size_t kDefaultShards = 64;
+    static constexpr uint64_t kMinShardWidth = 1024;
+
+    // Told about every index that insert(), erase() or sample_and_mark() adds or removes,
+    // after the shard lock is released and possibly from several threads at once.
+    // assign() and clear() replace the whole set without telling it.
+    class Observer {
+    public:
+        virtual ~Observer() = default;
+        virtual void on_insert(uint64_t idx) = 0;
+        virtual void on_erase(uint64_t idx) = 0;
+    };
+
+    ShardedUsedSet();
+
+    // Splits [0, universe) into up to `shards` ranges and replaces the members with `from`.
+    void assign(uint64_t universe, size_t shards, const UsedView& from);
+    void clear();
+
+    bool contains(uint64_t idx) const override;
+    size_t size() const override;
+    void clear_members_in(uint64_t* words, size_t nwords) const override;
+    void visit(const std::function<void(uint64_t)>& fn) const override;
+
+    bool insert(uint64_t idx);
+    bool erase(uint64_t idx);
+
+    size_t memory_bytes() const;
+    size_t shard_count() const { return shards_.size(); }
+    uint64_t universe() const { return universe_; }
+
+    // Set while nothing else uses the set; `o` must outlive it (nullptr detaches).
+    void set_observer(Observer* o) { observer_ = o; }
+
+    // Draws `k` distinct unused indices uniformly at random and marks them. Returns false,
+    // with nothing marked, when fewer than `k` unused indices are left. Scratch memory comes
+    // from `out`'s resource.
+    bool sample_and_mark(size_t k, std::mt19937& rng, std::pmr::vector<size_t>& out);
+
+private:
+    struct Shard {
+        mutable std::mutex mu;
+        UsedSet set;  // global indices in [begin, end)
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        std::atomic<uint64_t> used{0};
+    };
+
+    uint64_t universe_ = 0;
+    uint64_t width_ = 1;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    Observer* observer_ = nullptr;
+
+    Shard& shard_of(uint64_t idx) const;
+    bool insert_quietly(uint64_t idx);
+    bool draw_in(Shard& s, std::mt19937& rng, uint64_t& out);
+};
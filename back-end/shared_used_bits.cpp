@@ -0,0 +1,149 @@
+#include "shared_used_bits.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Futexes on the shared mapping (not FUTEX_PRIVATE_FLAG: waiters live in other processes).
+static void futex_wait(uint32_t* addr, uint32_t expected, int timeout_ms) {
+    timespec ts{};
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = static_cast<long>(timeout_ms % 1000) * 1000000L;
+    (void)::syscall(SYS_futex, addr, FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+static void futex_wake_all(uint32_t* addr) {
+    (void)::syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// Epochs wrap; compare them as a sequence number.
+static bool epoch_reached(uint32_t current, uint32_t target) {
+    return static_cast<int32_t>(current - target) >= 0;
+}
+
+std::string SharedUsedBits::create(uint64_t n, const UsedView& initial, std::unique_ptr<SharedUsedBits>& out) {
+    out.reset();
+    if (n > kMaxUniverse) return "universe too large for a shared history bitset";
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const size_t words_off = (sizeof(Header) + page - 1) / page * page;
+    const size_t len = words_off + static_cast<size_t>((n + 63) / 64) * 8;
+    void* base = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return "mmap of shared history bitset failed: " + std::string(std::strerror(errno));
+
+    out.reset(new SharedUsedBits(base, len, n));
+    initial.visit([&](uint64_t idx) {
+        if (idx < n) (void)out->claim(idx);
+    });
+    return "";
+}
+
+SharedUsedBits::SharedUsedBits(void* base, size_t len, uint64_t n) : base_(base), len_(len), n_(n) {
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    hdr_ = static_cast<Header*>(base);
+    words_ = reinterpret_cast<uint64_t*>(static_cast<uint8_t*>(base) + (sizeof(Header) + page - 1) / page * page);
+}
+
+SharedUsedBits::~SharedUsedBits() {
+    if (base_) ::munmap(base_, len_);
+}
+
+uint64_t SharedUsedBits::count() const {
+    return __atomic_load_n(&hdr_->count, __ATOMIC_RELAXED);
+}
+
+bool SharedUsedBits::claim(uint64_t idx) {
+    if (idx >= n_) return false;
+    const uint64_t bit = 1ULL << (idx % 64);
+    if (__atomic_fetch_or(&words_[idx / 64], bit, __ATOMIC_SEQ_CST) & bit) return false;
+    __atomic_fetch_add(&hdr_->count, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+void SharedUsedBits::release(uint64_t idx) {
+    if (idx >= n_) return;
+    const uint64_t bit = 1ULL << (idx % 64);
+    if (__atomic_fetch_and(&words_[idx / 64], ~bit, __ATOMIC_SEQ_CST) & bit) {
+        __atomic_fetch_sub(&hdr_->count, 1, __ATOMIC_RELAXED);
+    }
+}
+
+bool SharedUsedBits::contains(uint64_t idx) const {
+    if (idx >= n_) return false;
+    return (__atomic_load_n(&words_[idx / 64], __ATOMIC_RELAXED) >> (idx % 64)) & 1;
+}
+
+void SharedUsedBits::clear_members_in(uint64_t* words, size_t nwords) const {
+    nwords = std::min(nwords, static_cast<size_t>((n_ + 63) / 64));
+    for (size_t w = 0; w < nwords; w++) words[w] &= ~__atomic_load_n(&words_[w], __ATOMIC_RELAXED);
+}
+
+void SharedUsedBits::visit(const std::function<void(uint64_t)>& fn) const {
+    const size_t nwords = static_cast<size_t>((n_ + 63) / 64);
+    for (size_t w = 0; w < nwords; w++) {
+        uint64_t word = __atomic_load_n(&words_[w], __ATOMIC_RELAXED);
+        while (word) {
+            fn(static_cast<uint64_t>(w) * 64 + static_cast<uint64_t>(__builtin_ctzll(word)));
+            word &= word - 1;
+        }
+    }
+}
+
+void SharedUsedBits::copy_to(UsedSet& out) const {
+    out.clear();
+    const size_t nwords = static_cast<size_t>((n_ + 63) / 64);
+    for (size_t w = 0; w < nwords; w++) {
+        uint64_t word = __atomic_load_n(&words_[w], __ATOMIC_SEQ_CST);
+        while (word) {
+            out.insert(static_cast<uint64_t>(w) * 64 + static_cast<uint64_t>(__builtin_ctzll(word)));
+            word &= word - 1;
+        }
+    }
+}
+
+// A claim is durable once a persist that *started* after it has finished: begin_persist()
+// bumps `started` before copy_to() reads the words, and both sides use seq_cst, so if this
+// worker reads `started` == E then persist E + 1 sees its bits.
+std::string SharedUsedBits::wait_durable(int timeout_ms) {
+    const uint32_t target = __atomic_load_n(&hdr_->started, __ATOMIC_SEQ_CST) + 1;
+    __atomic_store_n(&hdr_->pending, 1, __ATOMIC_SEQ_CST);
+    futex_wake_all(&hdr_->pending);
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (true) {
+        const uint32_t done = __atomic_load_n(&hdr_->done, __ATOMIC_SEQ_CST);
+        if (epoch_reached(done, target)) {
+            const uint32_t failed = __atomic_load_n(&hdr_->failed_epoch, __ATOMIC_SEQ_CST);
+            // Persists are sequential, so only the latest one matters: any later success
+            // also covered this claim.
+            if (failed != 0 && failed == done) return "could not persist history";
+            return "";
+        }
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) return "timed out waiting for history persist";
+        futex_wait(&hdr_->done, done, static_cast<int>(left.count()));
+    }
+}
+
+bool SharedUsedBits::wait_persist_request(int timeout_ms) {
+    if (__atomic_exchange_n(&hdr_->pending, 0, __ATOMIC_SEQ_CST) != 0) return true;
+    futex_wait(&hdr_->pending, 0, timeout_ms);
+    return __atomic_exchange_n(&hdr_->pending, 0, __ATOMIC_SEQ_CST) != 0;
+}
+
+uint32_t SharedUsedBits::begin_persist() {
+    return __atomic_add_fetch(&hdr_->started, 1, __ATOMIC_SEQ_CST);
+}
+
+void SharedUsedBits::end_persist(uint32_t epoch, bool ok) {
+    if (!ok) __atomic_store_n(&hdr_->failed_epoch, epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&hdr_->done, epoch, __ATOMIC_SEQ_CST);
+    futex_wake_all(&hdr_->done);
+}
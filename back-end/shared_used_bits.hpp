@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "used_set.hpp"
+
+// Used-name bitset shared by the worker processes of prefork mode (SERVER_WORKERS > 1).
+//
+// The segment is a MAP_SHARED anonymous mapping created by the parent before it forks, so
+// every worker sees the same bits. A worker claims an index with an atomic fetch-or: the
+// claim succeeds for exactly one process, which is what keeps names unique without a
+// global lock. Workers sample from their own (possibly stale) UsedSet view and treat a
+// failed claim as "someone else issued this one".
+//
+// Durability is a group commit: the parent is the only process that writes HISTORY_FILE.
+// After claiming, a worker calls wait_durable(), which asks the parent for a persist and
+// blocks until one that started after the claim has completed. Concurrent requests from
+// all workers share a single persist.
+//
+// The bitset is flat over the universe (universe_size / 8 bytes, zero pages are never
+// touched), so it is only available for universes up to kMaxUniverse names.
+//
+// As a UsedView it reads the live bits, so counting over it needs no copy; members may
+// come and go while a visit runs.
+class SharedUsedBits : public UsedView {
+public:
+    static constexpr uint64_t kMaxUniverse = uint64_t{1} << 33; // 1 GiB of bits
+
+    // Creates the segment over [0, n) with the members of `initial` set.
+    // Returns empty string on success; otherwise an error message.
+    static std::string create(uint64_t n, const UsedView& initial, std::unique_ptr<SharedUsedBits>& out);
+    ~SharedUsedBits() override;
+
+    SharedUsedBits(const SharedUsedBits&) = delete;
+    SharedUsedBits& operator=(const SharedUsedBits&) = delete;
+
+    uint64_t universe() const { return n_; }
+    uint64_t count() const;
+
+    bool contains(uint64_t idx) const override;
+    size_t size() const override { return static_cast<size_t>(count()); }
+    void clear_members_in(uint64_t* words, size_t nwords) const override;
+    void visit(const std::function<void(uint64_t)>& fn) const override;
+
+    // Returns true if this call set the bit (the caller now owns the name).
+    bool claim(uint64_t idx);
+    // Undoes a claim that will not be handed out.
+    void release(uint64_t idx);
+
+    // Replaces `out` with the current members.
+    void copy_to(UsedSet& out) const;
+
+    // Worker side: blocks until every claim made before this call is persisted.
+    // Returns empty string on success; otherwise an error message.
+    std::string wait_durable(int timeout_ms = 10000);
+
+    // Persister side: waits up to `timeout_ms` for a persist request. Returns true if one
+    // is pending; the caller then brackets the persist with begin_persist()/end_persist().
+    bool wait_persist_request(int timeout_ms);
+    uint32_t begin_persist();
+    void end_persist(uint32_t epoch, bool ok);
+
+private:
+    struct Header {
+        uint64_t count;
+        uint32_t pending;       // a worker is waiting for a persist
+        uint32_t started;       // epoch of the last persist that started
+        uint32_t done;          // epoch of the last persist that finished
+        uint32_t failed_epoch;  // epoch of the last persist that failed (0 = none)
+    };
+
+    SharedUsedBits(void* base, size_t len, uint64_t n);
+
+    void* base_ = nullptr;
+    size_t len_ = 0;
+    uint64_t n_ = 0;
+    Header* hdr_ = nullptr;
+    uint64_t* words_ = nullptr;
+};
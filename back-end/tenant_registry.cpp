@@ -0,0 +1,135 @@
+#include "tenant_registry.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+TenantRegistry::TenantRegistry(std::string dir, size_t max_hot, size_t max_bytes)
+    : dir_(std::move(dir)), max_hot_(std::max<size_t>(1, max_hot)), max_bytes_(max_bytes) {}
+
+bool TenantRegistry::is_valid_tenant_id(const std::string& id) {
+    if (id.empty() || id.size() > 64) return false;
+    for (unsigned char c : id) {
+        const bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                        (c >= '0' && c <= '9') || c == '_' || c == '-';
+        if (!ok) return false;
+    }
+    return true;
+}
+
+std::string TenantRegistry::path_for(const std::string& tenant) const {
+    return dir_ + "/" + tenant + ".bin";
+}
+
+std::string TenantRegistry::acquire(const std::string& tenant, std::shared_ptr<HistoryStore>& out) {
+    out.reset();
+    if (!is_valid_tenant_id(tenant)) return "invalid tenant id";
+
+    std::lock_guard<std::mutex> lk(mu_);
+    if (auto it = hot_.find(tenant); it != hot_.end()) {
+        hits_++;
+        lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+        out = it->second.store;
+        return "";
+    }
+
+    misses_++;
+    auto store = std::make_shared<HistoryStore>(path_for(tenant), /*allow_remote=*/false);
+    store->set_multi_process(multi_process_);
+    auto err = store->init();
+    if (!err.empty()) return "tenant '" + tenant + "': " + err;
+
+    lru_.push_front(tenant);
+    hot_[tenant] = Entry{store, lru_.begin()};
+    auto& st = known_[tenant];
+    st.id = tenant;
+    st.hot = true;
+    out = std::move(store);
+
+    trim_locked();
+    return "";
+}
+
+size_t TenantRegistry::hot_memory_bytes() const {
+    size_t total = 0;
+    for (const auto& [id, e] : hot_) total += e.store->memory_bytes();
+    return total;
+}
+
+void TenantRegistry::trim() {
+    std::lock_guard<std::mutex> lk(mu_);
+    trim_locked();
+}
+
+void TenantRegistry::trim_locked() {
+    // Least recently used first, skipping tenants a request still holds (the most recently
+    // used one among them: it is the one being served). Holders only copy their pointer,
+    // and new ones come from acquire() under mu_, so use_count() cannot rise meanwhile.
+    auto pos = lru_.end();
+    while (pos != lru_.begin() && hot_.size() > 1 &&
+           (hot_.size() > max_hot_ || hot_memory_bytes() > max_bytes_)) {
+        --pos;
+        auto it = hot_.find(*pos);
+        if (it != hot_.end() && it->second.store.use_count() > 1) continue;
+        pos = evict(pos);
+    }
+}
+
+void TenantRegistry::evict_all() {
+    std::lock_guard<std::mutex> lk(mu_);
+    while (!lru_.empty()) evict(std::prev(lru_.end()));
+}
+
+std::list<std::string>::iterator TenantRegistry::evict(std::list<std::string>::iterator pos) {
+    const std::string tenant = *pos;
+    auto next = lru_.erase(pos);
+    auto it = hot_.find(tenant);
+    if (it == hot_.end()) return next;
+
+    // Fold the store's counters into the tenant's cumulative stats before dropping it.
+    auto& st = known_[tenant];
+    const auto& io = it->second.store->io_stats();
+    st.io.loads += io.loads;
+    st.io.persists += io.persists;
+    st.io.bytes_read += io.bytes_read;
+    st.io.bytes_written += io.bytes_written;
+    st.used = it->second.store->used_count();
+    st.memory_bytes = 0;
+    st.hot = false;
+    st.evictions++;
+    evictions_++;
+    hot_.erase(it);
+    return next;
+}
+
+TenantRegistry::Totals TenantRegistry::totals() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    Totals t;
+    t.hot = hot_.size();
+    t.known = known_.size();
+    t.memory_bytes = hot_memory_bytes();
+    t.hits = hits_;
+    t.misses = misses_;
+    t.evictions = evictions_;
+    return t;
+}
+
+std::vector<TenantRegistry::TenantStats> TenantRegistry::snapshot() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::vector<TenantStats> out;
+    out.reserve(known_.size());
+    for (const auto& [id, st] : known_) {
+        TenantStats s = st;
+        if (auto it = hot_.find(id); it != hot_.end()) {
+            const auto& io = it->second.store->io_stats();
+            s.io.loads += io.loads;
+            s.io.persists += io.persists;
+            s.io.bytes_read += io.bytes_read;
+            s.io.bytes_written += io.bytes_written;
+            s.used = it->second.store->used_count();
+            s.memory_bytes = it->second.store->memory_bytes();
+        }
+        out.push_back(std::move(s));
+    }
+    std::sort(out.begin(), out.end(), [](const TenantStats& a, const TenantStats& b) { return a.id < b.id; });
+    return out;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "history_store.hpp"
+
+// Per-tenant history namespaces.
+//
+// Every tenant gets its own HistoryStore (independent uniqueness domain) persisted as
+// `<dir>/<tenant>.bin`. Only recently used tenants are kept in memory: an LRU list bounded
+// by `max_hot` entries and `max_bytes` of used-set memory. Cold tenants are dropped from
+// memory (their blob is already on disk, since every generate persists) and lazily
+// reloaded on their next request.
+//
+// Thread-safe. A tenant whose store a caller still holds (a shared_ptr from acquire()) is
+// never trimmed: a second store loaded for it from the file would lack the first one's
+// latest marks, and both would issue names. The bounds can be exceeded meanwhile.
+class TenantRegistry {
+public:
+    struct TenantStats {
+        std::string id;
+        bool hot = false;
+        size_t used = 0;          // names issued (as of last time the tenant was in memory)
+        size_t memory_bytes = 0;  // 0 while cold
+        uint64_t evictions = 0;
+        HistoryStore::IoStats io; // cumulative across loads/evictions
+    };
+
+    struct Totals {
+        size_t hot = 0;
+        size_t known = 0;
+        size_t memory_bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    TenantRegistry(std::string dir, size_t max_hot, size_t max_bytes);
+
+    // Tenant ids are 1-64 chars of [A-Za-z0-9_-] (they become file names).
+    static bool is_valid_tenant_id(const std::string& id);
+
+    // Returns the (possibly freshly loaded) store for `tenant`.
+    // Returns empty string on success; otherwise an error message.
+    std::string acquire(const std::string& tenant, std::shared_ptr<HistoryStore>& out);
+
+    // Evicts least recently used tenants until within the configured bounds.
+    // Call after a store's memory may have grown (e.g. after generate_and_mark).
+    void trim();
+
+    // Drops every tenant from memory, e.g. after the name universe changed: each one is
+    // reloaded (and its history migrated) on its next request. Held stores are dropped
+    // too, so no request may be using one (the server holds its swap lock exclusively).
+    void evict_all();
+
+    // Set when several processes serve tenants from the same directory (prefork mode).
+    void set_multi_process(bool on) { multi_process_ = on; }
+
+    Totals totals() const;
+    std::vector<TenantStats> snapshot() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<HistoryStore> store;
+        std::list<std::string>::iterator lru_pos;
+    };
+
+    mutable std::mutex mu_;  // guards everything below
+    std::string dir_;
+    size_t max_hot_;
+    size_t max_bytes_;
+    bool multi_process_ = false;
+
+    std::list<std::string> lru_; // front = most recently used
+    std::unordered_map<std::string, Entry> hot_;
+    std::unordered_map<std::string, TenantStats> known_;
+
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t evictions_ = 0;
+
+    std::string path_for(const std::string& tenant) const;
+    void trim_locked();
+    // Drops the tenant at `pos`; returns the next position in `lru_`.
+    std::list<std::string>::iterator evict(std::list<std::string>::iterator pos);
+    size_t hot_memory_bytes() const;
+};
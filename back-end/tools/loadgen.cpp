@@ -0,0 +1,649 @@
+// Load generator for the name server: drives /api/generate and the static routes and
+// reports latency percentiles and throughput as JSON on stdout.
+//
+// Build (from repo root):
+//   g++ -std=c++17 -O2 -pthread -Iback-end back-end/tools/loadgen.cpp back-end/namegen.cpp -o loadgen
+//
+// Usage:
+//   loadgen [--host H] [--port P] [--spawn SERVER [--server-cwd DIR]]
+//           [--mode closed|open] [--concurrency N] [--rate R]
+//           [--duration S | --requests N] [--mix generate=90,static=10]
+//           [--count fixed:N | uniform:A-B | zipf:A-B] [--seed N]
+//
+// Closed loop (the default): each of N connections sends its next request as soon as the
+// previous one is answered, so latency is per request and the server sets the pace.
+// Open loop: requests are due at a fixed --rate whatever the server does, and latency is
+// measured from when a request was due, not from when a connection got round to sending
+// it. A stalled server then shows up as the queue of late requests it caused, instead of
+// as one slow request (coordinated omission). --concurrency caps the requests in flight.
+//
+// --spawn starts SERVER on a free port with HISTORY_FILE and HISTORY_TENANT_DIR in a new
+// temporary directory (removed afterwards; the server's output goes to server.log there
+// and is printed if it fails to start). Unless NAME_DICT_FILE is set, the server also gets
+// a generated dictionary of made-up names (kSpawnUniverse combinations): the built-in
+// 79,404 last about a second of a default run. The server runs in --server-cwd (default
+// "."), which must hold front-end/ for the static routes. Other settings (SERVER_WORKERS,
+// IO_ENGINE, ...) are inherited from the environment.
+//
+// Latency is reported for 2xx responses only: errors, e.g. the 400s once the universe runs
+// out, take a much cheaper path. They are counted under "status", and a warning goes to
+// stderr when more than kMaxErrorFraction of the responses are not 2xx.
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "namegen.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr double kMaxErrorFraction = 0.01;
+
+// -------------------------
+// HdrHistogram
+// -------------------------
+// Log-linear buckets after HdrHistogram: every value up to kHighest microseconds is
+// recorded with three significant digits, in a fixed array of counters (about 40 KB).
+class Histogram {
+public:
+    static constexpr int64_t kHighest = 3600LL * 1000 * 1000;  // one hour, in microseconds
+
+    Histogram() {
+        int64_t smallest_untrackable = kSubBucketCount;
+        int buckets = 1;
+        while (smallest_untrackable <= kHighest) {
+            smallest_untrackable <<= 1;
+            buckets++;
+        }
+        counts_.assign(static_cast<size_t>(buckets + 1) * kSubBucketHalfCount, 0);
+    }
+
+    void record(int64_t value) {
+        value = std::clamp<int64_t>(value, 0, kHighest);
+        counts_[index_of(value)]++;
+        total_++;
+        sum_ += value;
+        max_ = std::max(max_, value);
+        min_ = std::min(min_, value);
+    }
+
+    void merge(const Histogram& other) {
+        for (size_t i = 0; i < counts_.size(); i++) counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+        min_ = std::min(min_, other.min_);
+    }
+
+    uint64_t count() const { return total_; }
+    int64_t max() const { return total_ ? max_ : 0; }
+    int64_t min() const { return total_ ? min_ : 0; }
+    double mean() const { return total_ ? static_cast<double>(sum_) / static_cast<double>(total_) : 0; }
+
+    // The largest value that `percentile` percent of recorded values are at or below (to
+    // the histogram's precision).
+    int64_t value_at_percentile(double percentile) const {
+        if (total_ == 0) return 0;
+        const double p = std::clamp(percentile, 0.0, 100.0);
+        const uint64_t wanted = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100.0 * total_)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= wanted) return std::min(highest_equivalent(value_at_index(i)), max_);
+        }
+        return max_;
+    }
+
+private:
+    // 2 * 10^3 values get single-unit resolution; sub-buckets come in powers of two.
+    static constexpr int kSubBucketCountMagnitude = 11;
+    static constexpr int64_t kSubBucketCount = int64_t{1} << kSubBucketCountMagnitude;
+    static constexpr int64_t kSubBucketHalfCount = kSubBucketCount / 2;
+    static constexpr int kSubBucketHalfCountMagnitude = kSubBucketCountMagnitude - 1;
+    static constexpr int64_t kSubBucketMask = kSubBucketCount - 1;
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    int64_t sum_ = 0;
+    int64_t max_ = 0;
+    int64_t min_ = kHighest;
+
+    static int bucket_of(int64_t value) {
+        const int pow2ceiling = 64 - __builtin_clzll(static_cast<uint64_t>(value | kSubBucketMask));
+        return pow2ceiling - (kSubBucketHalfCountMagnitude + 1);
+    }
+
+    static size_t index_of(int64_t value) {
+        const int bucket = bucket_of(value);
+        const int64_t sub = value >> bucket;
+        return static_cast<size_t>((static_cast<int64_t>(bucket + 1) << kSubBucketHalfCountMagnitude) +
+                                   (sub - kSubBucketHalfCount));
+    }
+
+    static int64_t value_at_index(size_t index) {
+        int bucket = static_cast<int>(index >> kSubBucketHalfCountMagnitude) - 1;
+        int64_t sub = static_cast<int64_t>(index & (kSubBucketHalfCount - 1)) + kSubBucketHalfCount;
+        if (bucket < 0) {
+            sub -= kSubBucketHalfCount;
+            bucket = 0;
+        }
+        return sub << bucket;
+    }
+
+    static int64_t highest_equivalent(int64_t value) {
+        const int bucket = bucket_of(value);
+        const int64_t sub = value >> bucket;
+        const int64_t lowest = sub << bucket;
+        const int range_bucket = sub >= kSubBucketCount ? bucket + 1 : bucket;
+        return lowest + (int64_t{1} << range_bucket) - 1;
+    }
+};
+
+// -------------------------
+// Options
+// -------------------------
+enum Route { kGenerate = 0, kStatic = 1, kRouteCount = 2 };
+static const char* const kRouteNames[kRouteCount] = {"generate", "static"};
+static const char* const kStaticPaths[] = {"/", "/app.js", "/styles.css"};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::string spawn;
+    std::string server_cwd = ".";
+    bool open_loop = false;
+    int concurrency = 16;
+    double rate = 1000;
+    double duration_s = 10;
+    uint64_t requests = 0;  // 0: run for duration_s
+    double weights[kRouteCount] = {90, 10};
+    std::string count_spec = "fixed:10";
+    uint64_t seed = 1;
+};
+
+// Per-request `count` for /api/generate: fixed, uniform or Zipf (s = 1) over [lo, hi].
+class CountDistribution {
+public:
+    // Returns empty string on success; otherwise an error message.
+    std::string parse(const std::string& spec) {
+        const size_t colon = spec.find(':');
+        if (colon == std::string::npos) return "bad --count '" + spec + "'";
+        const std::string kind = spec.substr(0, colon);
+        const std::string range = spec.substr(colon + 1);
+        const size_t dash = range.find('-');
+        lo_ = std::atoi(range.substr(0, dash).c_str());
+        hi_ = dash == std::string::npos ? lo_ : std::atoi(range.substr(dash + 1).c_str());
+        if (lo_ < 1 || hi_ < lo_) return "bad --count range '" + range + "'";
+        if (kind == "fixed") {
+            if (dash != std::string::npos) return "--count fixed takes one value";
+            hi_ = lo_;
+        } else if (kind == "uniform") {
+        } else if (kind == "zipf") {
+            double sum = 0;
+            for (int k = lo_; k <= hi_; k++) {
+                sum += 1.0 / (k - lo_ + 1);
+                zipf_cdf_.push_back(sum);
+            }
+            for (double& c : zipf_cdf_) c /= sum;
+        } else {
+            return "unknown --count kind '" + kind + "' (fixed, uniform or zipf)";
+        }
+        return "";
+    }
+
+    int sample(std::mt19937_64& rng) const {
+        if (lo_ == hi_) return lo_;
+        if (zipf_cdf_.empty()) return std::uniform_int_distribution<int>(lo_, hi_)(rng);
+        const double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        const size_t i = std::lower_bound(zipf_cdf_.begin(), zipf_cdf_.end(), u) - zipf_cdf_.begin();
+        return lo_ + static_cast<int>(std::min(i, zipf_cdf_.size() - 1));
+    }
+
+private:
+    int lo_ = 1;
+    int hi_ = 1;
+    std::vector<double> zipf_cdf_;
+};
+
+static bool parse_mix(const std::string& spec, double (&weights)[kRouteCount]) {
+    double parsed[kRouteCount] = {0, 0};
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        const std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        const size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        const std::string name = item.substr(0, eq);
+        int route = -1;
+        for (int r = 0; r < kRouteCount; r++) {
+            if (name == kRouteNames[r]) route = r;
+        }
+        const double w = std::atof(item.c_str() + eq + 1);
+        if (route < 0 || w < 0) return false;
+        parsed[route] = w;
+    }
+    if (parsed[kGenerate] + parsed[kStatic] <= 0) return false;
+    std::copy(parsed, parsed + kRouteCount, weights);
+    return true;
+}
+
+// -------------------------
+// HTTP
+// -------------------------
+// One request on a new connection (the server closes after every response). Returns the
+// status code, or 0 if the connection or the response failed.
+static int http_get(const sockaddr_storage& addr, socklen_t addr_len, const std::string& host, const std::string& path) {
+    const int fd = ::socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return 0;
+    timeval tv{30, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    const int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), addr_len) != 0) {
+        ::close(fd);
+        return 0;
+    }
+    const std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+    size_t sent = 0;
+    while (sent < req.size()) {
+        const ssize_t n = ::send(fd, req.data() + sent, req.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            ::close(fd);
+            return 0;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    // Read to EOF; only the status line is kept.
+    char buf[16384];
+    std::string head;
+    for (;;) {
+        const ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            return 0;
+        }
+        if (head.size() < 16) head.append(buf, std::min<size_t>(static_cast<size_t>(n), 16 - head.size()));
+    }
+    ::close(fd);
+    if (head.compare(0, 5, "HTTP/") != 0) return 0;
+    const size_t sp = head.find(' ');
+    return sp == std::string::npos ? 0 : std::atoi(head.c_str() + sp + 1);
+}
+
+// -------------------------
+// Spawned server
+// -------------------------
+struct SpawnedServer {
+    pid_t pid = -1;
+    std::string dir;
+    uint64_t made_up_names = 0;  // size of the generated dictionary, if any
+};
+
+static int remove_entry(const char* path, const struct stat*, int, FTW*) {
+    return ::remove(path);
+}
+
+static void remove_tree(const std::string& dir) {
+    ::nftw(dir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int free_port() {
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(a);
+    int port = -1;
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0 &&
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&a), &len) == 0) {
+        port = ntohs(a.sin_port);
+    }
+    ::close(fd);
+    return port;
+}
+
+static void print_server_log(const SpawnedServer& s) {
+    FILE* f = std::fopen((s.dir + "/server.log").c_str(), "r");
+    if (!f) return;
+    char line[512];
+    while (std::fgets(line, sizeof(line), f)) std::cerr << "  server: " << line;
+    std::fclose(f);
+}
+
+static void stop_server(SpawnedServer& s) {
+    if (s.pid > 0) {
+        ::kill(s.pid, SIGTERM);
+        int status = 0;
+        ::waitpid(s.pid, &status, 0);
+        s.pid = -1;
+    }
+    if (!s.dir.empty()) remove_tree(s.dir);
+    s.dir.clear();
+}
+
+// Made-up names from syllables: `len` syllables spelling `id`, then `suffix`.
+static std::string made_up_name(size_t id, int len, const char* suffix) {
+    static const char* const kSyllables[] = {"ka", "ri", "lo", "ma", "nu", "se", "ta", "vi",
+                                             "de", "pa", "ro", "mi", "na", "zu", "le", "go"};
+    std::string name;
+    for (int i = 0; i < len; i++, id /= 16) name += kSyllables[id % 16];
+    name += suffix;
+    name[0] = static_cast<char>(name[0] - 'a' + 'A');
+    return name;
+}
+
+// 1,200 first names x (8 middles + none) x 5,000 surnames: 54M combinations.
+static constexpr size_t kSpawnFirsts = 600;  // per gender
+static constexpr size_t kSpawnMiddles = 8;
+static constexpr size_t kSpawnSurnames = 5000;
+static constexpr uint64_t kSpawnUniverse = kSpawnFirsts * 2 * (kSpawnMiddles + 1) * kSpawnSurnames;
+
+static std::string write_spawn_dictionary(const std::string& path) {
+    std::vector<std::string> boys, girls, middles, surnames;
+    for (size_t i = 0; i < kSpawnFirsts; i++) {
+        boys.push_back(made_up_name(i, 3, "n"));
+        girls.push_back(made_up_name(i, 3, "a"));
+    }
+    for (size_t i = 0; i < kSpawnMiddles; i++) middles.push_back(made_up_name(i, 2, "s"));
+    for (size_t i = 0; i < kSpawnSurnames; i++) surnames.push_back(made_up_name(i, 4, "r"));
+    return namegen::write_dictionary(path, boys, girls, middles, surnames);
+}
+
+// Returns empty string on success; otherwise an error message.
+static std::string start_server(Options& o, SpawnedServer& out) {
+    char tmpl[] = "/tmp/loadgen.XXXXXX";
+    if (!::mkdtemp(tmpl)) return std::string("mkdtemp: ") + std::strerror(errno);
+    out.dir = tmpl;
+    o.port = free_port();
+    if (o.port < 0) return "could not find a free port";
+    o.host = "127.0.0.1";
+
+    std::string dict_path;
+    if (const char* v = std::getenv("NAME_DICT_FILE"); !v || !*v) {
+        dict_path = out.dir + "/names.dict";
+        if (auto err = write_spawn_dictionary(dict_path); !err.empty()) return "name dictionary: " + err;
+        out.made_up_names = kSpawnUniverse;
+    }
+
+    const std::string log_path = out.dir + "/server.log";
+    const pid_t pid = ::fork();
+    if (pid < 0) return std::string("fork: ") + std::strerror(errno);
+    if (pid == 0) {
+        const int log = ::open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log >= 0) {
+            ::dup2(log, STDOUT_FILENO);
+            ::dup2(log, STDERR_FILENO);
+        }
+        ::setenv("PORT", std::to_string(o.port).c_str(), 1);
+        ::setenv("HISTORY_FILE", (out.dir + "/history").c_str(), 1);
+        ::setenv("HISTORY_TENANT_DIR", (out.dir + "/tenants").c_str(), 1);
+        if (!dict_path.empty()) ::setenv("NAME_DICT_FILE", dict_path.c_str(), 1);
+        if (::chdir(o.server_cwd.c_str()) != 0) _exit(127);
+        ::execl(o.spawn.c_str(), o.spawn.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    out.pid = pid;
+
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_port = htons(static_cast<uint16_t>(o.port));
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sockaddr_storage addr{};
+    std::memcpy(&addr, &a, sizeof(a));
+    const auto deadline = Clock::now() + std::chrono::seconds(30);
+    while (Clock::now() < deadline) {
+        int status = 0;
+        if (::waitpid(pid, &status, WNOHANG) == pid) {
+            out.pid = -1;
+            return "server exited during startup";
+        }
+        if (http_get(addr, sizeof(a), o.host, "/api/remaining") == 200) return "";
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return "server did not answer /api/remaining within 30s";
+}
+
+// -------------------------
+// Load
+// -------------------------
+struct RouteStats {
+    Histogram latency;  // 2xx only; open loop: from when the request was due
+    Histogram service;  // 2xx only; from when it was sent
+    std::map<int, uint64_t> status;  // every response; 0: connection or protocol error
+};
+
+struct Worker {
+    RouteStats routes[kRouteCount];
+};
+
+static void run_worker(const Options& o, const CountDistribution& counts, const sockaddr_storage& addr,
+                       socklen_t addr_len, int index, Clock::time_point start, Clock::time_point stop,
+                       std::atomic<uint64_t>& next, Worker& w) {
+    std::mt19937_64 rng(o.seed * 0x9E3779B97F4A7C15ULL + static_cast<uint64_t>(index));
+    std::discrete_distribution<int> pick_route(o.weights, o.weights + kRouteCount);
+    const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / o.rate));
+    for (;;) {
+        const uint64_t i = next.fetch_add(1, std::memory_order_relaxed);
+        if (o.requests && i >= o.requests) break;
+        Clock::time_point due = Clock::now();
+        if (o.open_loop) {
+            due = start + period * static_cast<int64_t>(i);
+            if (!o.requests && due >= stop) break;
+            std::this_thread::sleep_until(due);
+        } else if (!o.requests && due >= stop) {
+            break;
+        }
+
+        const int route = pick_route(rng);
+        std::string path;
+        if (route == kGenerate) {
+            path = "/api/generate?count=" + std::to_string(counts.sample(rng));
+        } else {
+            path = kStaticPaths[i % (sizeof(kStaticPaths) / sizeof(kStaticPaths[0]))];
+        }
+        const auto sent = Clock::now();
+        const int status = http_get(addr, addr_len, o.host, path);
+        const auto done = Clock::now();
+
+        RouteStats& r = w.routes[route];
+        r.status[status]++;
+        if (status < 200 || status >= 300) continue;
+        r.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(done - due).count());
+        r.service.record(std::chrono::duration_cast<std::chrono::microseconds>(done - sent).count());
+    }
+}
+
+static void append_histogram(std::string& out, const Histogram& h) {
+    char buf[256];
+    std::snprintf(buf, sizeof(buf),
+                  "{\"count\":%llu,\"min\":%lld,\"mean\":%.1f,\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,"
+                  "\"p99.9\":%lld,\"max\":%lld}",
+                  static_cast<unsigned long long>(h.count()), static_cast<long long>(h.min()), h.mean(),
+                  static_cast<long long>(h.value_at_percentile(50)), static_cast<long long>(h.value_at_percentile(90)),
+                  static_cast<long long>(h.value_at_percentile(99)),
+                  static_cast<long long>(h.value_at_percentile(99.9)), static_cast<long long>(h.max()));
+    out += buf;
+}
+
+static void append_status(std::string& out, const std::map<int, uint64_t>& status) {
+    out += "{";
+    bool first = true;
+    for (const auto& [code, n] : status) {
+        if (!first) out += ",";
+        first = false;
+        out += "\"" + (code ? std::to_string(code) : std::string("error")) + "\":" + std::to_string(n);
+    }
+    out += "}";
+}
+
+static std::string report(const Options& o, const RouteStats (&routes)[kRouteCount], double elapsed_s) {
+    RouteStats all;
+    for (const RouteStats& r : routes) {
+        all.latency.merge(r.latency);
+        all.service.merge(r.service);
+        for (const auto& [code, n] : r.status) all.status[code] += n;
+    }
+    uint64_t ok = 0;
+    uint64_t requests = 0;
+    for (const auto& [code, n] : all.status) {
+        if (code >= 200 && code < 300) ok += n;
+        requests += n;
+    }
+    if (requests > 0 && static_cast<double>(requests - ok) > kMaxErrorFraction * static_cast<double>(requests)) {
+        std::cerr << "warning: " << requests - ok << " of " << requests
+                  << " responses were not 2xx; latency covers the 2xx ones only\n";
+    }
+
+    char buf[512];
+    std::string out = "{";
+    std::snprintf(buf, sizeof(buf),
+                  "\"mode\":\"%s\",\"concurrency\":%d,\"target_rate\":%.1f,\"count\":\"%s\",\"elapsed_s\":%.3f,"
+                  "\"requests\":%llu,\"throughput_rps\":%.1f,\"ok_rps\":%.1f,\"unit\":\"us\",",
+                  o.open_loop ? "open" : "closed", o.concurrency, o.open_loop ? o.rate : 0.0, o.count_spec.c_str(),
+                  elapsed_s, static_cast<unsigned long long>(requests), requests / elapsed_s, ok / elapsed_s);
+    out += buf;
+    out += "\"latency\":";
+    append_histogram(out, all.latency);
+    if (o.open_loop) {
+        out += ",\"service\":";
+        append_histogram(out, all.service);
+    }
+    out += ",\"status\":";
+    append_status(out, all.status);
+    out += ",\"routes\":{";
+    bool first = true;
+    for (int r = 0; r < kRouteCount; r++) {
+        if (routes[r].status.empty()) continue;
+        if (!first) out += ",";
+        first = false;
+        out += "\"" + std::string(kRouteNames[r]) + "\":{\"latency\":";
+        append_histogram(out, routes[r].latency);
+        out += ",\"status\":";
+        append_status(out, routes[r].status);
+        out += "}";
+    }
+    out += "}}";
+    return out;
+}
+
+static void usage() {
+    std::cerr << "usage: loadgen [--host H] [--port P] [--spawn SERVER [--server-cwd DIR]]\n"
+                 "               [--mode closed|open] [--concurrency N] [--rate R]\n"
+                 "               [--duration S | --requests N] [--mix generate=90,static=10]\n"
+                 "               [--count fixed:N | uniform:A-B | zipf:A-B] [--seed N]\n";
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        std::string v;
+        auto next = [&]() {
+            if (i + 1 >= argc) return false;
+            v = argv[++i];
+            return true;
+        };
+        bool ok = true;
+        if (a == "--host") ok = next() && (o.host = v, true);
+        else if (a == "--port") ok = next() && (o.port = std::atoi(v.c_str())) > 0;
+        else if (a == "--spawn") ok = next() && (o.spawn = v, true);
+        else if (a == "--server-cwd") ok = next() && (o.server_cwd = v, true);
+        else if (a == "--mode") ok = next() && (v == "open" || v == "closed") && (o.open_loop = v == "open", true);
+        else if (a == "--concurrency") ok = next() && (o.concurrency = std::atoi(v.c_str())) > 0;
+        else if (a == "--rate") ok = next() && (o.rate = std::atof(v.c_str())) > 0;
+        else if (a == "--duration") ok = next() && (o.duration_s = std::atof(v.c_str())) > 0;
+        else if (a == "--requests") ok = next() && (o.requests = std::strtoull(v.c_str(), nullptr, 10)) > 0;
+        else if (a == "--mix") ok = next() && parse_mix(v, o.weights);
+        else if (a == "--count") ok = next() && (o.count_spec = v, true);
+        else if (a == "--seed") ok = next() && (o.seed = std::strtoull(v.c_str(), nullptr, 10), true);
+        else ok = false;
+        if (!ok) {
+            usage();
+            return 2;
+        }
+    }
+    CountDistribution counts;
+    if (auto err = counts.parse(o.count_spec); !err.empty()) {
+        std::cerr << err << "\n";
+        return 2;
+    }
+
+    SpawnedServer server;
+    if (!o.spawn.empty()) {
+        if (auto err = start_server(o, server); !err.empty()) {
+            std::cerr << "could not start " << o.spawn << ": " << err << "\n";
+            print_server_log(server);
+            stop_server(server);
+            return 1;
+        }
+        std::cerr << "started " << o.spawn << " on port " << o.port << " (history in " << server.dir;
+        if (server.made_up_names) std::cerr << ", " << server.made_up_names << " made-up names";
+        std::cerr << ")\n";
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (::getaddrinfo(o.host.c_str(), std::to_string(o.port).c_str(), &hints, &res) != 0 || !res) {
+        std::cerr << "could not resolve " << o.host << "\n";
+        stop_server(server);
+        return 1;
+    }
+    sockaddr_storage addr{};
+    const socklen_t addr_len = static_cast<socklen_t>(res->ai_addrlen);
+    std::memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    ::freeaddrinfo(res);
+
+    std::vector<Worker> workers(static_cast<size_t>(o.concurrency));
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> next{0};
+    const auto start = Clock::now();
+    const auto stop = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(o.duration_s));
+    for (int t = 0; t < o.concurrency; t++) {
+        threads.emplace_back(run_worker, std::cref(o), std::cref(counts), std::cref(addr), addr_len, t, start, stop,
+                             std::ref(next), std::ref(workers[static_cast<size_t>(t)]));
+    }
+    for (auto& t : threads) t.join();
+    const double elapsed_s = std::chrono::duration<double>(Clock::now() - start).count();
+
+    RouteStats routes[kRouteCount];
+    for (const Worker& w : workers) {
+        for (int r = 0; r < kRouteCount; r++) {
+            routes[r].latency.merge(w.routes[r].latency);
+            routes[r].service.merge(w.routes[r].service);
+            for (const auto& [code, n] : w.routes[r].status) routes[r].status[code] += n;
+        }
+    }
+    std::cout << report(o, routes, elapsed_s) << "\n";
+    stop_server(server);
+    return 0;
+}
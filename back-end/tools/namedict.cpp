@@ -0,0 +1,90 @@
+// Builds a binary name dictionary for NAME_DICT_FILE.
+//
+// Build (from repo root):
+//   g++ -std=c++17 -O2 -Iback-end back-end/tools/namedict.cpp back-end/namegen.cpp -o namedict
+//
+// Usage:
+//   namedict --boys boys.txt --girls girls.txt --surnames surnames.txt [--middles middles.txt] -o names.dict
+//   namedict --builtin -o names.dict      (export the built-in lists)
+//
+// Input files hold one name per line; blank lines and lines starting with '#' are skipped.
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "namegen.hpp"
+
+static bool read_list(const std::string& path, std::vector<std::string>& out) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "could not open " << path << "\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) line.pop_back();
+        size_t b = line.find_first_not_of(" \t");
+        if (b == std::string::npos || line[b] == '#') continue;
+        out.push_back(line.substr(b));
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string boys_path, girls_path, middles_path, surnames_path, out_path;
+    bool builtin = false;
+    for (int i = 1; i < argc; i++) {
+        const std::string a = argv[i];
+        auto next = [&](std::string& dst) {
+            if (i + 1 >= argc) return false;
+            dst = argv[++i];
+            return true;
+        };
+        bool ok = true;
+        if (a == "--boys") ok = next(boys_path);
+        else if (a == "--girls") ok = next(girls_path);
+        else if (a == "--middles") ok = next(middles_path);
+        else if (a == "--surnames") ok = next(surnames_path);
+        else if (a == "-o" || a == "--out") ok = next(out_path);
+        else if (a == "--builtin") builtin = true;
+        else ok = false;
+        if (!ok) {
+            std::cerr << "usage: namedict (--builtin | --boys F --girls F --surnames F [--middles F]) -o OUT\n";
+            return 2;
+        }
+    }
+    if (out_path.empty()) {
+        std::cerr << "missing -o OUT\n";
+        return 2;
+    }
+
+    std::vector<std::string> boys, girls, middles, surnames;
+    if (builtin) {
+        for (size_t f = 0; f < namegen::first_name_count(); f++) {
+            auto& dst = namegen::first_name_gender(f) == namegen::Gender::Male ? boys : girls;
+            dst.emplace_back(namegen::first_name_at(f));
+        }
+        for (size_t l = 0; l < namegen::surname_count(); l++) surnames.emplace_back(namegen::surname_at(l));
+    } else {
+        if (boys_path.empty() || girls_path.empty() || surnames_path.empty()) {
+            std::cerr << "--boys, --girls and --surnames are required\n";
+            return 2;
+        }
+        if (!read_list(boys_path, boys) || !read_list(girls_path, girls) || !read_list(surnames_path, surnames)) return 1;
+        if (!middles_path.empty() && !read_list(middles_path, middles)) return 1;
+    }
+
+    auto err = namegen::write_dictionary(out_path, boys, girls, middles, surnames);
+    if (!err.empty()) {
+        std::cerr << err << "\n";
+        return 1;
+    }
+    const double combos = static_cast<double>(boys.size() + girls.size()) *
+                          static_cast<double>(middles.size() + 1) * static_cast<double>(surnames.size());
+    std::cout << "wrote " << out_path << ": " << boys.size() << " boys, " << girls.size() << " girls, "
+              << middles.size() << " middles, " << surnames.size() << " surnames (" << combos
+              << " combinations)\n";
+    return 0;
+}
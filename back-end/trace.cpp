@@ -0,0 +1,194 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+
+struct Event {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int64_t> start_ns{0};  // since g_epoch
+    std::atomic<int64_t> dur_ns{0};
+};
+
+// One per recording thread; kept (in g_rings) after the thread exits so its events still
+// show up in the next dump.
+struct Ring {
+    Event events[Trace::kEventsPerThread];
+    std::atomic<uint64_t> head{0};  // events ever recorded
+    uint32_t tid = 0;
+    std::string thread_name;
+};
+
+std::atomic<double> g_rate{0};
+const Trace::Clock::time_point g_epoch = Trace::Clock::now();
+
+std::mutex g_rings_mu;
+std::vector<std::shared_ptr<Ring>> g_rings;  // guarded by g_rings_mu
+
+thread_local Ring* t_ring = nullptr;
+thread_local const char* t_thread_name = "thread";
+thread_local uint64_t t_rng = 0;
+
+Ring& ring_for_this_thread() {
+    if (!t_ring) {
+        auto r = std::make_shared<Ring>();
+        r->thread_name = t_thread_name;
+        std::lock_guard<std::mutex> lk(g_rings_mu);
+        r->tid = static_cast<uint32_t>(g_rings.size() + 1);
+        g_rings.push_back(r);
+        t_ring = r.get();
+    }
+    return *t_ring;
+}
+
+// xorshift64: the sampling decision must cost next to nothing.
+uint64_t next_random() {
+    if (t_rng == 0) {
+        t_rng = static_cast<uint64_t>(Trace::Clock::now().time_since_epoch().count()) ^
+                reinterpret_cast<uintptr_t>(&t_rng) ^ 0x9E3779B97F4A7C15ULL;
+    }
+    t_rng ^= t_rng << 13;
+    t_rng ^= t_rng >> 7;
+    t_rng ^= t_rng << 17;
+    return t_rng;
+}
+
+void append_json_string(std::string& out, const char* s) {
+    out += '"';
+    for (; *s; s++) {
+        const char c = *s;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) >= 0x20) {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+}  // namespace
+
+void Trace::configure(double rate) {
+    g_rate.store(std::clamp(rate, 0.0, 1.0), std::memory_order_relaxed);
+}
+
+double Trace::sample_rate() {
+    return g_rate.load(std::memory_order_relaxed);
+}
+
+void Trace::record(const char* name, Clock::time_point start, Clock::time_point end) {
+    if (!active_) return;
+    Ring& r = ring_for_this_thread();
+    const uint64_t h = r.head.load(std::memory_order_relaxed);
+    Event& e = r.events[h & (kEventsPerThread - 1)];
+    e.name.store(name, std::memory_order_relaxed);
+    e.start_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(start - g_epoch).count(),
+                     std::memory_order_relaxed);
+    e.dur_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                   std::memory_order_relaxed);
+    r.head.store(h + 1, std::memory_order_release);
+}
+
+void Trace::set_thread_name(const char* name) {
+    t_thread_name = name;
+    if (t_ring) {
+        std::lock_guard<std::mutex> lk(g_rings_mu);
+        t_ring->thread_name = name;
+    }
+}
+
+Trace::Request::Request(const char* name) : name_(nullptr) {
+    const double rate = sample_rate();
+    if (rate <= 0) return;
+    if (rate < 1 && static_cast<double>(next_random() >> 11) * 0x1.0p-53 >= rate) return;
+    name_ = name;
+    active_ = true;
+    start_ = Clock::now();
+}
+
+Trace::Request::~Request() {
+    if (!name_) return;
+    record(name_, start_, Clock::now());
+    active_ = false;
+}
+
+void Trace::write_json(std::string& out) {
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> lk(g_rings_mu);
+        rings = g_rings;
+    }
+    const long pid = static_cast<long>(::getpid());
+    char buf[256];
+    out += "{\"traceEvents\":[";
+    bool first = true;
+    struct Copy {
+        const char* name;
+        int64_t start_ns;
+        int64_t dur_ns;
+    };
+    std::vector<Copy> copy;
+    for (const auto& r : rings) {
+        std::string thread_name;
+        {
+            std::lock_guard<std::mutex> lk(g_rings_mu);
+            thread_name = r->thread_name;
+        }
+        std::snprintf(buf, sizeof(buf), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%u,\"args\":{\"name\":",
+                      first ? "" : ",", pid, r->tid);
+        first = false;
+        out += buf;
+        append_json_string(out, (thread_name + "-" + std::to_string(r->tid)).c_str());
+        out += "}}";
+
+        const uint64_t before = r->head.load(std::memory_order_acquire);
+        const uint64_t from = before > kEventsPerThread ? before - kEventsPerThread : 0;
+        copy.clear();
+        for (uint64_t i = from; i < before; i++) {
+            const Event& e = r->events[i & (kEventsPerThread - 1)];
+            copy.push_back(Copy{e.name.load(std::memory_order_relaxed), e.start_ns.load(std::memory_order_relaxed),
+                                e.dur_ns.load(std::memory_order_relaxed)});
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // Slots at or below `after - kEventsPerThread` may have been rewritten while they
+        // were copied.
+        const uint64_t after = r->head.load(std::memory_order_relaxed);
+        const uint64_t valid_from = after >= kEventsPerThread ? after - kEventsPerThread + 1 : 0;
+        for (uint64_t i = std::max(from, valid_from); i < before; i++) {
+            const Copy& c = copy[i - from];
+            if (!c.name) continue;
+            std::snprintf(buf, sizeof(buf), ",{\"ph\":\"X\",\"pid\":%ld,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+                          pid, r->tid, static_cast<double>(c.start_ns) / 1000.0, static_cast<double>(c.dur_ns) / 1000.0);
+            out += buf;
+            append_json_string(out, c.name);
+            out += "}";
+        }
+    }
+    std::snprintf(buf, sizeof(buf), "],\"displayTimeUnit\":\"ms\",\"otherData\":{\"sample_rate\":%g}}", sample_rate());
+    out += buf;
+}
+
+std::string Trace::write_file(const std::string& path) {
+    std::string json;
+    write_json(json);
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        if (!f) return "could not open " + tmp + ": " + std::strerror(errno);
+        f.write(json.data(), static_cast<std::streamsize>(json.size()));
+        if (!f) return "could not write " + tmp;
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) return "could not rename " + tmp + ": " + std::strerror(errno);
+    return "";
+}
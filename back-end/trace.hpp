@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// Sampled request tracing in the Chrome trace event format (chrome://tracing, Perfetto).
+//
+// TRACE_SAMPLE sets the fraction of requests that are traced (off by default). A traced
+// request records a span for itself and for each Trace::Span opened on its thread while it
+// runs; every other request pays one thread_local check per span. Spans go into a ring of
+// the last kEventsPerThread events owned by the recording thread: only that thread writes
+// it, with plain atomic stores and no lock, and write_json() copies every ring without
+// stopping the writers (events overwritten while it copies are left out).
+//
+// Span names must be string literals (or otherwise outlive the process): only the pointer
+// is stored.
+class Trace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t kEventsPerThread = 16384;  // a power of two
+
+    // Traces a `rate` fraction of requests; 0 turns tracing off.
+    static void configure(double rate);
+    static double sample_rate();
+    static bool enabled() { return sample_rate() > 0; }
+
+    // True while the calling thread serves a traced request.
+    static bool active() { return active_; }
+
+    // Records a finished span on the calling thread if it serves a traced request.
+    static void record(const char* name, Clock::time_point start, Clock::time_point end);
+
+    // Shown for the calling thread's events (default "thread").
+    static void set_thread_name(const char* name);
+
+    // Appends every thread's recorded events as a trace JSON object.
+    static void write_json(std::string& out);
+
+    // Writes write_json() to `path`. Returns empty string on success; otherwise an error
+    // message.
+    static std::string write_file(const std::string& path);
+
+    // Decides whether the request served by the calling thread is traced, and if so
+    // records a span named `name` covering this object's lifetime.
+    class Request {
+    public:
+        explicit Request(const char* name);
+        ~Request();
+        Request(const Request&) = delete;
+        Request& operator=(const Request&) = delete;
+
+    private:
+        const char* name_;
+        Clock::time_point start_;
+    };
+
+    // A span covering this object's lifetime, if the thread serves a traced request.
+    class Span {
+    public:
+        explicit Span(const char* name) : name_(active_ ? name : nullptr) {
+            if (name_) start_ = Clock::now();
+        }
+        ~Span() {
+            if (name_) record(name_, start_, Clock::now());
+        }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+    private:
+        const char* name_;
+        Clock::time_point start_;
+    };
+
+private:
+    inline static thread_local bool active_ = false;
+};
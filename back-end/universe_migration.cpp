@@ -0,0 +1,87 @@
+#include "universe_migration.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+
+using namegen::ListKind;
+
+// Sort-merge join of two name lists into CSR form: for every old entry (by position), the
+// positions of the new entries with the same name, plus `offset`.
+static void join_by_name(size_t old_n, const std::function<std::string_view(size_t)>& old_at,
+                         size_t new_n, const std::function<std::string_view(size_t)>& new_at,
+                         uint64_t offset, std::vector<uint32_t>& start, std::vector<uint64_t>& targets) {
+    std::vector<uint32_t> a(old_n);
+    std::vector<uint32_t> b(new_n);
+    for (size_t i = 0; i < old_n; i++) a[i] = static_cast<uint32_t>(i);
+    for (size_t i = 0; i < new_n; i++) b[i] = static_cast<uint32_t>(i);
+    std::sort(a.begin(), a.end(), [&](uint32_t x, uint32_t y) { return old_at(x) < old_at(y); });
+    std::sort(b.begin(), b.end(), [&](uint32_t x, uint32_t y) { return new_at(x) < new_at(y); });
+
+    std::vector<std::pair<uint32_t, uint32_t>> pairs; // (old, new)
+    pairs.reserve(old_n);
+    size_t j = 0;
+    for (size_t i = 0; i < old_n;) {
+        const std::string_view key = old_at(a[i]);
+        while (j < new_n && new_at(b[j]) < key) j++;
+        size_t j_end = j;
+        while (j_end < new_n && new_at(b[j_end]) == key) j_end++;
+        // Every old entry with this spelling maps to every new entry with it.
+        size_t i_end = i;
+        while (i_end < old_n && old_at(a[i_end]) == key) i_end++;
+        for (size_t x = i; x < i_end; x++) {
+            for (size_t y = j; y < j_end; y++) pairs.emplace_back(a[x], b[y]);
+        }
+        i = i_end;
+        j = j_end;
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    start.assign(old_n + 1, 0);
+    targets.clear();
+    targets.reserve(pairs.size());
+    size_t p = 0;
+    for (size_t i = 0; i < old_n; i++) {
+        start[i] = static_cast<uint32_t>(targets.size());
+        while (p < pairs.size() && pairs[p].first == i) targets.push_back(pairs[p++].second + offset);
+    }
+    start[old_n] = static_cast<uint32_t>(targets.size());
+}
+
+UniverseRemap::UniverseRemap(const namegen::Universe& from, const namegen::Universe& to) {
+    using namegen::list_name_at;
+    using namegen::list_size;
+
+    from_middles_ = list_size(from, ListKind::Middles) + 1;
+    from_lasts_ = list_size(from, ListKind::Surnames);
+    to_middles_ = list_size(to, ListKind::Middles) + 1;
+    to_lasts_ = list_size(to, ListKind::Surnames);
+
+    // First names: boys followed by girls on both sides.
+    const size_t from_boys = list_size(from, ListKind::Boys);
+    const size_t to_boys = list_size(to, ListKind::Boys);
+    join_by_name(
+        from_boys + list_size(from, ListKind::Girls),
+        [&](size_t i) {
+            return i < from_boys ? list_name_at(from, ListKind::Boys, i) : list_name_at(from, ListKind::Girls, i - from_boys);
+        },
+        to_boys + list_size(to, ListKind::Girls),
+        [&](size_t i) {
+            return i < to_boys ? list_name_at(to, ListKind::Boys, i) : list_name_at(to, ListKind::Girls, i - to_boys);
+        },
+        0, first_.start, first_.targets);
+
+    // Middle slots: slot 0 is "no middle name" and maps to itself; named slots are 1-based.
+    Map named;
+    join_by_name(list_size(from, ListKind::Middles), [&](size_t i) { return list_name_at(from, ListKind::Middles, i); },
+                 list_size(to, ListKind::Middles), [&](size_t i) { return list_name_at(to, ListKind::Middles, i); },
+                 1, named.start, named.targets);
+    middle_.targets.assign(1, 0);
+    middle_.targets.insert(middle_.targets.end(), named.targets.begin(), named.targets.end());
+    middle_.start.assign(1, 0);
+    for (uint32_t s : named.start) middle_.start.push_back(s + 1);
+
+    join_by_name(from_lasts_, [&](size_t i) { return list_name_at(from, ListKind::Surnames, i); },
+                 to_lasts_, [&](size_t i) { return list_name_at(to, ListKind::Surnames, i); },
+                 0, last_.start, last_.targets);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "namegen.hpp"
+
+// Maps universe indices of one name universe onto another by name identity.
+//
+// A full name is first [middle] last, so it is enough to map each of the component lists:
+// every old first name maps to all new first-name indices with the same spelling (a name may
+// move between the boy and girl lists or appear twice), and likewise for middle names and
+// surnames. An old index then maps to the cross product of its components' targets, which
+// is empty when any component was removed. Memory is O(list sizes), independent of the
+// universe size, so remapping a used set is a single streaming pass over it.
+class UniverseRemap {
+public:
+    UniverseRemap(const namegen::Universe& from, const namegen::Universe& to);
+
+    // Calls emit(new_idx) for every index of `to` with the same full name as `old_idx`.
+    template <typename Fn>
+    void remap(uint64_t old_idx, Fn&& emit) const {
+        const uint64_t l = old_idx % from_lasts_;
+        const uint64_t row = old_idx / from_lasts_;
+        const uint64_t m = row % from_middles_;
+        const uint64_t f = row / from_middles_;
+        if (f >= first_.start.size() - 1) return;
+        for (uint32_t a = first_.start[f]; a < first_.start[f + 1]; a++) {
+            for (uint32_t b = middle_.start[m]; b < middle_.start[m + 1]; b++) {
+                const uint64_t new_row = first_.targets[a] * to_middles_ + middle_.targets[b];
+                for (uint32_t c = last_.start[l]; c < last_.start[l + 1]; c++) {
+                    emit(new_row * to_lasts_ + last_.targets[c]);
+                }
+            }
+        }
+    }
+
+private:
+    // CSR: targets of old entry i are targets[start[i] .. start[i + 1]).
+    struct Map {
+        std::vector<uint32_t> start;
+        std::vector<uint64_t> targets;
+    };
+
+    uint64_t from_middles_ = 1;
+    uint64_t from_lasts_ = 1;
+    uint64_t to_middles_ = 1;
+    uint64_t to_lasts_ = 1;
+    Map first_;
+    Map middle_; // slot 0 (no middle name) always maps to slot 0
+    Map last_;
+};
@@ -0,0 +1,219 @@
+#include "upgrade.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace {
+
+constexpr char kMagic[4] = {'N', 'G', 'U', '1'};
+constexpr size_t kHeaderBytes = 4 + 8;
+constexpr int kChildFd = 3;  // where the successor finds its end of the channel
+constexpr int kSendTimeoutSeconds = 10;
+
+std::string errno_message(const char* what) {
+    return std::string(what) + ": " + std::strerror(errno);
+}
+
+std::string send_all(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        const ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? std::string("send timed out") : errno_message("send");
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return "";
+}
+
+std::string recv_all(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        const ssize_t n = ::recv(fd, p, len, 0);
+        if (n == 0) return "channel closed";
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? std::string("timed out") : errno_message("recv");
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return "";
+}
+
+// Everything but stdio and the channel: the successor must not hold on to this process's
+// sockets and files (most are not close-on-exec).
+void close_inherited_fds() {
+#ifdef SYS_close_range
+    if (::syscall(SYS_close_range, kChildFd + 1, ~0U, 0) == 0) return;
+#endif
+    for (int fd = kChildFd + 1; fd < 65536; fd++) ::close(fd);
+}
+
+}  // namespace
+
+std::string UpgradeChannel::spawn(const std::string& exe, char* const* argv, std::unique_ptr<UpgradeChannel>& out) {
+    int sv[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) return errno_message("socketpair");
+
+    // Built before fork(): the child may only make async-signal-safe calls.
+    std::vector<std::string> env_strings;
+    for (char** e = environ; *e; e++) {
+        if (std::strncmp(*e, "UPGRADE_FD=", 11) != 0) env_strings.emplace_back(*e);
+    }
+    env_strings.push_back("UPGRADE_FD=" + std::to_string(kChildFd));
+    std::vector<char*> envp;
+    for (auto& s : env_strings) envp.push_back(s.data());
+    envp.push_back(nullptr);
+
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+        const auto err = errno_message("fork");
+        ::close(sv[0]);
+        ::close(sv[1]);
+        return err;
+    }
+    if (pid == 0) {
+        if (sv[1] == kChildFd) {
+            ::fcntl(kChildFd, F_SETFD, 0);
+        } else if (::dup2(sv[1], kChildFd) < 0) {
+            ::_exit(127);
+        }
+        close_inherited_fds();
+        sigset_t none;
+        sigemptyset(&none);
+        ::sigprocmask(SIG_SETMASK, &none, nullptr);
+        ::execve(exe.c_str(), argv, envp.data());
+        ::_exit(127);
+    }
+    ::close(sv[1]);
+    timeval tv{kSendTimeoutSeconds, 0};
+    ::setsockopt(sv[0], SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    out.reset(new UpgradeChannel(sv[0], pid));
+    return "";
+}
+
+std::string UpgradeChannel::inherit(std::unique_ptr<UpgradeChannel>& out) {
+    out.reset();
+    const char* v = std::getenv("UPGRADE_FD");
+    if (!v || !*v) return "";
+    const int fd = std::atoi(v);
+    ::unsetenv("UPGRADE_FD");  // not for this process's own successor
+    if (fd < 0 || ::fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) return "UPGRADE_FD is not an open descriptor";
+    out.reset(new UpgradeChannel(fd, -1));
+    return "";
+}
+
+UpgradeChannel::~UpgradeChannel() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+std::string UpgradeChannel::send_message(char m) {
+    return send_all(fd_, &m, 1);
+}
+
+int UpgradeChannel::poll_message() {
+    char m = 0;
+    while (true) {
+        const ssize_t n = ::recv(fd_, &m, 1, MSG_DONTWAIT);
+        if (n == 1) return static_cast<unsigned char>(m);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        return -1;
+    }
+}
+
+std::string UpgradeChannel::send_state(int listen_fd, const std::vector<uint8_t>& blob) {
+    uint8_t header[kHeaderBytes];
+    std::memcpy(header, kMagic, 4);
+    const uint64_t len = blob.size();
+    std::memcpy(header + 4, &len, 8);
+
+    iovec iov{header, sizeof(header)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(c), &listen_fd, sizeof(int));
+
+    ssize_t n;
+    do {
+        n = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return errno_message("sendmsg");
+    // The descriptor went with the first byte; the rest of the header is plain data.
+    if (auto err = send_all(fd_, header + n, sizeof(header) - static_cast<size_t>(n)); !err.empty()) return err;
+    return send_all(fd_, blob.data(), blob.size());
+}
+
+std::string UpgradeChannel::receive_state(int timeout_ms, int& listen_fd, std::vector<uint8_t>& blob) {
+    listen_fd = -1;
+    pollfd p{fd_, POLLIN, 0};
+    int r;
+    do {
+        r = ::poll(&p, 1, timeout_ms);
+    } while (r < 0 && errno == EINTR);
+    if (r == 0) return "timed out waiting for the predecessor";
+    if (r < 0) return errno_message("poll");
+    timeval tv{timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    ::setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    uint8_t header[kHeaderBytes];
+    iovec iov{header, sizeof(header)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = ::recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n == 0) return "channel closed";
+    if (n < 0) return errno_message("recvmsg");
+    for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) std::memcpy(&listen_fd, CMSG_DATA(c), sizeof(int));
+    }
+    if (listen_fd < 0) return "no listening socket in the handoff";
+
+    auto fail = [&](std::string err) {
+        ::close(listen_fd);
+        listen_fd = -1;
+        return err;
+    };
+    if (auto err = recv_all(fd_, header + n, sizeof(header) - static_cast<size_t>(n)); !err.empty()) return fail(err);
+    if (std::memcmp(header, kMagic, 4) != 0) return fail("bad handoff header");
+    uint64_t len = 0;
+    std::memcpy(&len, header + 4, 8);
+    blob.resize(static_cast<size_t>(len));
+    if (auto err = recv_all(fd_, blob.data(), blob.size()); !err.empty()) return fail(err);
+    return "";
+}
+
+void UpgradeChannel::kill_successor() {
+    if (pid_ <= 0) return;
+    ::kill(pid_, SIGKILL);
+    while (::waitpid(pid_, nullptr, 0) < 0 && errno == EINTR) {
+    }
+    pid_ = -1;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+// Zero-downtime binary upgrade: a running server (single process) starts its successor and
+// hands it the listening socket and the in-memory used set over a Unix socket pair.
+//
+//   old: spawn()            execs the binary again, with UPGRADE_FD naming the child's end
+//   new: inherit(), starts up as usual up to the point of listening, sends kReady
+//   old: stops accepting, drains its connections and request queue, then send_state():
+//        the listening socket (SCM_RIGHTS) and a history blob of the used set
+//   new: receive_state(), loads the blob instead of reading the backing store (no gist
+//        re-fetch), sends kServing and starts accepting
+//   old: closes its listener and exits
+// Connections that arrive during the switch wait in the listen backlog; none is refused.
+// If the successor exits or stalls before kServing, the old process kills it and accepts
+// again. The successor is not a child of whatever started the old process: a supervisor
+// that follows the server's pid (a container's init, systemd's main PID) sees it exit.
+//
+// Messages (native byte order; both ends are builds of this program on one machine):
+//   u8 kReady / kServing
+//   "NGU1", u64 blob bytes (the listening socket rides on this header), then the blob
+class UpgradeChannel {
+public:
+    static constexpr char kReady = 'R';
+    static constexpr char kServing = 'S';
+
+    // Old process: forks and execs `exe` with `argv`. Returns empty string on success;
+    // otherwise an error message.
+    static std::string spawn(const std::string& exe, char* const* argv, std::unique_ptr<UpgradeChannel>& out);
+
+    // New process: takes over the channel named by UPGRADE_FD (and unsets it). `out` stays
+    // empty when the process was not started by spawn().
+    static std::string inherit(std::unique_ptr<UpgradeChannel>& out);
+
+    ~UpgradeChannel();
+
+    UpgradeChannel(const UpgradeChannel&) = delete;
+    UpgradeChannel& operator=(const UpgradeChannel&) = delete;
+
+    pid_t successor() const { return pid_; }  // old process only
+
+    std::string send_message(char m);
+
+    // Without blocking: the next message, 0 if none has arrived, -1 once the other end has
+    // closed the channel (exited).
+    int poll_message();
+
+    std::string send_state(int listen_fd, const std::vector<uint8_t>& blob);
+
+    // Waits up to `timeout_ms` for send_state(). `listen_fd` is then owned by the caller.
+    std::string receive_state(int timeout_ms, int& listen_fd, std::vector<uint8_t>& blob);
+
+    // Old process, giving up: SIGKILLs the successor and reaps it.
+    void kill_successor();
+
+private:
+    explicit UpgradeChannel(int fd, pid_t pid) : fd_(fd), pid_(pid) {}
+
+    int fd_ = -1;
+    pid_t pid_ = -1;
+};
@@ -0,0 +1,430 @@
+#include "uring_engine.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint16_t kBufferGroup = 0;
+
+// user_data: operation in the top byte, connection id / fd / send slot below.
+enum Op : uint64_t { kAccept = 1, kRecv, kWake, kTick, kSend, kClose, kCancel, kProvide, kWatch };
+constexpr int kOpShift = 56;
+constexpr uint64_t kValueMask = (uint64_t{1} << kOpShift) - 1;
+
+uint64_t tag(Op op, uint64_t value) {
+    return (static_cast<uint64_t>(op) << kOpShift) | (value & kValueMask);
+}
+
+int sys_io_uring_setup(unsigned entries, io_uring_params* p) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+std::string errno_message(const char* what) {
+    return std::string(what) + ": " + std::strerror(errno);
+}
+
+}  // namespace
+
+std::string UringEngine::create(int listen_fd, const Limits& limits, std::unique_ptr<UringEngine>& out) {
+    out.reset();
+    std::unique_ptr<UringEngine> e(new UringEngine());
+    e->listen_fd_ = listen_fd;
+    e->limits_ = limits;
+
+    io_uring_params p{};
+    e->ring_fd_ = sys_io_uring_setup(kEntries, &p);
+    if (e->ring_fd_ < 0) return errno_message("io_uring_setup");
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        return "io_uring too old (needs single-mmap rings and no-drop completions)";
+    }
+
+    const size_t sq_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    const size_t cq_bytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    e->ring_bytes_ = std::max(sq_bytes, cq_bytes);
+    void* ring = ::mmap(nullptr, e->ring_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, e->ring_fd_,
+                        IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) return errno_message("mmap io_uring rings");
+    e->ring_ = ring;
+    char* base = static_cast<char*>(ring);
+    e->sq_head_ = reinterpret_cast<unsigned*>(base + p.sq_off.head);
+    e->sq_tail_ = reinterpret_cast<unsigned*>(base + p.sq_off.tail);
+    e->sq_mask_ = *reinterpret_cast<unsigned*>(base + p.sq_off.ring_mask);
+    e->sq_entries_ = p.sq_entries;
+    e->sq_array_ = reinterpret_cast<unsigned*>(base + p.sq_off.array);
+    e->sq_tail_local_ = *e->sq_tail_;
+    e->cq_head_ = reinterpret_cast<unsigned*>(base + p.cq_off.head);
+    e->cq_tail_ = reinterpret_cast<unsigned*>(base + p.cq_off.tail);
+    e->cq_mask_ = *reinterpret_cast<unsigned*>(base + p.cq_off.ring_mask);
+    e->cqes_ = reinterpret_cast<io_uring_cqe*>(base + p.cq_off.cqes);
+
+    e->sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, e->sqes_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, e->ring_fd_,
+                        IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return errno_message("mmap io_uring sqes");
+    e->sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    if (auto err = e->setup_buffers(); !err.empty()) return err;
+
+    e->wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+    if (e->wake_fd_ < 0) return errno_message("eventfd");
+    e->tick_.tv_sec = 0;
+    e->tick_.tv_nsec = static_cast<long long>(kTickMs) * 1000000;
+
+    out = std::move(e);
+    return "";
+}
+
+UringEngine::~UringEngine() {
+    for (const auto& [id, c] : conns_) ::close(c.fd);
+    if (wake_fd_ >= 0) ::close(wake_fd_);
+    if (sqes_) ::munmap(sqes_, sqes_bytes_);
+    if (ring_) ::munmap(ring_, ring_bytes_);
+    if (ring_fd_ >= 0) ::close(ring_fd_);
+}
+
+std::string UringEngine::setup_buffers() {
+    // Multishot accept came with Linux 5.19, as did IORING_OP_SOCKET, which the probe can
+    // see (it lists opcodes, not flags).
+    std::vector<char> probe_mem(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    auto* probe = reinterpret_cast<io_uring_probe*>(probe_mem.data());
+    if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+        probe->last_op < IORING_OP_SOCKET || !(probe->ops[IORING_OP_SOCKET].flags & IO_URING_OP_SUPPORTED) ||
+        !(probe->ops[IORING_OP_PROVIDE_BUFFERS].flags & IO_URING_OP_SUPPORTED)) {
+        return "io_uring too old (multishot accept needs Linux 5.19)";
+    }
+
+    buffers_.reset(new char[static_cast<size_t>(kBuffers) * kBufferBytes]);
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<int>(kBuffers);
+    sqe->addr = reinterpret_cast<uint64_t>(buffers_.get());
+    sqe->len = kBufferBytes;
+    sqe->buf_group = kBufferGroup;
+    sqe->user_data = tag(kProvide, 0);
+    enter(1);
+    io_uring_cqe cqe{};
+    if (!wait_cqe(cqe) || cqe.res < 0) return "IORING_OP_PROVIDE_BUFFERS failed";
+    return "";
+}
+
+// -------------------------
+// Submission and completion rings
+// -------------------------
+io_uring_sqe* UringEngine::next_sqe() {
+    reserve_sqes(1);
+    const unsigned idx = sq_tail_local_ & sq_mask_;
+    io_uring_sqe* sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    sq_tail_local_++;
+    to_submit_++;
+    return sqe;
+}
+
+// Makes room for `n` more entries, submitting what is queued if needed; linked entries
+// must not be split across submissions.
+void UringEngine::reserve_sqes(unsigned n) {
+    const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_entries_ - (sq_tail_local_ - head) < n) enter(0);
+}
+
+void UringEngine::enter(unsigned wait) {
+    __atomic_store_n(sq_tail_, sq_tail_local_, __ATOMIC_RELEASE);
+    const unsigned n = to_submit_;
+    syscalls_.fetch_add(1, std::memory_order_relaxed);
+    const int r = sys_io_uring_enter(ring_fd_, n, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    // Whatever was not consumed (e.g. interrupted before submitting) goes with the next call.
+    to_submit_ = r < 0 ? n : n - std::min(n, static_cast<unsigned>(r));
+}
+
+// Setup only: takes the next completion, if enter() produced one.
+bool UringEngine::wait_cqe(io_uring_cqe& out) {
+    const unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) return false;
+    out = cqes_[head & cq_mask_];
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Hands buffer `bid` back to the kernel; it goes out with the next submission.
+void UringEngine::recycle_buffer(uint16_t bid) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = reinterpret_cast<uint64_t>(buffers_.get() + static_cast<size_t>(bid) * kBufferBytes);
+    sqe->len = kBufferBytes;
+    sqe->off = bid;
+    sqe->buf_group = kBufferGroup;
+    sqe->user_data = tag(kProvide, 0);
+}
+
+void UringEngine::arm_accept() {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = tag(kAccept, 0);
+}
+
+void UringEngine::arm_recv(uint64_t id, int fd) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = kBufferBytes;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufferGroup;
+    sqe->user_data = tag(kRecv, id);
+}
+
+void UringEngine::arm_wake() {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd_;
+    sqe->addr = reinterpret_cast<uint64_t>(&wake_value_);
+    sqe->len = sizeof(wake_value_);
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->user_data = tag(kWake, 0);
+}
+
+void UringEngine::arm_tick() {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = reinterpret_cast<uint64_t>(&tick_);
+    sqe->len = 1;
+    sqe->user_data = tag(kTick, 0);
+}
+
+void UringEngine::arm_watch() {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = watch_fd_;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = tag(kWatch, 0);
+}
+
+void UringEngine::submit_close(int fd) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = tag(kClose, static_cast<uint64_t>(fd));
+}
+
+// -------------------------
+// Event loop
+// -------------------------
+void UringEngine::watch(int fd, std::function<void()> on_readable) {
+    watch_fd_ = fd;
+    on_watch_ = std::move(on_readable);
+}
+
+void UringEngine::run(const OnRequest& on_request, const std::function<bool()>& idle) {
+    arm_accept();
+    arm_wake();
+    arm_tick();
+    if (watch_fd_ >= 0) arm_watch();
+    running_ = true;
+    while (running_) {
+        enter(1);
+        unsigned head = *cq_head_;
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe cqe = cqes_[head & cq_mask_];
+            __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+            handle(cqe, on_request, idle);
+        }
+        // Responses handed back while completions were being handled.
+        drain_outbox();
+    }
+}
+
+void UringEngine::handle(const io_uring_cqe& cqe, const OnRequest& on_request, const std::function<bool()>& idle) {
+    const uint64_t value = cqe.user_data & kValueMask;
+    switch (static_cast<Op>(cqe.user_data >> kOpShift)) {
+        case kAccept:
+            if (cqe.res >= 0) on_accept(cqe.res);
+            if (!(cqe.flags & IORING_CQE_F_MORE)) arm_accept();
+            break;
+        case kRecv:
+            on_recv(value, cqe, on_request);
+            break;
+        case kWake:
+            drain_outbox();
+            arm_wake();
+            break;
+        case kTick:
+            expire_heads();
+            running_ = idle();
+            if (running_) arm_tick();
+            break;
+        case kWatch:
+            on_watch_();
+            if (running_) arm_watch();
+            break;
+        case kSend: {
+            std::lock_guard<std::mutex> lk(out_mu_);
+            free_bufs_.push_back(static_cast<uint32_t>(value));
+            break;
+        }
+        case kClose:
+            // The linked send failed or came up short, which cancels the close.
+            if (cqe.res == -ECANCELED) {
+                syscalls_.fetch_add(1, std::memory_order_relaxed);
+                ::close(static_cast<int>(value));
+            }
+            break;
+        case kCancel:
+        case kProvide:
+            break;
+    }
+}
+
+void UringEngine::on_accept(int fd) {
+    if (conns_.size() >= limits_.max_conns) {
+        submit_close(fd);
+        return;
+    }
+    Conn c;
+    c.fd = fd;
+    c.deadline = std::chrono::steady_clock::now() + limits_.head_timeout;
+    if (want_peer_) {
+        sockaddr_storage addr{};
+        socklen_t len = sizeof(addr);
+        char host[INET6_ADDRSTRLEN] = "";
+        syscalls_.fetch_add(1, std::memory_order_relaxed);
+        if (::getpeername(fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0) {
+            if (addr.ss_family == AF_INET) {
+                ::inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(&addr)->sin_addr, host, sizeof(host));
+            } else if (addr.ss_family == AF_INET6) {
+                ::inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6*>(&addr)->sin6_addr, host, sizeof(host));
+            }
+        }
+        c.client = host;
+    }
+    const uint64_t id = next_conn_++;
+    conns_.emplace(id, std::move(c));
+    arm_recv(id, fd);
+}
+
+void UringEngine::on_recv(uint64_t id, const io_uring_cqe& cqe, const OnRequest& on_request) {
+    auto it = conns_.find(id);
+    const bool has_buffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+    const uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    if (it == conns_.end()) {
+        if (has_buffer) recycle_buffer(bid);
+        return;
+    }
+    Conn& c = it->second;
+    const size_t from = c.raw.size() < 3 ? 0 : c.raw.size() - 3;
+    if (has_buffer) {
+        if (cqe.res > 0) c.raw.append(buffers_.get() + static_cast<size_t>(bid) * kBufferBytes, cqe.res);
+        recycle_buffer(bid);
+    }
+    if (cqe.res == -ENOBUFS && !c.cancelled) {
+        // Every buffer was taken; they are recycled as their completions are handled.
+        arm_recv(id, c.fd);
+        return;
+    }
+    if (cqe.res <= 0 || c.raw.size() > limits_.max_head) {
+        submit_close(c.fd);
+        conns_.erase(it);
+        return;
+    }
+    if (c.raw.find("\r\n\r\n", from) != std::string::npos) {
+        const int fd = c.fd;
+        std::string raw = std::move(c.raw);
+        std::string client = std::move(c.client);
+        conns_.erase(it);
+        on_request(fd, raw, client);
+        return;
+    }
+    if (c.cancelled) {
+        submit_close(c.fd);
+        conns_.erase(it);
+        return;
+    }
+    arm_recv(id, c.fd);
+}
+
+void UringEngine::expire_heads() {
+    const auto now = std::chrono::steady_clock::now();
+    for (auto& [id, c] : conns_) {
+        if (c.cancelled || now < c.deadline) continue;
+        // The recv completes with -ECANCELED and on_recv closes the connection.
+        c.cancelled = true;
+        io_uring_sqe* sqe = next_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = tag(kRecv, id);
+        sqe->user_data = tag(kCancel, 0);
+    }
+}
+
+void UringEngine::send_and_close(int fd, std::string_view response) {
+    std::string* buf = nullptr;
+    uint32_t slot = 0;
+    {
+        std::lock_guard<std::mutex> lk(out_mu_);
+        if (free_bufs_.empty()) {
+            slot = static_cast<uint32_t>(send_bufs_.size());
+            send_bufs_.emplace_back();
+        } else {
+            slot = free_bufs_.back();
+            free_bufs_.pop_back();
+        }
+        buf = &send_bufs_[slot];
+    }
+    buf->assign(response.data(), response.size());
+
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lk(out_mu_);
+        outbox_.push_back(Outgoing{fd, slot, buf});
+        wake = !wake_pending_;
+        wake_pending_ = true;
+    }
+    if (wake) {
+        const uint64_t one = 1;
+        syscalls_.fetch_add(1, std::memory_order_relaxed);
+        (void)!::write(wake_fd_, &one, sizeof(one));
+    }
+}
+
+void UringEngine::drain_outbox() {
+    {
+        std::lock_guard<std::mutex> lk(out_mu_);
+        draining_.swap(outbox_);
+        wake_pending_ = false;
+    }
+    for (const Outgoing& o : draining_) {
+        reserve_sqes(2);
+        io_uring_sqe* send = next_sqe();
+        send->opcode = IORING_OP_SEND;
+        send->fd = o.fd;
+        send->addr = reinterpret_cast<uint64_t>(o.data->data());
+        send->len = static_cast<uint32_t>(o.data->size());
+        // MSG_WAITALL: a short send fails the link instead of closing after a partial write.
+        send->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        send->flags = IOSQE_IO_LINK;
+        send->user_data = tag(kSend, o.slot);
+        submit_close(o.fd);
+    }
+    draining_.clear();
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <linux/io_uring.h>
+
+// io_uring network engine (IO_ENGINE=uring), an alternative to serve()'s poll loop.
+//
+// One thread owns the ring and drives every connection through it:
+//   - a multishot accept on the listener completes once per new connection;
+//   - each connection reads its request head with a recv into a provided buffer (the
+//     kernel picks one when data arrives, so waiting connections pin no memory), re-armed
+//     until the head is complete;
+//   - a response is a send linked to a close, so finishing a request needs no syscall of
+//     its own;
+//   - request threads hand responses back through an eventfd read, and a timeout every
+//     kTickMs runs the caller's idle work and expires slow heads.
+// In steady state the ring thread makes one io_uring_enter per batch of completions.
+//
+// Receive buffers are handed to the kernel with IORING_OP_PROVIDE_BUFFERS (a used buffer
+// goes back as one more entry in the next submission), not a registered buffer ring: on
+// some kernels registering a ring succeeds, yet every receive then finds it empty.
+//
+// There is no liburing here: the ring is set up with the raw syscalls. create() fails (and
+// the server falls back to the poll loop) on kernels older than 5.19, which brought
+// multishot accept.
+class UringEngine {
+public:
+    static constexpr unsigned kEntries = 1024;
+    static constexpr unsigned kBuffers = 256;  // provided receive buffers (a power of two)
+    static constexpr unsigned kBufferBytes = 4096;
+    static constexpr int kTickMs = 200;
+
+    struct Limits {
+        size_t max_conns = 1024;  // connections still sending their head
+        size_t max_head = 64 * 1024;
+        std::chrono::milliseconds head_timeout{10000};
+    };
+
+    // Called on the ring thread with a complete request head and the peer address (empty
+    // unless set_want_peer). The callee owns `fd` from then on and must pass it to
+    // send_and_close() (or close it) when done.
+    using OnRequest = std::function<void(int fd, std::string& raw, std::string& client)>;
+
+    // Returns empty string on success; otherwise an error message.
+    static std::string create(int listen_fd, const Limits& limits, std::unique_ptr<UringEngine>& out);
+    ~UringEngine();
+
+    UringEngine(const UringEngine&) = delete;
+    UringEngine& operator=(const UringEngine&) = delete;
+
+    // Looks up each connection's peer address (one getpeername per connection).
+    void set_want_peer(bool on) { want_peer_ = on; }
+
+    // Calls `on_readable` on the ring thread whenever `fd` is readable (one fd; set before
+    // run()). Lets another component's events share the ring, e.g. AsyncHttp::fd().
+    void watch(int fd, std::function<void()> on_readable);
+
+    // Runs the ring on the calling thread until `idle` (called about every kTickMs)
+    // returns false.
+    void run(const OnRequest& on_request, const std::function<bool()>& idle);
+
+    // Any thread: sends `response` on `fd`, then closes it.
+    void send_and_close(int fd, std::string_view response);
+
+    // Syscalls made by the engine, on the ring thread and in send_and_close().
+    uint64_t syscalls() const { return syscalls_.load(std::memory_order_relaxed); }
+
+private:
+    struct Conn {
+        int fd = -1;
+        std::string raw;
+        std::string client;
+        std::chrono::steady_clock::time_point deadline;
+        bool cancelled = false;
+    };
+
+    struct Outgoing {
+        int fd = -1;
+        uint32_t slot = 0;
+        const std::string* data = nullptr;
+    };
+
+    UringEngine() = default;
+
+    int ring_fd_ = -1;
+    void* ring_ = nullptr;
+    size_t ring_bytes_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_bytes_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_tail_local_ = 0;  // includes prepared, unpublished entries
+    unsigned to_submit_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    std::unique_ptr<char[]> buffers_;
+
+    int listen_fd_ = -1;
+    int wake_fd_ = -1;
+    uint64_t wake_value_ = 0;     // eventfd read target
+    __kernel_timespec tick_{};
+    Limits limits_;
+    bool want_peer_ = false;
+    int watch_fd_ = -1;
+    std::function<void()> on_watch_;
+    bool running_ = false;
+
+    std::unordered_map<uint64_t, Conn> conns_;  // ring thread only
+    uint64_t next_conn_ = 1;
+    std::vector<Outgoing> draining_;
+
+    std::mutex out_mu_;                 // guards the send buffers and the outbox
+    std::deque<std::string> send_bufs_;  // stable addresses while a send is in flight
+    std::vector<uint32_t> free_bufs_;
+    std::vector<Outgoing> outbox_;
+    bool wake_pending_ = false;
+
+    std::atomic<uint64_t> syscalls_{0};
+
+    io_uring_sqe* next_sqe();
+    void reserve_sqes(unsigned n);
+    void enter(unsigned wait);
+    bool wait_cqe(io_uring_cqe& out);
+    std::string setup_buffers();
+    void recycle_buffer(uint16_t bid);
+
+    void arm_accept();
+    void arm_recv(uint64_t id, int fd);
+    void arm_wake();
+    void arm_tick();
+    void arm_watch();
+    void submit_close(int fd);
+
+    void handle(const io_uring_cqe& cqe, const OnRequest& on_request, const std::function<bool()>& idle);
+    void on_accept(int fd);
+    void on_recv(uint64_t id, const io_uring_cqe& cqe, const OnRequest& on_request);
+    void expire_heads();
+    void drain_outbox();
+};
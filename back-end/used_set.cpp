@@ -0,0 +1,122 @@
+#include "used_set.hpp"
+
+#include <algorithm>
+
+#include "bitset_simd.hpp"
+
+const UsedSet::Chunk* UsedSet::find_chunk(uint64_t key) const {
+    auto it = std::lower_bound(chunks_.begin(), chunks_.end(), key,
+                               [](const Chunk& c, uint64_t k) { return c.key < k; });
+    if (it == chunks_.end() || it->key != key) return nullptr;
+    return &*it;
+}
+
+UsedSet::Chunk& UsedSet::find_or_add_chunk(uint64_t key) {
+    auto it = std::lower_bound(chunks_.begin(), chunks_.end(), key,
+                               [](const Chunk& c, uint64_t k) { return c.key < k; });
+    if (it != chunks_.end() && it->key == key) return *it;
+    Chunk c;
+    c.key = key;
+    return *chunks_.insert(it, std::move(c));
+}
+
+bool UsedSet::contains(uint64_t idx) const {
+    const Chunk* c = find_chunk(idx >> 16);
+    if (!c) return false;
+    const uint16_t lo = static_cast<uint16_t>(idx & 0xFFFF);
+    if (!c->bitmap.empty()) return (c->bitmap[lo / 64] >> (lo % 64)) & 1u;
+    return std::binary_search(c->array.begin(), c->array.end(), lo);
+}
+
+bool UsedSet::insert(uint64_t idx) {
+    Chunk& c = find_or_add_chunk(idx >> 16);
+    const uint16_t lo = static_cast<uint16_t>(idx & 0xFFFF);
+
+    if (!c.bitmap.empty()) {
+        uint64_t& word = c.bitmap[lo / 64];
+        const uint64_t mask = 1ULL << (lo % 64);
+        if (word & mask) return false;
+        word |= mask;
+    } else {
+        auto it = std::lower_bound(c.array.begin(), c.array.end(), lo);
+        if (it != c.array.end() && *it == lo) return false;
+        c.array.insert(it, lo);
+        if (c.array.size() > kArrayMax) {
+            c.bitmap.assign(1024, 0);
+            for (uint16_t v : c.array) c.bitmap[v / 64] |= 1ULL << (v % 64);
+            std::vector<uint16_t>().swap(c.array);
+        }
+    }
+    c.card++;
+    count_++;
+    return true;
+}
+
+bool UsedSet::erase(uint64_t idx) {
+    const uint64_t key = idx >> 16;
+    auto it = std::lower_bound(chunks_.begin(), chunks_.end(), key,
+                               [](const Chunk& c, uint64_t k) { return c.key < k; });
+    if (it == chunks_.end() || it->key != key) return false;
+    const uint16_t lo = static_cast<uint16_t>(idx & 0xFFFF);
+
+    if (!it->bitmap.empty()) {
+        uint64_t& word = it->bitmap[lo / 64];
+        const uint64_t mask = 1ULL << (lo % 64);
+        if (!(word & mask)) return false;
+        word &= ~mask;
+    } else {
+        auto pos = std::lower_bound(it->array.begin(), it->array.end(), lo);
+        if (pos == it->array.end() || *pos != lo) return false;
+        it->array.erase(pos);
+    }
+    it->card--;
+    count_--;
+    if (it->card == 0) chunks_.erase(it);
+    return true;
+}
+
+void UsedSet::clear() {
+    chunks_.clear();
+    count_ = 0;
+}
+
+size_t UsedSet::memory_bytes() const {
+    size_t total = chunks_.capacity() * sizeof(Chunk);
+    for (const auto& c : chunks_) {
+        total += c.array.capacity() * sizeof(uint16_t);
+        total += c.bitmap.capacity() * sizeof(uint64_t);
+    }
+    return total;
+}
+
+void UsedSet::to_bitset(size_t n, std::vector<uint8_t>& out_bits) const {
+    out_bits.assign((n + 7) / 8, 0);
+    for_each([&](uint64_t idx) {
+        if (idx < n) out_bits[idx / 8] |= static_cast<uint8_t>(1u << (idx % 8));
+    });
+}
+
+void UsedSet::assign_from_bitset(const std::vector<uint8_t>& bits, size_t n) {
+    clear();
+    const size_t limit = std::min(n, bits.size() * 8);
+    for (size_t i = 0; i < limit; i++) {
+        if ((bits[i / 8] >> (i % 8)) & 1u) insert(i);
+    }
+}
+
+void UsedSet::clear_members_in(uint64_t* words, size_t nwords) const {
+    for (const auto& c : chunks_) {
+        const uint64_t first_word = c.key * 1024;
+        if (first_word >= nwords) break;
+        if (!c.bitmap.empty()) {
+            const size_t len = static_cast<size_t>(std::min<uint64_t>(1024, nwords - first_word));
+            bitset_simd::andnot_into(words + first_word, c.bitmap.data(), len);
+            continue;
+        }
+        const uint64_t base = c.key << 16;
+        for (uint16_t lo : c.array) {
+            const uint64_t idx = base | lo;
+            if (idx / 64 < nwords) words[idx / 64] &= ~(1ULL << (idx % 64));
+        }
+    }
+}
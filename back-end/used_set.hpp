@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Read-only access to a set of used universe indices: a UsedSet, or the sharded set the
+// history store keeps for concurrent generation (ShardedUsedSet).
+class UsedView {
+public:
+    virtual ~UsedView() = default;
+
+    virtual bool contains(uint64_t idx) const = 0;
+    virtual size_t size() const = 0;
+
+    // Clears every member from a word bitset (bit i in words[i / 64]) of `nwords` words.
+    virtual void clear_members_in(uint64_t* words, size_t nwords) const = 0;
+
+    // Calls fn(idx) for every member in ascending order.
+    virtual void visit(const std::function<void(uint64_t)>& fn) const = 0;
+};
+
+// Compressed set of used universe indices (roaring-bitmap style).
+//
+// The index space is split into 64Ki-wide chunks. Each chunk is either a sorted array of
+// 16-bit offsets (sparse) or an 8 KiB bitmap (dense); a chunk switches to a bitmap once it
+// holds more than 4096 entries, which is where the bitmap becomes the smaller of the two.
+// Chunks with no members are not stored at all, so a nearly empty history costs a few bytes
+// no matter how large the universe is.
+class UsedSet : public UsedView {
+public:
+    bool contains(uint64_t idx) const override;
+
+    // Returns true if `idx` was newly inserted.
+    bool insert(uint64_t idx);
+
+    // Returns true if `idx` was a member.
+    bool erase(uint64_t idx);
+
+    size_t size() const override { return count_; }
+    bool empty() const { return count_ == 0; }
+    void clear();
+
+    // Approximate heap footprint in bytes.
+    size_t memory_bytes() const;
+
+    // Flat little-endian bitset over [0, n) (bit i of byte i/8), as used by the blob format.
+    void to_bitset(size_t n, std::vector<uint8_t>& out_bits) const;
+    void assign_from_bitset(const std::vector<uint8_t>& bits, size_t n);
+
+    void clear_members_in(uint64_t* words, size_t nwords) const override;
+    void visit(const std::function<void(uint64_t)>& fn) const override { for_each(fn); }
+
+    // Calls fn(idx) for every member in ascending order (without the indirect call).
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const auto& c : chunks_) {
+            const uint64_t base = c.key << 16;
+            if (c.bitmap.empty()) {
+                for (uint16_t lo : c.array) fn(base | lo);
+                continue;
+            }
+            for (size_t w = 0; w < c.bitmap.size(); w++) {
+                uint64_t word = c.bitmap[w];
+                while (word) {
+                    const int bit = __builtin_ctzll(word);
+                    fn(base | (static_cast<uint64_t>(w) * 64 + static_cast<uint64_t>(bit)));
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+
+private:
+    struct Chunk {
+        uint64_t key = 0;
+        uint32_t card = 0;
+        std::vector<uint16_t> array;   // used while sparse (sorted)
+        std::vector<uint64_t> bitmap;  // 1024 words once dense
+    };
+
+    static constexpr uint32_t kArrayMax = 4096;
+
+    std::vector<Chunk> chunks_;  // sorted by key
+    size_t count_ = 0;
+
+    const Chunk* find_chunk(uint64_t key) const;
+    Chunk& find_or_add_chunk(uint64_t key);
+};
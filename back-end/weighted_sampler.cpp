@@ -0,0 +1,268 @@
+#include "weighted_sampler.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+#include "namegen.hpp"
+
+static std::unique_ptr<NameWeights> g_active_weights;
+
+static std::string trim_copy(const std::string& s) {
+    size_t b = 0;
+    size_t e = s.size();
+    while (b < e && (s[b] == ' ' || s[b] == '\t' || s[b] == '\r')) b++;
+    while (e > b && (s[e - 1] == ' ' || s[e - 1] == '\t' || s[e - 1] == '\r')) e--;
+    return s.substr(b, e - b);
+}
+
+std::string NameWeights::load_file(const std::string& path, NameWeights& out) {
+    std::ifstream in(path);
+    if (!in) return "could not open name weights file: " + path;
+
+    out.first.assign(namegen::first_name_count(), 1.0);
+    out.last.assign(namegen::surname_count(), 1.0);
+
+    std::unordered_map<std::string, std::vector<size_t>> first_idx;
+    std::unordered_map<std::string, std::vector<size_t>> last_idx;
+    for (size_t i = 0; i < out.first.size(); i++) first_idx[std::string(namegen::first_name_at(i))].push_back(i);
+    for (size_t i = 0; i < out.last.size(); i++) last_idx[std::string(namegen::surname_at(i))].push_back(i);
+
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        if (auto hash = line.find('#'); hash != std::string::npos) line.resize(hash);
+        line = trim_copy(line);
+        if (line.empty()) continue;
+
+        const size_t c1 = line.find(',');
+        const size_t c2 = (c1 == std::string::npos) ? std::string::npos : line.find(',', c1 + 1);
+        if (c2 == std::string::npos) {
+            std::ostringstream ss;
+            ss << "name weights line " << line_no << ": expected kind,name,weight";
+            return ss.str();
+        }
+        const std::string kind = trim_copy(line.substr(0, c1));
+        const std::string name = trim_copy(line.substr(c1 + 1, c2 - c1 - 1));
+        const std::string wstr = trim_copy(line.substr(c2 + 1));
+        char* end = nullptr;
+        const double w = std::strtod(wstr.c_str(), &end);
+        if (wstr.empty() || *end != '\0' || !(w >= 0)) {
+            std::ostringstream ss;
+            ss << "name weights line " << line_no << ": invalid weight";
+            return ss.str();
+        }
+
+        std::unordered_map<std::string, std::vector<size_t>>* lookup = nullptr;
+        std::vector<double>* target = nullptr;
+        if (kind == "first") {
+            lookup = &first_idx;
+            target = &out.first;
+        } else if (kind == "last") {
+            lookup = &last_idx;
+            target = &out.last;
+        } else {
+            std::ostringstream ss;
+            ss << "name weights line " << line_no << ": kind must be first or last";
+            return ss.str();
+        }
+        // Names that are not in the universe are ignored, so one weights file can serve
+        // several name lists.
+        auto it = lookup->find(name);
+        if (it == lookup->end()) continue;
+        for (size_t i : it->second) (*target)[i] = w;
+    }
+    return "";
+}
+
+std::string NameWeights::load_active_from_env() {
+    g_active_weights.reset();
+    const char* path = std::getenv("NAME_WEIGHTS_FILE");
+    if (!path || !*path) return "";
+    auto w = std::make_unique<NameWeights>();
+    auto err = load_file(path, *w);
+    if (!err.empty()) return err;
+    g_active_weights = std::move(w);
+    return "";
+}
+
+const NameWeights* NameWeights::active() {
+    return g_active_weights.get();
+}
+
+// -------------------------
+// Alias tables (Vose)
+// -------------------------
+void WeightedSampler::AliasTable::build(std::vector<uint64_t> items_in, const std::vector<double>& weights) {
+    items = std::move(items_in);
+    const size_t n = items.size();
+    prob.assign(n, 0.0);
+    alias.assign(n, 0);
+    total = 0;
+    for (double w : weights) total += w;
+    if (n == 0 || total <= 0) return;
+
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small;
+    std::vector<uint32_t> large;
+    for (size_t i = 0; i < n; i++) {
+        scaled[i] = weights[i] * static_cast<double>(n) / total;
+        (scaled[i] < 1.0 ? small : large).push_back(static_cast<uint32_t>(i));
+    }
+    while (!small.empty() && !large.empty()) {
+        const uint32_t s = small.back();
+        small.pop_back();
+        const uint32_t l = large.back();
+        prob[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    for (uint32_t i : large) prob[i] = 1.0;
+    for (uint32_t i : small) prob[i] = 1.0; // rounding leftovers
+}
+
+uint64_t WeightedSampler::AliasTable::sample(std::mt19937& rng) const {
+    const size_t n = items.size();
+    const size_t i = std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+    const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    return items[u < prob[i] ? i : alias[i]];
+}
+
+// -------------------------
+// WeightedSampler
+// -------------------------
+WeightedSampler::WeightedSampler(const NameWeights& weights, const UsedView& used)
+    : weights_(weights),
+      firsts_(namegen::first_name_count()),
+      middles_(namegen::middle_slot_count()),
+      lasts_(namegen::surname_count()) {
+    std::vector<uint64_t> items(lasts_);
+    for (size_t l = 0; l < lasts_; l++) items[l] = l;
+    surname_table_.build(std::move(items), weights_.last);
+    full_row_mass_ = static_cast<double>(middles_) * surname_table_.total;
+    resync(used);
+}
+
+void WeightedSampler::resync(const UsedView& used) {
+    // Start from "everything unused" and subtract the used cells: O(firsts + used), never
+    // O(universe), so this works for dictionary-sized universes.
+    row_mass_.assign(firsts_, full_row_mass_);
+    row_unused_.assign(firsts_, middles_ * lasts_);
+    row_tables_.clear();
+    row_table_items_ = 0;
+    used.visit([&](uint64_t idx) {
+        const size_t f = static_cast<size_t>(idx) / (middles_ * lasts_);
+        if (f >= firsts_ || row_unused_[f] == 0) return;
+        row_unused_[f]--;
+        row_mass_[f] -= weights_.last[static_cast<size_t>(idx) % lasts_];
+    });
+    for (size_t f = 0; f < firsts_; f++) {
+        if (row_unused_[f] == 0 || row_mass_[f] < 0) row_mass_[f] = 0;
+    }
+    rebuild_first();
+}
+
+void WeightedSampler::rebuild_first() {
+    std::vector<uint64_t> items;
+    std::vector<double> w;
+    first_built_.assign(firsts_, 0.0);
+    total_mass_ = 0;
+    for (size_t f = 0; f < firsts_; f++) {
+        const double m = row_unused_[f] ? weights_.first[f] * row_mass_[f] : 0.0;
+        if (m <= 0) continue;
+        items.push_back(f);
+        w.push_back(m);
+        first_built_[f] = m;
+        total_mass_ += m;
+    }
+    first_table_.build(std::move(items), w);
+}
+
+bool WeightedSampler::rebuild_row(size_t f, const UsedView& used) {
+    const size_t row_len = middles_ * lasts_;
+    if (row_len > kMaxRowTable) return false;
+    if (row_table_items_ + row_len > kMaxRowTableItems) {
+        // Bound memory: drop every per-row table; rows fall back to the shared table.
+        row_tables_.clear();
+        row_table_items_ = 0;
+    }
+    std::vector<uint64_t> items;
+    std::vector<double> w;
+    double mass = 0;
+    const size_t base = f * row_len;
+    for (size_t c = 0; c < row_len; c++) {
+        const double wl = weights_.last[c % lasts_];
+        if (wl <= 0 || used.contains(base + c)) continue;
+        items.push_back(c);
+        w.push_back(wl);
+        mass += wl;
+    }
+    row_mass_[f] = mass; // resync (drops accumulated floating-point drift)
+    row_table_items_ += items.size();
+    row_tables_[f].build(std::move(items), w);
+    return true;
+}
+
+bool WeightedSampler::pick(const UsedView& used, std::mt19937& rng, size_t& out_idx) {
+    // Acceptance is >= 1/4 per attempt, so a long rejection streak means the live masses
+    // have drifted (floating-point error, or only zero-weight names left): resync exactly.
+    int misses = 0;
+    bool resynced = false;
+    while (true) {
+        if (++misses > 256) {
+            if (resynced) return false;
+            resync(used);
+            resynced = true;
+            misses = 0;
+        }
+        if (total_mass_ <= 0 || first_table_.total <= 0) return false;
+        if (total_mass_ < 0.5 * first_table_.total) {
+            rebuild_first();
+            continue;
+        }
+
+        const size_t f = static_cast<size_t>(first_table_.sample(rng));
+        const double live = row_unused_[f] ? weights_.first[f] * row_mass_[f] : 0.0;
+        if (live <= 0) continue;
+        if (live < first_built_[f] &&
+            std::uniform_real_distribution<double>(0.0, first_built_[f])(rng) >= live) {
+            continue;
+        }
+
+        // Row step: the shared surname table (uniform middle slot) while the row is mostly
+        // unused; a dedicated table over the row's unused cells once it has thinned out.
+        auto it = row_tables_.find(f);
+        const double built = (it == row_tables_.end()) ? full_row_mass_ : it->second.total;
+        if (row_mass_[f] < 0.5 * built && rebuild_row(f, used)) it = row_tables_.find(f);
+
+        size_t cell = 0;
+        if (it != row_tables_.end()) {
+            if (it->second.items.empty()) continue;
+            cell = static_cast<size_t>(it->second.sample(rng));
+        } else {
+            const size_t m = std::uniform_int_distribution<size_t>(0, middles_ - 1)(rng);
+            cell = m * lasts_ + static_cast<size_t>(surname_table_.sample(rng));
+        }
+        const size_t idx = f * middles_ * lasts_ + cell;
+        if (used.contains(idx)) continue;
+        out_idx = idx;
+        return true;
+    }
+}
+
+void WeightedSampler::on_marked(size_t idx) {
+    const size_t f = idx / (middles_ * lasts_);
+    const size_t l = idx % lasts_;
+    if (f >= firsts_ || row_unused_[f] == 0) return;
+    const double before = weights_.first[f] * row_mass_[f];
+    row_unused_[f]--;
+    row_mass_[f] = row_unused_[f] ? std::max(0.0, row_mass_[f] - weights_.last[l]) : 0.0;
+    total_mass_ -= before - weights_.first[f] * row_mass_[f];
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "used_set.hpp"
+
+// Frequency weights for first names and surnames, loaded from `NAME_WEIGHTS_FILE`.
+//
+// File format (one entry per line, '#' starts a comment):
+//   first,Aarav,1520
+//   last,Patel,98000
+// Names that are not listed get weight 1. A full name's weight is first * last.
+struct NameWeights {
+    std::vector<double> first; // by namegen first-name index
+    std::vector<double> last;  // by namegen surname index
+
+    // Returns empty string on success; otherwise an error message.
+    static std::string load_file(const std::string& path, NameWeights& out);
+
+    // Loads `NAME_WEIGHTS_FILE` (if set) as the process-wide weights for the active universe.
+    // Any previously active weights are dropped first, also on error.
+    static std::string load_active_from_env();
+
+    // nullptr when no weights are configured (uniform sampling).
+    static const NameWeights* active();
+};
+
+// Weighted sampling of unused universe indices in O(1) expected time per pick.
+//
+// P(name) is proportional to w_first * w_last over unused names (middle names, if any, are
+// uniform). It is drawn in two steps, both with Vose alias tables:
+//   1) a first name f with probability ~ w_first[f] * (sum of w_last over unused cells of row f)
+//   2) a (middle, surname) cell of row f: from one shared surname table while the row is
+//      mostly unused, or from a dedicated table over the row's unused cells once it thins out.
+// Tables are not rebuilt on every pick. A stale table still dominates the current weights,
+// so each draw is accepted with probability current/stale (step 1) or rejected if the cell
+// is used (step 2). A table is rebuilt once its live mass falls below half of what it was
+// built with, so acceptance stays >= 1/2 per step and throughput stays flat as the
+// universe fills. State is O(first names + surnames), plus bounded per-row tables.
+class WeightedSampler {
+public:
+    WeightedSampler(const NameWeights& weights, const UsedView& used);
+
+    // Picks one unused index (does not mark it). Returns false when no weighted mass is left.
+    bool pick(const UsedView& used, std::mt19937& rng, size_t& out_idx);
+
+    // Must be called after `idx` is added to the used set.
+    void on_marked(size_t idx);
+
+private:
+    struct AliasTable {
+        std::vector<uint64_t> items;
+        std::vector<double> prob;
+        std::vector<uint32_t> alias;
+        double total = 0;
+
+        void build(std::vector<uint64_t> items_in, const std::vector<double>& weights);
+        uint64_t sample(std::mt19937& rng) const;
+    };
+
+    // Rows wider than this never get a dedicated table (the shared table + rejection is used).
+    static constexpr size_t kMaxRowTable = size_t{1} << 22;
+    // Total cells across all dedicated row tables before they are dropped and rebuilt lazily.
+    static constexpr size_t kMaxRowTableItems = size_t{1} << 23;
+
+    const NameWeights& weights_;
+    size_t firsts_ = 0;
+    size_t middles_ = 1;
+    size_t lasts_ = 0;
+
+    AliasTable surname_table_;           // all surnames, weighted by w_last
+    double full_row_mass_ = 0;           // middles * sum(w_last)
+
+    std::vector<double> row_mass_;       // live sum of w_last over unused cells per row
+    std::vector<size_t> row_unused_;     // live unused count per row
+    double total_mass_ = 0;              // live sum of w_first * row_mass_
+
+    AliasTable first_table_;
+    std::vector<double> first_built_;    // per-row weight the first table was built with
+    std::unordered_map<size_t, AliasTable> row_tables_;
+    size_t row_table_items_ = 0;
+
+    void resync(const UsedView& used);
+    void rebuild_first();
+    bool rebuild_row(size_t f, const UsedView& used);
+};
@@ -10,45 +10,98 @@
   const $generate = document.getElementById("generate");
   const $copy = document.getElementById("copy");
   const $error = document.getElementById("error");
+  const $viewport = document.getElementById("viewport");
+  const $spacer = document.getElementById("spacer");
   const $list = document.getElementById("list");
   const $meta = document.getElementById("meta");
 
-  async function fetchNames(count) {
+  // Asks for NDJSON ({"name":".."} per line) and hands each batch of complete lines to
+  // `onNames` as it arrives. Errors, and servers that only speak JSON, answer with one
+  // JSON document instead.
+  async function streamNames(count, onNames) {
     const qs = `count=${encodeURIComponent(String(count))}`;
     const url = API_BASE ? `${API_BASE}/api/generate?${qs}` : `/api/generate?${qs}`;
 
     const res = await fetch(url, {
       method: "GET",
-      headers: { Accept: "application/json" },
+      headers: { Accept: "application/x-ndjson, application/json;q=0.9" },
     });
 
     const contentType = res.headers.get("content-type") || "";
-    const isJson = contentType.includes("application/json");
-    const data = isJson ? await res.json() : { error: await res.text() };
-
-    if (!res.ok) {
-      const msg = data?.error || `Request failed (${res.status})`;
-      throw new Error(msg);
+    if (!res.ok || !contentType.includes("ndjson") || !res.body) {
+      const isJson = contentType.includes("application/json");
+      const data = isJson ? await res.json() : { error: await res.text() };
+      if (!res.ok) {
+        const msg = data?.error || `Request failed (${res.status})`;
+        throw new Error(msg);
+      }
+      if (!data || !Array.isArray(data.names)) {
+        throw new Error("Bad response from server.");
+      }
+      onNames(data.names);
+      return;
     }
-    if (!data || !Array.isArray(data.names)) {
-      throw new Error("Bad response from server.");
+
+    const reader = res.body.getReader();
+    const decoder = new TextDecoder();
+    let carry = "";
+    const parseLines = (text) => {
+      const batch = [];
+      for (const line of text.split("\n")) {
+        if (line.trim()) batch.push(JSON.parse(line).name);
+      }
+      if (batch.length) onNames(batch);
+    };
+    for (;;) {
+      const { value, done } = await reader.read();
+      if (done) break;
+      const text = carry + decoder.decode(value, { stream: true });
+      const cut = text.lastIndexOf("\n");
+      carry = text.slice(cut + 1);
+      parseLines(text.slice(0, cut + 1));
     }
-    return data.names;
+    parseLines(carry + decoder.decode());
   }
 
   function setError(message) {
     $error.textContent = message || "";
   }
 
-  function render(names) {
-    $list.innerHTML = "";
-    for (const name of names) {
-      const li = document.createElement("li");
-      li.textContent = name;
-      $list.appendChild(li);
+  // Virtualized list: the spacer is as tall as every row together, and only the rows in
+  // view (plus a few either side) exist as <li>s, moved into place and renumbered through
+  // the <ol>'s `start`. Rows have a fixed height (--row-height in styles.css).
+  const OVERSCAN = 8;
+  let rowHeight = 0;
+  let items = [];
+  let frame = 0;
+
+  function renderWindow() {
+    frame = 0;
+    if (!rowHeight) {
+      rowHeight = parseFloat(getComputedStyle($viewport).getPropertyValue("--row-height")) || 40;
+    }
+    $spacer.style.height = `${items.length * rowHeight}px`;
+    const first = Math.max(0, Math.floor($viewport.scrollTop / rowHeight) - OVERSCAN);
+    const last = Math.min(items.length, Math.ceil(($viewport.scrollTop + $viewport.clientHeight) / rowHeight) + OVERSCAN);
+    const want = Math.max(0, last - first);
+    while ($list.children.length > want) $list.lastChild.remove();
+    while ($list.children.length < want) $list.appendChild(document.createElement("li"));
+    for (let i = 0; i < want; i++) {
+      const li = $list.children[i];
+      if (li.textContent !== items[first + i]) li.textContent = items[first + i];
     }
+    $list.start = first + 1;
+    $list.style.transform = `translateY(${first * rowHeight}px)`;
   }
 
+  function render(names) {
+    items = names;
+    if (!frame) frame = requestAnimationFrame(renderWindow);
+  }
+
+  $viewport.addEventListener("scroll", () => render(items), { passive: true });
+  window.addEventListener("resize", () => render(items));
+
   async function copyAll(names) {
     const text = names.map((n, i) => `${i + 1}. ${n}`).join("\n");
     if (navigator.clipboard?.writeText) {
@@ -84,9 +137,15 @@
     $generate.disabled = true;
     $generate.textContent = "Generating…";
     $copy.disabled = true;
+    lastNames = [];
+    render(lastNames);
+    $viewport.scrollTop = 0;
     try {
-      lastNames = await fetchNames(count);
-      render(lastNames);
+      await streamNames(count, (batch) => {
+        for (const name of batch) lastNames.push(name);
+        render(lastNames);
+        $meta.textContent = `${lastNames.length} of ${count}…`;
+      });
       $meta.textContent = `${lastNames.length} generated`;
       $copy.disabled = lastNames.length === 0;
     } catch (e) {